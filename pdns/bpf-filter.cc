@@ -28,6 +28,10 @@
 #include <sys/syscall.h>
 #include <sys/resource.h>
 #include <linux/bpf.h>
+#ifdef HAVE_XSK
+#include <linux/if_link.h>
+#include <net/if.h>
+#endif /* HAVE_XSK */
 
 #include "ext/libbpf/libbpf.h"
 
@@ -895,6 +899,87 @@ uint64_t BPFFilter::getHits(const ComboAddress& requestor)
   return 0;
 }
 
+std::pair<int, int> BPFFilter::getAddressMapsFDs()
+{
+  auto maps = d_maps.lock();
+  return {maps->d_v4.d_fd.getHandle(), maps->d_v6.d_fd.getHandle()};
+}
+
+#ifdef HAVE_XSK
+XskSteering::XskSteering(const std::string& interface, uint16_t port, uint32_t queues, const std::shared_ptr<BPFFilter>& filter) :
+  d_queues(queues)
+{
+  int ifIndex = if_nametoindex(interface.c_str());
+  if (ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface '" + interface + "': " + stringerror());
+  }
+
+  d_xskMap = FDWrapper(bpf_create_map(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t), sizeof(uint32_t), static_cast<int>(queues), 0));
+  if (d_xskMap.getHandle() == -1) {
+    throw std::runtime_error("Error creating an AF_XDP socket map of size " + std::to_string(queues) + ": " + stringerror());
+  }
+
+  int v4MapFD = -1;
+  int v6MapFD = -1;
+  /* whether the values of the address maps hold the action to take after the counter, in which case
+     only the addresses whose action is Drop are dropped. Otherwise every address present is */
+  bool withActions = false;
+  if (filter) {
+    d_filter = filter;
+    std::tie(v4MapFD, v6MapFD) = d_filter->getAddressMapsFDs();
+    withActions = d_filter->supportsMatchAction(BPFFilter::MatchAction::Truncate);
+  }
+  else {
+    d_v4 = FDWrapper(bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(uint32_t), sizeof(uint64_t), 1, 0));
+    d_v6 = FDWrapper(bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(KeyV6), sizeof(uint64_t), 1, 0));
+    if (d_v4.getHandle() == -1 || d_v6.getHandle() == -1) {
+      throw std::runtime_error("Error creating the eBPF maps for the AF_XDP steering program: " + stringerror());
+    }
+    v4MapFD = d_v4.getHandle();
+    v6MapFD = d_v6.getHandle();
+  }
+
+  int xskMapFD = d_xskMap.getHandle();
+  const struct bpf_insn steering[] = {
+#include "bpf-filter.xsk.ebpf"
+  };
+
+  d_program = FDWrapper(bpf_prog_load(BPF_PROG_TYPE_XDP, steering, sizeof(steering), "GPL", 0));
+  if (d_program.getHandle() == -1) {
+    throw std::runtime_error("Error loading the AF_XDP steering program: " + stringerror());
+  }
+
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd = d_program.getHandle();
+  attr.link_create.target_ifindex = ifIndex;
+  attr.link_create.attach_type = BPF_XDP;
+  d_link = FDWrapper(syscall(SYS_bpf, BPF_LINK_CREATE, &attr, sizeof(attr)));
+  if (d_link.getHandle() == -1) {
+    /* the driver might not support XDP, fall back to the generic mode */
+    auto err = stringerror();
+    attr.link_create.flags = XDP_FLAGS_SKB_MODE;
+    d_link = FDWrapper(syscall(SYS_bpf, BPF_LINK_CREATE, &attr, sizeof(attr)));
+    if (d_link.getHandle() == -1) {
+      throw std::runtime_error("Error attaching the AF_XDP steering program to interface '" + interface + "': " + err);
+    }
+    warnlog("Interface '%s' does not support XDP in native mode (%s), using the much slower generic mode instead", interface, err);
+  }
+}
+
+void XskSteering::addSocket(uint32_t queue, int xskSocket)
+{
+  if (queue >= d_queues) {
+    throw std::runtime_error("Trying to register an AF_XDP socket for queue " + std::to_string(queue) + " but the steering map only has " + std::to_string(d_queues) + " entries");
+  }
+
+  int res = bpf_update_elem(d_xskMap.getHandle(), &queue, &xskSocket, BPF_ANY);
+  if (res != 0) {
+    throw std::runtime_error("Error registering the AF_XDP socket for queue " + std::to_string(queue) + ": " + stringerror());
+  }
+}
+#endif /* HAVE_XSK */
+
 #else
 
 BPFFilter::BPFFilter(std::unordered_map<std::string, MapConfiguration>& configs, BPFFilter::MapFormat format, bool external)
@@ -960,6 +1045,11 @@ uint64_t BPFFilter::getHits(const ComboAddress&)
 {
   return 0;
 }
+
+std::pair<int, int> BPFFilter::getAddressMapsFDs()
+{
+  return {-1, -1};
+}
 #endif /* HAVE_EBPF */
 
 bool BPFFilter::supportsMatchAction(MatchAction action) const
@@ -101,6 +101,8 @@ public:
 
   bool supportsMatchAction(MatchAction action) const;
   bool isExternal() const;
+  /* file descriptors of the maps holding the blocked IPv4 and IPv6 addresses */
+  std::pair<int, int> getAddressMapsFDs();
 
 private:
 #ifdef HAVE_EBPF
@@ -179,3 +181,35 @@ private:
 #endif /* HAVE_EBPF */
 };
 using CounterAndActionValue = BPFFilter::CounterAndActionValue;
+
+#ifdef HAVE_XSK
+/* Attaches an XDP program to a network interface, redirecting the UDP packets sent to
+   the given port to the AF_XDP socket registered for the receive queue they arrived on,
+   and passing everything else to the kernel.
+   When an internal BPFFilter is supplied, the packets coming from an address blocked
+   in that filter are dropped by the XDP program instead.
+   The program is detached from the interface when this object is destroyed. */
+class XskSteering
+{
+public:
+  XskSteering(const std::string& interface, uint16_t port, uint32_t queues, const std::shared_ptr<BPFFilter>& filter);
+  XskSteering(const XskSteering&) = delete;
+  XskSteering(XskSteering&&) = delete;
+  XskSteering& operator=(const XskSteering&) = delete;
+  XskSteering& operator=(XskSteering&&) = delete;
+
+  void addSocket(uint32_t queue, int xskSocket);
+
+private:
+  /* kept alive while the program is loaded */
+  std::shared_ptr<BPFFilter> d_filter;
+  FDWrapper d_xskMap;
+  /* empty maps used when there is no filter */
+  FDWrapper d_v4;
+  FDWrapper d_v6;
+  FDWrapper d_program;
+  /* the program stays attached as long as the link is open */
+  FDWrapper d_link;
+  uint32_t d_queues;
+};
+#endif /* HAVE_XSK */
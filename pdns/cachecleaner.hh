@@ -21,12 +21,78 @@
  */
 #pragma once
 
+#include <atomic>
 #include <cmath>
+#include <type_traits>
 #include <boost/multi_index_container.hpp>
 
 #include "dnsname.hh"
 #include "lock.hh"
 
+/* Entries of caches supporting second chance (CLOCK-like) eviction have a 'd_referenced' flag,
+   which is set on a hit instead of moving the entry to the back of the 'sequence' index, saving
+   the rewriting of the linked list on every hit. When entries have to be evicted, the ones that
+   have been referenced since they were last moved are moved to the back instead, and their flag
+   is cleared. The flag is atomic so it can be set while holding only a shared lock. */
+class ReferencedFlag
+{
+public:
+  ReferencedFlag() = default;
+  ReferencedFlag(const ReferencedFlag& rhs) :
+    d_value(rhs.d_value.load(std::memory_order_relaxed))
+  {
+  }
+  ReferencedFlag& operator=(const ReferencedFlag& rhs)
+  {
+    d_value.store(rhs.d_value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    return *this;
+  }
+
+  void set()
+  {
+    // don't dirty the cache line if it is already set
+    if (!d_value.load(std::memory_order_relaxed)) {
+      d_value.store(true, std::memory_order_relaxed);
+    }
+  }
+
+  bool testAndClear()
+  {
+    return d_value.exchange(false, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<bool> d_value{false};
+};
+
+template <typename E, typename = void>
+struct HasReferencedFlag : std::false_type
+{
+};
+
+template <typename E>
+struct HasReferencedFlag<E, std::void_t<decltype(std::declval<const E&>().d_referenced)>> : std::true_type
+{
+};
+
+// if the entry has been referenced since it was last moved, move it to the back of the
+// sequence index, point iter to the next entry and return true.
+// This expects the index to be walked from the front, so that once the end is reached,
+// the front holds the entries that have been moved and can now be evicted
+template <typename Index>
+bool giveSecondChance(Index& sidx, typename Index::iterator& iter)
+{
+  if constexpr (HasReferencedFlag<typename Index::value_type>::value) {
+    if (iter->d_referenced.testAndClear()) {
+      auto next = std::next(iter);
+      sidx.relocate(sidx.end(), iter);
+      iter = next != sidx.end() ? next : sidx.begin();
+      return true;
+    }
+  }
+  return false;
+}
+
 // this function can clean any cache that has an isStale() method on its entries, a preRemoval() method and a 'sequence' index as its second index
 // the ritual is that the oldest entries are in *front* of the sequence collection, so on a hit, move an item to the end
 // and optionally, on a miss, move it to the beginning
@@ -71,8 +137,12 @@ void pruneCollection(C& container, T& collection, size_t maxCached, size_t scanF
 
   // just lob it off from the beginning
   auto iter = sidx.begin();
-  for (size_t i = 0; i < toTrim && iter != sidx.end(); i++) {
+  for (size_t i = 0; i < toTrim && iter != sidx.end();) {
+    if (giveSecondChance(sidx, iter)) {
+      continue;
+    }
     iter = sidx.erase(iter);
+    i++;
   }
 }
 
@@ -101,6 +171,19 @@ void moveCacheItemToBack(T& collection, typename T::iterator& iter)
   moveCacheItemToFrontOrBack<S>(collection, iter, false);
 }
 
+// on a hit, move the entry to the back of the sequence index or, when doing
+// second chance eviction, only flag it as referenced
+template <typename S, typename T>
+void touchCacheItem(T& collection, typename T::iterator& iter, bool secondChance)
+{
+  if (secondChance) {
+    iter->d_referenced.set();
+  }
+  else {
+    moveCacheItemToBack<S>(collection, iter);
+  }
+}
+
 template <typename S, typename T>
 uint64_t pruneLockedCollectionsVector(std::vector<T>& maps)
 {
@@ -129,6 +212,9 @@ uint64_t pruneLockedCollectionsVector(std::vector<T>& maps)
   return totErased;
 }
 
+// the entries should have an isStale() method, the container a preRemoval() one.
+// When non-expired entries have to be removed, those that have been flagged as referenced since they
+// were last moved in the 'sequence' index get a second chance instead (see ReferencedFlag)
 template <typename S, typename C, typename T>
 uint64_t pruneMutexCollectionsVector(C& container, std::vector<T>& maps, uint64_t maxCached, uint64_t cacheSize)
 {
@@ -222,7 +308,11 @@ uint64_t pruneMutexCollectionsVector(C& container, std::vector<T>& maps, uint64_
     shard->invalidate();
     auto& sidx = boost::multi_index::get<S>(shard->d_map);
     size_t removed = 0;
-    for (auto i = sidx.begin(); i != sidx.end() && removed < toTrimForThisShard; removed++) {
+    for (auto i = sidx.begin(); i != sidx.end() && removed < toTrimForThisShard;) {
+      if (giveSecondChance(sidx, i)) {
+        continue;
+      }
+      removed++;
       container.preRemoval(*shard, *i);
       i = sidx.erase(i);
       --content.d_entriesCount;
@@ -72,6 +72,7 @@ static struct DevPollRegisterOurselves
   DevPollRegisterOurselves()
   {
     FDMultiplexer::getMultiplexerMap().emplace(1, &makeDevPoll); // priority 1, so that /dev/poll is preferred over poll, but not over completion ports!
+    FDMultiplexer::getMultiplexerNames().emplace("/dev/poll", &makeDevPoll);
   }
 } doItDevPoll;
 
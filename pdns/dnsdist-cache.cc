@@ -29,7 +29,7 @@
 #include "ednssubnet.hh"
 #include "packetcache.hh"
 
-DNSDistPacketCache::DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL, uint32_t minTTL, uint32_t tempFailureTTL, uint32_t maxNegativeTTL, uint32_t staleTTL, bool dontAge, uint32_t shards, bool deferrableInsertLock, bool parseECS): d_maxEntries(maxEntries), d_shardCount(shards), d_maxTTL(maxTTL), d_tempFailureTTL(tempFailureTTL), d_maxNegativeTTL(maxNegativeTTL), d_minTTL(minTTL), d_staleTTL(staleTTL), d_dontAge(dontAge), d_deferrableInsertLock(deferrableInsertLock), d_parseECS(parseECS)
+DNSDistPacketCache::DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL, uint32_t minTTL, uint32_t tempFailureTTL, uint32_t maxNegativeTTL, uint32_t staleTTL, bool dontAge, uint32_t shards, bool deferrableInsertLock, bool parseECS, bool lockFreeReads): d_maxEntries(maxEntries), d_shardCount(shards), d_maxTTL(maxTTL), d_tempFailureTTL(tempFailureTTL), d_maxNegativeTTL(maxNegativeTTL), d_minTTL(minTTL), d_staleTTL(staleTTL), d_dontAge(dontAge), d_deferrableInsertLock(deferrableInsertLock), d_parseECS(parseECS), d_lockFreeReads(lockFreeReads)
 {
   if (d_maxEntries == 0) {
     throw std::runtime_error("Trying to create a 0-sized packet-cache");
@@ -40,10 +40,145 @@ DNSDistPacketCache::DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL, uint3
   /* we reserve maxEntries + 1 to avoid rehashing from occurring
      when we get to maxEntries, as it means a load factor of 1 */
   for (auto& shard : d_shards) {
+    if (d_lockFreeReads) {
+      shard.d_lockFreeMap = std::make_unique<dnsdist::LockFreeHashMap<CacheValue, CacheValue::Deleter>>(d_reclaimer);
+    }
     shard.setSize((maxEntries / d_shardCount) + 1);
   }
 }
 
+DNSDistPacketCache::CacheValue::Ptr DNSDistPacketCache::CacheValue::create(const DNSName& qname, uint16_t qtype, uint16_t qclass, uint16_t queryFlags, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet, time_t added, time_t validity, const PacketBuffer& response)
+{
+  const auto& storage = qname.getStorage();
+  if (storage.size() > std::numeric_limits<uint8_t>::max() || response.size() > std::numeric_limits<uint16_t>::max()) {
+    return nullptr;
+  }
+
+  void* raw = ::operator new(sizeof(CacheValue) + storage.size() + response.size());
+  Ptr value(new (raw) CacheValue());
+  value->added = added;
+  value->validity = validity;
+  value->qtype = qtype;
+  value->qclass = qclass;
+  value->queryFlags = queryFlags;
+  value->len = response.size();
+  value->qnameLength = storage.size();
+  value->receivedOverUDP = receivedOverUDP;
+  value->dnssecOK = dnssecOK;
+
+  if (subnet) {
+    const auto& network = subnet->getNetwork();
+    value->subnetFamily = network.sin4.sin_family;
+    value->subnetBits = subnet->getBits();
+    if (network.isIPv4()) {
+      memcpy(value->subnetAddress.data(), &network.sin4.sin_addr.s_addr, sizeof(network.sin4.sin_addr.s_addr));
+    }
+    else if (network.isIPv6()) {
+      memcpy(value->subnetAddress.data(), &network.sin6.sin6_addr.s6_addr, sizeof(network.sin6.sin6_addr.s6_addr));
+    }
+  }
+
+  memcpy(value->getQNameStorage(), storage.data(), storage.size());
+  if (!response.empty()) {
+    memcpy(value->getQNameStorage() + storage.size(), response.data(), response.size());
+  }
+
+  return value;
+}
+
+void DNSDistPacketCache::CacheValue::Deleter::operator()(CacheValue* value) const
+{
+  value->~CacheValue();
+  ::operator delete(value);
+}
+
+DNSName DNSDistPacketCache::CacheValue::getQName() const
+{
+  return DNSName(reinterpret_cast<const char*>(getQNameStorage()), qnameLength, 0, false);
+}
+
+bool DNSDistPacketCache::CacheValue::qnameMatches(const std::string_view& qname) const
+{
+  if (qname.size() != qnameLength) {
+    return false;
+  }
+
+  return dns_iequals_n(getQNameStorage(), reinterpret_cast<const unsigned char*>(qname.data()), qnameLength);
+}
+
+bool DNSDistPacketCache::CacheValue::subnetMatches(const boost::optional<Netmask>& subnet) const
+{
+  if (!subnet) {
+    return subnetFamily == 0;
+  }
+
+  const auto& network = subnet->getNetwork();
+  if (subnetFamily != network.sin4.sin_family || subnetBits != subnet->getBits()) {
+    return false;
+  }
+
+  if (network.isIPv4()) {
+    return memcmp(subnetAddress.data(), &network.sin4.sin_addr.s_addr, sizeof(network.sin4.sin_addr.s_addr)) == 0;
+  }
+  if (network.isIPv6()) {
+    return memcmp(subnetAddress.data(), &network.sin6.sin6_addr.s6_addr, sizeof(network.sin6.sin6_addr.s6_addr)) == 0;
+  }
+  return true;
+}
+
+template <typename F>
+void DNSDistPacketCache::visitEntries(CacheShard& shard, F func)
+{
+  if (shard.d_lockFreeMap) {
+    auto map = shard.d_lockFreeMap->write_lock();
+    map->forEach(func);
+  }
+  else {
+    auto map = shard.d_map.read_lock();
+    for (const auto& entry : *map) {
+      func(entry.first, *entry.second);
+    }
+  }
+}
+
+/* remove the entries for which pred(key, value) returns true,
+   until there are at most maxToKeep entries left in the shard */
+template <typename P>
+size_t DNSDistPacketCache::removeEntries(CacheShard& shard, P pred, size_t maxToKeep)
+{
+  size_t removed = 0;
+
+  if (shard.d_lockFreeMap) {
+    auto map = shard.d_lockFreeMap->write_lock();
+    if (map->size() > maxToKeep) {
+      removed = map->eraseIf(pred, map->size() - maxToKeep);
+    }
+    /* the values replaced on insertion and the old tables have been retired
+       as well, so we need to reclaim even if we did not remove anything */
+    map->reclaim();
+  }
+  else {
+    auto map = shard.d_map.write_lock();
+    if (map->size() <= maxToKeep) {
+      return removed;
+    }
+
+    size_t toRemove = map->size() - maxToKeep;
+    for (auto it = map->begin(); toRemove > 0 && it != map->end(); ) {
+      if (pred(it->first, *it->second)) {
+        it = map->erase(it);
+        --toRemove;
+        ++removed;
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  shard.d_entriesCount -= removed;
+  return removed;
+}
+
 bool DNSDistPacketCache::getClientSubnet(const PacketBuffer& packet, size_t qnameWireLength, boost::optional<Netmask>& subnet)
 {
   uint16_t optRDPosition;
@@ -70,51 +205,104 @@ bool DNSDistPacketCache::getClientSubnet(const PacketBuffer& packet, size_t qnam
   return false;
 }
 
-bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet) const
+bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const std::string_view& qname, uint16_t qtype, uint16_t qclass, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet) const
 {
-  if (cachedValue.queryFlags != queryFlags || cachedValue.dnssecOK != dnssecOK || cachedValue.receivedOverUDP != receivedOverUDP || cachedValue.qtype != qtype || cachedValue.qclass != qclass || cachedValue.qname != qname) {
+  if (cachedValue.queryFlags != queryFlags || cachedValue.dnssecOK != dnssecOK || cachedValue.receivedOverUDP != receivedOverUDP || cachedValue.qtype != qtype || cachedValue.qclass != qclass || !cachedValue.qnameMatches(qname)) {
     return false;
   }
 
-  if (d_parseECS && cachedValue.subnet != subnet) {
+  if (d_parseECS && !cachedValue.subnetMatches(subnet)) {
     return false;
   }
 
   return true;
 }
 
-void DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue)
+bool DNSDistPacketCache::cachedValueMatches(const CacheValue& cachedValue, const CacheValue& other) const
+{
+  if (cachedValue.queryFlags != other.queryFlags || cachedValue.dnssecOK != other.dnssecOK || cachedValue.receivedOverUDP != other.receivedOverUDP || cachedValue.qtype != other.qtype || cachedValue.qclass != other.qclass || !cachedValue.qnameMatches(other.getQNameWire())) {
+    return false;
+  }
+
+  if (d_parseECS && (cachedValue.subnetFamily != other.subnetFamily || cachedValue.subnetBits != other.subnetBits || cachedValue.subnetAddress != other.subnetAddress)) {
+    return false;
+  }
+
+  return true;
+}
+
+void DNSDistPacketCache::insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue::Ptr>& map, uint32_t key, CacheValue::Ptr& newValue)
+{
+  /* check again now that we hold the lock to prevent a race */
+  if (map.size() >= (d_maxEntries / d_shardCount)) {
+    return;
+  }
+
+  std::unordered_map<uint32_t,CacheValue::Ptr>::iterator it;
+  bool result;
+  std::tie(it, result) = map.try_emplace(key, nullptr);
+
+  if (result) {
+    it->second = std::move(newValue);
+    ++shard.d_entriesCount;
+    return;
+  }
+
+  /* in case of collision, don't override the existing entry
+     except if it has expired */
+  CacheValue::Ptr& value = it->second;
+  bool wasExpired = value->validity <= newValue->added;
+
+  if (!wasExpired && !cachedValueMatches(*value, *newValue)) {
+    d_insertCollisions++;
+    return;
+  }
+
+  /* if the existing entry had a longer TTD, keep it */
+  if (newValue->validity <= value->validity) {
+    return;
+  }
+
+  value = std::move(newValue);
+}
+
+void DNSDistPacketCache::insertLocked(CacheShard& shard, dnsdist::LockFreeHashMap<CacheValue, CacheValue::Deleter>::Writer& map, uint32_t key, CacheValue::Ptr& newValue)
 {
   /* check again now that we hold the lock to prevent a race */
   if (map.size() >= (d_maxEntries / d_shardCount)) {
     return;
   }
 
-  std::unordered_map<uint32_t,CacheValue>::iterator it;
+  const CacheValue* existing;
   bool result;
-  std::tie(it, result) = map.insert({key, newValue});
+  std::tie(existing, result) = map.insert(key, std::move(newValue));
 
   if (result) {
     ++shard.d_entriesCount;
     return;
   }
 
+  if (existing == nullptr) {
+    return;
+  }
+
   /* in case of collision, don't override the existing entry
      except if it has expired */
-  CacheValue& value = it->second;
-  bool wasExpired = value.validity <= newValue.added;
+  bool wasExpired = existing->validity <= newValue->added;
 
-  if (!wasExpired && !cachedValueMatches(value, newValue.queryFlags, newValue.qname, newValue.qtype, newValue.qclass, newValue.receivedOverUDP, newValue.dnssecOK, newValue.subnet)) {
+  if (!wasExpired && !cachedValueMatches(*existing, *newValue)) {
     d_insertCollisions++;
     return;
   }
 
   /* if the existing entry had a longer TTD, keep it */
-  if (newValue.validity <= value.validity) {
+  if (newValue->validity <= existing->validity) {
     return;
   }
 
-  value = newValue;
+  /* values are immutable once inserted since readers do not hold a lock,
+     so we replace the whole entry instead */
+  map.replace(key, std::move(newValue));
 }
 
 void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL)
@@ -161,21 +349,31 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
 
   const time_t now = time(nullptr);
   time_t newValidity = now + minTTL;
-  CacheValue newValue;
-  newValue.qname = qname;
-  newValue.qtype = qtype;
-  newValue.qclass = qclass;
-  newValue.queryFlags = queryFlags;
-  newValue.len = response.size();
-  newValue.validity = newValidity;
-  newValue.added = now;
-  newValue.receivedOverUDP = receivedOverUDP;
-  newValue.dnssecOK = dnssecOK;
-  newValue.value = std::string(response.begin(), response.end());
-  newValue.subnet = subnet;
+  auto newValue = CacheValue::create(qname, qtype, qclass, queryFlags, receivedOverUDP, dnssecOK, subnet, now, newValidity, response);
+  if (!newValue) {
+    return;
+  }
 
   auto& shard = d_shards.at(shardIndex);
 
+  if (shard.d_lockFreeMap) {
+    if (d_deferrableInsertLock) {
+      auto w = shard.d_lockFreeMap->try_write_lock();
+
+      if (!w.owns_lock()) {
+        d_deferredInserts++;
+        return;
+      }
+      insertLocked(shard, *w, key, newValue);
+    }
+    else {
+      auto w = shard.d_lockFreeMap->write_lock();
+
+      insertLocked(shard, *w, key, newValue);
+    }
+    return;
+  }
+
   if (d_deferrableInsertLock) {
     auto w = shard.d_map.try_write_lock();
 
@@ -194,15 +392,16 @@ void DNSDistPacketCache::insert(uint32_t key, const boost::optional<Netmask>& su
 
 bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired, bool skipAging, bool truncatedOK, bool recordMiss)
 {
-  const auto& dnsQName = dq.ids.qname.getStorage();
-  uint32_t key = getKey(dnsQName, dq.ids.qname.wirelength(), dq.getData(), receivedOverUDP);
+  const DNSNameView qname(dq.ids.qname);
+  const auto dnsQName = qname.getStorage();
+  uint32_t key = getKey(dnsQName, qname.wirelength(), dq.getData(), receivedOverUDP);
 
   if (keyOut) {
     *keyOut = key;
   }
 
   if (d_parseECS) {
-    getClientSubnet(dq.getData(), dq.ids.qname.wirelength(), subnet);
+    getClientSubnet(dq.getData(), qname.wirelength(), subnet);
   }
 
   uint32_t shardIndex = getShardIndex(key);
@@ -211,28 +410,15 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
   bool stale = false;
   auto& response = dq.getMutableData();
   auto& shard = d_shards.at(shardIndex);
-  {
-    auto map = shard.d_map.try_read_lock();
-    if (!map.owns_lock()) {
-      d_deferredLookups++;
-      return false;
-    }
+  bool hit = false;
 
-    std::unordered_map<uint32_t,CacheValue>::const_iterator it = map->find(key);
-    if (it == map->end()) {
-      if (recordMiss) {
-        d_misses++;
-      }
-      return false;
-    }
-
-    const CacheValue& value = it->second;
+  auto processCachedValue = [&](const CacheValue& value) {
     if (value.validity <= now) {
       if ((now - value.validity) >= static_cast<time_t>(allowExpired)) {
         if (recordMiss) {
           d_misses++;
         }
-        return false;
+        return;
       }
       else {
         stale = true;
@@ -240,41 +426,41 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
     }
 
     if (value.len < sizeof(dnsheader)) {
-      return false;
+      return;
     }
 
     /* check for collision */
-    if (!cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.getHeader())), dq.ids.qname, dq.ids.qtype, dq.ids.qclass, receivedOverUDP, dnssecOK, subnet)) {
+    if (!cachedValueMatches(value, *(getFlagsFromDNSHeader(dq.getHeader())), dnsQName, dq.ids.qtype, dq.ids.qclass, receivedOverUDP, dnssecOK, subnet)) {
       d_lookupCollisions++;
-      return false;
+      return;
     }
 
     if (!truncatedOK) {
       dnsheader dh;
-      memcpy(&dh, value.value.data(), sizeof(dh));
+      memcpy(&dh, value.getData(), sizeof(dh));
       if (dh.tc != 0) {
-        return false;
+        return;
       }
     }
 
     response.resize(value.len);
     memcpy(&response.at(0), &queryId, sizeof(queryId));
-    memcpy(&response.at(sizeof(queryId)), &value.value.at(sizeof(queryId)), sizeof(dnsheader) - sizeof(queryId));
+    memcpy(&response.at(sizeof(queryId)), value.getData() + sizeof(queryId), sizeof(dnsheader) - sizeof(queryId));
 
     if (value.len == sizeof(dnsheader)) {
       /* DNS header only, our work here is done */
-      d_hits++;
-      return true;
+      hit = true;
+      return;
     }
 
     const size_t dnsQNameLen = dnsQName.length();
     if (value.len < (sizeof(dnsheader) + dnsQNameLen)) {
-      return false;
+      return;
     }
 
-    memcpy(&response.at(sizeof(dnsheader)), dnsQName.c_str(), dnsQNameLen);
+    memcpy(&response.at(sizeof(dnsheader)), dnsQName.data(), dnsQNameLen);
     if (value.len > (sizeof(dnsheader) + dnsQNameLen)) {
-      memcpy(&response.at(sizeof(dnsheader) + dnsQNameLen), &value.value.at(sizeof(dnsheader) + dnsQNameLen), value.len - (sizeof(dnsheader) + dnsQNameLen));
+      memcpy(&response.at(sizeof(dnsheader) + dnsQNameLen), value.getData() + sizeof(dnsheader) + dnsQNameLen, value.len - (sizeof(dnsheader) + dnsQNameLen));
     }
 
     if (!stale) {
@@ -283,6 +469,42 @@ bool DNSDistPacketCache::get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut
     else {
       age = (value.validity - value.added) - d_staleTTL;
     }
+    hit = true;
+  };
+
+  if (shard.d_lockFreeMap) {
+    if (!shard.d_lockFreeMap->visit(key, processCachedValue)) {
+      if (recordMiss) {
+        d_misses++;
+      }
+      return false;
+    }
+  }
+  else {
+    auto map = shard.d_map.try_read_lock();
+    if (!map.owns_lock()) {
+      d_deferredLookups++;
+      return false;
+    }
+
+    std::unordered_map<uint32_t,CacheValue::Ptr>::const_iterator it = map->find(key);
+    if (it == map->end()) {
+      if (recordMiss) {
+        d_misses++;
+      }
+      return false;
+    }
+
+    processCachedValue(*it->second);
+  }
+
+  if (!hit) {
+    return false;
+  }
+
+  if (response.size() == sizeof(dnsheader)) {
+    d_hits++;
+    return true;
   }
 
   if (!d_dontAge && !skipAging) {
@@ -313,25 +535,9 @@ size_t DNSDistPacketCache::purgeExpired(size_t upTo, const time_t now)
 
   d_cleanupCount++;
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.write_lock();
-    if (map->size() <= maxPerShard) {
-      continue;
-    }
-
-    size_t toRemove = map->size() - maxPerShard;
-
-    for (auto it = map->begin(); toRemove > 0 && it != map->end(); ) {
-      const CacheValue& value = it->second;
-
-      if (value.validity <= now) {
-        it = map->erase(it);
-        --toRemove;
-        --shard.d_entriesCount;
-        ++removed;
-      } else {
-        ++it;
-      }
-    }
+    removed += removeEntries(shard, [now](uint32_t key, const CacheValue& value) {
+      return value.validity <= now;
+    }, maxPerShard);
   }
 
   return removed;
@@ -349,28 +555,9 @@ size_t DNSDistPacketCache::expunge(size_t upTo)
   size_t removed = 0;
 
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.write_lock();
-
-    if (map->size() <= maxPerShard) {
-      continue;
-    }
-
-    size_t toRemove = map->size() - maxPerShard;
-
-    auto beginIt = map->begin();
-    auto endIt = beginIt;
-
-    if (map->size() >= toRemove) {
-      std::advance(endIt, toRemove);
-      map->erase(beginIt, endIt);
-      shard.d_entriesCount -= toRemove;
-      removed += toRemove;
-    }
-    else {
-      removed += map->size();
-      map->clear();
-      shard.d_entriesCount = 0;
-    }
+    removed += removeEntries(shard, [](uint32_t key, const CacheValue& value) {
+      return true;
+    }, maxPerShard);
   }
 
   return removed;
@@ -379,21 +566,19 @@ size_t DNSDistPacketCache::expunge(size_t upTo)
 size_t DNSDistPacketCache::expungeByName(const DNSName& name, uint16_t qtype, bool suffixMatch)
 {
   size_t removed = 0;
+  const auto& nameStorage = name.getStorage();
+  const std::string_view storage(nameStorage.data(), nameStorage.size());
 
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.write_lock();
-
-    for(auto it = map->begin(); it != map->end(); ) {
-      const CacheValue& value = it->second;
-
-      if ((value.qname == name || (suffixMatch && value.qname.isPartOf(name))) && (qtype == QType::ANY || qtype == value.qtype)) {
-        it = map->erase(it);
-        --shard.d_entriesCount;
-        ++removed;
-      } else {
-        ++it;
+    removed += removeEntries(shard, [&storage, &name, qtype, suffixMatch](uint32_t key, const CacheValue& value) {
+      if (qtype != QType::ANY && qtype != value.qtype) {
+        return false;
       }
-    }
+      if (value.qnameMatches(storage)) {
+        return true;
+      }
+      return suffixMatch && value.getQName().isPartOf(name);
+    }, 0);
   }
 
   return removed;
@@ -420,7 +605,7 @@ uint32_t DNSDistPacketCache::getMinTTL(const char* packet, uint16_t length, bool
   return getDNSPacketMinTTL(packet, length, seenNoDataSOA);
 }
 
-uint32_t DNSDistPacketCache::getKey(const DNSName::string_t& qname, size_t qnameWireLength, const PacketBuffer& packet, bool receivedOverUDP)
+uint32_t DNSDistPacketCache::getKey(const std::string_view& qname, size_t qnameWireLength, const PacketBuffer& packet, bool receivedOverUDP)
 {
   uint32_t result = 0;
   /* skip the query ID */
@@ -429,7 +614,7 @@ uint32_t DNSDistPacketCache::getKey(const DNSName::string_t& qname, size_t qname
   }
 
   result = burtle(&packet.at(2), sizeof(dnsheader) - 2, result);
-  result = burtleCI((const unsigned char*) qname.c_str(), qname.length(), result);
+  result = burtleCI(reinterpret_cast<const unsigned char*>(qname.data()), qname.length(), result);
   if (packet.size() < sizeof(dnsheader) + qnameWireLength) {
     throw std::range_error("Computing packet cache key for an invalid packet (" + std::to_string(packet.size()) + " < " + std::to_string(sizeof(dnsheader) + qnameWireLength) + ")");
   }
@@ -473,26 +658,23 @@ uint64_t DNSDistPacketCache::dump(int fd)
   uint64_t count = 0;
   time_t now = time(nullptr);
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.read_lock();
-
-    for (const auto& entry : *map) {
-      const CacheValue& value = entry.second;
+    visitEntries(shard, [&](uint32_t key, const CacheValue& value) {
       count++;
 
       try {
         uint8_t rcode = 0;
         if (value.len >= sizeof(dnsheader)) {
           dnsheader dh;
-          memcpy(&dh, value.value.data(), sizeof(dnsheader));
+          memcpy(&dh, value.getData(), sizeof(dnsheader));
           rcode = dh.rcode;
         }
 
-        fprintf(fp.get(), "%s %" PRId64 " %s ; rcode %" PRIu8 ", key %" PRIu32 ", length %" PRIu16 ", received over UDP %d, added %" PRId64 "\n", value.qname.toString().c_str(), static_cast<int64_t>(value.validity - now), QType(value.qtype).toString().c_str(), rcode, entry.first, value.len, value.receivedOverUDP, static_cast<int64_t>(value.added));
+        fprintf(fp.get(), "%s %" PRId64 " %s ; rcode %" PRIu8 ", key %" PRIu32 ", length %" PRIu16 ", received over UDP %d, added %" PRId64 "\n", value.getQName().toString().c_str(), static_cast<int64_t>(value.validity - now), QType(value.qtype).toString().c_str(), rcode, key, value.len, value.receivedOverUDP, static_cast<int64_t>(value.added));
       }
       catch(...) {
-        fprintf(fp.get(), "; error printing '%s'\n", value.qname.empty() ? "EMPTY" : value.qname.toString().c_str());
+        fprintf(fp.get(), "; error printing '%s'\n", value.qnameLength == 0 ? "EMPTY" : "invalid qname");
       }
-    }
+    });
   }
 
   return count;
@@ -508,24 +690,21 @@ std::set<DNSName> DNSDistPacketCache::getDomainsContainingRecords(const ComboAdd
   std::set<DNSName> domains;
 
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.read_lock();
-
-    for (const auto& entry : *map) {
-      const CacheValue& value = entry.second;
+    visitEntries(shard, [&](uint32_t key, const CacheValue& value) {
 
       try {
         dnsheader dh;
         if (value.len < sizeof(dnsheader)) {
-          continue;
+          return;
         }
 
-        memcpy(&dh, value.value.data(), sizeof(dnsheader));
+        memcpy(&dh, value.getData(), sizeof(dnsheader));
         if (dh.rcode != RCode::NoError || (dh.ancount == 0 && dh.nscount == 0 && dh.arcount == 0)) {
-          continue;
+          return;
         }
 
         bool found = false;
-        bool valid = visitDNSPacket(value.value, [addr, &found](uint8_t section, uint16_t qclass, uint16_t qtype, uint32_t ttl, uint16_t rdatalength, const char* rdata) {
+        bool valid = visitDNSPacket(value.getResponse(), [addr, &found](uint8_t section, uint16_t qclass, uint16_t qtype, uint32_t ttl, uint16_t rdatalength, const char* rdata) {
 
           if (qtype == QType::A && qclass == QClass::IN && addr.isIPv4() && rdatalength == 4 && rdata != nullptr) {
             ComboAddress parsed;
@@ -550,13 +729,13 @@ std::set<DNSName> DNSDistPacketCache::getDomainsContainingRecords(const ComboAdd
         });
 
         if (valid && found) {
-          domains.insert(value.qname);
+          domains.insert(value.getQName());
         }
       }
       catch (...) {
-        continue;
+        return;
       }
-    }
+    });
   }
 
   return domains;
@@ -565,29 +744,28 @@ std::set<DNSName> DNSDistPacketCache::getDomainsContainingRecords(const ComboAdd
 std::set<ComboAddress> DNSDistPacketCache::getRecordsForDomain(const DNSName& domain)
 {
   std::set<ComboAddress> addresses;
+  const auto& storage = domain.getStorage();
+  const std::string_view domainStorage(storage.data(), storage.size());
 
   for (auto& shard : d_shards) {
-    auto map = shard.d_map.read_lock();
-
-    for (const auto& entry : *map) {
-      const CacheValue& value = entry.second;
+    visitEntries(shard, [&](uint32_t key, const CacheValue& value) {
 
       try {
-        if (value.qname != domain) {
-          continue;
+        if (!value.qnameMatches(domainStorage)) {
+          return;
         }
 
         dnsheader dh;
         if (value.len < sizeof(dnsheader)) {
-          continue;
+          return;
         }
 
-        memcpy(&dh, value.value.data(), sizeof(dnsheader));
+        memcpy(&dh, value.getData(), sizeof(dnsheader));
         if (dh.rcode != RCode::NoError || (dh.ancount == 0 && dh.nscount == 0 && dh.arcount == 0)) {
-          continue;
+          return;
         }
 
-        visitDNSPacket(value.value, [&addresses](uint8_t section, uint16_t qclass, uint16_t qtype, uint32_t ttl, uint16_t rdatalength, const char* rdata) {
+        visitDNSPacket(value.getResponse(), [&addresses](uint8_t section, uint16_t qclass, uint16_t qtype, uint32_t ttl, uint16_t rdatalength, const char* rdata) {
 
           if (qtype == QType::A && qclass == QClass::IN && rdatalength == 4 && rdata != nullptr) {
             ComboAddress parsed;
@@ -606,9 +784,9 @@ std::set<ComboAddress> DNSDistPacketCache::getRecordsForDomain(const DNSName& do
         });
       }
       catch (...) {
-        continue;
+        return;
       }
-    }
+    });
   }
 
   return addresses;
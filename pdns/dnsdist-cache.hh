@@ -21,9 +21,14 @@
  */
 #pragma once
 
+#include <array>
 #include <atomic>
+#include <memory>
+#include <string_view>
 #include <unordered_map>
 
+#include "dnsdist-lockfree-map.hh"
+#include "epoch-reclaimer.hh"
 #include "iputils.hh"
 #include "lock.hh"
 #include "noinitvector.hh"
@@ -35,7 +40,7 @@ struct DNSQuestion;
 class DNSDistPacketCache : boost::noncopyable
 {
 public:
-  DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL=86400, uint32_t minTTL=0, uint32_t tempFailureTTL=60, uint32_t maxNegativeTTL=3600, uint32_t staleTTL=60, bool dontAge=false, uint32_t shards=1, bool deferrableInsertLock=true, bool parseECS=false);
+  DNSDistPacketCache(size_t maxEntries, uint32_t maxTTL=86400, uint32_t minTTL=0, uint32_t tempFailureTTL=60, uint32_t maxNegativeTTL=3600, uint32_t staleTTL=60, bool dontAge=false, uint32_t shards=1, bool deferrableInsertLock=true, bool parseECS=false, bool lockFreeReads=false);
 
   void insert(uint32_t key, const boost::optional<Netmask>& subnet, uint16_t queryFlags, bool dnssecOK, const DNSName& qname, uint16_t qtype, uint16_t qclass, const PacketBuffer& response, bool receivedOverUDP, uint8_t rcode, boost::optional<uint32_t> tempFailureTTL);
   bool get(DNSQuestion& dq, uint16_t queryId, uint32_t* keyOut, boost::optional<Netmask>& subnet, bool dnssecOK, bool receivedOverUDP, uint32_t allowExpired = 0, bool skipAging = false, bool truncatedOK = true, bool recordMiss = true);
@@ -54,6 +59,8 @@ public:
   uint64_t getMaxEntries() const { return d_maxEntries; }
   uint64_t getTTLTooShorts() const { return d_ttlTooShorts; }
   uint64_t getCleanupCount() const { return d_cleanupCount; }
+  /* number of entries removed or replaced from a lock-free cache that have not been freed yet */
+  uint64_t getRetiredCount() const { return d_reclaimer.getPendingCount(); }
   uint64_t getEntriesCount();
   uint64_t dump(int fd);
 
@@ -65,6 +72,7 @@ public:
   void setSkippedOptions(const std::unordered_set<uint16_t>& optionsToSkip);
 
   bool isECSParsingEnabled() const { return d_parseECS; }
+  bool hasLockFreeReads() const { return d_lockFreeReads; }
 
   bool keepStaleData() const
   {
@@ -81,27 +89,63 @@ public:
     d_parseECS = enabled;
   }
 
-  uint32_t getKey(const DNSName::string_t& qname, size_t qnameWireLength, const PacketBuffer& packet, bool receivedOverUDP);
+  uint32_t getKey(const std::string_view& qname, size_t qnameWireLength, const PacketBuffer& packet, bool receivedOverUDP);
 
   static uint32_t getMinTTL(const char* packet, uint16_t length, bool* seenNoDataSOA);
   static bool getClientSubnet(const PacketBuffer& packet, size_t qnameWireLength, boost::optional<Netmask>& subnet);
 
 private:
 
-  struct CacheValue
+  /* Everything needed to match a query against a cached entry, and to build the
+     response, lives in a single allocation: the fixed-size metadata first, then
+     the qname in wire format and finally the response itself. A hit therefore
+     only needs to dereference the pointer stored in the map, and entries do
+     not carry the overhead of separate DNSName, string and Netmask objects. */
+  class CacheValue
   {
+  public:
+    struct Deleter
+    {
+      void operator()(CacheValue* value) const;
+    };
+    using Ptr = std::unique_ptr<CacheValue, Deleter>;
+
+    static Ptr create(const DNSName& qname, uint16_t qtype, uint16_t qclass, uint16_t queryFlags, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet, time_t added, time_t validity, const PacketBuffer& response);
+
     time_t getTTD() const { return validity; }
-    std::string value;
-    DNSName qname;
-    boost::optional<Netmask> subnet;
+    /* the response, including the DNS header, of size len */
+    const uint8_t* getData() const { return getQNameStorage() + qnameLength; }
+    std::string_view getResponse() const { return std::string_view(reinterpret_cast<const char*>(getData()), len); }
+    /* the qname, in wire format */
+    std::string_view getQNameWire() const { return std::string_view(reinterpret_cast<const char*>(getQNameStorage()), qnameLength); }
+    /* only for the slow paths (dump, expunge..), allocates */
+    DNSName getQName() const;
+    /* case-insensitive comparison of the stored qname with the wire representation of a name */
+    bool qnameMatches(const std::string_view& qname) const;
+    bool subnetMatches(const boost::optional<Netmask>& subnet) const;
+
+    time_t added{0};
+    time_t validity{0};
     uint16_t qtype{0};
     uint16_t qclass{0};
     uint16_t queryFlags{0};
-    time_t added{0};
-    time_t validity{0};
     uint16_t len{0};
+    uint8_t qnameLength{0};
+    /* 0 if there was no subnet, AF_INET or AF_INET6 otherwise */
+    uint8_t subnetFamily{0};
+    uint8_t subnetBits{0};
     bool receivedOverUDP{false};
     bool dnssecOK{false};
+    /* already masked, zero-filled beyond the address itself */
+    std::array<uint8_t, 16> subnetAddress{};
+
+  private:
+    CacheValue()
+    {
+    }
+
+    const uint8_t* getQNameStorage() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+    uint8_t* getQNameStorage() { return reinterpret_cast<uint8_t*>(this + 1); }
   };
 
   class CacheShard
@@ -116,16 +160,31 @@ private:
 
     void setSize(size_t maxSize)
     {
-      d_map.write_lock()->reserve(maxSize);
+      if (d_lockFreeMap) {
+        d_lockFreeMap->write_lock()->reserve(maxSize);
+      }
+      else {
+        d_map.write_lock()->reserve(maxSize);
+      }
     }
 
-    SharedLockGuarded<std::unordered_map<uint32_t,CacheValue>> d_map;
+    SharedLockGuarded<std::unordered_map<uint32_t,CacheValue::Ptr>> d_map;
+    /* only set when lock-free reads have been requested, in which case d_map is not used */
+    std::unique_ptr<dnsdist::LockFreeHashMap<CacheValue, CacheValue::Deleter>> d_lockFreeMap{nullptr};
     std::atomic<uint64_t> d_entriesCount{0};
   };
 
-  bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const DNSName& qname, uint16_t qtype, uint16_t qclass, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  bool cachedValueMatches(const CacheValue& cachedValue, uint16_t queryFlags, const std::string_view& qname, uint16_t qtype, uint16_t qclass, bool receivedOverUDP, bool dnssecOK, const boost::optional<Netmask>& subnet) const;
+  bool cachedValueMatches(const CacheValue& cachedValue, const CacheValue& other) const;
   uint32_t getShardIndex(uint32_t key) const;
-  void insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue>& map, uint32_t key, CacheValue& newValue);
+  void insertLocked(CacheShard& shard, std::unordered_map<uint32_t,CacheValue::Ptr>& map, uint32_t key, CacheValue::Ptr& newValue);
+  void insertLocked(CacheShard& shard, dnsdist::LockFreeHashMap<CacheValue, CacheValue::Deleter>::Writer& map, uint32_t key, CacheValue::Ptr& newValue);
+  template <typename F> void visitEntries(CacheShard& shard, F func);
+  template <typename P> size_t removeEntries(CacheShard& shard, P pred, size_t maxToKeep);
+
+  /* needs to be declared before the shards, since removing entries
+     from a lock-free shard hands them over to the reclaimer */
+  EpochReclaimer d_reclaimer;
 
   std::vector<CacheShard> d_shards;
   std::unordered_set<uint16_t> d_optionsToSkip{EDNSOptionCode::COOKIE};
@@ -149,5 +208,6 @@ private:
   bool d_dontAge;
   bool d_deferrableInsertLock;
   bool d_parseECS;
+  bool d_lockFreeReads;
   bool d_keepStaleData{false};
 };
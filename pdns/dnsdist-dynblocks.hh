@@ -26,6 +26,7 @@
 
 #include "dolog.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-sketch.hh"
 #include "statnode.hh"
 
 #include "dnsdist-lua-inspection-ffi.hh"
@@ -223,6 +224,72 @@ private:
 
   typedef std::unordered_map<AddressAndPortRange, Counts, AddressAndPortRange::hash> counts_t;
 
+  /* In approximate mode, the entries of the rings are fed to bounded heavy-hitters trackers,
+     one per counter that is needed by a rule, instead of being counted exactly per requestor */
+  struct ApproximateCounts
+  {
+    using tracker_t = dnsdist::HeavyHitters<AddressAndPortRange, AddressAndPortRange::hash>;
+
+    ApproximateCounts(size_t capacity): d_queries(capacity), d_respBytes(capacity), d_responses(tracker_t::getDefaultWidth(capacity), 4), d_capacity(capacity)
+    {
+    }
+
+    tracker_t& getQTypeTracker(uint16_t qtype)
+    {
+      return d_qtypes.try_emplace(qtype, d_capacity).first->second;
+    }
+
+    tracker_t& getRCodeTracker(uint8_t rcode)
+    {
+      return d_rcodes.try_emplace(rcode, d_capacity).first->second;
+    }
+
+    /* fill counts with the requestors tracked by at least one tracker */
+    void collect(counts_t& counts) const;
+    /* the trackers are kept between runs and only reset, since their sketches are quite large */
+    void clear();
+
+    tracker_t d_queries;
+    tracker_t d_respBytes;
+    std::map<uint16_t, tracker_t> d_qtypes;
+    std::map<uint8_t, tracker_t> d_rcodes;
+    /* only used as the denominator of the ratio rules, so we don't need to know which requestors sent the most */
+    dnsdist::CountMinSketch d_responses;
+    AddressAndPortRange::hash d_hash;
+    const size_t d_capacity;
+  };
+
+  /* In incremental mode, only the entries inserted into the rings since the last run
+     are looked at, and aggregated into per-second buckets kept between runs, so that
+     the cost of a run depends on the number of active requestors and names instead
+     of the size of the rings.
+     Since the buckets outlive the entries of the rings, the number of tracked keys is
+     capped to the capacity of the rings, so that the memory usage stays bounded as in
+     the exact mode: once that limit has been reached new requestors are ignored until
+     some of the existing ones expire, and new names are counted for their closest
+     tracked ancestor instead, or their parent, up to twice that limit, or the root */
+  struct IncrementalState
+  {
+    void clear()
+    {
+      d_requestors.clear();
+      d_names.clear();
+      d_queryPositions.clear();
+      d_responsePositions.clear();
+    }
+
+    /* return nullptr if that requestor is not tracked and the limit has been reached */
+    std::map<time_t, Counts>* getRequestorBuckets(const AddressAndPortRange& requestor);
+    std::map<time_t, StatNode::Stat>& getNameBuckets(const DNSName& name);
+
+    std::unordered_map<AddressAndPortRange, std::map<time_t, Counts>, AddressAndPortRange::hash> d_requestors;
+    std::unordered_map<DNSName, std::map<time_t, StatNode::Stat>> d_names;
+    size_t d_maxKeys{0};
+    /* position of the next entry to look at in the query and response ring of each shard */
+    std::vector<uint64_t> d_queryPositions;
+    std::vector<uint64_t> d_responsePositions;
+  };
+
 public:
   DynBlockRulesGroup()
   {
@@ -231,30 +298,35 @@ public:
   void setQueryRate(unsigned int rate, unsigned int warningRate, unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action)
   {
     d_queryRateRule = DynBlockRule(reason, blockDuration, rate, warningRate, seconds, action);
+    d_incrementalState.clear();
   }
 
   /* rate is in bytes per second */
   void setResponseByteRate(unsigned int rate, unsigned int warningRate, unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action)
   {
     d_respRateRule = DynBlockRule(reason, blockDuration, rate, warningRate, seconds, action);
+    d_incrementalState.clear();
   }
 
   void setRCodeRate(uint8_t rcode, unsigned int rate, unsigned int warningRate, unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action)
   {
     auto& entry = d_rcodeRules[rcode];
     entry = DynBlockRule(reason, blockDuration, rate, warningRate, seconds, action);
+    d_incrementalState.clear();
   }
 
   void setRCodeRatio(uint8_t rcode, double ratio, double warningRatio, unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action, size_t minimumNumberOfResponses)
   {
     auto& entry = d_rcodeRatioRules[rcode];
     entry = DynBlockRatioRule(reason, blockDuration, ratio, warningRatio, seconds, action, minimumNumberOfResponses);
+    d_incrementalState.clear();
   }
 
   void setQTypeRate(uint16_t qtype, unsigned int rate, unsigned int warningRate, unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action)
   {
     auto& entry = d_qtypeRules[qtype];
     entry = DynBlockRule(reason, blockDuration, rate, warningRate, seconds, action);
+    d_incrementalState.clear();
   }
 
   typedef std::function<std::tuple<bool, boost::optional<std::string>>(const StatNode&, const StatNode::Stat&, const StatNode::Stat&)> smtVisitor_t;
@@ -263,12 +335,14 @@ public:
   {
     d_suffixMatchRule = DynBlockRule(reason, blockDuration, 0, 0, seconds, action);
     d_smtVisitor = visitor;
+    d_incrementalState.clear();
   }
 
   void setSuffixMatchRuleFFI(unsigned int seconds, std::string reason, unsigned int blockDuration, DNSAction::Action action, dnsdist_ffi_stat_node_visitor_t visitor)
   {
     d_suffixMatchRule = DynBlockRule(reason, blockDuration, 0, 0, seconds, action);
     d_smtVisitorFFI = visitor;
+    d_incrementalState.clear();
   }
 
   void setMasks(uint8_t v4, uint8_t v6, uint8_t port)
@@ -276,6 +350,7 @@ public:
     d_v4Mask = v4;
     d_v6Mask = v6;
     d_portMask = port;
+    d_incrementalState.clear();
   }
 
   void apply()
@@ -342,10 +417,33 @@ public:
     d_beQuiet = quiet;
   }
 
+  /* In incremental mode, the rings are no longer entirely scanned every time apply() is called:
+     only the new entries are, and the counters are kept between runs with a one-second granularity.
+     Rules with a window of 0 seconds are then evaluated over the largest window of the group. */
+  void setIncrementalMode(bool incremental)
+  {
+    d_incremental = incremental;
+    d_incrementalState.clear();
+  }
+
+  /* In approximate mode, which is not used in incremental mode, the number of queries and responses
+     per requestor is estimated with a count-min sketch, and only the capacity requestors with the highest
+     estimates, for each rule, are considered. Memory usage and the cost of a run then no longer depend
+     on the number of distinct requestors, at the cost of counts that might be slightly over-estimated. */
+  void setApproximateMode(bool approximate, size_t capacity)
+  {
+    if (approximate && capacity > 0) {
+      d_approximate = std::make_unique<ApproximateCounts>(capacity);
+    }
+    else {
+      d_approximate.reset();
+    }
+  }
+
 private:
 
-  bool checkIfQueryTypeMatches(const Rings::Query& query);
-  bool checkIfResponseCodeMatches(const Rings::Response& response);
+  bool checkIfQueryTypeMatches(uint16_t qtype, const struct timespec& when);
+  bool checkIfResponseCodeMatches(uint8_t rcode, const struct timespec& when);
   void addOrRefreshBlock(boost::optional<NetmaskTree<DynBlock, AddressAndPortRange> >& blocks, const struct timespec& now, const AddressAndPortRange& requestor, const DynBlockRule& rule, bool& updated, bool warning);
   void addOrRefreshBlockSMT(SuffixMatchTree<DynBlock>& blocks, const struct timespec& now, const DNSName& name, const DynBlockRule& rule, bool& updated);
 
@@ -379,8 +477,11 @@ private:
     return hasQueryRules() || hasResponseRules();
   }
 
-  void processQueryRules(counts_t& counts, const struct timespec& now);
-  void processResponseRules(counts_t& counts, StatNode& root, const struct timespec& now);
+  void processQueryRules(counts_t& counts, ApproximateCounts* approximate, const struct timespec& now);
+  void processResponseRules(counts_t& counts, ApproximateCounts* approximate, StatNode& root, const struct timespec& now);
+  unsigned int getLargestWindow() const;
+  void updateIncrementalState(const struct timespec& now);
+  void processIncrementalState(counts_t& counts, StatNode& root, const struct timespec& now);
 
   std::map<uint8_t, DynBlockRule> d_rcodeRules;
   std::map<uint8_t, DynBlockRatioRule> d_rcodeRatioRules;
@@ -394,8 +495,11 @@ private:
   dnsdist_ffi_stat_node_visitor_t d_smtVisitorFFI;
   uint8_t d_v6Mask{128};
   uint8_t d_v4Mask{32};
+  IncrementalState d_incrementalState;
+  std::unique_ptr<ApproximateCounts> d_approximate{nullptr};
   uint8_t d_portMask{0};
   bool d_beQuiet{false};
+  bool d_incremental{false};
 };
 
 class DynBlockMaintenance
@@ -22,6 +22,10 @@
 #pragma once
 
 #include "config.h"
+
+#include <functional>
+#include <optional>
+
 #include "dnsname.hh"
 #include "dnsdist-protocols.hh"
 #include "gettime.hh"
@@ -144,6 +148,7 @@ struct InternalQueryState
   uint16_t origFlags{0}; // 2
   uint16_t cacheFlags{0}; // DNS flags as sent to the backend // 2
   uint16_t udpPayloadSize{0}; // Max UDP payload size from the query // 2
+  uint16_t backendResponder{0}; // index of the responder owning backendFD, and the ID space of this state // 2
   dnsdist::Protocol protocol; // 1
   boost::optional<boost::uuids::uuid> uniqueId{boost::none}; // 17 (placed here to reduce the space lost to padding)
   bool ednsAdded{false};
@@ -154,97 +159,104 @@ struct InternalQueryState
   bool forwardedOverUDP{false};
 };
 
+/* The state of one in-flight UDP query to a backend. IDStateTable owns these. */
 struct IDState
 {
-  IDState()
-  {
-  }
-
+  IDState() = default;
   IDState(const IDState& orig) = delete;
-  IDState(IDState&& rhs) noexcept :
-    internal(std::move(rhs.internal))
-  {
-    inUse.store(rhs.inUse.load());
-    age.store(rhs.age.load());
-  }
+  IDState(IDState&& rhs) = delete;
+  IDState& operator=(const IDState&) = delete;
+  IDState& operator=(IDState&&) = delete;
 
-  IDState& operator=(IDState&& rhs) noexcept
-  {
-    inUse.store(rhs.inUse.load());
-    age.store(rhs.age.load());
-    internal = std::move(rhs.internal);
-    return *this;
-  }
+  static constexpr uint32_t s_free{0};
+  static constexpr uint32_t s_inUse{1};
+  static constexpr uint32_t s_busy{2};
+  static constexpr uint32_t s_statusMask{3};
+  static constexpr uint32_t s_generationShift{2};
 
   bool isInUse() const
   {
-    return inUse;
+    return (d_state.load() & s_statusMask) == s_inUse;
   }
 
-  /* For performance reasons we don't want to use a lock here, but that means
-     we need to be very careful when modifying this value. Modifications happen
-     from:
+  /* Modifications can happen concurrently from:
      - one of the UDP or DoH 'client' threads receiving a query, selecting a backend
-       then picking one of the states associated to this backend (via the idOffset).
-       Most of the time this state should not be in use and usageIndicator is -1, but we
-       might not yet have received a response for the query previously associated to this
-       state, meaning that we will 'reuse' this state and erase the existing state.
-       If we ever receive a response for this state, it will be discarded. This is
-       mostly fine for UDP except that we still need to be careful in order to miss
-       the 'outstanding' counters, which should only be increased when we are picking
-       an empty state, and not when reusing ;
-       For DoH, though, we have dynamically allocated a DOHUnit object that needs to
-       be freed, as well as internal objects internals to libh2o.
+       then picking a slot for the state of that query. Most of the time this slot is
+       free, but we might not yet have received a response for the query previously
+       associated to it, and then we 'reuse' it, erasing the existing state.
+       If we ever receive a response for the erased state, it will be discarded.
+       For DoH, we have dynamically allocated a DOHUnit object that needs to
+       be freed, as well as internal objects internals to libh2o ;
      - one of the UDP receiver threads receiving a response from a backend, picking
        the corresponding state and sending the response to the client ;
      - the 'healthcheck' thread scanning the states to actively discover timeouts,
        mostly to keep some counters like the 'outstanding' one sane.
 
-     We have two flags:
-     - inUse tells us if there currently is a in-flight query whose state is stored
-       in this state
-     - locked tells us whether someone currently owns the state, so no-one else can touch
-       it
+     Instead of a lock, each slot has a single atomic word holding its status (free,
+     in use, or busy, meaning that a thread currently owns it) and a generation counter
+     that changes every time the slot is assigned to a new query. A thread takes
+     ownership of the slot by swapping the word it has seen for the 'busy' status, which
+     fails if anyone else changed the slot in the meantime, even if the slot went back
+     to the same status, since the generation would differ.
   */
-  InternalQueryState internal;
+  std::atomic<uint32_t> d_state{0};
   std::atomic<uint16_t> age{0};
+  InternalQueryState internal;
+};
 
-  class StateGuard
-  {
-  public:
-    StateGuard(IDState& ids) :
-      d_ids(ids)
-    {
-    }
-    ~StateGuard()
-    {
-      d_ids.release();
-    }
-    StateGuard(const StateGuard&) = delete;
-    StateGuard(StateGuard&&) = delete;
-    StateGuard& operator=(const StateGuard&) = delete;
-    StateGuard& operator=(StateGuard&&) = delete;
-
-  private:
-    IDState& d_ids;
-  };
+/* A fixed-size table of the states of in-flight UDP queries to a backend, indexed by
+   the ID of the query sent to the backend. No lock is involved in saving, retrieving
+   or expiring a state. When the table holds fewer than 65536 slots, the bits of the ID
+   that are not needed to identify the slot hold the lowest bits of the slot's generation,
+   so that a late response for a query whose slot has been reused is not matched to the
+   new query. */
+class IDStateTable
+{
+public:
+  IDStateTable() = default;
+  IDStateTable(const IDStateTable&) = delete;
+  IDStateTable(IDStateTable&&) = delete;
+  IDStateTable& operator=(const IDStateTable&) = delete;
+  IDStateTable& operator=(IDStateTable&&) = delete;
 
-  [[nodiscard]] std::optional<StateGuard> acquire()
+  /* Allocates 'slots' (1 to 65536) empty slots. With randomIDs, slots are picked at random
+     and the unused bits of the ID are random as well, otherwise slots are picked in
+     sequence. Not thread-safe, needs to be called before any other method. */
+  void resize(uint32_t slots, bool randomIDs);
+  size_t size() const
   {
-    bool expected = false;
-    if (locked.compare_exchange_strong(expected, true)) {
-      return std::optional<StateGuard>(*this);
-    }
-    return std::nullopt;
+    return d_size;
   }
 
-  void release()
-  {
-    locked.store(false);
-  }
+  /* Stores the state of a new query and returns the ID to use for it. A free slot is
+     looked for, but if none is found after a few attempts an in-flight state is
+     overwritten and its former content moved to 'evicted' */
+  uint16_t save(InternalQueryState&& state, std::optional<InternalQueryState>& evicted);
+  /* Retrieves and removes the state associated to that ID, if any */
+  std::optional<InternalQueryState> get(uint16_t id);
+  /* Puts back a state retrieved by get() for that ID. Returns false, leaving 'state'
+     untouched, if the slot has been assigned to a different query in the meantime */
+  bool restore(uint16_t id, InternalQueryState&& state);
+  /* Ages the in-flight states, removing those that are older than maxAge and passing them
+     to the supplied function. Only the slots in use are visited. */
+  void expire(uint16_t maxAge, const std::function<void(InternalQueryState&)>& expired);
 
-  std::atomic<bool> inUse{false}; // 1
+  static constexpr size_t s_maxAttempts{5};
 
 private:
-  std::atomic<bool> locked{false}; // 1
+  uint32_t pickSlot();
+  uint32_t nextGeneration(uint32_t generation);
+  uint16_t makeID(uint32_t slot, uint32_t generation) const;
+  void markInUse(uint32_t slot);
+  void markFree(uint32_t slot);
+
+  std::unique_ptr<IDState[]> d_slots{nullptr};
+  /* one bit per slot, set while the slot is in use, so that the timeouts can be
+     handled without looking at every slot */
+  std::unique_ptr<std::atomic<uint64_t>[]> d_inUse{nullptr};
+  std::atomic<uint64_t> d_cursor{0};
+  uint32_t d_size{0};
+  uint32_t d_slotBits{0};
+  uint32_t d_generationMask{0};
+  bool d_randomIDs{false};
 };
@@ -0,0 +1,349 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include <boost/noncopyable.hpp>
+
+#include "epoch-reclaimer.hh"
+#include "lock.hh"
+
+namespace dnsdist
+{
+/* A fixed-capacity, open-addressing hash map keyed by a precomputed 32-bit hash,
+   whose lookups (visit()) do not take any lock: values are owned by the map through
+   a pointer, are immutable once inserted and are only freed via the epoch-based
+   reclaimer once no reader can see them anymore.
+   All modifications go through the Writer object, which is protected by a mutex
+   and obtained via write_lock() or try_write_lock().
+   Removed entries leave a tombstone behind, and the table is rebuilt into a fresh
+   one when there are too many of them. */
+template <typename T, typename Deleter = std::default_delete<T>>
+class LockFreeHashMap : public boost::noncopyable
+{
+  struct Slot
+  {
+    std::atomic<T*> d_entry{nullptr};
+    std::atomic<uint32_t> d_key{0};
+    /* set once the slot has been used, it then stays part of the probing chain
+       until the table is rebuilt, even if the entry is removed */
+    std::atomic<bool> d_used{false};
+  };
+
+  struct Table
+  {
+    Table(size_t capacity): d_slots(std::make_unique<Slot[]>(capacity)), d_capacity(capacity)
+    {
+    }
+
+    size_t getIndex(uint32_t key) const
+    {
+      return static_cast<size_t>((static_cast<uint64_t>(key) * d_capacity) >> 32);
+    }
+
+    size_t getNext(size_t idx) const
+    {
+      return ++idx == d_capacity ? 0 : idx;
+    }
+
+    std::unique_ptr<Slot[]> d_slots;
+    const size_t d_capacity;
+  };
+
+public:
+  using value_ptr = std::unique_ptr<T, Deleter>;
+
+  class Writer
+  {
+  public:
+    Writer(LockFreeHashMap& map): d_map(map)
+    {
+    }
+
+    ~Writer()
+    {
+      clear();
+      delete d_map.d_table.load();
+    }
+
+    /* returns the existing value and false if there is already one for that key,
+       nullptr and true if the value has been inserted (and thus moved from),
+       and nullptr and false if the map is full */
+    std::pair<const T*, bool> insert(uint32_t key, value_ptr&& value)
+    {
+      auto* table = d_map.d_table.load(std::memory_order_relaxed);
+      if (table == nullptr || d_size >= d_maxEntries) {
+        return {nullptr, false};
+      }
+
+      Slot* target = nullptr;
+      size_t idx = table->getIndex(key);
+      for (size_t probes = 0; probes < table->d_capacity; probes++, idx = table->getNext(idx)) {
+        auto& slot = table->d_slots[idx];
+        if (!slot.d_used.load(std::memory_order_relaxed)) {
+          if (target == nullptr) {
+            target = &slot;
+          }
+          break;
+        }
+        auto* entry = slot.d_entry.load(std::memory_order_relaxed);
+        if (entry == nullptr) {
+          if (target == nullptr) {
+            target = &slot;
+          }
+          continue;
+        }
+        if (slot.d_key.load(std::memory_order_relaxed) == key) {
+          return {entry, false};
+        }
+      }
+
+      if (target == nullptr) {
+        return {nullptr, false};
+      }
+
+      if (target->d_used.load(std::memory_order_relaxed)) {
+        /* re-using a tombstone */
+        --d_tombstones;
+      }
+      target->d_key.store(key, std::memory_order_release);
+      target->d_entry.store(value.release(), std::memory_order_release);
+      target->d_used.store(true, std::memory_order_release);
+      ++d_size;
+      return {nullptr, true};
+    }
+
+    /* replace the existing value for that key, if any */
+    void replace(uint32_t key, value_ptr&& value)
+    {
+      Slot* slot = findSlot(key);
+      if (slot == nullptr) {
+        return;
+      }
+      auto* old = slot->d_entry.exchange(value.release(), std::memory_order_acq_rel);
+      d_map.d_reclaimer.template retire<T, Deleter>(old);
+      /* a map that never needs to remove anything would otherwise keep
+         the replaced values around forever */
+      if (++d_retiredSinceReclaim >= s_reclaimInterval) {
+        reclaim();
+      }
+    }
+
+    /* remove every entry for which pred(key, value) returns true, stopping after upTo entries */
+    template <typename P>
+    size_t eraseIf(P pred, size_t upTo = std::numeric_limits<size_t>::max())
+    {
+      size_t removed = 0;
+      auto* table = d_map.d_table.load(std::memory_order_relaxed);
+      if (table == nullptr) {
+        return removed;
+      }
+
+      for (size_t idx = 0; removed < upTo && idx < table->d_capacity; idx++) {
+        auto& slot = table->d_slots[idx];
+        auto* entry = slot.d_entry.load(std::memory_order_relaxed);
+        if (entry == nullptr || !pred(slot.d_key.load(std::memory_order_relaxed), *entry)) {
+          continue;
+        }
+        slot.d_entry.store(nullptr, std::memory_order_release);
+        d_map.d_reclaimer.template retire<T, Deleter>(entry);
+        ++d_retiredSinceReclaim;
+        --d_size;
+        ++d_tombstones;
+        ++removed;
+      }
+
+      rebuildIfNeeded();
+      return removed;
+    }
+
+    template <typename F>
+    void forEach(F func) const
+    {
+      const auto* table = d_map.d_table.load(std::memory_order_relaxed);
+      if (table == nullptr) {
+        return;
+      }
+
+      for (size_t idx = 0; idx < table->d_capacity; idx++) {
+        const auto& slot = table->d_slots[idx];
+        const auto* entry = slot.d_entry.load(std::memory_order_relaxed);
+        if (entry != nullptr) {
+          func(slot.d_key.load(std::memory_order_relaxed), *entry);
+        }
+      }
+    }
+
+    void clear()
+    {
+      eraseIf([](uint32_t, const T&) { return true; });
+    }
+
+    /* allocate the table, sized so that the load factor stays
+       below 75% even when maxEntries entries are stored */
+    void reserve(size_t maxEntries)
+    {
+      clear();
+      d_maxEntries = maxEntries;
+      auto* old = d_map.d_table.exchange(new Table(std::max(maxEntries + (maxEntries / 3) + 1, static_cast<size_t>(4))), std::memory_order_acq_rel);
+      if (old != nullptr) {
+        d_map.d_reclaimer.retire(old);
+      }
+      d_tombstones = 0;
+    }
+
+    size_t size() const
+    {
+      return d_size;
+    }
+
+    /* frees the entries and tables no reader can see anymore */
+    size_t reclaim()
+    {
+      d_retiredSinceReclaim = 0;
+      return d_map.d_reclaimer.tryReclaim();
+    }
+
+  private:
+    Slot* findSlot(uint32_t key) const
+    {
+      auto* table = d_map.d_table.load(std::memory_order_relaxed);
+      if (table == nullptr) {
+        return nullptr;
+      }
+
+      size_t idx = table->getIndex(key);
+      for (size_t probes = 0; probes < table->d_capacity; probes++, idx = table->getNext(idx)) {
+        auto& slot = table->d_slots[idx];
+        if (!slot.d_used.load(std::memory_order_relaxed)) {
+          break;
+        }
+        if (slot.d_entry.load(std::memory_order_relaxed) != nullptr && slot.d_key.load(std::memory_order_relaxed) == key) {
+          return &slot;
+        }
+      }
+      return nullptr;
+    }
+
+    void rebuildIfNeeded()
+    {
+      auto* table = d_map.d_table.load(std::memory_order_relaxed);
+      if (table == nullptr || (d_size + d_tombstones) < (table->d_capacity - (table->d_capacity / 8))) {
+        return;
+      }
+
+      /* the entries themselves are moved to the new table, not copied,
+         readers still going through the old one will see the same objects */
+      auto newTable = std::make_unique<Table>(table->d_capacity);
+      for (size_t idx = 0; idx < table->d_capacity; idx++) {
+        const auto& slot = table->d_slots[idx];
+        auto* entry = slot.d_entry.load(std::memory_order_relaxed);
+        if (entry == nullptr) {
+          continue;
+        }
+        auto key = slot.d_key.load(std::memory_order_relaxed);
+        size_t newIdx = newTable->getIndex(key);
+        while (newTable->d_slots[newIdx].d_used.load(std::memory_order_relaxed)) {
+          newIdx = newTable->getNext(newIdx);
+        }
+        auto& newSlot = newTable->d_slots[newIdx];
+        newSlot.d_key.store(key, std::memory_order_relaxed);
+        newSlot.d_entry.store(entry, std::memory_order_relaxed);
+        newSlot.d_used.store(true, std::memory_order_relaxed);
+      }
+
+      d_map.d_table.store(newTable.release(), std::memory_order_release);
+      d_map.d_reclaimer.retire(table);
+      d_tombstones = 0;
+    }
+
+    static constexpr size_t s_reclaimInterval{1024};
+
+    LockFreeHashMap& d_map;
+    size_t d_retiredSinceReclaim{0};
+    size_t d_size{0};
+    size_t d_tombstones{0};
+    size_t d_maxEntries{0};
+  };
+
+  LockFreeHashMap(EpochReclaimer& reclaimer): d_reclaimer(reclaimer), d_writer(*this)
+  {
+  }
+
+  /* call func with the value associated to that key, if any, and return whether it was found.
+     No lock is taken, func should be quick since the value can't be freed until it returns. */
+  template <typename F>
+  bool visit(uint32_t key, F func) const
+  {
+    auto guard = d_reclaimer.read();
+    const auto* table = d_table.load(std::memory_order_acquire);
+    if (table == nullptr) {
+      return false;
+    }
+
+    size_t idx = table->getIndex(key);
+    for (size_t probes = 0; probes < table->d_capacity; probes++, idx = table->getNext(idx)) {
+      const auto& slot = table->d_slots[idx];
+      if (!slot.d_used.load(std::memory_order_acquire)) {
+        return false;
+      }
+      const T* entry = nullptr;
+      uint32_t slotKey = 0;
+      /* a slot is only re-used for a different key after its entry has been removed,
+         so if the entry did not change while we were reading the key, they belong together */
+      while (true) {
+        entry = slot.d_entry.load(std::memory_order_acquire);
+        slotKey = slot.d_key.load(std::memory_order_acquire);
+        if (slot.d_entry.load(std::memory_order_acquire) == entry) {
+          break;
+        }
+      }
+      if (entry != nullptr && slotKey == key) {
+        func(*entry);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  LockGuardedHolder<Writer> write_lock()
+  {
+    return LockGuardedHolder<Writer>(d_writer, d_writeMutex);
+  }
+
+  LockGuardedTryHolder<Writer> try_write_lock()
+  {
+    return LockGuardedTryHolder<Writer>(d_writer, d_writeMutex);
+  }
+
+private:
+  EpochReclaimer& d_reclaimer;
+  std::atomic<Table*> d_table{nullptr};
+  std::mutex d_writeMutex;
+  Writer d_writer;
+};
+}
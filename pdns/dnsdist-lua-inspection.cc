@@ -24,65 +24,100 @@
 #include "dnsdist-dynblocks.hh"
 #include "dnsdist-nghttp2.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-sketch.hh"
 #include "dnsdist-tcp.hh"
 
 #include "statnode.hh"
 
 #ifndef DISABLE_TOP_N_BINDINGS
+/* 0 means that the top-N functions count every entry exactly */
+static size_t s_approximateTopNCapacity{0};
+
+/* Count the keys passed by feeder to the function it gets as parameter, and return them along with
+   their count, highest first. When approximate top-N is enabled only the heaviest keys are tracked,
+   with estimated counts, so the result does not contain every key but the memory usage is bounded.
+   total is set to the exact number of keys that have been counted. */
+template <typename Key, typename Less, typename Hash, typename KeyEqual, typename F>
+static std::vector<std::pair<unsigned int, Key>> getTopCounts(uint64_t top, F feeder, unsigned int& total)
+{
+  std::vector<std::pair<unsigned int, Key>> rcounts;
+  total = 0;
+
+  if (s_approximateTopNCapacity > 0) {
+    dnsdist::HeavyHitters<Key, Hash, KeyEqual> hitters(std::max(s_approximateTopNCapacity, static_cast<size_t>(top)));
+    feeder([&hitters](const Key& key) {
+      hitters.add(key);
+    });
+    total = hitters.getTotal();
+    auto entries = hitters.getTop();
+    rcounts.reserve(entries.size());
+    for (auto& entry : entries) {
+      rcounts.emplace_back(entry.second, std::move(entry.first));
+    }
+    return rcounts;
+  }
+
+  std::map<Key, unsigned int, Less> counts;
+  feeder([&counts, &total](const Key& key) {
+    counts[key]++;
+    total++;
+  });
+
+  rcounts.reserve(counts.size());
+  for (const auto& c : counts) {
+    rcounts.emplace_back(c.second, c.first);
+  }
+
+  sort(rcounts.begin(), rcounts.end(), [](const typename decltype(rcounts)::value_type& a,
+                                          const typename decltype(rcounts)::value_type& b) {
+         return b.first < a.first;
+       });
+
+  return rcounts;
+}
+
 static LuaArray<std::vector<boost::variant<string,double>>> getGenResponses(uint64_t top, boost::optional<int> labels, std::function<bool(const Rings::Response&)> pred)
 {
   setLuaNoSideEffect();
-  map<DNSName, unsigned int> counts;
   unsigned int total=0;
-  {
+  auto rcounts = getTopCounts<DNSName, std::less<DNSName>, std::hash<DNSName>, std::equal_to<DNSName>>(top, [&labels, &pred](const auto& add) {
     for (const auto& shard : g_rings.d_shards) {
-      auto rl = shard->respRing.lock();
+      const auto rl = shard->respRing.snapshot();
       if (!labels) {
-        for(const auto& a : *rl) {
+        for(const auto& a : rl) {
           if(!pred(a))
             continue;
-          counts[a.name]++;
-          total++;
+          add(a.name);
         }
       }
       else {
         unsigned int lab = *labels;
-        for(const auto& a : *rl) {
+        for(const auto& a : rl) {
           if(!pred(a))
             continue;
 
           DNSName temp(a.name);
           temp.trimToLabels(lab);
-          counts[temp]++;
-          total++;
+          add(temp);
         }
       }
     }
-  }
-  //      cout<<"Looked at "<<total<<" responses, "<<counts.size()<<" different ones"<<endl;
-  vector<pair<unsigned int, DNSName>> rcounts;
-  rcounts.reserve(counts.size());
-  for (const auto& c : counts)
-    rcounts.emplace_back(c.second, c.first.makeLowerCase());
-
-  sort(rcounts.begin(), rcounts.end(), [](const decltype(rcounts)::value_type& a,
-                                          const decltype(rcounts)::value_type& b) {
-         return b.first < a.first;
-       });
+  }, total);
 
   LuaArray<vector<boost::variant<string,double>>> ret;
   ret.reserve(std::min(rcounts.size(), static_cast<size_t>(top + 1U)));
   int count = 1;
-  unsigned int rest = 0;
+  unsigned int shown = 0;
   for (const auto& rc : rcounts) {
     if (count == static_cast<int>(top + 1)) {
-      rest+=rc.first;
-    }
-    else {
-      ret.push_back({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+      break;
     }
+    shown += rc.first;
+    ret.push_back({count++, {rc.second.makeLowerCase().toString(), rc.first, 100.0*rc.first/total}});
   }
 
+  /* approximate counts might be over-estimated */
+  unsigned int rest = total > shown ? total - shown : 0;
   if (total > 0) {
     ret.push_back({count, {"Rest", rest, 100.0*rest/total}});
   }
@@ -125,9 +160,9 @@ static void statNodeRespRing(statvisitor_t visitor, uint64_t seconds)
 
   StatNode root;
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->respRing.lock();
+    const auto rl = shard->respRing.snapshot();
 
-    for(const auto& c : *rl) {
+    for(const auto& c : rl) {
       if (now < c.when)
         continue;
 
@@ -149,10 +184,10 @@ static LuaArray<LuaAssociativeTable<std::string>> getRespRing(boost::optional<in
   LuaArray<entry_t> ret;
 
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->respRing.lock();
+    const auto rl = shard->respRing.snapshot();
 
     int count = 1;
-    for (const auto& c : *rl) {
+    for (const auto& c : rl) {
       if (rcode && (rcode.get() != c.dh.rcode)) {
         continue;
       }
@@ -178,8 +213,8 @@ static counts_t exceedRespGen(unsigned int rate, int seconds, std::function<void
   counts.reserve(g_rings.getNumberOfResponseEntries());
 
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->respRing.lock();
-    for(const auto& c : *rl) {
+    const auto rl = shard->respRing.snapshot();
+    for(const auto& c : rl) {
 
       if(seconds && c.when < cutoff)
         continue;
@@ -207,8 +242,8 @@ static counts_t exceedQueryGen(unsigned int rate, int seconds, std::function<voi
   counts.reserve(g_rings.getNumberOfQueryEntries());
 
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->queryRing.lock();
-    for(const auto& c : *rl) {
+    const auto rl = shard->queryRing.snapshot();
+    for(const auto& c : rl) {
       if(seconds && c.when < cutoff)
         continue;
       if(now < c.when)
@@ -250,82 +285,65 @@ void setupLuaInspection(LuaContext& luaCtx)
   luaCtx.writeFunction("topClients", [](boost::optional<uint64_t> top_) {
       setLuaNoSideEffect();
       auto top = top_.get_value_or(10);
-      map<ComboAddress, unsigned int,ComboAddress::addressOnlyLessThan > counts;
       unsigned int total=0;
-      {
+      auto rcounts = getTopCounts<ComboAddress, ComboAddress::addressOnlyLessThan, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual>(top, [](const auto& add) {
         for (const auto& shard : g_rings.d_shards) {
-          auto rl = shard->queryRing.lock();
-          for(const auto& c : *rl) {
-            counts[c.requestor]++;
-            total++;
+          const auto rl = shard->queryRing.snapshot();
+          for(const auto& c : rl) {
+            add(c.requestor);
           }
         }
-      }
-      vector<pair<unsigned int, ComboAddress>> rcounts;
-      rcounts.reserve(counts.size());
-      for(const auto& c : counts)
-        rcounts.emplace_back(c.second, c.first);
+      }, total);
 
-      sort(rcounts.begin(), rcounts.end(), [](const decltype(rcounts)::value_type& a,
-					      const decltype(rcounts)::value_type& b) {
-	     return b.first < a.first;
-	   });
-      unsigned int count=1, rest=0;
+      unsigned int count=1, shown=0;
       boost::format fmt("%4d  %-40s %4d %4.1f%%\n");
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
+	  break;
+	shown+=rc.first;
+	g_outputBuffer += (fmt % (count++) % rc.second.toString() % rc.first % (100.0*rc.first/total)).str();
       }
+      /* approximate counts might be over-estimated */
+      unsigned int rest = total > shown ? total - shown : 0;
       g_outputBuffer += (fmt % (count) % "Rest" % rest % (total > 0 ? 100.0*rest/total : 100.0)).str();
     });
 
   luaCtx.writeFunction("getTopQueries", [](uint64_t top, boost::optional<int> labels) {
       setLuaNoSideEffect();
-      map<DNSName, unsigned int> counts;
       unsigned int total=0;
-      if(!labels) {
-        for (const auto& shard : g_rings.d_shards) {
-          auto rl = shard->queryRing.lock();
-          for(const auto& a : *rl) {
-            counts[a.name]++;
-            total++;
+      auto rcounts = getTopCounts<DNSName, std::less<DNSName>, std::hash<DNSName>, std::equal_to<DNSName>>(top, [&labels](const auto& add) {
+        if(!labels) {
+          for (const auto& shard : g_rings.d_shards) {
+            const auto rl = shard->queryRing.snapshot();
+            for(const auto& a : rl) {
+              add(a.name);
+            }
           }
         }
-      }
-      else {
-	unsigned int lab = *labels;
-        for (const auto& shard : g_rings.d_shards) {
-          auto rl = shard->queryRing.lock();
-          // coverity[auto_causes_copy]
-          for (auto a : *rl) {
-            a.name.trimToLabels(lab);
-            counts[a.name]++;
-            total++;
+        else {
+          unsigned int lab = *labels;
+          for (const auto& shard : g_rings.d_shards) {
+            const auto rl = shard->queryRing.snapshot();
+            // coverity[auto_causes_copy]
+            for (auto a : rl) {
+              a.name.trimToLabels(lab);
+              add(a.name);
+            }
           }
         }
-      }
-      // cout<<"Looked at "<<total<<" queries, "<<counts.size()<<" different ones"<<endl;
-      vector<pair<unsigned int, DNSName>> rcounts;
-      rcounts.reserve(counts.size());
-      for(const auto& c : counts)
-        rcounts.emplace_back(c.second, c.first.makeLowerCase());
-
-      sort(rcounts.begin(), rcounts.end(), [](const decltype(rcounts)::value_type& a,
-					      const decltype(rcounts)::value_type& b) {
-	     return b.first < a.first;
-	   });
+      }, total);
 
       std::unordered_map<unsigned int, vector<boost::variant<string,double>>> ret;
-      unsigned int count=1, rest=0;
+      unsigned int count=1, shown=0;
       for(const auto& rc : rcounts) {
 	if(count==top+1)
-	  rest+=rc.first;
-	else
-	  ret.insert({count++, {rc.second.toString(), rc.first, 100.0*rc.first/total}});
+	  break;
+	shown+=rc.first;
+	ret.insert({count++, {rc.second.makeLowerCase().toString(), rc.first, 100.0*rc.first/total}});
       }
 
+      /* approximate counts might be over-estimated */
+      unsigned int rest = total > shown ? total - shown : 0;
       if (total > 0) {
         ret.insert({count, {"Rest", rest, 100.0*rest/total}});
       }
@@ -337,18 +355,19 @@ void setupLuaInspection(LuaContext& luaCtx)
 
     });
 
+  luaCtx.writeFunction("setApproximateTopN", [](bool approximate, boost::optional<uint64_t> capacity) {
+      s_approximateTopNCapacity = approximate ? capacity.get_value_or(1000) : 0;
+    });
+
   luaCtx.executeCode(R"(function topQueries(top, labels) top = top or 10; for k,v in ipairs(getTopQueries(top,labels)) do show(string.format("%4d  %-40s %4d %4.1f%%",k,v[1],v[2], v[3])) end end)");
 
   luaCtx.writeFunction("getResponseRing", []() {
       setLuaNoSideEffect();
       size_t totalEntries = 0;
-      std::vector<boost::circular_buffer<Rings::Response>> rings;
+      std::vector<std::vector<Rings::Response>> rings;
       rings.reserve(g_rings.getNumberOfShards());
       for (const auto& shard : g_rings.d_shards) {
-        {
-          auto rl = shard->respRing.lock();
-          rings.push_back(*rl);
-        }
+        rings.push_back(shard->respRing.snapshot());
         totalEntries += rings.back().size();
       }
       vector<std::unordered_map<string, boost::variant<string, unsigned int> > > ret;
@@ -443,14 +462,14 @@ void setupLuaInspection(LuaContext& luaCtx)
       rr.reserve(g_rings.getNumberOfResponseEntries());
       for (const auto& shard : g_rings.d_shards) {
         {
-          auto rl = shard->queryRing.lock();
-          for (const auto& entry : *rl) {
+          const auto rl = shard->queryRing.snapshot();
+          for (const auto& entry : rl) {
             qr.push_back(entry);
           }
         }
         {
-          auto rl = shard->respRing.lock();
-          for (const auto& entry : *rl) {
+          const auto rl = shard->respRing.snapshot();
+          for (const auto& entry : rl) {
             rr.push_back(entry);
           }
         }
@@ -567,8 +586,8 @@ void setupLuaInspection(LuaContext& luaCtx)
       unsigned int size=0;
       {
         for (const auto& shard : g_rings.d_shards) {
-          auto rl = shard->respRing.lock();
-          for(const auto& r : *rl) {
+          const auto rl = shard->respRing.snapshot();
+          for(const auto& r : rl) {
             /* skip actively discovered timeouts */
             if (r.usec == std::numeric_limits<unsigned int>::max())
               continue;
@@ -885,6 +904,10 @@ void setupLuaInspection(LuaContext& luaCtx)
     group->apply();
   });
   luaCtx.registerFunction("setQuiet", &DynBlockRulesGroup::setQuiet);
+  luaCtx.registerFunction("setIncrementalMode", &DynBlockRulesGroup::setIncrementalMode);
+  luaCtx.registerFunction<void(std::shared_ptr<DynBlockRulesGroup>::*)(bool, boost::optional<uint64_t>)>("setApproximateMode", [](std::shared_ptr<DynBlockRulesGroup>& group, bool approximate, boost::optional<uint64_t> capacity) {
+    group->setApproximateMode(approximate, capacity.get_value_or(1000));
+  });
   luaCtx.registerFunction("toString", &DynBlockRulesGroup::toString);
 #endif /* DISABLE_DYNBLOCKS */
 }
@@ -52,10 +52,13 @@
 #include "dnsdist-secpoll.hh"
 #include "dnsdist-session-cache.hh"
 #include "dnsdist-tcp-downstream.hh"
+#include "dnsdist-udp-offload.hh"
 #include "dnsdist-web.hh"
+#include "dnsdist-xsk.hh"
 
 #include "base64.hh"
 #include "dolog.hh"
+#include "mplexer.hh"
 #include "sodcrypto.hh"
 #include "threadname.hh"
 
@@ -136,6 +139,27 @@ static void parseLocalBindVars(boost::optional<localbind_t> vars, bool& reusePor
   }
 }
 
+static void parseXskVars(boost::optional<localbind_t>& vars, ClientState& cs)
+{
+  if (!vars || vars->count("xskInterface") == 0) {
+    return;
+  }
+#ifdef HAVE_XSK
+  auto interface = boost::get<std::string>((*vars)["xskInterface"]);
+  uint32_t queues = 1;
+  uint32_t frames = dnsdist::xsk::s_defaultFrameCount;
+  if (vars->count("xskQueues")) {
+    queues = boost::get<int>((*vars)["xskQueues"]);
+  }
+  if (vars->count("xskFrames")) {
+    frames = boost::get<int>((*vars)["xskFrames"]);
+  }
+  cs.d_xsk = std::make_shared<dnsdist::xsk::XskFrontend>(interface, queues, frames);
+#else
+  throw std::runtime_error("AF_XDP (XSK) support is not enabled");
+#endif /* HAVE_XSK */
+}
+
 #if defined(HAVE_DNS_OVER_TLS) || defined(HAVE_DNS_OVER_HTTPS)
 static bool loadTLSCertificateAndKeys(const std::string& context, std::vector<TLSCertKeyPair>& pairs, boost::variant<std::string, std::shared_ptr<TLSCertKeyPair>, LuaArray<std::string>, LuaArray<std::shared_ptr<TLSCertKeyPair>>> certFiles, LuaTypeOrArrayOf<std::string> keyFiles)
 {
@@ -404,6 +428,18 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
                            }
                          }
 
+                         if (vars.count("responderThreads")) {
+                           config.d_numberOfResponderThreads = std::stoul(boost::get<string>(vars["responderThreads"]));
+                           if (config.d_numberOfResponderThreads == 0) {
+                             warnlog("Dismissing invalid number of responder threads '%s', using 1 instead", boost::get<string>(vars["responderThreads"]));
+                             config.d_numberOfResponderThreads = 1;
+                           }
+                           if (config.d_numberOfResponderThreads > config.d_numberOfSockets) {
+                             warnlog("Raising the number of sockets from %d to %d to match the number of responder threads", config.d_numberOfSockets, config.d_numberOfResponderThreads);
+                             config.d_numberOfSockets = config.d_numberOfResponderThreads;
+                           }
+                         }
+
                          if (vars.count("qps")) {
                            config.d_qpsLimit = std::stoi(boost::get<string>(vars["qps"]));
                          }
@@ -861,7 +897,9 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
       }
 
       // only works pre-startup, so no sync necessary
-      g_frontends.push_back(std::make_unique<ClientState>(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+      auto udpCS = std::make_unique<ClientState>(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus);
+      parseXskVars(vars, *udpCS);
+      g_frontends.push_back(std::move(udpCS));
       auto tcpCS = std::make_unique<ClientState>(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus);
       if (tcpListenQueueSize > 0) {
         tcpCS->tcpListenQueueSize = tcpListenQueueSize;
@@ -901,7 +939,9 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
     try {
       ComboAddress loc(addr, 53);
       // only works pre-startup, so no sync necessary
-      g_frontends.push_back(std::make_unique<ClientState>(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus));
+      auto udpCS = std::make_unique<ClientState>(loc, false, reusePort, tcpFastOpenQueueSize, interface, cpus);
+      parseXskVars(vars, *udpCS);
+      g_frontends.push_back(std::move(udpCS));
       auto tcpCS = std::make_unique<ClientState>(loc, true, reusePort, tcpFastOpenQueueSize, interface, cpus);
       if (tcpListenQueueSize > 0) {
         tcpCS->tcpListenQueueSize = tcpListenQueueSize;
@@ -2326,7 +2366,32 @@ static void setupLuaConfig(LuaContext& luaCtx, bool client, bool configCheck)
     g_proxyProtocolMaximumSize = std::max(static_cast<uint64_t>(16), size);
   });
 
+  luaCtx.writeFunction("setPreferredMultiplexer", [](const std::string& name) {
+    if (g_configurationDone) {
+      errlog("setPreferredMultiplexer() cannot be used at runtime!");
+      g_outputBuffer = "setPreferredMultiplexer() cannot be used at runtime!\n";
+      return;
+    }
+    setLuaSideEffect();
+    FDMultiplexer::s_preferredMultiplexer = name;
+  });
+
 #ifndef DISABLE_RECVMMSG
+  luaCtx.writeFunction("setUDPSegmentationOffload", [](bool enabled) {
+    if (g_configurationDone) {
+      errlog("setUDPSegmentationOffload() cannot be used at runtime!");
+      g_outputBuffer = "setUDPSegmentationOffload() cannot be used at runtime!\n";
+      return;
+    }
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) && defined(UDP_GRO) && defined(UDP_SEGMENT)
+    setLuaSideEffect();
+    g_udpSegmentationOffload = enabled;
+#else
+    errlog("UDP segmentation offload support is not available!");
+    g_outputBuffer = "UDP segmentation offload support is not available!\n";
+#endif
+  });
+
   luaCtx.writeFunction("setUDPMultipleMessagesVectorSize", [](uint64_t vSize) {
     if (g_configurationDone) {
       errlog("setUDPMultipleMessagesVectorSize() cannot be used at runtime!");
@@ -49,10 +49,10 @@ void Rings::init()
   for (auto& shard : d_shards) {
     shard = std::make_unique<Shard>();
     if (shouldRecordQueries()) {
-      shard->queryRing.lock()->set_capacity(d_capacity / d_numberOfShards);
+      shard->queryRing.set_capacity(d_capacity / d_numberOfShards);
     }
     if (shouldRecordResponses()) {
-      shard->respRing.lock()->set_capacity(d_capacity / d_numberOfShards);
+      shard->respRing.set_capacity(d_capacity / d_numberOfShards);
     }
   }
 
@@ -70,6 +70,28 @@ void Rings::setNumberOfLockRetries(size_t retries)
   }
 }
 
+DNSName Rings::StoredName::get() const
+{
+  if (d_length == 0) {
+    return DNSName();
+  }
+  return DNSName(d_storage.data(), d_length, 0, false);
+}
+
+Rings::Query Rings::StoredQuery::get() const
+{
+#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
+  return Query{requestor, name.get(), when, dh, size, qtype, protocol, macaddress, hasmac};
+#else
+  return Query{requestor, name.get(), when, dh, size, qtype, protocol};
+#endif
+}
+
+Rings::Response Rings::StoredResponse::get() const
+{
+  return Response{requestor, ds, name.get(), when, dh, usec, size, qtype, protocol};
+}
+
 void Rings::setRecordQueries(bool record)
 {
   d_recordQueries = record;
@@ -84,10 +106,9 @@ size_t Rings::numDistinctRequestors()
 {
   std::set<ComboAddress, ComboAddress::addressOnlyLessThan> s;
   for (const auto& shard : d_shards) {
-    auto rl = shard->queryRing.lock();
-    for (const auto& q : *rl) {
+    shard->queryRing.visit([&s](const StoredQuery& q) {
       s.insert(q.requestor);
-    }
+    });
   }
   return s.size();
 }
@@ -97,20 +118,14 @@ std::unordered_map<int, vector<boost::variant<string,double>>> Rings::getTopBand
   map<ComboAddress, unsigned int, ComboAddress::addressOnlyLessThan> counts;
   uint64_t total=0;
   for (const auto& shard : d_shards) {
-    {
-      auto rl = shard->queryRing.lock();
-      for(const auto& q : *rl) {
-        counts[q.requestor] += q.size;
-        total+=q.size;
-      }
-    }
-    {
-      auto rl = shard->respRing.lock();
-      for(const auto& r : *rl) {
-        counts[r.requestor] += r.size;
-        total+=r.size;
-      }
-    }
+    shard->queryRing.visit([&counts, &total](const StoredQuery& q) {
+      counts[q.requestor] += q.size;
+      total+=q.size;
+    });
+    shard->respRing.visit([&counts, &total](const StoredResponse& r) {
+      counts[r.requestor] += r.size;
+      total+=r.size;
+    });
   }
 
   typedef vector<pair<unsigned int, ComboAddress>> ret_t;
@@ -21,12 +21,20 @@
  */
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
 #include <time.h>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
 
+#include <boost/noncopyable.hpp>
 #include <boost/variant.hpp>
 
-#include "circular_buffer.hh"
 #include "dnsname.hh"
 #include "iputils.hh"
 #include "lock.hh"
@@ -34,6 +42,222 @@
 #include "dnsdist-protocols.hh"
 #include "dnsdist-mac-address.hh"
 
+/* A ring buffer that can be written to without taking any lock, and read concurrently.
+   Entries are converted to a trivially copyable representation (Stored) which is
+   copied word by word into the slots. Every slot has a sequence number
+   derived from the position of the entry it holds, which is odd while the entry
+   is being written, so readers can detect and skip slots that have been modified
+   while they were copying them.
+   Only the first Stored::getInlineSize() bytes of an entry are kept in its slot. When
+   entry.getStoredSize() is larger, the remaining bytes go to a per-slot overflow area,
+   covered by the same sequence number, whose pages are only committed once they have
+   been written to, so that entries with a short name do not pay for the longest ones.
+   Writers claim a position with a single atomic increment, and then the slot itself
+   via a CAS on its sequence number, so concurrent writers are safe as well: if a
+   slot is still being written by a different writer, or already holds a newer entry,
+   which can only happen when the ring wraps around during that write, the entry is
+   dropped instead. */
+template <typename T, typename Stored>
+class LockFreeRing : public boost::noncopyable
+{
+  static_assert(std::is_trivially_copyable<Stored>::value, "The stored type of a LockFreeRing should be trivially copyable");
+  static constexpr size_t s_words = (sizeof(Stored) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+  /* these can't be static members: Stored is often a nested type, whose member functions
+     can't be used in a constant expression until the enclosing class is complete */
+  static constexpr size_t getInlineWords()
+  {
+    return std::min((Stored::getInlineSize() + sizeof(uint64_t) - 1) / sizeof(uint64_t), s_words);
+  }
+  static constexpr size_t getOverflowWords()
+  {
+    return s_words - getInlineWords();
+  }
+  /* a slot is the sequence number followed by the inline words */
+  static constexpr size_t getSlotWords()
+  {
+    return 1 + getInlineWords();
+  }
+
+  struct MemoryDeleter
+  {
+    void operator()(void* memory) const
+    {
+      std::free(memory);
+    }
+  };
+
+public:
+  /* this should only be called at configuration time, before any entry has been inserted */
+  void set_capacity(size_t capacity)
+  {
+    /* a slot whose sequence number is 0 has never been written to, so zero-filled memory
+       holds valid empty slots, and large calloc() allocations are backed by pages that are
+       only committed once an entry has actually been written there */
+    d_slots.reset(nullptr);
+    d_overflows.reset(nullptr);
+    if (capacity > 0) {
+      d_slots.reset(static_cast<uint64_t*>(std::calloc(capacity, getSlotWords() * sizeof(uint64_t))));
+      if (!d_slots) {
+        throw std::bad_alloc();
+      }
+      if (getOverflowWords() > 0) {
+        d_overflows.reset(static_cast<uint64_t*>(std::calloc(capacity, getOverflowWords() * sizeof(uint64_t))));
+        if (!d_overflows) {
+          throw std::bad_alloc();
+        }
+      }
+    }
+    d_capacity = capacity;
+    d_start.store(0);
+    d_head.store(0);
+  }
+
+  size_t capacity() const
+  {
+    return d_capacity;
+  }
+
+  size_t size() const
+  {
+    return std::min(static_cast<size_t>(d_head.load(std::memory_order_relaxed) - d_start.load(std::memory_order_relaxed)), d_capacity);
+  }
+
+  /* returns false if the entry has been dropped, otherwise sets replaced
+     to whether it took the place of an older entry */
+  bool push_back(const Stored& entry, bool& replaced)
+  {
+    if (d_capacity == 0) {
+      return false;
+    }
+
+    const uint64_t pos = d_head.fetch_add(1, std::memory_order_relaxed);
+    const size_t idx = pos % d_capacity;
+    uint64_t* slot = &d_slots[idx * getSlotWords()];
+    uint64_t seq = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    /* the slot should hold an entry older than ours and not be in the middle of a write,
+       otherwise a writer that has been delayed between claiming its position and getting
+       there could overwrite a newer entry */
+    if ((seq & 1) != 0 || seq > pos * 2 || !__atomic_compare_exchange_n(slot, &seq, (pos * 2) + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      return false;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    /* only the words actually used by this entry are copied, whatever is left
+       after them in the slot is not going to be looked at by readers */
+    const size_t used = getUsedWords(entry);
+    std::array<uint64_t, s_words> words;
+    words[used - 1] = 0;
+    memcpy(words.data(), &entry, std::min(used * sizeof(uint64_t), sizeof(entry)));
+    for (size_t word = 0; word < std::min(used, getInlineWords()); word++) {
+      __atomic_store_n(&slot[1 + word], words[word], __ATOMIC_RELAXED);
+    }
+    for (size_t word = getInlineWords(); word < used; word++) {
+      __atomic_store_n(&d_overflows[(idx * getOverflowWords()) + word - getInlineWords()], words[word], __ATOMIC_RELAXED);
+    }
+
+    __atomic_store_n(slot, (pos + 1) * 2, __ATOMIC_RELEASE);
+    replaced = pos >= d_start.load(std::memory_order_relaxed) + d_capacity;
+    return true;
+  }
+
+  /* Call visitor with the stored form of every entry inserted since position,
+     oldest first, then set position to the current end of the ring. Positions
+     only ever increase, so a reader can consume the new entries of a ring in
+     a streaming fashion by keeping position around between calls.
+     Entries that have been overwritten before we got to them are skipped. */
+  template <typename F>
+  void visitSince(uint64_t& position, F visitor) const
+  {
+    const uint64_t head = d_head.load(std::memory_order_acquire);
+    if (d_capacity == 0) {
+      position = head;
+      return;
+    }
+
+    uint64_t pos = std::max(position, d_start.load(std::memory_order_relaxed));
+    if (pos > head) {
+      /* the ring has been re-created */
+      pos = 0;
+    }
+    if (head - pos > d_capacity) {
+      pos = head - d_capacity;
+    }
+
+    typename std::aligned_storage<s_words * sizeof(uint64_t), alignof(Stored)>::type stored;
+    auto* words = reinterpret_cast<uint64_t*>(&stored);
+    const auto* entry = reinterpret_cast<const Stored*>(&stored);
+
+    for (; pos < head; pos++) {
+      const size_t idx = pos % d_capacity;
+      const uint64_t* slot = &d_slots[idx * getSlotWords()];
+      const uint64_t expected = (pos + 1) * 2;
+      if (__atomic_load_n(slot, __ATOMIC_ACQUIRE) != expected) {
+        /* being written, or already overwritten */
+        continue;
+      }
+      for (size_t word = 0; word < getInlineWords(); word++) {
+        words[word] = __atomic_load_n(&slot[1 + word], __ATOMIC_RELAXED);
+      }
+      /* the size might be garbage if the slot is being overwritten, but then we will
+         notice once we check the sequence number again */
+      const size_t used = getUsedWords(*entry);
+      for (size_t word = getInlineWords(); word < used; word++) {
+        words[word] = __atomic_load_n(&d_overflows[(idx * getOverflowWords()) + word - getInlineWords()], __ATOMIC_RELAXED);
+      }
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(slot, __ATOMIC_RELAXED) != expected) {
+        continue;
+      }
+
+      visitor(*entry);
+    }
+
+    position = head;
+  }
+
+  /* Call visitor with the stored form of every entry currently in the ring, oldest first */
+  template <typename F>
+  void visit(F visitor) const
+  {
+    uint64_t position = 0;
+    visitSince(position, visitor);
+  }
+
+  /* return a copy of the entries currently in the ring, oldest first */
+  std::vector<T> snapshot() const
+  {
+    std::vector<T> result;
+    result.reserve(size());
+    visit([&result](const Stored& entry) {
+      result.push_back(entry.get());
+    });
+    return result;
+  }
+
+  void clear()
+  {
+    d_start.store(d_head.load());
+  }
+
+private:
+  static size_t getUsedWords(const Stored& entry)
+  {
+    return std::min((entry.getStoredSize() + sizeof(uint64_t) - 1) / sizeof(uint64_t), s_words);
+  }
+
+  /* slots are not initialized, they live in zero-filled memory instead, see set_capacity().
+     They only hold plain integers, which are accessed atomically via the __atomic builtins,
+     because std::atomic objects would have to be constructed first, touching every page */
+  std::unique_ptr<uint64_t[], MemoryDeleter> d_slots{nullptr};
+  std::unique_ptr<uint64_t[], MemoryDeleter> d_overflows{nullptr};
+  size_t d_capacity{0};
+  /* position of the oldest entry still considered part of the ring, moved by clear() */
+  std::atomic<uint64_t> d_start{0};
+  /* the query and response rings of a shard are written by different threads */
+  alignas(CPU_LEVEL1_DCACHE_LINESIZE) std::atomic<uint64_t> d_head{0};
+};
+
 struct Rings {
   struct Query
   {
@@ -64,13 +288,94 @@ struct Rings {
     dnsdist::Protocol protocol;
   };
 
+  /* a name in wire format, stored inline so that it can be part of a LockFreeRing entry.
+     It has to be the last member of that entry, since only the first s_inlineLength bytes
+     of the name are kept in the ring slot itself, see LockFreeRing */
+  class StoredName
+  {
+  public:
+    static constexpr size_t s_inlineLength{64};
+
+    StoredName(const DNSName& name)
+    {
+      const auto& storage = name.getStorage();
+      d_length = static_cast<uint8_t>(std::min(storage.size(), d_storage.size()));
+      memcpy(d_storage.data(), storage.data(), d_length);
+    }
+
+    /* the number of bytes actually used, from the beginning of the object */
+    size_t getStoredSize() const
+    {
+      return sizeof(d_length) + d_length;
+    }
+
+    std::string_view getWire() const
+    {
+      return std::string_view(d_storage.data(), d_length);
+    }
+
+    DNSName get() const;
+
+  private:
+    uint8_t d_length{0};
+    std::array<char, 255> d_storage;
+  };
+
+  struct StoredQuery
+  {
+    static constexpr size_t getInlineSize()
+    {
+      return offsetof(StoredQuery, name) + sizeof(uint8_t) + StoredName::s_inlineLength;
+    }
+    size_t getStoredSize() const
+    {
+      return offsetof(StoredQuery, name) + name.getStoredSize();
+    }
+    Query get() const;
+
+    ComboAddress requestor;
+    struct timespec when;
+    struct dnsheader dh;
+    uint16_t size;
+    uint16_t qtype;
+    dnsdist::Protocol protocol;
+#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
+    dnsdist::MacAddress macaddress;
+    bool hasmac{false};
+#endif
+    StoredName name;
+  };
+
+  struct StoredResponse
+  {
+    static constexpr size_t getInlineSize()
+    {
+      return offsetof(StoredResponse, name) + sizeof(uint8_t) + StoredName::s_inlineLength;
+    }
+    size_t getStoredSize() const
+    {
+      return offsetof(StoredResponse, name) + name.getStoredSize();
+    }
+    Response get() const;
+
+    ComboAddress requestor;
+    ComboAddress ds;
+    struct timespec when;
+    struct dnsheader dh;
+    unsigned int usec;
+    unsigned int size;
+    uint16_t qtype;
+    dnsdist::Protocol protocol;
+    StoredName name;
+  };
+
   struct Shard
   {
-    LockGuarded<boost::circular_buffer<Query>> queryRing;
-    LockGuarded<boost::circular_buffer<Response>> respRing;
+    LockFreeRing<Query, StoredQuery> queryRing;
+    LockFreeRing<Response, StoredResponse> respRing;
   };
 
-  Rings(size_t capacity=10000, size_t numberOfShards=10, size_t nbLockTries=5, bool keepLockingStats=false): d_blockingQueryInserts(0), d_blockingResponseInserts(0), d_deferredQueryInserts(0), d_deferredResponseInserts(0), d_nbQueryEntries(0), d_nbResponseEntries(0), d_currentShardId(0), d_capacity(capacity), d_numberOfShards(numberOfShards), d_nbLockTries(nbLockTries), d_keepLockingStats(keepLockingStats)
+  Rings(size_t capacity=10000, size_t numberOfShards=10, size_t nbLockTries=5, bool keepLockingStats=false): d_blockingQueryInserts(0), d_blockingResponseInserts(0), d_deferredQueryInserts(0), d_deferredResponseInserts(0), d_nbQueryEntries(0), d_nbResponseEntries(0), d_capacity(capacity), d_numberOfShards(numberOfShards), d_nbLockTries(nbLockTries), d_keepLockingStats(keepLockingStats)
   {
   }
 
@@ -104,74 +409,49 @@ struct Rings {
   void insertQuery(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh, dnsdist::Protocol protocol)
   {
 #if defined(DNSDIST_RINGS_WITH_MACADDRESS)
-    dnsdist::MacAddress macaddress;
-    bool hasmac{false};
-    if (dnsdist::MacAddressesCache::get(requestor, macaddress.data(), macaddress.size()) == 0) {
-      hasmac = true;
+    StoredQuery query{requestor, when, dh, size, qtype, protocol, dnsdist::MacAddress{}, false, name};
+    if (dnsdist::MacAddressesCache::get(requestor, query.macaddress.data(), query.macaddress.size()) == 0) {
+      query.hasmac = true;
     }
-#endif
-    for (size_t idx = 0; idx < d_nbLockTries; idx++) {
-      auto& shard = getOneShard();
-      auto lock = shard->queryRing.try_lock();
-      if (lock.owns_lock()) {
-#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
-        insertQueryLocked(*lock, when, requestor, name, qtype, size, dh, protocol, macaddress, hasmac);
 #else
-        insertQueryLocked(*lock, when, requestor, name, qtype, size, dh, protocol);
+    StoredQuery query{requestor, when, dh, size, qtype, protocol, name};
 #endif
-        return;
-      }
+    bool replaced = false;
+    if (!getOneShard()->queryRing.push_back(query, replaced)) {
       if (d_keepLockingStats) {
         ++d_deferredQueryInserts;
       }
+      return;
     }
-
-    /* out of luck, let's just wait */
-    if (d_keepLockingStats) {
-      ++d_blockingResponseInserts;
+    if (!replaced) {
+      d_nbQueryEntries++;
     }
-    auto& shard = getOneShard();
-    auto lock = shard->queryRing.lock();
-#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
-    insertQueryLocked(*lock, when, requestor, name, qtype, size, dh, protocol, macaddress, hasmac);
-#else
-    insertQueryLocked(*lock, when, requestor, name, qtype, size, dh, protocol);
-#endif
   }
 
   void insertResponse(const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend, dnsdist::Protocol protocol)
   {
-    for (size_t idx = 0; idx < d_nbLockTries; idx++) {
-      auto& shard = getOneShard();
-      auto lock = shard->respRing.try_lock();
-      if (lock.owns_lock()) {
-        insertResponseLocked(*lock, when, requestor, name, qtype, usec, size, dh, backend, protocol);
-        return;
-      }
+    StoredResponse response{requestor, backend, when, dh, usec, size, qtype, protocol, name};
+    bool replaced = false;
+    if (!getOneShard()->respRing.push_back(response, replaced)) {
       if (d_keepLockingStats) {
         ++d_deferredResponseInserts;
       }
+      return;
     }
-
-    /* out of luck, let's just wait */
-    if (d_keepLockingStats) {
-      ++d_blockingResponseInserts;
+    if (!replaced) {
+      d_nbResponseEntries++;
     }
-    auto& shard = getOneShard();
-    auto lock = shard->respRing.lock();
-    insertResponseLocked(*lock, when, requestor, name, qtype, usec, size, dh, backend, protocol);
   }
 
   void clear()
   {
     for (auto& shard : d_shards) {
-      shard->queryRing.lock()->clear();
-      shard->respRing.lock()->clear();
+      shard->queryRing.clear();
+      shard->respRing.clear();
     }
 
     d_nbQueryEntries.store(0);
     d_nbResponseEntries.store(0);
-    d_currentShardId.store(0);
     d_blockingQueryInserts.store(0);
     d_blockingResponseInserts.store(0);
     d_deferredQueryInserts.store(0);
@@ -208,7 +488,11 @@ struct Rings {
 private:
   size_t getShardId()
   {
-    return (d_currentShardId++ % d_numberOfShards);
+    /* every thread cycles over the shards on its own, starting from a different one,
+       so that inserting does not require updating a counter shared by all threads */
+    static std::atomic<size_t> s_nextThreadShard{0};
+    thread_local size_t t_shardId = s_nextThreadShard++;
+    return (t_shardId++ % d_numberOfShards);
   }
 
   std::unique_ptr<Shard>& getOneShard()
@@ -216,41 +500,13 @@ private:
     return d_shards[getShardId()];
   }
 
-#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
-  void insertQueryLocked(boost::circular_buffer<Query>& ring, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh, dnsdist::Protocol protocol, const dnsdist::MacAddress& macaddress, const bool hasmac)
-#else
-  void insertQueryLocked(boost::circular_buffer<Query>& ring, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, uint16_t size, const struct dnsheader& dh, dnsdist::Protocol protocol)
-#endif
-  {
-    if (!ring.full()) {
-      d_nbQueryEntries++;
-    }
-#if defined(DNSDIST_RINGS_WITH_MACADDRESS)
-    Rings::Query query{requestor, name, when, dh, size, qtype, protocol, dnsdist::MacAddress{""}, hasmac};
-    if (hasmac) {
-      memcpy(query.macaddress.data(), macaddress.data(), macaddress.size());
-    }
-    ring.push_back(std::move(query));
-#else
-    ring.push_back({requestor, name, when, dh, size, qtype, protocol});
-#endif
-  }
-
-  void insertResponseLocked(boost::circular_buffer<Response>& ring, const struct timespec& when, const ComboAddress& requestor, const DNSName& name, uint16_t qtype, unsigned int usec, unsigned int size, const struct dnsheader& dh, const ComboAddress& backend, dnsdist::Protocol protocol)
-  {
-    if (!ring.full()) {
-      d_nbResponseEntries++;
-    }
-    ring.push_back({requestor, backend, name, when, dh, usec, size, qtype, protocol});
-  }
-
   std::atomic<size_t> d_nbQueryEntries;
   std::atomic<size_t> d_nbResponseEntries;
-  std::atomic<size_t> d_currentShardId;
   std::atomic<bool> d_initialized{false};
 
   size_t d_capacity;
   size_t d_numberOfShards;
+  /* no longer used since inserting does not take a lock, kept for compatibility */
   size_t d_nbLockTries = 5;
   bool d_keepLockingStats{false};
   bool d_recordQueries{true};
@@ -60,10 +60,13 @@
 #include "dnsdist-proxy-protocol.hh"
 #include "dnsdist-random.hh"
 #include "dnsdist-rings.hh"
+#include "dnsdist-rule-chain.hh"
 #include "dnsdist-secpoll.hh"
 #include "dnsdist-tcp.hh"
+#include "dnsdist-udp-offload.hh"
 #include "dnsdist-web.hh"
 #include "dnsdist-xpf.hh"
+#include "dnsdist-xsk.hh"
 
 #include "base64.hh"
 #include "capabilities.hh"
@@ -332,9 +335,10 @@ bool responseContentMatches(const PacketBuffer& response, const DNSName& qname,
   }
 
   uint16_t rqtype, rqclass;
-  DNSName rqname;
+  /* every response goes through here, so check the qname in place instead of copying it */
+  DNSNameView rqname;
   try {
-    rqname = DNSName(reinterpret_cast<const char*>(response.data()), response.size(), sizeof(dnsheader), false, &rqtype, &rqclass, &qnameWireLength);
+    rqname = DNSNameView(reinterpret_cast<const char*>(response.data()), response.size(), sizeof(dnsheader), &rqtype, &rqclass, &qnameWireLength);
   }
   catch (const std::exception& e) {
     if (remote && response.size() > 0 && static_cast<size_t>(response.size()) > sizeof(dnsheader)) {
@@ -640,7 +644,33 @@ void handleResponseSent(const DNSName& qname, const QType& qtype, double udiff,
   doLatencyStats(incomingProtocol, udiff);
 }
 
-static void handleResponseForUDPClient(InternalQueryState& ids, PacketBuffer& response, const std::vector<DNSDistResponseRuleAction>& respRuleActions, const std::vector<DNSDistResponseRuleAction>& cacheInsertedRespRuleActions, const std::shared_ptr<DownstreamState>& ds, bool selfGenerated)
+/* a response that is not sent right away but as part of a batch: where to send it, and
+   what is needed to account for it once it has actually been sent */
+struct QueuedUDPResponse
+{
+  ComboAddress dest;
+  ComboAddress remote;
+  ComboAddress origRemote;
+  DNSName qname;
+  StopWatch queryRealTime;
+  dnsheader cleartextDH;
+  ClientState* cs{nullptr};
+  uint16_t qtype{0};
+  dnsdist::Protocol protocol;
+  int fd{-1};
+};
+
+static void handleQueuedUDPResponseSent(QueuedUDPResponse& queued, const PacketBuffer& response, const std::shared_ptr<DownstreamState>& ds)
+{
+  ++g_stats.responses;
+  ++queued.cs->responses;
+
+  double udiff = queued.queryRealTime.udiff();
+  vinfolog("Got answer from %s, relayed to %s (UDP), took %f usec", ds->d_config.remote.toStringWithPort(), queued.origRemote.toStringWithPort(), udiff);
+  handleResponseSent(queued.qname, QType(queued.qtype), udiff, queued.origRemote, ds->d_config.remote, response.size(), queued.cleartextDH, ds->getProtocol(), queued.protocol);
+}
+
+static void handleResponseForUDPClient(InternalQueryState& ids, PacketBuffer& response, const std::vector<DNSDistResponseRuleAction>& respRuleActions, const std::vector<DNSDistResponseRuleAction>& cacheInsertedRespRuleActions, const std::shared_ptr<DownstreamState>& ds, bool selfGenerated, QueuedUDPResponse* queued = nullptr)
 {
   DNSResponse dr(ids, response, ds);
 
@@ -662,6 +692,21 @@ static void handleResponseForUDPClient(InternalQueryState& ids, PacketBuffer& re
     return;
   }
 
+  if (queued != nullptr && !selfGenerated && ids.cs && !ids.cs->muted && dr.ids.delayMsec == 0) {
+    /* accounted for once the batch has been sent, see handleQueuedUDPResponseSent() */
+    queued->fd = ids.cs->udpFD;
+    queued->dest = ids.hopLocal;
+    queued->remote = ids.hopRemote;
+    queued->origRemote = ids.origRemote;
+    queued->qname = std::move(ids.qname);
+    queued->queryRealTime = ids.queryRealTime;
+    queued->cleartextDH = cleartextDH;
+    queued->cs = ids.cs;
+    queued->qtype = ids.qtype;
+    queued->protocol = ids.protocol;
+    return;
+  }
+
   ++g_stats.responses;
   if (ids.cs) {
     ++ids.cs->responses;
@@ -669,8 +714,6 @@ static void handleResponseForUDPClient(InternalQueryState& ids, PacketBuffer& re
 
   bool muted = true;
   if (ids.cs && !ids.cs->muted) {
-    ComboAddress empty;
-    empty.sin4.sin_family = 0;
     sendUDPResponse(ids.cs->udpFD, response, dr.ids.delayMsec, ids.hopLocal, ids.hopRemote);
     muted = false;
   }
@@ -691,11 +734,189 @@ static void handleResponseForUDPClient(InternalQueryState& ids, PacketBuffer& re
   }
 }
 
+static void handleResponseFromBackend(const std::shared_ptr<DownstreamState>& dss, size_t responder, int fd, PacketBuffer& response, uint16_t& queryId, const std::vector<DNSDistResponseRuleAction>& respRuleActions, const std::vector<DNSDistResponseRuleAction>& cacheInsertedRespRuleActions, QueuedUDPResponse* queued)
+{
+  dnsheader* dh = reinterpret_cast<struct dnsheader*>(response.data());
+  queryId = dh->id;
+
+  auto ids = dss->getState(responder, queryId);
+  if (!ids) {
+    return;
+  }
+
+  unsigned int qnameWireLength = 0;
+  if (fd != ids->backendFD || !responseContentMatches(response, ids->qname, ids->qtype, ids->qclass, dss, qnameWireLength)) {
+    dss->restoreState(queryId, std::move(*ids));
+    return;
+  }
+
+  auto du = std::move(ids->du);
+
+  dh->id = ids->origID;
+  ++dss->responses;
+
+  double udiff = ids->queryRealTime.udiff();
+  // do that _before_ the processing, otherwise it's not fair to the backend
+  dss->updateLatency(udiff);
+  dss->reportResponse(dh->rcode);
+
+  /* don't call processResponse for DOH */
+  if (du) {
+#ifdef HAVE_DNS_OVER_HTTPS
+    // DoH query, we cannot touch du after that
+    handleUDPResponseForDoH(std::move(du), std::move(response), std::move(*ids));
+#endif
+    return;
+  }
+
+  handleResponseForUDPClient(*ids, response, respRuleActions, cacheInsertedRespRuleActions, dss, false, queued);
+}
+
+#ifndef DISABLE_RECVMMSG
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+/* reads as many responses as possible from a backend socket with a single recvmmsg() call,
+   then sends the answers back to the clients with one sendmmsg() call per frontend socket */
+static void multipleMessagesResponderThread(const std::shared_ptr<DownstreamState>& dss, size_t responder)
+{
+  struct MMResponse
+  {
+    PacketBuffer packet;
+    ComboAddress from;
+    QueuedUDPResponse queued;
+    struct iovec iov;
+    /* used to set the source address of the response sent to the client */
+    cmsgbuf_aligned cbuf;
+  };
+  const size_t vectSize = g_udpVectorSize;
+
+  if (vectSize > std::numeric_limits<uint16_t>::max()) {
+    throw std::runtime_error("The value of setUDPMultipleMessagesVectorSize is too high, the maximum value is " + std::to_string(std::numeric_limits<uint16_t>::max()));
+  }
+
+  auto localRespRuleActions = g_respruleactions.getLocal();
+  auto localCacheInsertedRespRuleActions = g_cacheInsertedRespRuleActions.getLocal();
+  const size_t initialBufferSize = getInitialUDPPacketBufferSize();
+  auto recvData = std::make_unique<MMResponse[]>(vectSize);
+  auto msgVec = std::make_unique<struct mmsghdr[]>(vectSize);
+  auto outMsgVec = std::make_unique<struct mmsghdr[]>(vectSize);
+  /* index of the responses to send, ordered by frontend socket */
+  std::vector<std::pair<int, size_t>> toSend;
+  toSend.reserve(vectSize);
+  /* responses sent to the same client can be coalesced */
+  const bool gso = g_udpSegmentationOffload && dnsdist::udp::isGSOSupported();
+  dnsdist::udp::GSOCoalescer coalescer;
+  uint16_t queryId = 0;
+  std::vector<int> sockets;
+  sockets.reserve(dss->sockets.size());
+
+  for (size_t idx = 0; idx < vectSize; idx++) {
+    recvData[idx].from.sin4.sin_family = dss->d_config.remote.sin4.sin_family;
+  }
+
+  for (;;) {
+    try {
+      dss->pickSocketsReadyForReceiving(responder, sockets);
+      if (dss->isStopped()) {
+        break;
+      }
+
+      for (const auto& fd : sockets) {
+        /* the buffers might have been moved (DoH) or resized (response rules) during the last round */
+        for (size_t idx = 0; idx < vectSize; idx++) {
+          recvData[idx].packet.resize(initialBufferSize);
+          recvData[idx].queued.fd = -1;
+          fillMSGHdr(&msgVec[idx].msg_hdr, &recvData[idx].iov, nullptr, 0, reinterpret_cast<char*>(recvData[idx].packet.data()), recvData[idx].packet.size(), &recvData[idx].from);
+        }
+
+        /* block until we have at least one response ready, but get as many as possible */
+        int msgsGot = recvmmsg(fd, msgVec.get(), vectSize, MSG_WAITFORONE, nullptr);
+        if (msgsGot <= 0 || dss->isStopped()) {
+          if (dss->isStopped()) {
+            break;
+          }
+          continue;
+        }
+
+        toSend.clear();
+        for (int msgIdx = 0; msgIdx < msgsGot; msgIdx++) {
+          auto& data = recvData[msgIdx];
+          const size_t got = msgVec[msgIdx].msg_len;
+          if (got < sizeof(dnsheader)) {
+            continue;
+          }
+
+          data.packet.resize(got);
+          try {
+            handleResponseFromBackend(dss, responder, fd, data.packet, queryId, *localRespRuleActions, *localCacheInsertedRespRuleActions, &data.queued);
+          }
+          catch (const std::exception& e) {
+            vinfolog("Got an error in UDP responder thread while parsing a response from %s, id %d: %s", dss->d_config.remote.toStringWithPort(), queryId, e.what());
+            continue;
+          }
+
+          if (data.queued.fd != -1) {
+            toSend.emplace_back(data.queued.fd, msgIdx);
+          }
+        }
+
+        std::stable_sort(toSend.begin(), toSend.end(), [](const std::pair<int, size_t>& a, const std::pair<int, size_t>& b) { return a.first < b.first; });
+        size_t pos = 0;
+        while (pos < toSend.size()) {
+          const int clientFD = toSend.at(pos).first;
+          const size_t firstToSend = pos;
+          unsigned int msgsToSend = 0;
+          for (; pos < toSend.size() && toSend.at(pos).first == clientFD; ++pos) {
+            auto& data = recvData[toSend.at(pos).second];
+            auto& outMsg = outMsgVec[msgsToSend];
+            outMsg.msg_len = 0;
+            fillMSGHdr(&outMsg.msg_hdr, &data.iov, nullptr, 0, reinterpret_cast<char*>(data.packet.data()), data.packet.size(), &data.queued.remote);
+            if (data.queued.dest.sin4.sin_family != 0) {
+              addCMsgSrcAddr(&outMsg.msg_hdr, &data.cbuf, &data.queued.dest, 0);
+            }
+            ++msgsToSend;
+          }
+
+          struct mmsghdr* toSendMsgs = outMsgVec.get();
+          ClientState* cs = recvData[toSend.at(firstToSend).second].queued.cs;
+          if (gso && !cs->d_udpGSOFailed) {
+            std::tie(toSendMsgs, msgsToSend) = coalescer.coalesce(outMsgVec.get(), msgsToSend);
+          }
+
+          const bool segmentationWorked = dnsdist::udp::sendMessages(clientFD, toSendMsgs, msgsToSend, [&](size_t index, int error) {
+            auto& data = recvData[toSend.at(firstToSend + index).second];
+            if (error != 0) {
+              vinfolog("Error sending response to %s: %s", data.queued.remote.toStringWithPort(), stringerror(error));
+            }
+            /* accounted for even if it could not be sent, like sendUDPResponse() does */
+            handleQueuedUDPResponseSent(data.queued, data.packet, dss);
+          });
+          if (!segmentationWorked && !cs->d_udpGSOFailed.exchange(true)) {
+            warnlog("Sending coalesced UDP responses from %s failed, disabling UDP segmentation offload on that frontend", cs->local.toStringWithPort());
+          }
+        }
+      }
+    }
+    catch (const std::exception& e) {
+      vinfolog("Got an error in UDP responder thread while handling responses from %s: %s", dss->d_config.remote.toStringWithPort(), e.what());
+    }
+  }
+}
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+#endif /* DISABLE_RECVMMSG */
+
 // listens on a dedicated socket, lobs answers from downstream servers to original requestors
-void responderThread(std::shared_ptr<DownstreamState> dss)
+void responderThread(std::shared_ptr<DownstreamState> dss, size_t responder)
 {
   try {
   setThreadName("dnsdist/respond");
+#ifndef DISABLE_RECVMMSG
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+  if (g_udpVectorSize > 1) {
+    multipleMessagesResponderThread(dss, responder);
+    return;
+  }
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+#endif /* DISABLE_RECVMMSG */
   auto localRespRuleActions = g_respruleactions.getLocal();
   auto localCacheInsertedRespRuleActions = g_cacheInsertedRespRuleActions.getLocal();
   const size_t initialBufferSize = getInitialUDPPacketBufferSize();
@@ -706,7 +927,7 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
 
   for(;;) {
     try {
-      dss->pickSocketsReadyForReceiving(sockets);
+      dss->pickSocketsReadyForReceiving(responder, sockets);
       if (dss->isStopped()) {
         break;
       }
@@ -724,40 +945,7 @@ void responderThread(std::shared_ptr<DownstreamState> dss)
         }
 
         response.resize(static_cast<size_t>(got));
-        dnsheader* dh = reinterpret_cast<struct dnsheader*>(response.data());
-        queryId = dh->id;
-
-        auto ids = dss->getState(queryId);
-        if (!ids) {
-          continue;
-        }
-
-        unsigned int qnameWireLength = 0;
-        if (fd != ids->backendFD || !responseContentMatches(response, ids->qname, ids->qtype, ids->qclass, dss, qnameWireLength)) {
-          dss->restoreState(queryId, std::move(*ids));
-          continue;
-        }
-
-        auto du = std::move(ids->du);
-
-        dh->id = ids->origID;
-        ++dss->responses;
-
-        double udiff = ids->queryRealTime.udiff();
-        // do that _before_ the processing, otherwise it's not fair to the backend
-        dss->latencyUsec = (127.0 * dss->latencyUsec / 128.0) + udiff / 128.0;
-        dss->reportResponse(dh->rcode);
-
-        /* don't call processResponse for DOH */
-        if (du) {
-#ifdef HAVE_DNS_OVER_HTTPS
-          // DoH query, we cannot touch du after that
-          handleUDPResponseForDoH(std::move(du), std::move(response), std::move(*ids));
-#endif
-          continue;
-        }
-
-        handleResponseForUDPClient(*ids, response, *localRespRuleActions, *localCacheInsertedRespRuleActions, dss, false);
+        handleResponseFromBackend(dss, responder, fd, response, queryId, *localRespRuleActions, *localCacheInsertedRespRuleActions, nullptr);
       }
     }
     catch (const std::exception& e) {
@@ -1055,8 +1243,10 @@ static bool applyRulesToQuery(LocalHolders& holders, DNSQuestion& dq, const stru
   DNSAction::Action action=DNSAction::Action::None;
   string ruleresult;
   bool drop = false;
-  for(const auto& lr : *holders.ruleactions) {
-    if(lr.d_rule->matches(&dq)) {
+  const auto& chain = holders.compiledRuleactions.get(holders.ruleactions);
+  const auto leaves = chain.getMatchingLeaves(dq);
+  for (const auto& lr : chain.getEntries()) {
+    if (chain.matches(lr, dq, leaves)) {
       lr.d_rule->d_matches++;
       action=(*lr.d_action)(&dq, &ruleresult);
       if (processRulesResult(action, dq, ruleresult, drop)) {
@@ -1494,8 +1684,9 @@ bool assignOutgoingUDPQueryToBackend(std::shared_ptr<DownstreamState>& ds, uint1
   }
 
   try {
-    int fd = ds->pickSocketForSending();
+    auto [fd, responder] = ds->pickSocketForSending();
     dq.ids.backendFD = fd;
+    dq.ids.backendResponder = responder;
     dq.ids.origID = queryID;
     dq.ids.forwardedOverUDP = true;
 
@@ -1516,7 +1707,7 @@ bool assignOutgoingUDPQueryToBackend(std::shared_ptr<DownstreamState>& ds, uint1
     if (failed) {
       /* clear up the state. In the very unlikely event it was reused
          in the meantime, so be it. */
-      auto cleared = ds->getState(idOffset);
+      auto cleared = ds->getState(responder, idOffset);
       if (cleared) {
         dq.ids.du = std::move(cleared->du);
         if (dq.ids.du) {
@@ -1535,6 +1726,89 @@ bool assignOutgoingUDPQueryToBackend(std::shared_ptr<DownstreamState>& ds, uint1
   return true;
 }
 
+enum class UDPQueryOutcome : uint8_t
+{
+  Done, /* dropped, or passed to a backend */
+  SendResponse, /* 'query' now holds a response generated before the rules were applied */
+  SendAnswer /* 'query' now holds the answer selected by the rules or found in the cache */
+};
+
+/* The part of the processing of a UDP query shared by the regular and AF_XDP frontends, once the query
+   has been accepted and the proxy protocol payload, if any, removed. Sending the response, if any, is
+   left to the caller. */
+static UDPQueryOutcome processAcceptedUDPQuery(ClientState& cs, LocalHolders& holders, InternalQueryState& ids, PacketBuffer& query, std::vector<ProxyProtocolValue>& proxyProtocolValues, ComboAddress& dest, uint16_t& queryId)
+{
+  ids.queryRealTime.start();
+
+  auto dnsCryptResponse = checkDNSCryptQuery(cs, query, ids.dnsCryptQuery, ids.queryRealTime.d_start.tv_sec, false);
+  if (dnsCryptResponse) {
+    return UDPQueryOutcome::SendResponse;
+  }
+
+  {
+    /* this pointer will be invalidated the second the buffer is resized, don't hold onto it! */
+    struct dnsheader* dh = reinterpret_cast<struct dnsheader*>(query.data());
+    queryId = ntohs(dh->id);
+
+    if (!checkQueryHeaders(dh, cs)) {
+      return UDPQueryOutcome::Done;
+    }
+
+    if (dh->qdcount == 0) {
+      dh->rcode = RCode::NotImp;
+      dh->qr = true;
+      return UDPQueryOutcome::SendResponse;
+    }
+  }
+
+  ids.qname = DNSNameView(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), &ids.qtype, &ids.qclass).toDNSName();
+  if (ids.origDest.sin4.sin_family == 0) {
+    ids.origDest = cs.local;
+  }
+  if (ids.dnsCryptQuery) {
+    ids.protocol = dnsdist::Protocol::DNSCryptUDP;
+  }
+  DNSQuestion dq(ids, query);
+  const uint16_t* flags = getFlagsFromDNSHeader(dq.getHeader());
+  ids.origFlags = *flags;
+
+  if (!proxyProtocolValues.empty()) {
+    dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>(std::move(proxyProtocolValues));
+  }
+
+  std::shared_ptr<DownstreamState> ss{nullptr};
+  auto result = processQuery(dq, cs, holders, ss);
+
+  if (result == ProcessQueryResult::SendAnswer) {
+    return UDPQueryOutcome::SendAnswer;
+  }
+
+  if (result != ProcessQueryResult::PassToBackend || ss == nullptr) {
+    return UDPQueryOutcome::Done;
+  }
+
+  // the buffer might have been invalidated by now (resized)
+  struct dnsheader* dh = dq.getHeader();
+  if (ss->isTCPOnly()) {
+    std::string proxyProtocolPayload;
+    /* we need to do this _before_ creating the cross protocol query because
+       after that the buffer will have been moved */
+    if (ss->d_config.useProxyProtocol) {
+      proxyProtocolPayload = getProxyProtocolPayload(dq);
+    }
+
+    ids.origID = dh->id;
+    auto cpq = std::make_unique<UDPCrossProtocolQuery>(std::move(query), std::move(ids), ss);
+    cpq->query.d_proxyProtocolPayload = std::move(proxyProtocolPayload);
+
+    ss->passCrossProtocolQuery(std::move(cpq));
+    return UDPQueryOutcome::Done;
+  }
+
+  assignOutgoingUDPQueryToBackend(ss, dh->id, dq, query, dest);
+  return UDPQueryOutcome::Done;
+}
+
 static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct msghdr* msgh, const ComboAddress& remote, ComboAddress& dest, PacketBuffer& query, struct mmsghdr* responsesVect, unsigned int* queuedResponses, struct iovec* respIOV, cmsgbuf_aligned* respCBuf)
 {
   assert(responsesVect == nullptr || (queuedResponses != nullptr && respIOV != nullptr && respCBuf != nullptr));
@@ -1560,98 +1834,136 @@ static void processUDPQuery(ClientState& cs, LocalHolders& holders, const struct
       return;
     }
 
-    ids.queryRealTime.start();
-
-    auto dnsCryptResponse = checkDNSCryptQuery(cs, query, ids.dnsCryptQuery, ids.queryRealTime.d_start.tv_sec, false);
-    if (dnsCryptResponse) {
+    auto outcome = processAcceptedUDPQuery(cs, holders, ids, query, proxyProtocolValues, dest, queryId);
+    if (outcome == UDPQueryOutcome::SendResponse) {
       sendUDPResponse(cs.udpFD, query, 0, dest, remote);
       return;
     }
 
-    {
-      /* this pointer will be invalidated the second the buffer is resized, don't hold onto it! */
-      struct dnsheader* dh = reinterpret_cast<struct dnsheader*>(query.data());
-      queryId = ntohs(dh->id);
-
-      if (!checkQueryHeaders(dh, cs)) {
+    if (outcome == UDPQueryOutcome::SendAnswer) {
+#ifndef DISABLE_RECVMMSG
+#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
+      if (ids.delayMsec == 0 && responsesVect != nullptr) {
+        queueResponse(cs, query, dest, remote, responsesVect[*queuedResponses], respIOV, respCBuf);
+        (*queuedResponses)++;
         return;
       }
+#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
+#endif /* DISABLE_RECVMMSG */
+      /* we use dest, always, because we don't want to use the listening address to send a response since it could be 0.0.0.0 */
+      sendUDPResponse(cs.udpFD, query, ids.delayMsec, dest, remote);
 
-      if (dh->qdcount == 0) {
-        dh->rcode = RCode::NotImp;
-        dh->qr = true;
-        sendUDPResponse(cs.udpFD, query, 0, dest, remote);
-        return;
-      }
+      handleResponseSent(ids, 0., remote, ComboAddress(), query.size(), *reinterpret_cast<const struct dnsheader*>(query.data()), dnsdist::Protocol::DoUDP);
     }
+  }
+  catch(const std::exception& e){
+    vinfolog("Got an error in UDP question thread while parsing a query from %s, id %d: %s", ids.origRemote.toStringWithPort(), queryId, e.what());
+  }
+}
 
-    ids.qname = DNSName(reinterpret_cast<const char*>(query.data()), query.size(), sizeof(dnsheader), false, &ids.qtype, &ids.qclass);
-    if (ids.origDest.sin4.sin_family == 0) {
-      ids.origDest = cs.local;
-    }
-    if (ids.dnsCryptQuery) {
-      ids.protocol = dnsdist::Protocol::DNSCryptUDP;
+#ifdef HAVE_XSK
+/* Handles a query received over an AF_XDP socket. Returns true if a response has been written
+   into the frame of the query, which then needs to be sent back, and false if the frame can be
+   released. Queries passed to a backend get their response over the regular UDP socket of the frontend. */
+static bool processXskQuery(ClientState& cs, LocalHolders& holders, dnsdist::xsk::XskPacket& packet, size_t maxIncomingPacketSize)
+{
+  uint16_t queryId = 0;
+  const auto& remote = packet.getFrom();
+  auto dest = packet.getTo();
+  InternalQueryState ids;
+  ids.cs = &cs;
+  ids.origRemote = remote;
+  ids.hopRemote = remote;
+  ids.origDest = dest;
+  ids.hopLocal = dest;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+
+  try {
+    PacketBuffer query = packet.getPayload();
+    if (query.size() < sizeof(struct dnsheader) || query.size() > maxIncomingPacketSize) {
+      ++g_stats.nonCompliantQueries;
+      ++cs.nonCompliantQueries;
+      return false;
     }
-    DNSQuestion dq(ids, query);
-    const uint16_t* flags = getFlagsFromDNSHeader(dq.getHeader());
-    ids.origFlags = *flags;
 
-    if (!proxyProtocolValues.empty()) {
-      dq.proxyProtocolValues = make_unique<std::vector<ProxyProtocolValue>>(std::move(proxyProtocolValues));
+    bool expectProxyProtocol = expectProxyProtocolFrom(remote);
+    if (!holders.acl->match(remote) && !expectProxyProtocol) {
+      vinfolog("Query from %s dropped because of ACL", remote.toStringWithPort());
+      ++g_stats.aclDrops;
+      return false;
     }
 
-    std::shared_ptr<DownstreamState> ss{nullptr};
-    auto result = processQuery(dq, cs, holders, ss);
+    cs.queries++;
+    ++g_stats.queries;
 
-    if (result == ProcessQueryResult::Drop) {
-      return;
+    std::vector<ProxyProtocolValue> proxyProtocolValues;
+    if (expectProxyProtocol && !handleProxyProtocol(remote, false, *holders.acl, query, ids.origRemote, ids.origDest, proxyProtocolValues)) {
+      return false;
     }
 
-    // the buffer might have been invalidated by now (resized)
-    struct dnsheader* dh = dq.getHeader();
-    if (result == ProcessQueryResult::SendAnswer) {
-#ifndef DISABLE_RECVMMSG
-#if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
-      if (dq.ids.delayMsec == 0 && responsesVect != nullptr) {
-        queueResponse(cs, query, dest, remote, responsesVect[*queuedResponses], respIOV, respCBuf);
-        (*queuedResponses)++;
-        return;
+    auto outcome = processAcceptedUDPQuery(cs, holders, ids, query, proxyProtocolValues, dest, queryId);
+    if (outcome == UDPQueryOutcome::SendResponse) {
+      return packet.setResponse(query);
+    }
+
+    if (outcome == UDPQueryOutcome::SendAnswer) {
+      bool answered = false;
+      if (ids.delayMsec == 0) {
+        answered = packet.setResponse(query);
+      }
+      if (!answered) {
+        /* delayed, or too large to fit in the frame */
+        sendUDPResponse(cs.udpFD, query, ids.delayMsec, dest, remote);
       }
-#endif /* defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE) */
-#endif /* DISABLE_RECVMMSG */
-      /* we use dest, always, because we don't want to use the listening address to send a response since it could be 0.0.0.0 */
-      sendUDPResponse(cs.udpFD, query, dq.ids.delayMsec, dest, remote);
 
-      handleResponseSent(ids, 0., remote, ComboAddress(), query.size(), *dh, dnsdist::Protocol::DoUDP);
-      return;
+      handleResponseSent(ids, 0., remote, ComboAddress(), query.size(), *reinterpret_cast<const struct dnsheader*>(query.data()), dnsdist::Protocol::DoUDP);
+      return answered;
     }
+  }
+  catch (const std::exception& e) {
+    vinfolog("Got an error in AF_XDP question thread while parsing a query from %s, id %d: %s", ids.origRemote.toStringWithPort(), queryId, e.what());
+  }
 
-    if (result != ProcessQueryResult::PassToBackend || ss == nullptr) {
-      return;
-    }
+  return false;
+}
 
-    if (ss->isTCPOnly()) {
-      std::string proxyProtocolPayload;
-      /* we need to do this _before_ creating the cross protocol query because
-         after that the buffer will have been moved */
-      if (ss->d_config.useProxyProtocol) {
-        proxyProtocolPayload = getProxyProtocolPayload(dq);
+static void xskClientThread(ClientState* cs, dnsdist::xsk::XskSocket* socket)
+{
+  try {
+    setThreadName("dnsdist/xskClie");
+    LocalHolders holders;
+    const size_t maxIncomingPacketSize = getMaximumIncomingPacketSize(*cs);
+    /* the number of frames processed before the responses are sent */
+    const size_t batchSize = 64;
+
+    while (true) {
+      /* sent frames have to be reclaimed even if no new query is received */
+      socket->waitForFrames(socket->hasFramesBeingSent() ? 1 : -1);
+
+      auto packets = socket->recv(batchSize);
+      for (auto& packet : packets) {
+        if (packet.parse() && processXskQuery(*cs, holders, packet, maxIncomingPacketSize)) {
+          socket->queueForSending(packet);
+        }
+        else {
+          socket->release(packet);
+        }
       }
 
-      ids.origID = dh->id;
-      auto cpq = std::make_unique<UDPCrossProtocolQuery>(std::move(query), std::move(ids), ss);
-      cpq->query.d_proxyProtocolPayload = std::move(proxyProtocolPayload);
-
-      ss->passCrossProtocolQuery(std::move(cpq));
-      return;
+      socket->flush();
     }
-
-    assignOutgoingUDPQueryToBackend(ss, dh->id, dq, query, dest);
   }
-  catch(const std::exception& e){
-    vinfolog("Got an error in UDP question thread while parsing a query from %s, id %d: %s", ids.origRemote.toStringWithPort(), queryId, e.what());
+  catch (const std::exception& e) {
+    errlog("AF_XDP client thread died because of exception: %s", e.what());
+  }
+  catch (const PDNSException& e) {
+    errlog("AF_XDP client thread died because of PowerDNS exception: %s", e.reason);
+  }
+  catch (...) {
+    errlog("AF_XDP client thread died because of an exception: %s", "unknown");
   }
 }
+#endif /* HAVE_XSK */
 
 #ifndef DISABLE_RECVMMSG
 #if defined(HAVE_RECVMMSG) && defined(HAVE_SENDMMSG) && defined(MSG_WAITFORONE)
@@ -1674,7 +1986,8 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
 
   auto recvData = std::make_unique<MMReceiver[]>(vectSize);
   auto msgVec = std::make_unique<struct mmsghdr[]>(vectSize);
-  auto outMsgVec = std::make_unique<struct mmsghdr[]>(vectSize);
+  /* a single received message might contain several queries with GRO */
+  std::vector<struct mmsghdr> outMsgVec(vectSize);
 
   /* the actual buffer is larger because:
      - we may have to add EDNS and/or ECS
@@ -1684,11 +1997,23 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
   const size_t initialBufferSize = getInitialUDPPacketBufferSize();
   const size_t maxIncomingPacketSize = getMaximumIncomingPacketSize(*cs);
 
+  /* with GRO the kernel might coalesce several queries from the same client into one message,
+     so we need to be able to receive the largest possible UDP payload */
+  const bool gro = g_udpSegmentationOffload && dnsdist::udp::enableGRO(cs->udpFD);
+  const bool gso = g_udpSegmentationOffload && dnsdist::udp::isGSOSupported();
+  if (g_udpSegmentationOffload && !gro) {
+    warnlog("Unable to enable UDP Generic Receive Offload on %s", cs->local.toStringWithPort());
+  }
+  const size_t receiveBufferSize = gro ? std::max(initialBufferSize, dnsdist::udp::s_maxPayloadSize) : initialBufferSize;
+  /* the queries split from a coalesced message, reused from one round to the next */
+  std::vector<std::unique_ptr<MMReceiver>> segments;
+  dnsdist::udp::GSOCoalescer coalescer;
+
   /* initialize the structures needed to receive our messages */
   for (size_t idx = 0; idx < vectSize; idx++) {
     recvData[idx].remote.sin4.sin_family = cs->local.sin4.sin_family;
-    recvData[idx].packet.resize(initialBufferSize);
-    fillMSGHdr(&msgVec[idx].msg_hdr, &recvData[idx].iov, &recvData[idx].cbuf, sizeof(recvData[idx].cbuf), reinterpret_cast<char*>(&recvData[idx].packet.at(0)), maxIncomingPacketSize, &recvData[idx].remote);
+    recvData[idx].packet.resize(receiveBufferSize);
+    fillMSGHdr(&msgVec[idx].msg_hdr, &recvData[idx].iov, &recvData[idx].cbuf, sizeof(recvData[idx].cbuf), reinterpret_cast<char*>(&recvData[idx].packet.at(0)), gro ? receiveBufferSize : maxIncomingPacketSize, &recvData[idx].remote);
   }
 
   /* go now */
@@ -1697,9 +2022,11 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
     /* reset the IO vector, since it's also used to send the vector of responses
        to avoid having to copy the data around */
     for (size_t idx = 0; idx < vectSize; idx++) {
-      recvData[idx].packet.resize(initialBufferSize);
+      recvData[idx].packet.resize(receiveBufferSize);
       recvData[idx].iov.iov_base = &recvData[idx].packet.at(0);
       recvData[idx].iov.iov_len = recvData[idx].packet.size();
+      /* the kernel sets it to the size of the control messages it actually wrote */
+      msgVec[idx].msg_hdr.msg_controllen = sizeof(recvData[idx].cbuf);
     }
 
     /* block until we have at least one message ready, but return
@@ -1712,12 +2039,20 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
     }
 
     unsigned int msgsToSend = 0;
+    size_t segmentsUsed = 0;
+
+    auto processQuery = [&](const struct msghdr* msgh, MMReceiver& data) {
+      if (outMsgVec.size() <= msgsToSend) {
+        outMsgVec.resize(msgsToSend + 1);
+      }
+      processUDPQuery(*cs, holders, msgh, data.remote, data.dest, data.packet, outMsgVec.data(), &msgsToSend, &data.iov, &data.cbuf);
+    };
 
     /* process the received messages */
     for (int msgIdx = 0; msgIdx < msgsGot; msgIdx++) {
       const struct msghdr* msgh = &msgVec[msgIdx].msg_hdr;
       unsigned int got = msgVec[msgIdx].msg_len;
-      const ComboAddress& remote = recvData[msgIdx].remote;
+      auto& data = recvData[msgIdx];
 
       if (static_cast<size_t>(got) < sizeof(struct dnsheader)) {
         ++g_stats.nonCompliantQueries;
@@ -1725,18 +2060,73 @@ static void MultipleMessagesUDPClientThread(ClientState* cs, LocalHolders& holde
         continue;
       }
 
-      recvData[msgIdx].packet.resize(got);
-      processUDPQuery(*cs, holders, msgh, remote, recvData[msgIdx].dest, recvData[msgIdx].packet, outMsgVec.get(), &msgsToSend, &recvData[msgIdx].iov, &recvData[msgIdx].cbuf);
+      const size_t segmentSize = gro ? dnsdist::udp::getGROSegmentSize(msgh) : 0;
+      if (segmentSize == 0 || got <= segmentSize) {
+        /* without GRO the receive buffer is already limited to the maximum size */
+        if (gro && got > maxIncomingPacketSize) {
+          ++g_stats.nonCompliantQueries;
+          ++cs->nonCompliantQueries;
+          continue;
+        }
+        data.packet.resize(got);
+        processQuery(msgh, data);
+        continue;
+      }
+
+      /* several queries from the same client have been coalesced by GRO, all of them but the
+         last one have the same size. Copy them out before the first one, which stays in
+         place, gets processed and possibly moved */
+      const size_t firstSegment = segmentsUsed;
+      for (size_t offset = segmentSize; offset < got; offset += segmentSize) {
+        const size_t len = std::min(segmentSize, got - offset);
+        if (len < sizeof(struct dnsheader) || len > maxIncomingPacketSize) {
+          ++g_stats.nonCompliantQueries;
+          ++cs->nonCompliantQueries;
+          continue;
+        }
+        if (segmentsUsed == segments.size()) {
+          segments.push_back(std::make_unique<MMReceiver>());
+        }
+        auto& segment = *segments.at(segmentsUsed++);
+        segment.packet.reserve(initialBufferSize);
+        segment.packet.assign(data.packet.begin() + offset, data.packet.begin() + offset + len);
+        segment.remote = data.remote;
+        segment.dest = data.dest;
+      }
+
+      if (segmentSize < sizeof(struct dnsheader) || segmentSize > maxIncomingPacketSize) {
+        ++g_stats.nonCompliantQueries;
+        ++cs->nonCompliantQueries;
+      }
+      else {
+        data.packet.resize(segmentSize);
+        processQuery(msgh, data);
+      }
+
+      for (size_t idx = firstSegment; idx < segmentsUsed; idx++) {
+        processQuery(msgh, *segments.at(idx));
+      }
     }
 
     /* immediate (not delayed or sent to a backend) responses (mostly from a rule, dynamic block
        or the cache) can be sent in batch too */
 
-    if (msgsToSend > 0 && msgsToSend <= static_cast<unsigned int>(msgsGot)) {
-      int sent = sendmmsg(cs->udpFD, outMsgVec.get(), msgsToSend, 0);
+    if (msgsToSend > 0) {
+      struct mmsghdr* toSend = outMsgVec.data();
+      unsigned int toSendCount = msgsToSend;
+      if (gso && !cs->d_udpGSOFailed) {
+        std::tie(toSend, toSendCount) = coalescer.coalesce(outMsgVec.data(), msgsToSend);
+      }
 
-      if (sent < 0 || static_cast<unsigned int>(sent) != msgsToSend) {
-        vinfolog("Error sending responses with sendmmsg() (%d on %u): %s", sent, msgsToSend, stringerror());
+      /* these responses have already been accounted for, like the ones sent by sendUDPResponse() */
+      const bool segmentationWorked = dnsdist::udp::sendMessages(cs->udpFD, toSend, toSendCount, [&outMsgVec](size_t index, int error) {
+        if (error != 0) {
+          const auto* remote = reinterpret_cast<const ComboAddress*>(outMsgVec.at(index).msg_hdr.msg_name);
+          vinfolog("Error sending response to %s: %s", remote->toStringWithPort(), stringerror(error));
+        }
+      });
+      if (!segmentationWorked && !cs->d_udpGSOFailed.exchange(true)) {
+        warnlog("Sending coalesced UDP responses from %s failed, disabling UDP segmentation offload on that frontend", cs->local.toStringWithPort());
       }
     }
 
@@ -2257,6 +2647,13 @@ static void setUpLocalBind(std::unique_ptr<ClientState>& cstate)
     cstate->dohFrontend->setup();
   }
 
+#ifdef HAVE_XSK
+  if (cstate->d_xsk != nullptr) {
+    cstate->d_xsk->setUp(ntohs(cstate->local.sin4.sin_port), g_defaultBPFFilter);
+    infolog("Receiving the UDP queries sent to port %d on interface '%s' over %d AF_XDP socket(s) for %s", ntohs(cstate->local.sin4.sin_port), cstate->d_xsk->getInterface(), cstate->d_xsk->getSockets().size(), cstate->local.toStringWithPort());
+  }
+#endif /* HAVE_XSK */
+
   cstate->ready = true;
 }
 
@@ -2827,6 +3224,17 @@ int main(int argc, char** argv)
         }
         t1.detach();
 #endif /* USE_SINGLE_ACCEPTOR_THREAD */
+#ifdef HAVE_XSK
+        if (cs->d_xsk != nullptr) {
+          for (const auto& socket : cs->d_xsk->getSockets()) {
+            thread xskThread(xskClientThread, cs.get(), socket.get());
+            if (!cs->cpus.empty()) {
+              mapThreadToCPUList(xskThread.native_handle(), cs->cpus);
+            }
+            xskThread.detach();
+          }
+        }
+#endif /* HAVE_XSK */
       }
       else if (cs->tcpFD >= 0) {
 #ifdef USE_SINGLE_ACCEPTOR_THREAD
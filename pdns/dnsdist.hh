@@ -55,6 +55,11 @@
 
 uint64_t uptimeOfProcess(const std::string& str);
 
+namespace dnsdist::xsk
+{
+class XskFrontend;
+}
+
 extern uint16_t g_ECSSourcePrefixV4;
 extern uint16_t g_ECSSourcePrefixV6;
 extern bool g_ECSOverride;
@@ -595,11 +600,15 @@ struct ClientState
   std::shared_ptr<TLSFrontend> tlsFrontend{nullptr};
   std::shared_ptr<DOHFrontend> dohFrontend{nullptr};
   std::shared_ptr<BPFFilter> d_filter{nullptr};
+  /* AF_XDP sockets receiving the queries of this UDP frontend, if any */
+  std::shared_ptr<dnsdist::xsk::XskFrontend> d_xsk{nullptr};
   size_t d_maxInFlightQueriesPerConn{1};
   size_t d_tcpConcurrentConnectionsLimit{0};
   int udpFD{-1};
   int tcpFD{-1};
   int tcpListenQueueSize{SOMAXCONN};
+  /* set once sending a coalesced (GSO) message over udpFD failed, responses are then sent one by one */
+  std::atomic<bool> d_udpGSOFailed{false};
   int fastOpenQueueSize{0};
   bool muted{false};
   bool tcp;
@@ -763,6 +772,7 @@ struct DownstreamState: public std::enable_shared_from_this<DownstreamState>
     std::string name;
     std::string nameWithAddr;
     size_t d_numberOfSockets{1};
+    size_t d_numberOfResponderThreads{1};
     size_t d_maxInFlightQueriesPerConn{1};
     size_t d_tcpConcurrentConnectionsLimit{0};
     int order{1};
@@ -844,10 +854,16 @@ struct DownstreamState: public std::enable_shared_from_this<DownstreamState>
   pdns::stat_t_trait<double> dropRate{0.0};
 
   SharedLockGuarded<std::vector<unsigned int>> hashes;
-  LockGuarded<std::unique_ptr<FDMultiplexer>> mplexer{nullptr};
 private:
-  LockGuarded<std::map<uint16_t, IDState>> d_idStatesMap;
-  vector<IDState> idStates;
+  /* The UDP sockets are split between the responder threads, the socket at index i
+     belonging to the thread i % d_responders.size(). Each thread has its own multiplexer,
+     only used if it owns more than one socket, and its own ID space. */
+  struct UDPResponder
+  {
+    IDStateTable d_idStates;
+    LockGuarded<std::unique_ptr<FDMultiplexer>> d_mplexer{nullptr};
+  };
+  std::vector<std::unique_ptr<UDPResponder>> d_responders;
 
   struct LazyHealthCheckStats
   {
@@ -863,9 +879,8 @@ public:
   std::vector<int> sockets;
   StopWatch sw;
   QPSLimiter qps;
-  std::atomic<uint64_t> idOffset{0};
   size_t socketsOffset{0};
-  double latencyUsec{0.0};
+  std::atomic<double> latencyUsec{0.0};
   double latencyUsecTCP{0.0};
   unsigned int d_nextCheck{0};
   uint16_t currentCheckFailures{0};
@@ -877,7 +892,6 @@ public:
 private:
   void connectUDPSockets();
 
-  std::thread tid;
   std::mutex connectLock;
   std::atomic_flag threadStarted;
   bool d_stopped{false};
@@ -999,16 +1013,24 @@ public:
   }
 
   bool passCrossProtocolQuery(std::unique_ptr<CrossProtocolQuery>&& cpq);
-  int pickSocketForSending();
-  void pickSocketsReadyForReceiving(std::vector<int>& ready);
+  /* returns the socket to use and the index of the responder owning it */
+  std::pair<int, uint16_t> pickSocketForSending();
+  void pickSocketsReadyForReceiving(size_t responder, std::vector<int>& ready);
+  size_t getNumberOfResponders() const
+  {
+    return d_responders.size();
+  }
   void handleUDPTimeouts();
   void reportTimeoutOrError();
   void reportResponse(uint8_t rcode);
   void submitHealthCheckResult(bool initial, bool newState);
   time_t getNextLazyHealthCheck();
+  /* the state is stored in the ID space of the responder owning its backendFD socket, backendResponder */
   uint16_t saveState(InternalQueryState&&);
   void restoreState(uint16_t id, InternalQueryState&&);
-  std::optional<InternalQueryState> getState(uint16_t id);
+  std::optional<InternalQueryState> getState(size_t responder, uint16_t id);
+  /* the responder threads might be updating it concurrently */
+  void updateLatency(double udiff);
 
   dnsdist::Protocol getProtocol() const
   {
@@ -1028,12 +1050,13 @@ public:
   static bool s_randomizeSockets;
   static bool s_randomizeIDs;
 private:
-  void handleUDPTimeout(IDState& ids);
+  void handleUDPTimeout(InternalQueryState& ids);
+  LockGuarded<std::unique_ptr<FDMultiplexer>>& getMultiplexerForSocket(size_t idx);
   void updateNextLazyHealthCheck(LazyHealthCheckStats& stats, bool checkScheduled, std::optional<time_t> currentTime = std::nullopt);
 };
 using servers_t = vector<std::shared_ptr<DownstreamState>>;
 
-void responderThread(std::shared_ptr<DownstreamState> state);
+void responderThread(std::shared_ptr<DownstreamState> state, size_t responder);
 extern LockGuarded<LuaContext> g_lua;
 extern std::string g_outputBuffer; // locking for this is ok, as locked by g_luamutex
 
@@ -1151,6 +1174,23 @@ extern uint32_t g_socketUDPRecvBuffer;
 extern shared_ptr<BPFFilter> g_defaultBPFFilter;
 extern std::vector<std::shared_ptr<DynBPFFilter> > g_dynBPFFilters;
 
+namespace dnsdist::rules
+{
+class CompiledRuleChain;
+
+/* per-thread access to the compiled version of the query rules, see dnsdist-rule-chain.hh.
+   The compiled chain is shared between threads, and only rebuilt when the rules change */
+class CompiledRuleChainHolder
+{
+public:
+  const CompiledRuleChain& get(LocalStateHolder<vector<DNSDistRuleAction>>& rules);
+
+private:
+  std::shared_ptr<const CompiledRuleChain> d_chain{nullptr};
+  unsigned int d_generation{0};
+};
+}
+
 struct LocalHolders
 {
   LocalHolders(): acl(g_ACL.getLocal()), policy(g_policy.getLocal()), ruleactions(g_ruleactions.getLocal()), cacheHitRespRuleactions(g_cachehitrespruleactions.getLocal()), cacheInsertedRespRuleActions(g_cacheInsertedRespRuleActions.getLocal()), selfAnsweredRespRuleactions(g_selfansweredrespruleactions.getLocal()), servers(g_dstates.getLocal()), dynNMGBlock(g_dynblockNMG.getLocal()), dynSMTBlock(g_dynblockSMT.getLocal()), pools(g_pools.getLocal())
@@ -1160,6 +1200,7 @@ struct LocalHolders
   LocalStateHolder<NetmaskGroup> acl;
   LocalStateHolder<ServerPolicy> policy;
   LocalStateHolder<vector<DNSDistRuleAction> > ruleactions;
+  dnsdist::rules::CompiledRuleChainHolder compiledRuleactions;
   LocalStateHolder<vector<DNSDistResponseRuleAction> > cacheHitRespRuleactions;
   LocalStateHolder<vector<DNSDistResponseRuleAction> > cacheInsertedRespRuleActions;
   LocalStateHolder<vector<DNSDistResponseRuleAction> > selfAnsweredRespRuleactions;
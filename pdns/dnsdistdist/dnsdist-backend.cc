@@ -50,10 +50,11 @@ bool DownstreamState::reconnect()
   }
 
   connected = false;
-  for (auto& fd : sockets) {
+  for (size_t idx = 0; idx < sockets.size(); idx++) {
+    auto& fd = sockets[idx];
     if (fd != -1) {
-      if (sockets.size() > 1) {
-        (*mplexer.lock())->removeReadFD(fd);
+      if (auto mplexer = getMultiplexerForSocket(idx).lock(); *mplexer) {
+        (*mplexer)->removeReadFD(fd);
       }
       /* shutdown() is needed to wake up recv() in the responderThread */
       shutdown(fd, SHUT_RDWR);
@@ -83,8 +84,8 @@ bool DownstreamState::reconnect()
 
     try {
       SConnect(fd, d_config.remote);
-      if (sockets.size() > 1) {
-        (*mplexer.lock())->addReadFD(fd, [](int, boost::any) {});
+      if (auto mplexer = getMultiplexerForSocket(idx).lock(); *mplexer) {
+        (*mplexer)->addReadFD(fd, [](int, boost::any) {});
       }
       connected = true;
     }
@@ -97,11 +98,12 @@ bool DownstreamState::reconnect()
 
   /* if at least one (re-)connection failed, close all sockets */
   if (!connected) {
-    for (auto& fd : sockets) {
+    for (size_t idx = 0; idx < sockets.size(); idx++) {
+      auto& fd = sockets[idx];
       if (fd != -1) {
-        if (sockets.size() > 1) {
+        if (auto mplexer = getMultiplexerForSocket(idx).lock(); *mplexer) {
           try {
-            (*mplexer.lock())->removeReadFD(fd);
+            (*mplexer)->removeReadFD(fd);
           }
           catch (const FDMultiplexerException& e) {
             /* some sockets might not have been added to the multiplexer
@@ -128,12 +130,12 @@ void DownstreamState::stop()
 
   {
     std::lock_guard<std::mutex> tl(connectLock);
-    auto slock = mplexer.lock();
 
-    for (auto& fd : sockets) {
-      if (fd != -1) {
+    for (size_t idx = 0; idx < sockets.size(); idx++) {
+      auto slock = getMultiplexerForSocket(idx).lock();
+      if (sockets[idx] != -1) {
         /* shutdown() is needed to wake up recv() in the responderThread */
-        shutdown(fd, SHUT_RDWR);
+        shutdown(sockets[idx], SHUT_RDWR);
       }
     }
   }
@@ -238,28 +240,36 @@ DownstreamState::DownstreamState(DownstreamState::Config&& config, std::shared_p
 void DownstreamState::start()
 {
   if (connected && !threadStarted.test_and_set()) {
-    tid = std::thread(responderThread, shared_from_this());
+    for (size_t responder = 0; responder < d_responders.size(); responder++) {
+      std::thread tid(responderThread, shared_from_this(), responder);
 
-    if (!d_config.d_cpus.empty()) {
-      mapThreadToCPUList(tid.native_handle(), d_config.d_cpus);
-    }
+      if (!d_config.d_cpus.empty()) {
+        mapThreadToCPUList(tid.native_handle(), d_config.d_cpus);
+      }
 
-    tid.detach();
+      tid.detach();
+    }
   }
 }
 
 void DownstreamState::connectUDPSockets()
 {
-  if (s_randomizeIDs) {
-    idStates.clear();
-  }
-  else {
-    idStates.resize(g_maxOutstanding);
-  }
-  sockets.resize(d_config.d_numberOfSockets);
+  const size_t numberOfResponders = std::max(d_config.d_numberOfResponderThreads, static_cast<size_t>(1));
+  sockets.resize(std::max(d_config.d_numberOfSockets, numberOfResponders));
 
-  if (sockets.size() > 1) {
-    *(mplexer.lock()) = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
+  /* the maximum number of outstanding queries is split between the responders. With
+     randomized IDs, the number of states is still bounded by g_maxOutstanding, the IDs
+     being spread over the whole 16-bit space regardless */
+  const uint32_t statesPerResponder = (g_maxOutstanding + numberOfResponders - 1) / numberOfResponders;
+  d_responders.clear();
+  for (size_t responder = 0; responder < numberOfResponders; responder++) {
+    auto udpResponder = std::make_unique<UDPResponder>();
+    udpResponder->d_idStates.resize(std::max(statesPerResponder, static_cast<uint32_t>(1)), s_randomizeIDs);
+    /* a multiplexer is only needed if this responder owns more than one socket */
+    if (sockets.size() > responder + numberOfResponders) {
+      *(udpResponder->d_mplexer.lock()) = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
+    }
+    d_responders.push_back(std::move(udpResponder));
   }
 
   for (auto& fd : sockets) {
@@ -287,11 +297,11 @@ void DownstreamState::incCurrentConnectionsCount()
   }
 }
 
-int DownstreamState::pickSocketForSending()
+std::pair<int, uint16_t> DownstreamState::pickSocketForSending()
 {
   size_t numberOfSockets = sockets.size();
   if (numberOfSockets == 1) {
-    return sockets[0];
+    return {sockets[0], 0};
   }
 
   size_t idx;
@@ -302,42 +312,41 @@ int DownstreamState::pickSocketForSending()
     idx = socketsOffset++;
   }
 
-  return sockets[idx % numberOfSockets];
+  idx %= numberOfSockets;
+  return {sockets[idx], idx % d_responders.size()};
 }
 
-void DownstreamState::pickSocketsReadyForReceiving(std::vector<int>& ready)
+void DownstreamState::pickSocketsReadyForReceiving(size_t responder, std::vector<int>& ready)
 {
   ready.clear();
 
-  if (sockets.size() == 1) {
-    ready.push_back(sockets[0]);
+  if (sockets.size() <= responder + d_responders.size()) {
+    /* this responder owns a single socket */
+    ready.push_back(sockets.at(responder));
     return ;
   }
 
-  (*mplexer.lock())->getAvailableFDs(ready, 1000);
+  (*d_responders.at(responder)->d_mplexer.lock())->getAvailableFDs(ready, 1000);
+}
+
+LockGuarded<std::unique_ptr<FDMultiplexer>>& DownstreamState::getMultiplexerForSocket(size_t idx)
+{
+  return d_responders.at(idx % d_responders.size())->d_mplexer;
 }
 
 bool DownstreamState::s_randomizeSockets{false};
 bool DownstreamState::s_randomizeIDs{false};
 int DownstreamState::s_udpTimeout{2};
 
-static bool isIDSExpired(const IDState& ids)
+void DownstreamState::handleUDPTimeout(InternalQueryState& ids)
 {
-  auto age = ids.age.load();
-  return age > DownstreamState::s_udpTimeout;
-}
-
-void DownstreamState::handleUDPTimeout(IDState& ids)
-{
-  ids.age = 0;
-  ids.inUse = false;
-  handleDOHTimeout(std::move(ids.internal.du));
+  handleDOHTimeout(std::move(ids.du));
   reuseds++;
   --outstanding;
   ++g_stats.downstreamTimeouts; // this is an 'actively' discovered timeout
   vinfolog("Had a downstream timeout from %s (%s) for query for %s|%s from %s",
            d_config.remote.toStringWithPort(), getName(),
-           ids.internal.qname.toLogString(), QType(ids.internal.qtype).toString(), ids.internal.origRemote.toStringWithPort());
+           ids.qname.toLogString(), QType(ids.qtype).toString(), ids.origRemote.toStringWithPort());
 
   if (g_rings.shouldRecordResponses()) {
     struct timespec ts;
@@ -345,9 +354,9 @@ void DownstreamState::handleUDPTimeout(IDState& ids)
 
     struct dnsheader fake;
     memset(&fake, 0, sizeof(fake));
-    fake.id = ids.internal.origID;
+    fake.id = ids.origID;
 
-    g_rings.insertResponse(ts, ids.internal.origRemote, ids.internal.qname, ids.internal.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, d_config.remote, getProtocol());
+    g_rings.insertResponse(ts, ids.origRemote, ids.qname, ids.qtype, std::numeric_limits<unsigned int>::max(), 0, fake, d_config.remote, getProtocol());
   }
 
   reportTimeoutOrError();
@@ -374,178 +383,60 @@ void DownstreamState::handleUDPTimeouts()
     return;
   }
 
-  if (s_randomizeIDs) {
-    auto map = d_idStatesMap.lock();
-    for (auto it = map->begin(); it != map->end(); ) {
-      auto& ids = it->second;
-      if (isIDSExpired(ids)) {
+  if (outstanding.load() > 0) {
+    for (auto& responder : d_responders) {
+      responder->d_idStates.expire(s_udpTimeout, [this](InternalQueryState& ids) {
         handleUDPTimeout(ids);
-        it = map->erase(it);
-        continue;
-      }
-      ++ids.age;
-      ++it;
-    }
-  }
-  else {
-    if (outstanding.load() > 0) {
-      for (IDState& ids : idStates) {
-        if (!ids.isInUse()) {
-          continue;
-        }
-        if (!isIDSExpired(ids)) {
-          ++ids.age;
-          continue;
-        }
-        auto guard = ids.acquire();
-        if (!guard) {
-          continue;
-        }
-        /* check again, now that we have locked this state */
-        if (ids.isInUse() && isIDSExpired(ids)) {
-          handleUDPTimeout(ids);
-        }
-      }
+      });
     }
   }
 }
 
 uint16_t DownstreamState::saveState(InternalQueryState&& state)
 {
-  if (s_randomizeIDs) {
-    /* if the state is already in use we will retry,
-       up to 5 five times. The last selected one is used
-       even if it was already in use */
-    size_t remainingAttempts = 5;
-    auto map = d_idStatesMap.lock();
-
-    do {
-      uint16_t selectedID = dnsdist::getRandomValue(std::numeric_limits<uint16_t>::max());
-      auto [it, inserted] = map->emplace(selectedID, IDState());
-
-      if (!inserted) {
-        remainingAttempts--;
-        if (remainingAttempts > 0) {
-          continue;
-        }
-
-        auto oldDU = std::move(it->second.internal.du);
-        ++reuseds;
-        ++g_stats.downstreamTimeouts;
-        handleDOHTimeout(std::move(oldDU));
-      }
-      else {
-        ++outstanding;
-      }
-
-      it->second.internal = std::move(state);
-      it->second.age.store(0);
-
-      return it->first;
-    }
-    while (true);
+  std::optional<InternalQueryState> evicted;
+  auto& idStates = d_responders.at(state.backendResponder)->d_idStates;
+  auto selectedID = idStates.save(std::move(state), evicted);
+  if (evicted) {
+    /* we are reusing a state, no change in outstanding but if there was an existing DOHUnit we need
+       to handle it because it's about to be overwritten. */
+    ++reuseds;
+    ++g_stats.downstreamTimeouts;
+    handleDOHTimeout(std::move(evicted->du));
   }
-
-  do {
-    uint16_t selectedID = (idOffset++) % idStates.size();
-    IDState& ids = idStates[selectedID];
-    auto guard = ids.acquire();
-    if (!guard) {
-      continue;
-    }
-    if (ids.isInUse()) {
-      /* we are reusing a state, no change in outstanding but if there was an existing DOHUnit we need
-         to handle it because it's about to be overwritten. */
-      auto oldDU = std::move(ids.internal.du);
-      ++reuseds;
-      ++g_stats.downstreamTimeouts;
-      handleDOHTimeout(std::move(oldDU));
-    }
-    else {
-      ++outstanding;
-    }
-    ids.internal = std::move(state);
-    ids.age.store(0);
-    ids.inUse = true;
-    return selectedID;
+  else {
+    ++outstanding;
   }
-  while (true);
+  return selectedID;
 }
 
 void DownstreamState::restoreState(uint16_t id, InternalQueryState&& state)
 {
-  if (s_randomizeIDs) {
-    auto map = d_idStatesMap.lock();
-
-    auto [it, inserted] = map->emplace(id, IDState());
-    if (!inserted) {
-      /* already used */
-      ++reuseds;
-      ++g_stats.downstreamTimeouts;
-      handleDOHTimeout(std::move(state.du));
-    }
-    else {
-      it->second.internal = std::move(state);
-      ++outstanding;
-    }
-    return;
-  }
-
-  auto& ids = idStates[id];
-  auto guard = ids.acquire();
-  if (!guard) {
+  auto& idStates = d_responders.at(state.backendResponder)->d_idStates;
+  if (!idStates.restore(id, std::move(state))) {
     /* already used */
     ++reuseds;
     ++g_stats.downstreamTimeouts;
     handleDOHTimeout(std::move(state.du));
     return;
   }
-  if (ids.isInUse()) {
-    /* already used */
-    ++reuseds;
-    ++g_stats.downstreamTimeouts;
-    handleDOHTimeout(std::move(state.du));
-    return;
-  }
-  ids.internal = std::move(state);
-  ids.inUse = true;
   ++outstanding;
 }
 
-std::optional<InternalQueryState> DownstreamState::getState(uint16_t id)
+std::optional<InternalQueryState> DownstreamState::getState(size_t responder, uint16_t id)
 {
-  std::optional<InternalQueryState> result = std::nullopt;
-
-  if (s_randomizeIDs) {
-    auto map = d_idStatesMap.lock();
-
-    auto it = map->find(id);
-    if (it == map->end()) {
-      return result;
-    }
-
-    result = std::move(it->second.internal);
-    map->erase(it);
+  auto result = d_responders.at(responder)->d_idStates.get(id);
+  if (result) {
     --outstanding;
-    return result;
-  }
-
-  if (id > idStates.size()) {
-    return result;
-  }
-
-  auto& ids = idStates[id];
-  auto guard = ids.acquire();
-  if (!guard) {
-    return result;
   }
+  return result;
+}
 
-  if (ids.isInUse()) {
-    result = std::move(ids.internal);
-    --outstanding;
+void DownstreamState::updateLatency(double udiff)
+{
+  auto current = latencyUsec.load();
+  while (!latencyUsec.compare_exchange_weak(current, (127.0 * current / 128.0) + udiff / 128.0)) {
   }
-  ids.inUse = false;
-  return result;
 }
 
 bool DownstreamState::healthCheckRequired(std::optional<time_t> currentTime)
@@ -13,17 +13,29 @@ void DynBlockRulesGroup::apply(const struct timespec& now)
   counts_t counts;
   StatNode statNodeRoot;
 
-  size_t entriesCount = 0;
-  if (hasQueryRules()) {
-    entriesCount += g_rings.getNumberOfQueryEntries();
+  if (d_incremental) {
+    updateIncrementalState(now);
+    processIncrementalState(counts, statNodeRoot, now);
   }
-  if (hasResponseRules()) {
-    entriesCount += g_rings.getNumberOfResponseEntries();
+  else if (d_approximate) {
+    d_approximate->clear();
+    processQueryRules(counts, d_approximate.get(), now);
+    processResponseRules(counts, d_approximate.get(), statNodeRoot, now);
+    d_approximate->collect(counts);
   }
-  counts.reserve(entriesCount);
+  else {
+    size_t entriesCount = 0;
+    if (hasQueryRules()) {
+      entriesCount += g_rings.getNumberOfQueryEntries();
+    }
+    if (hasResponseRules()) {
+      entriesCount += g_rings.getNumberOfResponseEntries();
+    }
+    counts.reserve(entriesCount);
 
-  processQueryRules(counts, now);
-  processResponseRules(counts, statNodeRoot, now);
+    processQueryRules(counts, nullptr, now);
+    processResponseRules(counts, nullptr, statNodeRoot, now);
+  }
 
   if (counts.empty() && statNodeRoot.empty()) {
     return;
@@ -155,25 +167,25 @@ void DynBlockRulesGroup::apply(const struct timespec& now)
   }
 }
 
-bool DynBlockRulesGroup::checkIfQueryTypeMatches(const Rings::Query& query)
+bool DynBlockRulesGroup::checkIfQueryTypeMatches(uint16_t qtype, const struct timespec& when)
 {
-  auto rule = d_qtypeRules.find(query.qtype);
+  auto rule = d_qtypeRules.find(qtype);
   if (rule == d_qtypeRules.end()) {
     return false;
   }
 
-  return rule->second.matches(query.when);
+  return rule->second.matches(when);
 }
 
-bool DynBlockRulesGroup::checkIfResponseCodeMatches(const Rings::Response& response)
+bool DynBlockRulesGroup::checkIfResponseCodeMatches(uint8_t rcode, const struct timespec& when)
 {
-  auto rule = d_rcodeRules.find(response.dh.rcode);
-  if (rule != d_rcodeRules.end() && rule->second.matches(response.when)) {
+  auto rule = d_rcodeRules.find(rcode);
+  if (rule != d_rcodeRules.end() && rule->second.matches(when)) {
     return true;
   }
 
-  auto ratio = d_rcodeRatioRules.find(response.dh.rcode);
-  if (ratio != d_rcodeRatioRules.end() && ratio->second.matches(response.when)) {
+  auto ratio = d_rcodeRatioRules.find(rcode);
+  if (ratio != d_rcodeRatioRules.end() && ratio->second.matches(when)) {
     return true;
   }
 
@@ -315,7 +327,7 @@ void DynBlockRulesGroup::addOrRefreshBlockSMT(SuffixMatchTree<DynBlock>& blocks,
   updated = true;
 }
 
-void DynBlockRulesGroup::processQueryRules(counts_t& counts, const struct timespec& now)
+void DynBlockRulesGroup::processQueryRules(counts_t& counts, ApproximateCounts* approximate, const struct timespec& now)
 {
   if (!hasQueryRules()) {
     return;
@@ -330,17 +342,27 @@ void DynBlockRulesGroup::processQueryRules(counts_t& counts, const struct timesp
   }
 
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->queryRing.lock();
-    for(const auto& c : *rl) {
+    shard->queryRing.visit([this, &counts, approximate, &now](const Rings::StoredQuery& c) {
       if (now < c.when) {
-        continue;
+        return;
       }
 
       bool qRateMatches = d_queryRateRule.matches(c.when);
-      bool typeRuleMatches = checkIfQueryTypeMatches(c);
+      bool typeRuleMatches = checkIfQueryTypeMatches(c.qtype, c.when);
 
       if (qRateMatches || typeRuleMatches) {
-        auto& entry = counts[AddressAndPortRange(c.requestor, c.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask)];
+        AddressAndPortRange requestor(c.requestor, c.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask);
+        if (approximate != nullptr) {
+          if (qRateMatches) {
+            approximate->d_queries.add(requestor);
+          }
+          if (typeRuleMatches) {
+            approximate->getQTypeTracker(c.qtype).add(requestor);
+          }
+          return;
+        }
+
+        auto& entry = counts[requestor];
         if (qRateMatches) {
           ++entry.queries;
         }
@@ -348,11 +370,11 @@ void DynBlockRulesGroup::processQueryRules(counts_t& counts, const struct timesp
           ++entry.d_qtypeCounts[c.qtype];
         }
       }
-    }
+    });
   }
 }
 
-void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root, const struct timespec& now)
+void DynBlockRulesGroup::processResponseRules(counts_t& counts, ApproximateCounts* approximate, StatNode& root, const struct timespec& now)
 {
   if (!hasResponseRules() && !hasSuffixMatchRules()) {
     return;
@@ -389,24 +411,33 @@ void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root,
   }
 
   for (const auto& shard : g_rings.d_shards) {
-    auto rl = shard->respRing.lock();
-    for(const auto& c : *rl) {
+    shard->respRing.visit([this, &counts, approximate, &root, &now, &responseCutOff](const Rings::StoredResponse& c) {
       if (now < c.when) {
-        continue;
+        return;
       }
 
       if (c.when < responseCutOff) {
-        continue;
+        return;
       }
 
-      auto& entry = counts[AddressAndPortRange(c.requestor, c.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask)];
-      ++entry.responses;
-
+      AddressAndPortRange requestor(c.requestor, c.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask);
       bool respRateMatches = d_respRateRule.matches(c.when);
       bool suffixMatchRuleMatches = d_suffixMatchRule.matches(c.when);
-      bool rcodeRuleMatches = checkIfResponseCodeMatches(c);
+      bool rcodeRuleMatches = checkIfResponseCodeMatches(c.dh.rcode, c.when);
+
+      if (approximate != nullptr) {
+        approximate->d_responses.add(approximate->d_hash(requestor));
+        if (respRateMatches) {
+          approximate->d_respBytes.add(requestor, c.size);
+        }
+        if (rcodeRuleMatches) {
+          approximate->getRCodeTracker(c.dh.rcode).add(requestor);
+        }
+      }
+      else {
+        auto& entry = counts[requestor];
+        ++entry.responses;
 
-      if (respRateMatches || rcodeRuleMatches) {
         if (respRateMatches) {
           entry.respBytes += c.size;
         }
@@ -416,8 +447,293 @@ void DynBlockRulesGroup::processResponseRules(counts_t& counts, StatNode& root,
       }
 
       if (suffixMatchRuleMatches) {
-        root.submit(c.name, ((c.dh.rcode == 0 && c.usec == std::numeric_limits<unsigned int>::max()) ? -1 : c.dh.rcode), c.size, boost::none);
+        /* the only case where we actually need the name as a DNSName */
+        root.submit(c.name.get(), ((c.dh.rcode == 0 && c.usec == std::numeric_limits<unsigned int>::max()) ? -1 : c.dh.rcode), c.size, boost::none);
       }
+    });
+  }
+}
+
+void DynBlockRulesGroup::ApproximateCounts::collect(counts_t& counts) const
+{
+  /* the counts reported for a given rule are only the ones of the requestors tracked for that rule,
+     since the others are not heavy enough to matter, except for the number of responses which is
+     only used to compute ratios */
+  d_queries.visit([&counts](const AddressAndPortRange& requestor, uint64_t count) {
+    counts[requestor].queries = count;
+  });
+  d_respBytes.visit([&counts](const AddressAndPortRange& requestor, uint64_t count) {
+    counts[requestor].respBytes = count;
+  });
+  for (const auto& [qtype, tracker] : d_qtypes) {
+    tracker.visit([&counts, qtype = qtype](const AddressAndPortRange& requestor, uint64_t count) {
+      counts[requestor].d_qtypeCounts[qtype] = count;
+    });
+  }
+  for (const auto& [rcode, tracker] : d_rcodes) {
+    tracker.visit([&counts, rcode = rcode](const AddressAndPortRange& requestor, uint64_t count) {
+      counts[requestor].d_rcodeCounts[rcode] = count;
+    });
+  }
+  for (auto& [requestor, entry] : counts) {
+    entry.responses = d_responses.estimate(d_hash(requestor));
+  }
+}
+
+void DynBlockRulesGroup::ApproximateCounts::clear()
+{
+  d_queries.clear();
+  d_respBytes.clear();
+  for (auto& [qtype, tracker] : d_qtypes) {
+    tracker.clear();
+  }
+  for (auto& [rcode, tracker] : d_rcodes) {
+    tracker.clear();
+  }
+  d_responses.clear();
+}
+
+unsigned int DynBlockRulesGroup::getLargestWindow() const
+{
+  unsigned int result = 0;
+  const auto update = [&result](const DynBlockRule& rule) {
+    if (rule.isEnabled()) {
+      result = std::max(result, rule.d_seconds);
+    }
+  };
+
+  update(d_queryRateRule);
+  update(d_respRateRule);
+  update(d_suffixMatchRule);
+  for (const auto& rule : d_qtypeRules) {
+    update(rule.second);
+  }
+  for (const auto& rule : d_rcodeRules) {
+    update(rule.second);
+  }
+  for (const auto& rule : d_rcodeRatioRules) {
+    update(rule.second);
+  }
+
+  return result;
+}
+
+std::map<time_t, DynBlockRulesGroup::Counts>* DynBlockRulesGroup::IncrementalState::getRequestorBuckets(const AddressAndPortRange& requestor)
+{
+  auto it = d_requestors.find(requestor);
+  if (it != d_requestors.end()) {
+    return &it->second;
+  }
+  if (d_requestors.size() >= d_maxKeys) {
+    return nullptr;
+  }
+  return &d_requestors[requestor];
+}
+
+std::map<time_t, StatNode::Stat>& DynBlockRulesGroup::IncrementalState::getNameBuckets(const DNSName& name)
+{
+  auto it = d_names.find(name);
+  if (it != d_names.end()) {
+    return it->second;
+  }
+  if (d_names.size() < d_maxKeys) {
+    return d_names[name];
+  }
+
+  /* this is very likely a random subdomain attack, the suffix match rules only need
+     the counts of the parent names to catch it */
+  DNSName ancestor(name);
+  while (ancestor.chopOff()) {
+    it = d_names.find(ancestor);
+    if (it != d_names.end()) {
+      return it->second;
+    }
+  }
+  ancestor = name;
+  if (d_names.size() >= (2 * d_maxKeys) || !ancestor.chopOff()) {
+    return d_names[g_rootdnsname];
+  }
+  return d_names[ancestor];
+}
+
+void DynBlockRulesGroup::updateIncrementalState(const struct timespec& now)
+{
+  auto& state = d_incrementalState;
+  const time_t oldest = now.tv_sec - getLargestWindow();
+  const auto numberOfShards = g_rings.d_shards.size();
+  /* either ring might be disabled, and responses are looked at by more rules than queries */
+  state.d_maxKeys = 0;
+  for (const auto& shard : g_rings.d_shards) {
+    state.d_maxKeys += std::max(shard->queryRing.capacity(), shard->respRing.capacity());
+  }
+  if (state.d_queryPositions.size() != numberOfShards) {
+    state.d_queryPositions.assign(numberOfShards, 0);
+  }
+  if (state.d_responsePositions.size() != numberOfShards) {
+    state.d_responsePositions.assign(numberOfShards, 0);
+  }
+
+  if (hasQueryRules()) {
+    for (size_t idx = 0; idx < numberOfShards; idx++) {
+      g_rings.d_shards.at(idx)->queryRing.visitSince(state.d_queryPositions.at(idx), [this, &state, oldest](const Rings::StoredQuery& query) {
+        if (query.when.tv_sec < oldest) {
+          return;
+        }
+
+        bool qRateMatches = d_queryRateRule.isEnabled();
+        bool typeRuleMatches = d_qtypeRules.count(query.qtype) != 0;
+        if (!qRateMatches && !typeRuleMatches) {
+          return;
+        }
+
+        auto* buckets = state.getRequestorBuckets(AddressAndPortRange(query.requestor, query.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask));
+        if (buckets == nullptr) {
+          return;
+        }
+        auto& bucket = (*buckets)[query.when.tv_sec];
+        if (qRateMatches) {
+          ++bucket.queries;
+        }
+        if (typeRuleMatches) {
+          ++bucket.d_qtypeCounts[query.qtype];
+        }
+      });
+    }
+  }
+
+  if (hasResponseRules() || hasSuffixMatchRules()) {
+    for (size_t idx = 0; idx < numberOfShards; idx++) {
+      g_rings.d_shards.at(idx)->respRing.visitSince(state.d_responsePositions.at(idx), [this, &state, oldest](const Rings::StoredResponse& response) {
+        if (response.when.tv_sec < oldest) {
+          return;
+        }
+
+        auto* buckets = hasResponseRules() ? state.getRequestorBuckets(AddressAndPortRange(response.requestor, response.requestor.isIPv4() ? d_v4Mask : d_v6Mask, d_portMask)) : nullptr;
+        if (buckets != nullptr) {
+          auto& bucket = (*buckets)[response.when.tv_sec];
+          ++bucket.responses;
+          if (d_respRateRule.isEnabled()) {
+            bucket.respBytes += response.size;
+          }
+          if (d_rcodeRules.count(response.dh.rcode) != 0 || d_rcodeRatioRules.count(response.dh.rcode) != 0) {
+            ++bucket.d_rcodeCounts[response.dh.rcode];
+          }
+        }
+
+        if (hasSuffixMatchRules()) {
+          auto& stat = state.getNameBuckets(response.name.get())[response.when.tv_sec];
+          ++stat.queries;
+          stat.bytes += response.size;
+          if (response.dh.rcode == 0 && response.usec == std::numeric_limits<unsigned int>::max()) {
+            ++stat.drops;
+          }
+          else if (response.dh.rcode == RCode::NoError) {
+            ++stat.noerrors;
+          }
+          else if (response.dh.rcode == RCode::ServFail) {
+            ++stat.servfails;
+          }
+          else if (response.dh.rcode == RCode::NXDomain) {
+            ++stat.nxdomains;
+          }
+        }
+      });
+    }
+  }
+
+  /* expire the buckets that are now outside of every window */
+  for (auto it = state.d_requestors.begin(); it != state.d_requestors.end();) {
+    it->second.erase(it->second.begin(), it->second.lower_bound(oldest));
+    if (it->second.empty()) {
+      it = state.d_requestors.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+
+  for (auto it = state.d_names.begin(); it != state.d_names.end();) {
+    it->second.erase(it->second.begin(), it->second.lower_bound(oldest));
+    if (it->second.empty()) {
+      it = state.d_names.erase(it);
+    }
+    else {
+      ++it;
+    }
+  }
+}
+
+void DynBlockRulesGroup::processIncrementalState(counts_t& counts, StatNode& root, const struct timespec& now)
+{
+  /* the buckets have a one-second granularity, so the windows start at the beginning of a second */
+  struct timespec responseCutOff = now;
+  const auto setCutOff = [&now, &responseCutOff](DynBlockRule& rule, bool isResponseRule) {
+    rule.d_minTime = now;
+    rule.d_cutOff.tv_sec = now.tv_sec - rule.d_seconds;
+    rule.d_cutOff.tv_nsec = 0;
+    if (isResponseRule && rule.d_cutOff < responseCutOff) {
+      responseCutOff = rule.d_cutOff;
+    }
+  };
+
+  setCutOff(d_queryRateRule, false);
+  for (auto& rule : d_qtypeRules) {
+    setCutOff(rule.second, false);
+  }
+  setCutOff(d_respRateRule, true);
+  setCutOff(d_suffixMatchRule, true);
+  for (auto& rule : d_rcodeRules) {
+    setCutOff(rule.second, true);
+  }
+  for (auto& rule : d_rcodeRatioRules) {
+    setCutOff(rule.second, true);
+  }
+
+  counts.reserve(d_incrementalState.d_requestors.size());
+  for (const auto& [requestor, buckets] : d_incrementalState.d_requestors) {
+    auto& entry = counts[requestor];
+    for (const auto& [second, bucket] : buckets) {
+      if (second > now.tv_sec) {
+        break;
+      }
+
+      const struct timespec when{second, 0};
+      if (bucket.queries > 0 && d_queryRateRule.matches(when)) {
+        entry.queries += bucket.queries;
+      }
+      for (const auto& [qtype, count] : bucket.d_qtypeCounts) {
+        if (checkIfQueryTypeMatches(qtype, when)) {
+          entry.d_qtypeCounts[qtype] += count;
+        }
+      }
+
+      if (bucket.responses == 0 || when < responseCutOff) {
+        continue;
+      }
+      entry.responses += bucket.responses;
+      if (d_respRateRule.matches(when)) {
+        entry.respBytes += bucket.respBytes;
+      }
+      for (const auto& [rcode, count] : bucket.d_rcodeCounts) {
+        if (checkIfResponseCodeMatches(rcode, when)) {
+          entry.d_rcodeCounts[rcode] += count;
+        }
+      }
+    }
+  }
+
+  for (const auto& [name, buckets] : d_incrementalState.d_names) {
+    StatNode::Stat stat;
+    for (const auto& [second, bucket] : buckets) {
+      if (second > now.tv_sec) {
+        break;
+      }
+      if (d_suffixMatchRule.matches({second, 0})) {
+        stat += bucket;
+      }
+    }
+    if (stat.queries > 0) {
+      root.submit(name, stat);
     }
   }
 }
@@ -0,0 +1,220 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-idstate.hh"
+#include "dnscrypt.hh"
+#include "dnsdist-random.hh"
+
+static uint32_t getStatus(uint32_t state)
+{
+  return state & IDState::s_statusMask;
+}
+
+static uint32_t getGeneration(uint32_t state)
+{
+  return state >> IDState::s_generationShift;
+}
+
+static uint32_t makeState(uint32_t generation, uint32_t status)
+{
+  return (generation << IDState::s_generationShift) | status;
+}
+
+void IDStateTable::resize(uint32_t slots, bool randomIDs)
+{
+  if (slots == 0 || slots > 65536) {
+    throw std::runtime_error("Invalid number of UDP states requested: " + std::to_string(slots));
+  }
+
+  d_size = slots;
+  d_randomIDs = randomIDs;
+  d_slotBits = 0;
+  while ((1U << d_slotBits) < slots) {
+    ++d_slotBits;
+  }
+  d_generationMask = (1U << (16 - d_slotBits)) - 1;
+  d_cursor = 0;
+
+  d_slots = std::make_unique<IDState[]>(slots);
+  const size_t words = (slots + 63) / 64;
+  d_inUse = std::make_unique<std::atomic<uint64_t>[]>(words);
+  for (size_t idx = 0; idx < words; ++idx) {
+    d_inUse[idx].store(0);
+  }
+}
+
+uint32_t IDStateTable::pickSlot()
+{
+  if (d_randomIDs) {
+    return dnsdist::getRandomValue(d_size);
+  }
+  return d_cursor++ % d_size;
+}
+
+uint32_t IDStateTable::nextGeneration(uint32_t generation)
+{
+  if (!d_randomIDs || d_generationMask == 0) {
+    return generation + 1;
+  }
+  /* the bits going into the ID are random, the remaining ones still
+     guarantee that the generation changes */
+  const uint32_t bits = 16 - d_slotBits;
+  return (((generation >> bits) + 1) << bits) | dnsdist::getRandomValue(d_generationMask + 1);
+}
+
+uint16_t IDStateTable::makeID(uint32_t slot, uint32_t generation) const
+{
+  if (d_generationMask == 0) {
+    return static_cast<uint16_t>(slot);
+  }
+  return static_cast<uint16_t>(((generation & d_generationMask) << d_slotBits) | slot);
+}
+
+/* only called by the thread owning the slot, so no-one else modifies the bit concurrently */
+void IDStateTable::markInUse(uint32_t slot)
+{
+  d_inUse[slot / 64].fetch_or(uint64_t(1) << (slot % 64));
+}
+
+void IDStateTable::markFree(uint32_t slot)
+{
+  d_inUse[slot / 64].fetch_and(~(uint64_t(1) << (slot % 64)));
+}
+
+uint16_t IDStateTable::save(InternalQueryState&& state, std::optional<InternalQueryState>& evicted)
+{
+  size_t attempts = 0;
+
+  do {
+    const uint32_t slot = pickSlot();
+    IDState& ids = d_slots[slot];
+    uint32_t current = ids.d_state.load();
+    const uint32_t status = getStatus(current);
+    if (status == IDState::s_busy) {
+      continue;
+    }
+    ++attempts;
+    /* if the slot is already in use we will try another one, up to s_maxAttempts
+       times. The last selected one is used even if it is in use */
+    if (status == IDState::s_inUse && attempts < s_maxAttempts) {
+      continue;
+    }
+
+    const uint32_t generation = nextGeneration(getGeneration(current));
+    if (!ids.d_state.compare_exchange_strong(current, makeState(generation, IDState::s_busy))) {
+      continue;
+    }
+
+    if (status == IDState::s_inUse) {
+      evicted = std::move(ids.internal);
+    }
+    else {
+      markInUse(slot);
+    }
+    ids.internal = std::move(state);
+    ids.age.store(0);
+    ids.d_state.store(makeState(generation, IDState::s_inUse));
+    return makeID(slot, generation);
+  }
+  while (true);
+}
+
+std::optional<InternalQueryState> IDStateTable::get(uint16_t id)
+{
+  std::optional<InternalQueryState> result = std::nullopt;
+  const uint32_t slot = id & ((1U << d_slotBits) - 1);
+  if (slot >= d_size) {
+    return result;
+  }
+
+  IDState& ids = d_slots[slot];
+  uint32_t current = ids.d_state.load();
+  if (getStatus(current) != IDState::s_inUse || makeID(slot, getGeneration(current)) != id) {
+    return result;
+  }
+
+  if (!ids.d_state.compare_exchange_strong(current, makeState(getGeneration(current), IDState::s_busy))) {
+    return result;
+  }
+
+  result = std::move(ids.internal);
+  markFree(slot);
+  ids.d_state.store(makeState(getGeneration(current), IDState::s_free));
+  return result;
+}
+
+bool IDStateTable::restore(uint16_t id, InternalQueryState&& state)
+{
+  const uint32_t slot = id & ((1U << d_slotBits) - 1);
+  if (slot >= d_size) {
+    return false;
+  }
+
+  IDState& ids = d_slots[slot];
+  uint32_t current = ids.d_state.load();
+  /* the generation is only changed when the slot is assigned to a new query,
+     so a free slot with the same generation has not been used since */
+  if (getStatus(current) != IDState::s_free || makeID(slot, getGeneration(current)) != id) {
+    return false;
+  }
+
+  if (!ids.d_state.compare_exchange_strong(current, makeState(getGeneration(current), IDState::s_busy))) {
+    return false;
+  }
+
+  markInUse(slot);
+  ids.internal = std::move(state);
+  ids.d_state.store(makeState(getGeneration(current), IDState::s_inUse));
+  return true;
+}
+
+void IDStateTable::expire(uint16_t maxAge, const std::function<void(InternalQueryState&)>& expired)
+{
+  const size_t words = (d_size + 63) / 64;
+  for (size_t word = 0; word < words; ++word) {
+    uint64_t bits = d_inUse[word].load();
+    while (bits != 0) {
+      const auto bit = static_cast<uint32_t>(__builtin_ctzll(bits));
+      bits &= bits - 1;
+      const uint32_t slot = word * 64 + bit;
+
+      IDState& ids = d_slots[slot];
+      uint32_t current = ids.d_state.load();
+      if (getStatus(current) != IDState::s_inUse) {
+        continue;
+      }
+      if (ids.age.load() <= maxAge) {
+        ++ids.age;
+        continue;
+      }
+      /* fails if the state has been retrieved, or the slot reused, in the meantime */
+      if (!ids.d_state.compare_exchange_strong(current, makeState(getGeneration(current), IDState::s_busy))) {
+        continue;
+      }
+
+      expired(ids.internal);
+      ids.age.store(0);
+      markFree(slot);
+      ids.d_state.store(makeState(getGeneration(current), IDState::s_free));
+    }
+  }
+}
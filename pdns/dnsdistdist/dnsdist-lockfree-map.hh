@@ -0,0 +1 @@
+../dnsdist-lockfree-map.hh
\ No newline at end of file
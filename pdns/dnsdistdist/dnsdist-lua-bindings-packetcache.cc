@@ -45,6 +45,7 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
       bool dontAge = false;
       bool deferrableInsertLock = true;
       bool ecsParsing = false;
+      bool lockFreeReads = false;
       std::unordered_set<uint16_t> optionsToSkip{EDNSOptionCode::COOKIE};
 
       if (vars) {
@@ -61,6 +62,10 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
           keepStaleData = boost::get<bool>((*vars)["keepStaleData"]);
         }
 
+        if (vars->count("lockFreeReads")) {
+          lockFreeReads = boost::get<bool>((*vars)["lockFreeReads"]);
+        }
+
         if (vars->count("maxNegativeTTL")) {
           maxNegativeTTL = boost::get<size_t>((*vars)["maxNegativeTTL"]);
         }
@@ -118,7 +123,7 @@ void setupLuaBindingsPacketCache(LuaContext& luaCtx, bool client)
         numberOfShards = 1;
       }
 
-      auto res = std::make_shared<DNSDistPacketCache>(maxEntries, maxTTL, minTTL, tempFailTTL, maxNegativeTTL, staleTTL, dontAge, numberOfShards, deferrableInsertLock, ecsParsing);
+      auto res = std::make_shared<DNSDistPacketCache>(maxEntries, maxTTL, minTTL, tempFailTTL, maxNegativeTTL, staleTTL, dontAge, numberOfShards, deferrableInsertLock, ecsParsing, lockFreeReads);
 
       res->setKeepStaleData(keepStaleData);
       res->setSkippedOptions(optionsToSkip);
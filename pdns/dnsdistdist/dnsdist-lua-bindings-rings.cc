@@ -69,14 +69,14 @@ void setupLuaBindingsRings(LuaContext& luaCtx, bool client)
 
     for (const auto& shard : g_rings.d_shards) {
       {
-        auto ql = shard->queryRing.lock();
-        for (const auto& entry : *ql) {
+        const auto ql = shard->queryRing.snapshot();
+        for (const auto& entry : ql) {
           addRingEntryToList(results, entry);
         }
       }
       {
-        auto rl = shard->respRing.lock();
-        for (const auto& entry : *rl) {
+        const auto rl = shard->respRing.snapshot();
+        for (const auto& entry : rl) {
           addRingEntryToList(results, entry);
         }
       }
@@ -598,7 +598,7 @@ int dnsdist_ffi_server_get_order(const dnsdist_ffi_server_t* server)
 
 double dnsdist_ffi_server_get_latency(const dnsdist_ffi_server_t* server)
 {
-  return server->server->latencyUsec;
+  return server->server->latencyUsec.load();
 }
 
 bool dnsdist_ffi_server_is_up(const dnsdist_ffi_server_t* server)
@@ -1004,14 +1004,14 @@ size_t dnsdist_ffi_ring_get_entries(dnsdist_ffi_ring_entry_list_t** out)
 
   for (const auto& shard : g_rings.d_shards) {
     {
-      auto ql = shard->queryRing.lock();
-      for (const auto& entry : *ql) {
+      const auto ql = shard->queryRing.snapshot();
+      for (const auto& entry : ql) {
         addRingEntryToList(list, entry);
       }
     }
     {
-      auto rl = shard->respRing.lock();
-      for (const auto& entry : *rl) {
+      const auto rl = shard->respRing.snapshot();
+      for (const auto& entry : rl) {
         addRingEntryToList(list, entry);
       }
     }
@@ -1043,8 +1043,8 @@ size_t dnsdist_ffi_ring_get_entries_by_addr(const char* addr, dnsdist_ffi_ring_e
   auto compare = ComboAddress::addressOnlyEqual();
   for (const auto& shard : g_rings.d_shards) {
     {
-      auto ql = shard->queryRing.lock();
-      for (const auto& entry : *ql) {
+      const auto ql = shard->queryRing.snapshot();
+      for (const auto& entry : ql) {
         if (!compare(entry.requestor, ca)) {
           continue;
         }
@@ -1053,8 +1053,8 @@ size_t dnsdist_ffi_ring_get_entries_by_addr(const char* addr, dnsdist_ffi_ring_e
       }
     }
     {
-      auto rl = shard->respRing.lock();
-      for (const auto& entry : *rl) {
+      const auto rl = shard->respRing.snapshot();
+      for (const auto& entry : rl) {
         if (!compare(entry.requestor, ca)) {
           continue;
         }
@@ -1083,8 +1083,8 @@ size_t dnsdist_ffi_ring_get_entries_by_mac(const char* addr, dnsdist_ffi_ring_en
   auto list = std::make_unique<dnsdist_ffi_ring_entry_list_t>();
 
   for (const auto& shard : g_rings.d_shards) {
-    auto ql = shard->queryRing.lock();
-    for (const auto& entry : *ql) {
+    const auto ql = shard->queryRing.snapshot();
+    for (const auto& entry : ql) {
       if (memcmp(addr, entry.macaddress.data(), entry.macaddress.size()) != 0) {
         continue;
       }
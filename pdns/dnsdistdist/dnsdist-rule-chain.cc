@@ -0,0 +1,288 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-rule-chain.hh"
+#include "dnsdist-rules.hh"
+
+namespace dnsdist::rules
+{
+/* what the compiled rules contributed, before being merged into the lookup structures */
+struct CompiledRuleChain::Builder
+{
+  /* a rule used in several places of the chain only needs one leaf */
+  std::unordered_map<const DNSRule*, uint16_t> d_leaves;
+  std::unordered_map<DNSName, LeafSet> d_names;
+  std::map<Netmask, std::vector<std::pair<uint16_t, bool>>> d_sources;
+  std::map<Netmask, std::vector<std::pair<uint16_t, bool>>> d_destinations;
+};
+
+/* a netmask matches the leaves whose most specific entry covering it is a positive one,
+   as NetmaskGroup does. Since the best match for an address in the merged tree is at least
+   as specific as the best match in each group, this also holds for the addresses it covers */
+static void buildNetmaskTree(NetmaskTree<CompiledRuleChain::LeafSet>& tree, const std::map<Netmask, std::vector<std::pair<uint16_t, bool>>>& masks)
+{
+  for (const auto& entry : masks) {
+    const auto& mask = entry.first;
+    CompiledRuleChain::LeafSet matching;
+    CompiledRuleChain::LeafSet seen;
+    for (int bits = mask.getBits(); bits >= 0; bits--) {
+      auto parent = masks.find(Netmask(mask.getNetwork(), static_cast<uint8_t>(bits)));
+      if (parent == masks.end()) {
+        continue;
+      }
+      for (const auto& [leaf, positive] : parent->second) {
+        if (seen.test(leaf)) {
+          continue;
+        }
+        seen.set(leaf);
+        if (positive) {
+          matching.set(leaf);
+        }
+      }
+    }
+    tree.insert(mask).second = matching;
+  }
+}
+
+CompiledRuleChain::CompiledRuleChain(const std::vector<DNSDistRuleAction>& rules)
+{
+  Builder builder;
+  d_entries.reserve(rules.size());
+
+  for (const auto& rule : rules) {
+    Entry entry{rule.d_rule, rule.d_action};
+    std::unordered_set<const DNSRule*> newLeaves;
+    /* not worth compiling a lone AllRule */
+    if (typeid(*rule.d_rule) != typeid(AllRule) && getNeededLeaves(*rule.d_rule, builder, newLeaves) && (d_leaves + newLeaves.size()) <= s_maxLeaves) {
+      entry.d_expression = static_cast<int32_t>(compile(*rule.d_rule, builder));
+    }
+    d_entries.push_back(std::move(entry));
+  }
+
+  /* a name matches the leaves of all its ancestors as well, so that
+     the longest match in the suffix tree holds every matching leaf */
+  for (const auto& entry : builder.d_names) {
+    LeafSet matching;
+    DNSName parent(entry.first);
+    do {
+      auto it = builder.d_names.find(parent);
+      if (it != builder.d_names.end()) {
+        matching |= it->second;
+      }
+    }
+    while (parent.chopOff());
+    d_suffixes.add(entry.first, std::move(matching));
+  }
+
+  buildNetmaskTree(d_sources, builder.d_sources);
+  buildNetmaskTree(d_destinations, builder.d_destinations);
+}
+
+bool CompiledRuleChain::isCompiledFrom(const std::vector<DNSDistRuleAction>& rules) const
+{
+  if (rules.size() != d_entries.size()) {
+    return false;
+  }
+
+  /* we hold a reference to the rules and actions, so their addresses cannot have been reused */
+  for (size_t idx = 0; idx < rules.size(); idx++) {
+    if (rules.at(idx).d_rule != d_entries.at(idx).d_rule || rules.at(idx).d_action != d_entries.at(idx).d_action) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* whether that rule can be compiled, adding the leaves it needs that do not exist yet to newLeaves */
+bool CompiledRuleChain::getNeededLeaves(const DNSRule& rule, const Builder& builder, std::unordered_set<const DNSRule*>& newLeaves)
+{
+  if (typeid(rule) == typeid(QTypeRule) || typeid(rule) == typeid(SuffixMatchNodeRule) || typeid(rule) == typeid(NetmaskGroupRule)) {
+    if (builder.d_leaves.count(&rule) == 0) {
+      newLeaves.insert(&rule);
+    }
+    return true;
+  }
+
+  if (typeid(rule) == typeid(AllRule)) {
+    return true;
+  }
+
+  if (typeid(rule) == typeid(NotRule)) {
+    return getNeededLeaves(*dynamic_cast<const NotRule&>(rule).getRule(), builder, newLeaves);
+  }
+
+  if (typeid(rule) == typeid(AndRule) || typeid(rule) == typeid(OrRule)) {
+    const auto& children = typeid(rule) == typeid(AndRule) ? dynamic_cast<const AndRule&>(rule).getRules() : dynamic_cast<const OrRule&>(rule).getRules();
+    for (const auto& child : children) {
+      if (!getNeededLeaves(*child, builder, newLeaves)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  return false;
+}
+
+uint32_t CompiledRuleChain::compile(const DNSRule& rule, Builder& builder)
+{
+  Expression expression;
+
+  if (typeid(rule) == typeid(AllRule)) {
+    expression.d_type = Expression::Type::True;
+  }
+  else if (typeid(rule) == typeid(NotRule)) {
+    expression.d_type = Expression::Type::Not;
+    expression.d_children.push_back(compile(*dynamic_cast<const NotRule&>(rule).getRule(), builder));
+  }
+  else if (typeid(rule) == typeid(AndRule) || typeid(rule) == typeid(OrRule)) {
+    const bool isAnd = typeid(rule) == typeid(AndRule);
+    expression.d_type = isAnd ? Expression::Type::And : Expression::Type::Or;
+    const auto& children = isAnd ? dynamic_cast<const AndRule&>(rule).getRules() : dynamic_cast<const OrRule&>(rule).getRules();
+    for (const auto& child : children) {
+      expression.d_children.push_back(compile(*child, builder));
+    }
+  }
+  else if (auto existing = builder.d_leaves.find(&rule); existing != builder.d_leaves.end()) {
+    expression.d_type = Expression::Type::Leaf;
+    expression.d_leaf = existing->second;
+  }
+  else {
+    const uint16_t leaf = d_leaves++;
+    builder.d_leaves.emplace(&rule, leaf);
+    expression.d_type = Expression::Type::Leaf;
+    expression.d_leaf = leaf;
+
+    if (typeid(rule) == typeid(QTypeRule)) {
+      d_qtypes[dynamic_cast<const QTypeRule&>(rule).getQType()].set(leaf);
+    }
+    else if (typeid(rule) == typeid(SuffixMatchNodeRule)) {
+      dynamic_cast<const SuffixMatchNodeRule&>(rule).getNames().visit([&builder, leaf](const DNSName& name) {
+        builder.d_names[name].set(leaf);
+      });
+    }
+    else {
+      const auto& nmgRule = dynamic_cast<const NetmaskGroupRule&>(rule);
+      auto& masks = nmgRule.isSource() ? builder.d_sources : builder.d_destinations;
+      std::vector<std::string> entries;
+      nmgRule.getNetmaskGroup().toStringVector(&entries);
+      for (const auto& entry : entries) {
+        const bool positive = entry.at(0) != '!';
+        masks[Netmask(positive ? entry : entry.substr(1))].emplace_back(leaf, positive);
+      }
+    }
+  }
+
+  d_expressions.push_back(std::move(expression));
+  return d_expressions.size() - 1;
+}
+
+CompiledRuleChain::LeafSet CompiledRuleChain::getMatchingLeaves(const DNSQuestion& dq) const
+{
+  LeafSet leaves;
+  if (d_leaves == 0) {
+    return leaves;
+  }
+
+  if (!d_qtypes.empty()) {
+    auto it = d_qtypes.find(dq.ids.qtype);
+    if (it != d_qtypes.end()) {
+      leaves |= it->second;
+    }
+  }
+
+  if (const auto* names = d_suffixes.lookup(dq.ids.qname)) {
+    leaves |= *names;
+  }
+
+  if (!d_sources.empty()) {
+    if (const auto* sources = d_sources.lookup(dq.ids.origRemote)) {
+      leaves |= sources->second;
+    }
+  }
+
+  if (!d_destinations.empty()) {
+    if (const auto* destinations = d_destinations.lookup(dq.ids.origDest)) {
+      leaves |= destinations->second;
+    }
+  }
+
+  return leaves;
+}
+
+bool CompiledRuleChain::evaluate(uint32_t expression, const LeafSet& leaves) const
+{
+  const auto& expr = d_expressions[expression];
+  switch (expr.d_type) {
+  case Expression::Type::True:
+    return true;
+  case Expression::Type::Leaf:
+    return leaves.test(expr.d_leaf);
+  case Expression::Type::Not:
+    return !evaluate(expr.d_children.at(0), leaves);
+  case Expression::Type::And:
+    for (const auto& child : expr.d_children) {
+      if (!evaluate(child, leaves)) {
+        return false;
+      }
+    }
+    return true;
+  case Expression::Type::Or:
+    for (const auto& child : expr.d_children) {
+      if (evaluate(child, leaves)) {
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+size_t CompiledRuleChain::getNumberOfCompiledRules() const
+{
+  return std::count_if(d_entries.begin(), d_entries.end(), [](const Entry& entry) {
+    return entry.d_expression >= 0;
+  });
+}
+
+static LockGuarded<std::shared_ptr<const CompiledRuleChain>> s_lastCompiledChain{nullptr};
+
+const CompiledRuleChain& CompiledRuleChainHolder::get(LocalStateHolder<vector<DNSDistRuleAction>>& rules)
+{
+  const auto& current = *rules;
+  const auto generation = rules.getGeneration();
+  if (d_chain && generation == d_generation) {
+    return *d_chain;
+  }
+
+  {
+    /* the first thread noticing the change compiles the new rules, the other ones reuse them */
+    auto last = s_lastCompiledChain.lock();
+    if (!*last || !(*last)->isCompiledFrom(current)) {
+      *last = std::make_shared<const CompiledRuleChain>(current);
+    }
+    d_chain = *last;
+  }
+  d_generation = generation;
+  return *d_chain;
+}
+}
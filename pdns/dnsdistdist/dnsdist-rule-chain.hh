@@ -0,0 +1,108 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <bitset>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "dnsdist.hh"
+
+namespace dnsdist::rules
+{
+/* A snapshot of a chain of query rules, in which the rules that only depend on the
+   qname, qtype and addresses of the query (QNameSuffixRule, NetmaskGroupRule,
+   QTypeRule, and any AndRule, OrRule or NotRule built from them) are compiled into
+   one suffix tree, two netmask trees and a qtype map. Each of these rules is a 'leaf',
+   and a single lookup in each structure gives the set of leaves matching a query,
+   replacing what used to be one virtual call and one lookup per rule.
+   The remaining rules are evaluated the usual way, in order, so rules with side
+   effects (MaxQPSIPRule, ProbaRule, Lua rules...) still only see the queries that
+   reach them. */
+class CompiledRuleChain
+{
+public:
+  static constexpr size_t s_maxLeaves = 256;
+  using LeafSet = std::bitset<s_maxLeaves>;
+
+  struct Entry
+  {
+    std::shared_ptr<DNSRule> d_rule;
+    std::shared_ptr<DNSAction> d_action;
+    /* index of the compiled expression, -1 if the rule is not compiled */
+    int32_t d_expression{-1};
+  };
+
+  CompiledRuleChain(const std::vector<DNSDistRuleAction>& rules);
+
+  /* whether this chain is an up-to-date snapshot of these rules */
+  bool isCompiledFrom(const std::vector<DNSDistRuleAction>& rules) const;
+
+  const std::vector<Entry>& getEntries() const
+  {
+    return d_entries;
+  }
+
+  /* the leaves matching that query, to be passed to matches() for all the entries of the chain */
+  LeafSet getMatchingLeaves(const DNSQuestion& dq) const;
+
+  bool matches(const Entry& entry, const DNSQuestion& dq, const LeafSet& leaves) const
+  {
+    if (entry.d_expression < 0) {
+      return entry.d_rule->matches(&dq);
+    }
+    return evaluate(static_cast<uint32_t>(entry.d_expression), leaves);
+  }
+
+  size_t getNumberOfCompiledRules() const;
+
+private:
+  struct Expression
+  {
+    enum class Type : uint8_t
+    {
+      True,
+      Leaf,
+      And,
+      Or,
+      Not
+    };
+    std::vector<uint32_t> d_children;
+    uint16_t d_leaf{0};
+    Type d_type;
+  };
+
+  struct Builder;
+
+  bool evaluate(uint32_t expression, const LeafSet& leaves) const;
+  static bool getNeededLeaves(const DNSRule& rule, const Builder& builder, std::unordered_set<const DNSRule*>& newLeaves);
+  uint32_t compile(const DNSRule& rule, Builder& builder);
+
+  std::vector<Entry> d_entries;
+  std::vector<Expression> d_expressions;
+  std::unordered_map<uint16_t, LeafSet> d_qtypes;
+  SuffixMatchTree<LeafSet> d_suffixes;
+  NetmaskTree<LeafSet> d_sources;
+  NetmaskTree<LeafSet> d_destinations;
+  uint16_t d_leaves{0};
+};
+}
@@ -212,6 +212,14 @@ public:
     }
     return ret + d_nmg.toString();
   }
+  const NetmaskGroup& getNetmaskGroup() const
+  {
+    return d_nmg;
+  }
+  bool isSource() const
+  {
+    return d_src;
+  }
 private:
   bool d_src;
   bool d_quiet;
@@ -421,6 +429,10 @@ public:
     }
     return ret;
   }
+  const vector<std::shared_ptr<DNSRule> >& getRules() const
+  {
+    return d_rules;
+  }
 private:
 
   vector<std::shared_ptr<DNSRule> > d_rules;
@@ -457,6 +469,10 @@ public:
     }
     return ret;
   }
+  const vector<std::shared_ptr<DNSRule> >& getRules() const
+  {
+    return d_rules;
+  }
 private:
 
   vector<std::shared_ptr<DNSRule> > d_rules;
@@ -579,6 +595,10 @@ public:
     else
       return "qname in "+d_smn.toString();
   }
+  const SuffixMatchNode& getNames() const
+  {
+    return d_smn;
+  }
 private:
   SuffixMatchNode d_smn;
   bool d_quiet;
@@ -635,6 +655,10 @@ public:
     QType qt(d_qtype);
     return "qtype=="+qt.toString();
   }
+  uint16_t getQType() const
+  {
+    return d_qtype;
+  }
 private:
   uint16_t d_qtype;
 };
@@ -726,6 +750,10 @@ public:
   {
     return "!("+ d_rule->toString()+")";
   }
+  const shared_ptr<DNSRule>& getRule() const
+  {
+    return d_rule;
+  }
 private:
   shared_ptr<DNSRule> d_rule;
 };
@@ -0,0 +1,276 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace dnsdist
+{
+/* Estimates the number of occurrences of a key, known only by its hash, using a fixed
+   amount of memory: depth rows of width counters, a key being mapped to one counter
+   in each row. The estimate is the smallest of these counters, so it can only be
+   larger than the real count, never smaller.
+   Updates are conservative: only the counters that are lower than the new estimate
+   are raised, which greatly reduces the over-estimation caused by collisions. */
+class CountMinSketch
+{
+public:
+  /* width is rounded up to the next power of two */
+  CountMinSketch(size_t width, size_t depth): d_depth(std::max(depth, static_cast<size_t>(1)))
+  {
+    d_width = 1;
+    while (d_width < width) {
+      d_width <<= 1;
+    }
+    d_counters.resize(d_width * d_depth, 0);
+  }
+
+  /* returns the new estimate for that key */
+  uint64_t add(size_t hash, uint64_t count = 1)
+  {
+    const auto hashes = getHashes(hash);
+    const uint64_t estimate = getEstimate(hashes) + count;
+    for (size_t row = 0; row < d_depth; row++) {
+      auto& counter = d_counters[getIndex(row, hashes)];
+      counter = std::max(counter, estimate);
+    }
+    return estimate;
+  }
+
+  uint64_t estimate(size_t hash) const
+  {
+    return getEstimate(getHashes(hash));
+  }
+
+  void clear()
+  {
+    std::fill(d_counters.begin(), d_counters.end(), 0);
+  }
+
+  size_t getWidth() const
+  {
+    return d_width;
+  }
+
+  size_t getDepth() const
+  {
+    return d_depth;
+  }
+
+private:
+  /* the hash of the key is mixed and split into two halves, which are then combined
+     to get the position in each row (double hashing) */
+  static std::pair<uint32_t, uint32_t> getHashes(size_t hash)
+  {
+    uint64_t mixed = static_cast<uint64_t>(hash);
+    mixed ^= mixed >> 33;
+    mixed *= 0xff51afd7ed558ccdULL;
+    mixed ^= mixed >> 33;
+    mixed *= 0xc4ceb9fe1a85ec53ULL;
+    mixed ^= mixed >> 33;
+    return {static_cast<uint32_t>(mixed), static_cast<uint32_t>(mixed >> 32) | 1};
+  }
+
+  size_t getIndex(size_t row, const std::pair<uint32_t, uint32_t>& hashes) const
+  {
+    return (row * d_width) + ((hashes.first + row * hashes.second) & (d_width - 1));
+  }
+
+  uint64_t getEstimate(const std::pair<uint32_t, uint32_t>& hashes) const
+  {
+    uint64_t result = std::numeric_limits<uint64_t>::max();
+    for (size_t row = 0; row < d_depth; row++) {
+      result = std::min(result, d_counters[getIndex(row, hashes)]);
+    }
+    return result;
+  }
+
+  std::vector<uint64_t> d_counters;
+  size_t d_width{0};
+  size_t d_depth{0};
+};
+
+/* Keeps track of the capacity keys that have been seen the most, using a bounded amount
+   of memory regardless of the number of distinct keys: every key updates a count-min sketch,
+   and the keys whose estimate is the highest are kept in a min-heap along with that estimate,
+   a new key replacing the lowest one when its estimate becomes larger.
+   The cost of an update does not depend on the number of distinct keys, only (logarithmically)
+   on the capacity. Counts are estimates, they can be higher than the real ones but not lower. */
+template <typename Key, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class HeavyHitters
+{
+public:
+  /* a width of 0 means the default one, 16 counters per tracked key but at least 65536
+     counters, so that the sketch is not saturated by a large number of light keys */
+  HeavyHitters(size_t capacity, size_t width = 0, size_t depth = 4): d_sketch(width > 0 ? width : getDefaultWidth(capacity), depth), d_capacity(capacity)
+  {
+    d_heap.reserve(capacity);
+    d_positions.reserve(capacity);
+  }
+
+  void add(const Key& key, uint64_t count = 1)
+  {
+    d_total += count;
+    const uint64_t estimate = d_sketch.add(d_hash(key), count);
+
+    auto it = d_positions.find(key);
+    if (it != d_positions.end()) {
+      auto& entry = d_heap[it->second];
+      entry.count = estimate;
+      siftDown(it->second);
+      return;
+    }
+
+    if (d_heap.size() < d_capacity) {
+      d_heap.push_back({key, estimate});
+      d_positions.emplace(key, d_heap.size() - 1);
+      siftUp(d_heap.size() - 1);
+      return;
+    }
+
+    if (d_heap.empty() || estimate <= d_heap.front().count) {
+      return;
+    }
+
+    /* replace the tracked key with the lowest count */
+    d_positions.erase(d_heap.front().key);
+    d_heap.front() = {key, estimate};
+    d_positions.emplace(key, 0);
+    siftDown(0);
+  }
+
+  static size_t getDefaultWidth(size_t capacity)
+  {
+    return std::max(capacity * 16, static_cast<size_t>(65536));
+  }
+
+  /* the estimate for any key, tracked or not */
+  uint64_t estimate(const Key& key) const
+  {
+    return d_sketch.estimate(d_hash(key));
+  }
+
+  /* the tracked keys and their estimated counts, highest first */
+  std::vector<std::pair<Key, uint64_t>> getTop(size_t numberOfEntries = std::numeric_limits<size_t>::max()) const
+  {
+    std::vector<std::pair<Key, uint64_t>> result;
+    result.reserve(d_heap.size());
+    for (const auto& entry : d_heap) {
+      result.emplace_back(entry.key, entry.count);
+    }
+    std::sort(result.begin(), result.end(), [](const std::pair<Key, uint64_t>& lhs, const std::pair<Key, uint64_t>& rhs) {
+      return lhs.second > rhs.second;
+    });
+    if (result.size() > numberOfEntries) {
+      result.resize(numberOfEntries);
+    }
+    return result;
+  }
+
+  /* call visitor(key, count) for every tracked key, in no particular order */
+  template <typename F>
+  void visit(F visitor) const
+  {
+    for (const auto& entry : d_heap) {
+      visitor(entry.key, entry.count);
+    }
+  }
+
+  /* the exact sum of all the counts that have been added */
+  uint64_t getTotal() const
+  {
+    return d_total;
+  }
+
+  size_t size() const
+  {
+    return d_heap.size();
+  }
+
+  void clear()
+  {
+    d_heap.clear();
+    d_positions.clear();
+    d_sketch.clear();
+    d_total = 0;
+  }
+
+private:
+  struct Entry
+  {
+    Key key;
+    uint64_t count;
+  };
+
+  void swapEntries(size_t first, size_t second)
+  {
+    std::swap(d_heap[first], d_heap[second]);
+    d_positions[d_heap[first].key] = first;
+    d_positions[d_heap[second].key] = second;
+  }
+
+  void siftUp(size_t pos)
+  {
+    while (pos > 0) {
+      const size_t parent = (pos - 1) / 2;
+      if (d_heap[parent].count <= d_heap[pos].count) {
+        break;
+      }
+      swapEntries(parent, pos);
+      pos = parent;
+    }
+  }
+
+  void siftDown(size_t pos)
+  {
+    const size_t size = d_heap.size();
+    while (true) {
+      const size_t left = (2 * pos) + 1;
+      const size_t right = left + 1;
+      size_t smallest = pos;
+      if (left < size && d_heap[left].count < d_heap[smallest].count) {
+        smallest = left;
+      }
+      if (right < size && d_heap[right].count < d_heap[smallest].count) {
+        smallest = right;
+      }
+      if (smallest == pos) {
+        break;
+      }
+      swapEntries(pos, smallest);
+      pos = smallest;
+    }
+  }
+
+  std::vector<Entry> d_heap;
+  std::unordered_map<Key, size_t, Hash, KeyEqual> d_positions;
+  CountMinSketch d_sketch;
+  Hash d_hash;
+  const size_t d_capacity;
+  uint64_t d_total{0};
+};
+}
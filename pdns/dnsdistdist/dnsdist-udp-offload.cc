@@ -0,0 +1,224 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dnsdist-udp-offload.hh"
+
+bool g_udpSegmentationOffload{false};
+
+namespace dnsdist::udp
+{
+bool enableGRO(int fd)
+{
+#ifdef UDP_GRO
+  int on = 1;
+  return setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == 0;
+#else
+  return false;
+#endif
+}
+
+bool isGSOSupported()
+{
+#ifdef UDP_SEGMENT
+  static const bool supported = []() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+      return false;
+    }
+    int segmentSize = 0;
+    socklen_t len = sizeof(segmentSize);
+    bool result = getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segmentSize, &len) == 0;
+    close(fd);
+    return result;
+  }();
+  return supported;
+#else
+  return false;
+#endif
+}
+
+uint16_t getGROSegmentSize(const struct msghdr* msgh)
+{
+#ifdef UDP_GRO
+  for (auto cmsg = CMSG_FIRSTHDR(msgh); cmsg != nullptr; cmsg = CMSG_NXTHDR(const_cast<struct msghdr*>(msgh), const_cast<struct cmsghdr*>(cmsg))) {
+    if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO && cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+      int segmentSize = 0;
+      memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+      return static_cast<uint16_t>(segmentSize);
+    }
+  }
+#endif
+  return 0;
+}
+
+#ifdef UDP_SEGMENT
+static bool canBeCoalesced(const struct msghdr& first, const struct msghdr& other)
+{
+  if (other.msg_iovlen != 1 || first.msg_namelen != other.msg_namelen || first.msg_controllen != other.msg_controllen) {
+    return false;
+  }
+  if (!(*reinterpret_cast<const ComboAddress*>(first.msg_name) == *reinterpret_cast<const ComboAddress*>(other.msg_name))) {
+    return false;
+  }
+  return first.msg_controllen == 0 || first.msg_control == other.msg_control || memcmp(first.msg_control, other.msg_control, first.msg_controllen) == 0;
+}
+#endif
+
+std::pair<struct mmsghdr*, unsigned int> GSOCoalescer::coalesce(struct mmsghdr* msgs, unsigned int count)
+{
+#ifdef UDP_SEGMENT
+  d_msgs.clear();
+  d_iovs.clear();
+  d_cbufs.clear();
+  /* we keep pointers to these, so they should not be reallocated */
+  d_msgs.reserve(count);
+  d_iovs.reserve(count);
+  d_cbufs.reserve(count);
+
+  unsigned int idx = 0;
+  while (idx < count) {
+    const auto& first = msgs[idx].msg_hdr;
+    unsigned int end = idx + 1;
+    if (first.msg_iovlen == 1 && first.msg_controllen + CMSG_SPACE(sizeof(uint16_t)) <= sizeof(cmsgbuf_aligned)) {
+      const size_t segmentSize = first.msg_iov[0].iov_len;
+      size_t total = segmentSize;
+      while (end < count && (end - idx) < s_maxSegments && canBeCoalesced(first, msgs[end].msg_hdr)) {
+        const size_t len = msgs[end].msg_hdr.msg_iov[0].iov_len;
+        /* only the last segment can be smaller */
+        if (msgs[end - 1].msg_hdr.msg_iov[0].iov_len != segmentSize || len > segmentSize || (total + len) > s_maxPayloadSize) {
+          break;
+        }
+        total += len;
+        ++end;
+      }
+    }
+
+    if (end - idx == 1) {
+      d_msgs.push_back(msgs[idx]);
+      ++idx;
+      continue;
+    }
+
+    const auto iovStart = d_iovs.size();
+    for (auto pos = idx; pos < end; ++pos) {
+      d_iovs.push_back(msgs[pos].msg_hdr.msg_iov[0]);
+    }
+
+    struct mmsghdr coalesced;
+    memset(&coalesced, 0, sizeof(coalesced));
+    coalesced.msg_hdr.msg_name = first.msg_name;
+    coalesced.msg_hdr.msg_namelen = first.msg_namelen;
+    coalesced.msg_hdr.msg_iov = &d_iovs.at(iovStart);
+    coalesced.msg_hdr.msg_iovlen = end - idx;
+
+    auto& cbuf = d_cbufs.emplace_back();
+    memset(&cbuf, 0, sizeof(cbuf));
+    if (first.msg_controllen > 0) {
+      memcpy(&cbuf, first.msg_control, first.msg_controllen);
+    }
+    coalesced.msg_hdr.msg_control = &cbuf;
+    coalesced.msg_hdr.msg_controllen = first.msg_controllen + CMSG_SPACE(sizeof(uint16_t));
+    /* the existing control messages are already padded, so the next one starts right after them */
+    auto* cmsg = reinterpret_cast<struct cmsghdr*>(reinterpret_cast<char*>(&cbuf) + first.msg_controllen);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    const uint16_t segmentSize = first.msg_iov[0].iov_len;
+    memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+
+    d_msgs.push_back(coalesced);
+    idx = end;
+  }
+
+  return {d_msgs.data(), d_msgs.size()};
+#else
+  return {msgs, count};
+#endif
+}
+
+#ifdef UDP_SEGMENT
+/* sends the datagrams of a coalesced message as separate messages */
+static void sendSegments(int fd, const struct msghdr& coalesced, const std::function<void(size_t index, int error)>& report)
+{
+  std::vector<struct mmsghdr> segments(coalesced.msg_iovlen);
+  /* the UDP_SEGMENT control message has been added after the existing ones by GSOCoalescer::coalesce() */
+  const size_t controlLen = coalesced.msg_controllen - CMSG_SPACE(sizeof(uint16_t));
+  for (size_t idx = 0; idx < segments.size(); idx++) {
+    auto& msgh = segments.at(idx).msg_hdr;
+    memset(&segments.at(idx), 0, sizeof(segments.at(idx)));
+    msgh.msg_name = coalesced.msg_name;
+    msgh.msg_namelen = coalesced.msg_namelen;
+    msgh.msg_iov = &coalesced.msg_iov[idx];
+    msgh.msg_iovlen = 1;
+    if (controlLen > 0) {
+      msgh.msg_control = coalesced.msg_control;
+      msgh.msg_controllen = controlLen;
+    }
+  }
+  sendMessages(fd, segments.data(), segments.size(), report);
+}
+#endif
+
+bool sendMessages(int fd, struct mmsghdr* msgs, unsigned int count, const std::function<void(size_t index, int error)>& report)
+{
+  bool segmentationWorked = true;
+  size_t datagram = 0;
+  const auto reportMessage = [&datagram, &report](const struct mmsghdr& msg, int error) {
+    /* a message that has not been coalesced has a single iovec */
+    const size_t datagrams = std::max(static_cast<size_t>(msg.msg_hdr.msg_iovlen), static_cast<size_t>(1));
+    for (size_t idx = 0; idx < datagrams; idx++) {
+      report(datagram++, error);
+    }
+  };
+
+  unsigned int done = 0;
+  while (done < count) {
+    int sent = sendmmsg(fd, &msgs[done], count - done, 0);
+    if (sent <= 0) {
+      /* the error is about the first message we tried to send */
+      const int error = sent < 0 ? errno : EIO;
+#ifdef UDP_SEGMENT
+      if (msgs[done].msg_hdr.msg_iovlen > 1 && (error == EIO || error == EINVAL)) {
+        segmentationWorked = false;
+        const size_t first = datagram;
+        sendSegments(fd, msgs[done].msg_hdr, [first, &report](size_t index, int segmentError) {
+          report(first + index, segmentError);
+        });
+        datagram += msgs[done].msg_hdr.msg_iovlen;
+        ++done;
+        continue;
+      }
+#endif
+      reportMessage(msgs[done], error);
+      ++done;
+      continue;
+    }
+
+    for (int idx = 0; idx < sent; idx++) {
+      reportMessage(msgs[done + idx], 0);
+    }
+    done += static_cast<unsigned int>(sent);
+  }
+
+  return segmentationWorked;
+}
+}
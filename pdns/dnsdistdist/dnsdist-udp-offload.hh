@@ -0,0 +1,77 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+#include "iputils.hh"
+#include "misc.hh"
+
+/* whether UDP Generic Receive Offload should be enabled on frontend sockets,
+   and UDP Generic Segmentation Offload used to send responses */
+extern bool g_udpSegmentationOffload;
+
+namespace dnsdist::udp
+{
+/* UDP_MAX_SEGMENTS in older kernels, the kernel refuses to send more segments than that in a single message */
+static constexpr size_t s_maxSegments{64};
+/* the largest UDP payload (IPv4), which is also the buffer size needed to receive a message coalesced by GRO */
+static constexpr size_t s_maxPayloadSize{65507};
+
+/* enable GRO on that socket, returns false if it is not supported */
+bool enableGRO(int fd);
+/* whether the kernel supports sending several segments at once (UDP_SEGMENT) */
+bool isGSOSupported();
+/* returns the size of the segments if several datagrams have been coalesced by GRO into the received message, 0 otherwise */
+uint16_t getGROSegmentSize(const struct msghdr* msgh);
+
+/* Coalesces consecutive messages sent to the same destination, from the same source, into a single GSO message.
+   This is only possible when all the coalesced messages but the last one have the same size, and the last one
+   is not larger than the others. */
+class GSOCoalescer
+{
+public:
+  /* returns a pointer to the messages to pass to sendmmsg(), and their number.
+     The messages are only valid until the next call, and point to the data and addresses of the initial messages. */
+  std::pair<struct mmsghdr*, unsigned int> coalesce(struct mmsghdr* msgs, unsigned int count);
+
+private:
+  std::vector<struct mmsghdr> d_msgs;
+  std::vector<struct iovec> d_iovs;
+  std::vector<cmsgbuf_aligned> d_cbufs;
+};
+
+/* Sends the messages with as few sendmmsg() calls as possible: after a partial send the remaining
+   messages are sent again, and a message that cannot be sent is skipped, so that one unreachable
+   destination does not prevent the others from getting theirs.
+   report(index, error) is then called for every datagram, in order, with error set to 0 if it has been
+   sent and to errno otherwise. Messages coalesced by a GSOCoalescer count for as many datagrams as they
+   have segments, so index is the position of the datagram in the messages before they were coalesced.
+   If the kernel refuses a coalesced message (EIO, EINVAL), for example because the outgoing device does
+   not support it, its datagrams are sent one by one instead and false is returned, in which case messages
+   sent over that socket should no longer be coalesced. */
+bool sendMessages(int fd, struct mmsghdr* msgs, unsigned int count, const std::function<void(size_t index, int error)>& report);
+}
@@ -0,0 +1,454 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#include "dnsdist-xsk.hh"
+
+#ifdef HAVE_XSK
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "bpf-filter.hh"
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+namespace dnsdist::xsk
+{
+static constexpr uint8_t s_defaultTTL{64};
+
+/* the Internet checksum (RFC 1071) of data, starting from sum, not folded */
+static uint32_t checksumPartial(const uint8_t* data, size_t len, uint32_t sum)
+{
+  size_t idx = 0;
+  for (; idx + 1 < len; idx += 2) {
+    sum += (static_cast<uint32_t>(data[idx]) << 8) | data[idx + 1];
+  }
+  if (idx < len) {
+    sum += static_cast<uint32_t>(data[idx]) << 8;
+  }
+  return sum;
+}
+
+/* folds the sum, returning the checksum in network byte order */
+static uint16_t checksumFold(uint32_t sum)
+{
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  return htons(static_cast<uint16_t>(~sum));
+}
+
+XskPacket::XskPacket(uint8_t* frame, size_t length, size_t capacity, uint64_t address) :
+  d_frame(frame), d_address(address), d_capacity(capacity), d_length(length)
+{
+}
+
+bool XskPacket::parse()
+{
+  if (d_length < sizeof(struct ether_header)) {
+    return false;
+  }
+
+  struct ether_header eth;
+  memcpy(&eth, d_frame, sizeof(eth));
+  size_t udpOffset = 0;
+  if (eth.ether_type == htons(ETHERTYPE_IP)) {
+    if (d_length < sizeof(eth) + sizeof(struct iphdr) + sizeof(struct udphdr)) {
+      return false;
+    }
+    struct iphdr ip;
+    memcpy(&ip, d_frame + sizeof(eth), sizeof(ip));
+    /* no options, no fragments */
+    if (ip.version != 4 || ip.ihl != 5 || ip.protocol != IPPROTO_UDP || (ip.frag_off & htons(IP_MF | IP_OFFMASK)) != 0) {
+      return false;
+    }
+    if (ntohs(ip.tot_len) < sizeof(ip) + sizeof(struct udphdr) || sizeof(eth) + ntohs(ip.tot_len) > d_length) {
+      return false;
+    }
+    d_from.sin4.sin_family = AF_INET;
+    d_from.sin4.sin_addr.s_addr = ip.saddr;
+    d_to.sin4.sin_family = AF_INET;
+    d_to.sin4.sin_addr.s_addr = ip.daddr;
+    udpOffset = sizeof(eth) + sizeof(ip);
+    /* the frame might have been padded */
+    d_length = sizeof(eth) + ntohs(ip.tot_len);
+  }
+  else if (eth.ether_type == htons(ETHERTYPE_IPV6)) {
+    if (d_length < sizeof(eth) + sizeof(struct ip6_hdr) + sizeof(struct udphdr)) {
+      return false;
+    }
+    struct ip6_hdr ip6;
+    memcpy(&ip6, d_frame + sizeof(eth), sizeof(ip6));
+    /* no extension headers */
+    if ((ip6.ip6_vfc >> 4) != 6 || ip6.ip6_nxt != IPPROTO_UDP) {
+      return false;
+    }
+    if (ntohs(ip6.ip6_plen) < sizeof(struct udphdr) || sizeof(eth) + sizeof(ip6) + ntohs(ip6.ip6_plen) > d_length) {
+      return false;
+    }
+    d_from.sin6.sin6_family = AF_INET6;
+    memcpy(&d_from.sin6.sin6_addr, &ip6.ip6_src, sizeof(d_from.sin6.sin6_addr));
+    d_to.sin6.sin6_family = AF_INET6;
+    memcpy(&d_to.sin6.sin6_addr, &ip6.ip6_dst, sizeof(d_to.sin6.sin6_addr));
+    udpOffset = sizeof(eth) + sizeof(ip6);
+    d_length = sizeof(eth) + sizeof(ip6) + ntohs(ip6.ip6_plen);
+  }
+  else {
+    return false;
+  }
+
+  struct udphdr udp;
+  memcpy(&udp, d_frame + udpOffset, sizeof(udp));
+  if (ntohs(udp.len) < sizeof(udp) || udpOffset + ntohs(udp.len) > d_length) {
+    return false;
+  }
+  d_from.sin4.sin_port = udp.source;
+  d_to.sin4.sin_port = udp.dest;
+  d_payloadOffset = udpOffset + sizeof(udp);
+  d_payloadLength = ntohs(udp.len) - sizeof(udp);
+  return true;
+}
+
+PacketBuffer XskPacket::getPayload() const
+{
+  return PacketBuffer(d_frame + d_payloadOffset, d_frame + d_payloadOffset + d_payloadLength);
+}
+
+bool XskPacket::setResponse(const PacketBuffer& response)
+{
+  if (d_payloadOffset + response.size() > d_capacity || response.size() > (std::numeric_limits<uint16_t>::max() - sizeof(struct udphdr) - sizeof(struct ip6_hdr))) {
+    return false;
+  }
+
+  struct ether_header eth;
+  memcpy(&eth, d_frame, sizeof(eth));
+  uint8_t mac[ETH_ALEN];
+  memcpy(mac, eth.ether_shost, sizeof(mac));
+  memcpy(eth.ether_shost, eth.ether_dhost, sizeof(mac));
+  memcpy(eth.ether_dhost, mac, sizeof(mac));
+  memcpy(d_frame, &eth, sizeof(eth));
+
+  const uint16_t udpLength = sizeof(struct udphdr) + response.size();
+  uint32_t sum = 0;
+  size_t udpOffset = 0;
+  if (d_from.isIPv4()) {
+    struct iphdr ip;
+    memcpy(&ip, d_frame + sizeof(eth), sizeof(ip));
+    std::swap(ip.saddr, ip.daddr);
+    ip.tot_len = htons(sizeof(ip) + udpLength);
+    ip.frag_off = 0;
+    ip.ttl = s_defaultTTL;
+    ip.check = 0;
+    ip.check = checksumFold(checksumPartial(reinterpret_cast<const uint8_t*>(&ip), sizeof(ip), 0));
+    memcpy(d_frame + sizeof(eth), &ip, sizeof(ip));
+    /* pseudo-header: addresses, protocol and UDP length */
+    sum = checksumPartial(reinterpret_cast<const uint8_t*>(&ip.saddr), sizeof(ip.saddr) + sizeof(ip.daddr), 0);
+    udpOffset = sizeof(eth) + sizeof(ip);
+  }
+  else {
+    struct ip6_hdr ip6;
+    memcpy(&ip6, d_frame + sizeof(eth), sizeof(ip6));
+    std::swap(ip6.ip6_src, ip6.ip6_dst);
+    ip6.ip6_plen = htons(udpLength);
+    ip6.ip6_hlim = s_defaultTTL;
+    memcpy(d_frame + sizeof(eth), &ip6, sizeof(ip6));
+    sum = checksumPartial(reinterpret_cast<const uint8_t*>(&ip6.ip6_src), sizeof(ip6.ip6_src) + sizeof(ip6.ip6_dst), 0);
+    udpOffset = sizeof(eth) + sizeof(ip6);
+  }
+  sum += IPPROTO_UDP;
+  sum += udpLength;
+
+  struct udphdr udp;
+  udp.source = d_to.sin4.sin_port;
+  udp.dest = d_from.sin4.sin_port;
+  udp.len = htons(udpLength);
+  udp.check = 0;
+  memcpy(d_frame + udpOffset, &udp, sizeof(udp));
+  memcpy(d_frame + d_payloadOffset, response.data(), response.size());
+
+  uint16_t check = checksumFold(checksumPartial(d_frame + udpOffset, udpLength, sum));
+  if (check == 0) {
+    /* a zero checksum means 'no checksum' */
+    check = 0xffff;
+  }
+  memcpy(d_frame + udpOffset + offsetof(struct udphdr, check), &check, sizeof(check));
+
+  d_payloadLength = response.size();
+  d_length = d_payloadOffset + response.size();
+  return true;
+}
+
+XskSocket::XskSocket(const std::string& interface, uint32_t queue, uint32_t frameCount) :
+  d_queue(queue)
+{
+  if (frameCount == 0 || (frameCount & (frameCount - 1)) != 0) {
+    throw std::runtime_error("The number of frames of an AF_XDP socket has to be a power of two, not " + std::to_string(frameCount));
+  }
+
+  const auto ifIndex = if_nametoindex(interface.c_str());
+  if (ifIndex == 0) {
+    throw std::runtime_error("Unable to find the index of interface '" + interface + "': " + stringerror());
+  }
+
+  d_fd = FDWrapper(socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0));
+  if (d_fd.getHandle() == -1) {
+    throw std::runtime_error("Error creating an AF_XDP socket: " + stringerror());
+  }
+
+  d_umemSize = static_cast<size_t>(frameCount) * s_frameSize;
+  void* umem = mmap(nullptr, d_umemSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (umem == MAP_FAILED) {
+    throw std::runtime_error("Error allocating the UMEM of an AF_XDP socket: " + stringerror());
+  }
+  d_umem = static_cast<uint8_t*>(umem);
+
+  try {
+    struct xdp_umem_reg umemReg;
+    memset(&umemReg, 0, sizeof(umemReg));
+    umemReg.addr = reinterpret_cast<uint64_t>(d_umem);
+    umemReg.len = d_umemSize;
+    umemReg.chunk_size = s_frameSize;
+    umemReg.headroom = 0;
+    if (setsockopt(d_fd.getHandle(), SOL_XDP, XDP_UMEM_REG, &umemReg, sizeof(umemReg)) != 0) {
+      throw std::runtime_error("Error registering the UMEM of an AF_XDP socket: " + stringerror());
+    }
+
+    /* every frame can be in any of the rings at a given time */
+    for (const auto option : {XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING}) {
+      if (setsockopt(d_fd.getHandle(), SOL_XDP, option, &frameCount, sizeof(frameCount)) != 0) {
+        throw std::runtime_error("Error setting the size of the rings of an AF_XDP socket: " + stringerror());
+      }
+    }
+
+    struct xdp_mmap_offsets offsets;
+    socklen_t offsetsLen = sizeof(offsets);
+    if (getsockopt(d_fd.getHandle(), SOL_XDP, XDP_MMAP_OFFSETS, &offsets, &offsetsLen) != 0) {
+      throw std::runtime_error("Error getting the offsets of the rings of an AF_XDP socket: " + stringerror());
+    }
+
+    mapRing(d_fill, offsets.fr, frameCount, XDP_UMEM_PGOFF_FILL_RING);
+    mapRing(d_completion, offsets.cr, frameCount, XDP_UMEM_PGOFF_COMPLETION_RING);
+    mapRing(d_rx, offsets.rx, frameCount, XDP_PGOFF_RX_RING);
+    mapRing(d_tx, offsets.tx, frameCount, XDP_PGOFF_TX_RING);
+
+    d_freeFrames.reserve(frameCount);
+    for (uint32_t idx = 0; idx < frameCount; idx++) {
+      d_freeFrames.push_back(static_cast<uint64_t>(idx) * s_frameSize);
+    }
+    d_sendQueue.reserve(frameCount);
+    /* the kernel needs frames to receive packets as soon as we are bound */
+    fillFrames();
+
+    struct sockaddr_xdp addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifIndex;
+    addr.sxdp_queue_id = queue;
+    addr.sxdp_flags = XDP_USE_NEED_WAKEUP;
+    if (bind(d_fd.getHandle(), reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+      throw std::runtime_error("Error binding an AF_XDP socket to queue " + std::to_string(queue) + " of interface '" + interface + "': " + stringerror());
+    }
+  }
+  catch (...) {
+    d_fd = FDWrapper();
+    unmapRing(d_fill);
+    unmapRing(d_completion);
+    unmapRing(d_rx);
+    unmapRing(d_tx);
+    munmap(d_umem, d_umemSize);
+    throw;
+  }
+}
+
+XskSocket::~XskSocket()
+{
+  /* close the socket first so that the kernel is done with the rings and the UMEM */
+  d_fd = FDWrapper();
+  unmapRing(d_fill);
+  unmapRing(d_completion);
+  unmapRing(d_rx);
+  unmapRing(d_tx);
+  munmap(d_umem, d_umemSize);
+}
+
+template <typename T>
+void XskSocket::mapRing(Ring<T>& ring, const struct xdp_ring_offset& offsets, uint32_t size, off_t pageOffset)
+{
+  ring.d_mapSize = offsets.desc + size * sizeof(T);
+  void* map = mmap(nullptr, ring.d_mapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d_fd.getHandle(), pageOffset);
+  if (map == MAP_FAILED) {
+    throw std::runtime_error("Error mapping the rings of an AF_XDP socket: " + stringerror());
+  }
+  ring.d_map = map;
+  auto* base = static_cast<uint8_t*>(map);
+  ring.d_producer = reinterpret_cast<uint32_t*>(base + offsets.producer);
+  ring.d_consumer = reinterpret_cast<uint32_t*>(base + offsets.consumer);
+  ring.d_flags = reinterpret_cast<uint32_t*>(base + offsets.flags);
+  ring.d_entries = reinterpret_cast<T*>(base + offsets.desc);
+  ring.d_size = size;
+}
+
+template <typename T>
+void XskSocket::unmapRing(Ring<T>& ring)
+{
+  if (ring.d_map != nullptr) {
+    munmap(ring.d_map, ring.d_mapSize);
+    ring.d_map = nullptr;
+  }
+}
+
+void XskSocket::waitForFrames(int timeout) const
+{
+  struct pollfd pfd;
+  pfd.fd = d_fd.getHandle();
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+  /* this also wakes the kernel up if it has been waiting for frames on the fill ring */
+  poll(&pfd, 1, timeout);
+}
+
+std::vector<XskPacket> XskSocket::recv(size_t maxPackets)
+{
+  std::vector<XskPacket> packets;
+  /* the kernel is the producer, we are the consumer */
+  const uint32_t producer = __atomic_load_n(d_rx.d_producer, __ATOMIC_ACQUIRE);
+  const uint32_t consumer = *d_rx.d_consumer;
+  const uint32_t available = std::min(static_cast<size_t>(producer - consumer), maxPackets);
+  packets.reserve(available);
+
+  for (uint32_t idx = 0; idx < available; idx++) {
+    const auto& desc = d_rx.d_entries[(consumer + idx) & (d_rx.d_size - 1)];
+    /* the packet data does not start at the beginning of the frame */
+    const size_t capacity = s_frameSize - (desc.addr % s_frameSize);
+    packets.emplace_back(d_umem + desc.addr, desc.len, capacity, desc.addr);
+  }
+
+  __atomic_store_n(d_rx.d_consumer, consumer + available, __ATOMIC_RELEASE);
+  return packets;
+}
+
+void XskSocket::queueForSending(const XskPacket& packet)
+{
+  struct xdp_desc desc;
+  memset(&desc, 0, sizeof(desc));
+  desc.addr = packet.getAddress();
+  desc.len = packet.getLength();
+  d_sendQueue.push_back(desc);
+}
+
+void XskSocket::release(const XskPacket& packet)
+{
+  d_freeFrames.push_back(packet.getAddress() & ~(static_cast<uint64_t>(s_frameSize) - 1));
+}
+
+void XskSocket::flush()
+{
+  sendQueuedFrames();
+  reclaimSentFrames();
+  fillFrames();
+}
+
+void XskSocket::fillFrames()
+{
+  const uint32_t consumer = __atomic_load_n(d_fill.d_consumer, __ATOMIC_ACQUIRE);
+  const uint32_t producer = *d_fill.d_producer;
+  const uint32_t count = std::min(static_cast<size_t>(d_fill.d_size - (producer - consumer)), d_freeFrames.size());
+
+  for (uint32_t idx = 0; idx < count; idx++) {
+    d_fill.d_entries[(producer + idx) & (d_fill.d_size - 1)] = d_freeFrames.back();
+    d_freeFrames.pop_back();
+  }
+
+  __atomic_store_n(d_fill.d_producer, producer + count, __ATOMIC_RELEASE);
+}
+
+void XskSocket::sendQueuedFrames()
+{
+  if (d_sendQueue.empty()) {
+    return;
+  }
+
+  const uint32_t consumer = __atomic_load_n(d_tx.d_consumer, __ATOMIC_ACQUIRE);
+  const uint32_t producer = *d_tx.d_producer;
+  const uint32_t count = std::min(static_cast<size_t>(d_tx.d_size - (producer - consumer)), d_sendQueue.size());
+
+  for (uint32_t idx = 0; idx < count; idx++) {
+    d_tx.d_entries[(producer + idx) & (d_tx.d_size - 1)] = d_sendQueue.at(idx);
+  }
+  __atomic_store_n(d_tx.d_producer, producer + count, __ATOMIC_RELEASE);
+  d_framesBeingSent += count;
+
+  /* the TX ring is full, which should not happen since it can hold all our frames */
+  for (size_t idx = count; idx < d_sendQueue.size(); idx++) {
+    d_freeFrames.push_back(d_sendQueue.at(idx).addr & ~(static_cast<uint64_t>(s_frameSize) - 1));
+  }
+  d_sendQueue.clear();
+
+  if (__atomic_load_n(d_tx.d_flags, __ATOMIC_RELAXED) & XDP_RING_NEED_WAKEUP) {
+    sendto(d_fd.getHandle(), nullptr, 0, MSG_DONTWAIT, nullptr, 0);
+  }
+}
+
+void XskSocket::reclaimSentFrames()
+{
+  const uint32_t producer = __atomic_load_n(d_completion.d_producer, __ATOMIC_ACQUIRE);
+  const uint32_t consumer = *d_completion.d_consumer;
+  const uint32_t count = producer - consumer;
+
+  for (uint32_t idx = 0; idx < count; idx++) {
+    d_freeFrames.push_back(d_completion.d_entries[(consumer + idx) & (d_completion.d_size - 1)] & ~(static_cast<uint64_t>(s_frameSize) - 1));
+  }
+
+  __atomic_store_n(d_completion.d_consumer, consumer + count, __ATOMIC_RELEASE);
+  d_framesBeingSent -= count;
+}
+
+XskFrontend::XskFrontend(const std::string& interface, uint32_t queues, uint32_t frameCount) :
+  d_interface(interface), d_queues(queues), d_frameCount(frameCount)
+{
+  if (d_queues == 0) {
+    throw std::runtime_error("At least one receive queue is needed for the AF_XDP sockets of interface '" + interface + "'");
+  }
+}
+
+XskFrontend::~XskFrontend() = default;
+
+void XskFrontend::setUp(uint16_t port, const std::shared_ptr<BPFFilter>& filter)
+{
+  d_steering = std::make_unique<XskSteering>(d_interface, port, d_queues, filter);
+  for (uint32_t queue = 0; queue < d_queues; queue++) {
+    auto socket = std::make_unique<XskSocket>(d_interface, queue, d_frameCount);
+    d_steering->addSocket(queue, socket->getDescriptor());
+    d_sockets.push_back(std::move(socket));
+  }
+}
+}
+#endif /* HAVE_XSK */
@@ -0,0 +1,195 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include "config.h"
+
+#ifdef HAVE_XSK
+#include <linux/if_xdp.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "iputils.hh"
+#include "misc.hh"
+#include "noinitvector.hh"
+
+class BPFFilter;
+class XskSteering;
+
+namespace dnsdist::xsk
+{
+/* Size of a frame in the UMEM, a frame holds exactly one packet */
+static constexpr size_t s_frameSize{4096};
+/* Default number of frames per AF_XDP socket */
+static constexpr uint32_t s_defaultFrameCount{4096};
+
+/* An Ethernet frame holding a DNS query over UDP, received from an AF_XDP socket.
+   The frame lives in the UMEM of the socket and is modified in place when a
+   response is sent back from it. parse() has to be called before the addresses
+   and the payload are available. */
+class XskPacket
+{
+public:
+  /* capacity is the number of bytes that can be written from the start of the frame */
+  XskPacket(uint8_t* frame, size_t length, size_t capacity, uint64_t address);
+
+  /* checks that the frame holds a valid UDP datagram over IPv4 or IPv6, and extracts
+     the addresses and the payload. Returns false if the frame cannot be handled. */
+  bool parse();
+  const ComboAddress& getFrom() const
+  {
+    return d_from;
+  }
+  const ComboAddress& getTo() const
+  {
+    return d_to;
+  }
+  PacketBuffer getPayload() const;
+  /* replaces the payload by the supplied response, addressed to the sender of the query,
+     and updates the checksums. Returns false if the response does not fit in the frame. */
+  bool setResponse(const PacketBuffer& response);
+
+  uint64_t getAddress() const
+  {
+    return d_address;
+  }
+  uint32_t getLength() const
+  {
+    return d_length;
+  }
+
+private:
+  ComboAddress d_from;
+  ComboAddress d_to;
+  uint8_t* d_frame;
+  uint64_t d_address;
+  size_t d_capacity;
+  uint32_t d_length;
+  uint16_t d_payloadOffset{0};
+  uint16_t d_payloadLength{0};
+};
+
+/* An AF_XDP socket bound to one receive queue of a network interface, with its own UMEM.
+   Every frame starts on the fill ring, comes back to us on the RX ring, then is either
+   released or sent on the TX ring, in which case it comes back on the completion ring once
+   it has been sent. Not thread-safe, each socket is meant to be used by a single thread. */
+class XskSocket
+{
+public:
+  /* frameCount has to be a power of two */
+  XskSocket(const std::string& interface, uint32_t queue, uint32_t frameCount);
+  XskSocket(const XskSocket&) = delete;
+  XskSocket(XskSocket&&) = delete;
+  XskSocket& operator=(const XskSocket&) = delete;
+  XskSocket& operator=(XskSocket&&) = delete;
+  ~XskSocket();
+
+  int getDescriptor() const
+  {
+    return d_fd.getHandle();
+  }
+  uint32_t getQueue() const
+  {
+    return d_queue;
+  }
+
+  /* waits for at most timeout milliseconds for frames to be received, -1 meaning forever */
+  void waitForFrames(int timeout) const;
+  /* returns up to maxPackets received frames */
+  std::vector<XskPacket> recv(size_t maxPackets);
+  /* queues a frame that has been updated with a response, it will be sent by the next flush() */
+  void queueForSending(const XskPacket& packet);
+  /* gives a frame that will not be sent back to the pool of free frames */
+  void release(const XskPacket& packet);
+  /* sends the queued frames, reclaims the frames that have been sent and hands
+     all the free frames over to the kernel */
+  void flush();
+  /* whether frames are still owned by the kernel for sending */
+  bool hasFramesBeingSent() const
+  {
+    return d_framesBeingSent > 0;
+  }
+
+private:
+  template <typename T>
+  struct Ring
+  {
+    void* d_map{nullptr};
+    size_t d_mapSize{0};
+    uint32_t* d_producer{nullptr};
+    uint32_t* d_consumer{nullptr};
+    uint32_t* d_flags{nullptr};
+    T* d_entries{nullptr};
+    uint32_t d_size{0};
+  };
+
+  template <typename T>
+  void mapRing(Ring<T>& ring, const struct xdp_ring_offset& offsets, uint32_t size, off_t pageOffset);
+  template <typename T>
+  static void unmapRing(Ring<T>& ring);
+  void fillFrames();
+  void sendQueuedFrames();
+  void reclaimSentFrames();
+
+  std::vector<uint64_t> d_freeFrames;
+  std::vector<struct xdp_desc> d_sendQueue;
+  Ring<uint64_t> d_fill;
+  Ring<uint64_t> d_completion;
+  Ring<struct xdp_desc> d_rx;
+  Ring<struct xdp_desc> d_tx;
+  FDWrapper d_fd;
+  uint8_t* d_umem{nullptr};
+  size_t d_umemSize{0};
+  uint32_t d_queue;
+  uint32_t d_framesBeingSent{0};
+};
+
+/* The AF_XDP sockets receiving the queries sent to a UDP frontend, one per receive queue
+   of the network interface, and the XDP program steering these queries to them */
+class XskFrontend
+{
+public:
+  XskFrontend(const std::string& interface, uint32_t queues, uint32_t frameCount);
+  ~XskFrontend();
+
+  /* creates the sockets and attaches the steering program, which requires privileges */
+  void setUp(uint16_t port, const std::shared_ptr<BPFFilter>& filter);
+
+  const std::string& getInterface() const
+  {
+    return d_interface;
+  }
+  const std::vector<std::unique_ptr<XskSocket>>& getSockets() const
+  {
+    return d_sockets;
+  }
+
+private:
+  std::string d_interface;
+  std::vector<std::unique_ptr<XskSocket>> d_sockets;
+  std::unique_ptr<XskSteering> d_steering;
+  uint32_t d_queues;
+  uint32_t d_frameCount;
+};
+}
+#endif /* HAVE_XSK */
@@ -650,7 +650,7 @@ static void processDOHQuery(DOHUnitUniquePtr&& unit, bool inMainThread = false)
       queryId = ntohs(dh->id);
     }
 
-    du->ids.qname = DNSName(reinterpret_cast<const char*>(du->query.data()), du->query.size(), sizeof(dnsheader), false, &du->ids.qtype, &du->ids.qclass);
+    du->ids.qname = DNSNameView(reinterpret_cast<const char*>(du->query.data()), du->query.size(), sizeof(dnsheader), &du->ids.qtype, &du->ids.qclass).toDNSName();
     DNSQuestion dq(du->ids, du->query);
     const uint16_t* flags = getFlagsFromDNSHeader(dq.getHeader());
     ids.origFlags = *flags;
@@ -0,0 +1 @@
+../epoch-reclaimer.hh
\ No newline at end of file
@@ -0,0 +1,33 @@
+AC_DEFUN([DNSDIST_WITH_XSK],[
+  AC_MSG_CHECKING([if we have AF_XDP (XSK) support])
+  AC_ARG_WITH([xsk],
+    AS_HELP_STRING([--with-xsk],[enable AF_XDP (XSK) support, requires eBPF @<:@default=auto@:>@]),
+    [with_xsk=$withval],
+    [with_xsk=auto],
+  )
+  AC_MSG_RESULT([$with_xsk])
+
+  have_xsk=no
+  AS_IF([test "x$with_xsk" != "xno"], [
+    dnl the result of the SO_ATTACH_BPF check tells us whether HAVE_EBPF has been defined
+    AS_IF([test "x$ac_cv_have_decl_SO_ATTACH_BPF" = "xyes"], [
+      AC_CHECK_DECL(XDP_USE_NEED_WAKEUP,
+        [ AC_CHECK_DECL(BPF_XDP,
+          [ have_xsk=yes ],
+          [:],
+          [#include <linux/bpf.h>
+          ]
+        )],
+        [:],
+        [#include <linux/if_xdp.h>
+        ]
+      )
+    ])
+  ])
+  AS_IF([test "x$have_xsk" = "xyes"], [
+    AC_DEFINE([HAVE_XSK], [1], [Define if using AF_XDP (XSK).])
+  ])
+  AS_IF([test "x$with_xsk" = "xyes" -a "x$have_xsk" != "xyes"], [
+    AC_MSG_ERROR([AF_XDP (XSK) support requested but eBPF support is disabled or the AF_XDP headers were not found])
+  ])
+])
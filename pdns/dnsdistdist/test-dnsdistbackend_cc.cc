@@ -288,4 +288,49 @@ BOOST_AUTO_TEST_CASE(test_LazyExponentialBackOff)
   BOOST_CHECK_EQUAL(ds.healthCheckRequired(), false);
 }
 
+BOOST_AUTO_TEST_CASE(test_ResponderThreads)
+{
+  DownstreamState::Config config;
+  config.remote = ComboAddress("127.0.0.1:53");
+  config.d_numberOfSockets = 3;
+  config.d_numberOfResponderThreads = 2;
+  DownstreamState ds(std::move(config), nullptr, true);
+  BOOST_REQUIRE_EQUAL(ds.sockets.size(), 3U);
+  BOOST_CHECK_EQUAL(ds.getNumberOfResponders(), 2U);
+
+  /* sockets 0 and 2 belong to the first responder, socket 1 to the second one */
+  std::set<uint16_t> responders;
+  for (size_t idx = 0; idx < ds.sockets.size(); idx++) {
+    auto [fd, responder] = ds.pickSocketForSending();
+    BOOST_CHECK(std::find(ds.sockets.begin(), ds.sockets.end(), fd) != ds.sockets.end());
+    BOOST_CHECK_LT(responder, ds.getNumberOfResponders());
+    responders.insert(responder);
+  }
+  BOOST_CHECK_EQUAL(responders.size(), 2U);
+
+  auto save = [&ds](uint16_t responder, uint16_t origID) {
+    InternalQueryState ids;
+    ids.backendResponder = responder;
+    ids.origID = origID;
+    return ds.saveState(std::move(ids));
+  };
+  const auto first = save(0, 1);
+  const auto second = save(1, 2);
+  BOOST_CHECK_EQUAL(ds.outstanding.load(), 2U);
+  /* each responder has its own ID space, so both queries got the same ID */
+  BOOST_CHECK_EQUAL(first, second);
+
+  auto ids = ds.getState(1, second);
+  BOOST_REQUIRE(ids);
+  BOOST_CHECK_EQUAL(ids->origID, 2U);
+  ids = ds.getState(0, first);
+  BOOST_REQUIRE(ids);
+  BOOST_CHECK_EQUAL(ids->origID, 1U);
+  BOOST_CHECK(!ds.getState(0, first));
+  BOOST_CHECK_EQUAL(ds.outstanding.load(), 0U);
+
+  ds.updateLatency(128000.0);
+  BOOST_CHECK_EQUAL(ds.latencyUsec.load(), 1000.0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1058,6 +1058,297 @@ BOOST_AUTO_TEST_CASE(test_DynBlockRulesGroup_Ranges) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_DynBlockRulesGroup_Incremental) {
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor1("192.0.2.1");
+  ComboAddress requestor2("192.0.2.2");
+  ComboAddress backend("192.0.2.42");
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+  dnsdist::Protocol protocol = dnsdist::Protocol::DoUDP;
+  dnsdist::Protocol outgoingProtocol = dnsdist::Protocol::DoUDP;
+  unsigned int responseTime = 100 * 1000; /* 100ms */
+  struct timespec now;
+  gettime(&now);
+  NetmaskTree<DynBlock, AddressAndPortRange> emptyNMG;
+  SuffixMatchTree<DynBlock> emptySMT;
+
+  size_t numberOfSeconds = 10;
+  size_t blockDuration = 60;
+  const auto action = DNSAction::Action::Drop;
+  const std::string reason = "Exceeded query rate";
+
+  {
+    DynBlockRulesGroup dbrg;
+    dbrg.setQuiet(true);
+    dbrg.setIncrementalMode(true);
+
+    /* block above 50 qps for numberOfSeconds seconds, no warning */
+    dbrg.setQueryRate(50, 0, numberOfSeconds, reason, blockDuration, action);
+
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    /* insert 45 qps from a given client in the last 10s, this should not trigger the rule */
+    for (size_t idx = 0; idx < 45 * numberOfSeconds; idx++) {
+      g_rings.insertQuery(now, requestor1, qname, qtype, size, dh, protocol);
+    }
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+
+    /* applying the rules again without any new query should not change anything */
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+
+    /* only the new queries are read from the rings, but the existing counters
+       are kept so we are now just above 50 qps */
+    for (size_t idx = 0; idx < (5 * numberOfSeconds) + 1; idx++) {
+      g_rings.insertQuery(now, requestor1, qname, qtype, size, dh, protocol);
+    }
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor2) == nullptr);
+    const auto& block = g_dynblockNMG.getLocal()->lookup(requestor1)->second;
+    BOOST_CHECK_EQUAL(block.reason, reason);
+    BOOST_CHECK_EQUAL(static_cast<size_t>(block.until.tv_sec), now.tv_sec + blockDuration);
+    BOOST_CHECK(block.action == action);
+
+    /* once these queries are out of the window, they should not be counted anymore */
+    g_dynblockNMG.setState(emptyNMG);
+    struct timespec later = now;
+    later.tv_sec += numberOfSeconds + 1;
+    dbrg.apply(later);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+  }
+
+  {
+    DynBlockRulesGroup dbrg;
+    dbrg.setQuiet(true);
+    dbrg.setIncrementalMode(true);
+
+    /* block above 50 ServFail/s for numberOfSeconds seconds */
+    dbrg.setRCodeRate(RCode::ServFail, 50, 0, numberOfSeconds, reason, blockDuration, action);
+
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    /* spread just above 50 ServFail/s over the last 10s, plus some FormErr */
+    for (size_t second = 0; second < numberOfSeconds; second++) {
+      struct timespec when = now;
+      when.tv_sec -= second;
+      for (size_t idx = 0; idx < 50; idx++) {
+        dh.rcode = RCode::ServFail;
+        g_rings.insertResponse(when, requestor1, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+        dh.rcode = RCode::FormErr;
+        g_rings.insertResponse(when, requestor2, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+      }
+    }
+    dh.rcode = RCode::ServFail;
+    g_rings.insertResponse(now, requestor1, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor2) == nullptr);
+
+    /* two seconds later, the oldest bucket has left the window */
+    g_dynblockNMG.setState(emptyNMG);
+    struct timespec later = now;
+    later.tv_sec += 2;
+    dbrg.apply(later);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+  }
+
+  {
+    DynBlockRulesGroup dbrg;
+    dbrg.setQuiet(true);
+    dbrg.setIncrementalMode(true);
+
+    dbrg.setSuffixMatchRule(numberOfSeconds, reason, blockDuration, action, [](const StatNode& node, const StatNode::Stat& self, const StatNode::Stat& children) {
+      if (self.queries > 1) {
+        return std::tuple<bool, boost::optional<std::string>>(true, boost::none);
+      }
+      return std::tuple<bool, boost::optional<std::string>>(false, boost::none);
+    });
+
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+    g_dynblockSMT.setState(emptySMT);
+
+    const DNSName name1(DNSName("1") + qname);
+    const DNSName name2(DNSName("2") + qname);
+    dh.rcode = RCode::NoError;
+    g_rings.insertResponse(now, requestor1, name1, qtype, responseTime, size, dh, backend, outgoingProtocol);
+    g_rings.insertResponse(now, requestor1, name2, qtype, responseTime, size, dh, backend, outgoingProtocol);
+    dbrg.apply(now);
+    BOOST_CHECK(g_dynblockSMT.getLocal()->getNodes().empty());
+
+    /* the second response for name1 is counted along with the first one */
+    g_rings.insertResponse(now, requestor1, name1, qtype, responseTime, size, dh, backend, outgoingProtocol);
+    dbrg.apply(now);
+    BOOST_CHECK(g_dynblockSMT.getLocal()->lookup(name1) != nullptr);
+    BOOST_CHECK(g_dynblockSMT.getLocal()->lookup(name2) == nullptr);
+  }
+
+  {
+    /* random subdomains: far more names than the rings can hold are tracked between
+       two runs, they are counted for their parent once the limit has been reached */
+    const size_t numberOfNames = 1000;
+    DynBlockRulesGroup dbrg;
+    dbrg.setQuiet(true);
+    dbrg.setIncrementalMode(true);
+
+    dbrg.setSuffixMatchRule(numberOfSeconds, reason, blockDuration, action, [qname, numberOfNames](const StatNode& node, const StatNode::Stat& self, const StatNode::Stat& children) {
+      if (DNSName(node.fullname) == qname && (self.queries + children.queries) >= numberOfNames) {
+        return std::tuple<bool, boost::optional<std::string>>(true, boost::none);
+      }
+      return std::tuple<bool, boost::optional<std::string>>(false, boost::none);
+    });
+
+    g_rings.reset();
+    g_rings.setCapacity(100, 1);
+    g_rings.init();
+    g_dynblockNMG.setState(emptyNMG);
+    g_dynblockSMT.setState(emptySMT);
+
+    dh.rcode = RCode::NoError;
+    for (size_t idx = 0; idx < numberOfNames; idx++) {
+      g_rings.insertResponse(now, requestor1, DNSName(std::to_string(idx)) + qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+      if (idx % 50 == 49) {
+        dbrg.apply(now);
+      }
+    }
+    BOOST_CHECK(g_dynblockSMT.getLocal()->lookup(qname) != nullptr);
+
+    g_rings.reset();
+    g_rings.setCapacity(10000, 10);
+    g_rings.init();
+  }
+
+  {
+    /* only the responses are recorded */
+    DynBlockRulesGroup dbrg;
+    dbrg.setQuiet(true);
+    dbrg.setIncrementalMode(true);
+
+    /* block above 50 ServFail/s for numberOfSeconds seconds */
+    dbrg.setRCodeRate(RCode::ServFail, 50, 0, numberOfSeconds, reason, blockDuration, action);
+
+    g_rings.reset();
+    g_rings.setRecordQueries(false);
+    g_rings.init();
+    g_dynblockNMG.setState(emptyNMG);
+
+    dh.rcode = RCode::ServFail;
+    for (size_t idx = 0; idx < 50 * numberOfSeconds + 1; idx++) {
+      g_rings.insertResponse(now, requestor1, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+    }
+    BOOST_CHECK_EQUAL(g_rings.getNumberOfQueryEntries(), 0U);
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+
+    g_rings.reset();
+    g_rings.setRecordQueries(true);
+    g_rings.init();
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_DynBlockRulesGroup_Approximate) {
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  DNSName qname("rings.powerdns.com.");
+  ComboAddress requestor1("192.0.2.1");
+  ComboAddress requestor2("192.0.2.2");
+  ComboAddress backend("192.0.2.42");
+  uint16_t qtype = QType::AAAA;
+  uint16_t size = 42;
+  dnsdist::Protocol protocol = dnsdist::Protocol::DoUDP;
+  dnsdist::Protocol outgoingProtocol = dnsdist::Protocol::DoUDP;
+  unsigned int responseTime = 100 * 1000; /* 100ms */
+  struct timespec now;
+  gettime(&now);
+  NetmaskTree<DynBlock, AddressAndPortRange> emptyNMG;
+
+  size_t numberOfSeconds = 10;
+  size_t blockDuration = 60;
+  const auto action = DNSAction::Action::Drop;
+  const std::string reason = "Exceeded query rate";
+
+  DynBlockRulesGroup dbrg;
+  dbrg.setQuiet(true);
+  /* only track the 10 heaviest requestors */
+  dbrg.setApproximateMode(true, 10);
+
+  /* block above 50 qps or 50 ServFail/s for numberOfSeconds seconds, no warning */
+  dbrg.setQueryRate(50, 0, numberOfSeconds, reason, blockDuration, action);
+  dbrg.setRCodeRate(RCode::ServFail, 50, 0, numberOfSeconds, reason, blockDuration, action);
+
+  {
+    /* insert 45 qps from a given client in the last 10s, along with one query from a lot of other clients,
+       this should not trigger the rule */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    for (size_t idx = 0; idx < 45 * numberOfSeconds; idx++) {
+      g_rings.insertQuery(now, requestor1, qname, qtype, size, dh, protocol);
+    }
+    for (size_t idx = 0; idx < 1000; idx++) {
+      ComboAddress client("198.51.100.0");
+      client.sin4.sin_addr.s_addr = htonl(ntohl(client.sin4.sin_addr.s_addr) + idx);
+      g_rings.insertQuery(now, client, qname, qtype, size, dh, protocol);
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 0U);
+  }
+
+  {
+    /* insert just above 50 qps from a given client in the last 10s, this should trigger the rule */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    for (size_t idx = 0; idx < (50 * numberOfSeconds) + 1; idx++) {
+      g_rings.insertQuery(now, requestor1, qname, qtype, size, dh, protocol);
+    }
+    for (size_t idx = 0; idx < 1000; idx++) {
+      ComboAddress client("198.51.100.0");
+      client.sin4.sin_addr.s_addr = htonl(ntohl(client.sin4.sin_addr.s_addr) + idx);
+      g_rings.insertQuery(now, client, qname, qtype, size, dh, protocol);
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    const auto& block = g_dynblockNMG.getLocal()->lookup(requestor1)->second;
+    BOOST_CHECK_EQUAL(block.reason, reason);
+    BOOST_CHECK_EQUAL(static_cast<size_t>(block.until.tv_sec), now.tv_sec + blockDuration);
+    BOOST_CHECK(block.action == action);
+  }
+
+  {
+    /* just above 50 ServFail/s from a given client, but not from the second one */
+    g_rings.clear();
+    g_dynblockNMG.setState(emptyNMG);
+
+    for (size_t idx = 0; idx < (50 * numberOfSeconds) + 1; idx++) {
+      dh.rcode = RCode::ServFail;
+      g_rings.insertResponse(now, requestor1, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+      dh.rcode = RCode::NoError;
+      g_rings.insertResponse(now, requestor2, qname, qtype, responseTime, size, dh, backend, outgoingProtocol);
+    }
+
+    dbrg.apply(now);
+    BOOST_CHECK_EQUAL(g_dynblockNMG.getLocal()->size(), 1U);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor1) != nullptr);
+    BOOST_CHECK(g_dynblockNMG.getLocal()->lookup(requestor2) == nullptr);
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_DynBlockRulesMetricsCache_GetTopN) {
   dnsheader dh;
   memset(&dh, 0, sizeof(dh));
@@ -0,0 +1,301 @@
+
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+#include <map>
+#include <set>
+#include <thread>
+
+#include "dnsdist-idstate.hh"
+#include "dnscrypt.hh"
+#include "dnsdist-random.hh"
+#include "lock.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistidstate_cc)
+
+static InternalQueryState makeState(uint16_t origID)
+{
+  InternalQueryState ids;
+  ids.origID = origID;
+  ids.qname = DNSName("powerdns.com.");
+  return ids;
+}
+
+BOOST_AUTO_TEST_CASE(test_Sequential)
+{
+  IDStateTable table;
+  table.resize(65535, false);
+  BOOST_CHECK_EQUAL(table.size(), 65535U);
+
+  std::optional<InternalQueryState> evicted;
+  for (uint16_t idx = 0; idx < 10; idx++) {
+    auto id = table.save(makeState(idx + 1000), evicted);
+    BOOST_CHECK_EQUAL(id, idx);
+    BOOST_CHECK(!evicted);
+  }
+
+  auto ids = table.get(5);
+  BOOST_REQUIRE(ids);
+  BOOST_CHECK_EQUAL(ids->origID, 1005U);
+  BOOST_CHECK(ids->qname == DNSName("powerdns.com."));
+  /* already retrieved */
+  BOOST_CHECK(!table.get(5));
+  /* never used */
+  BOOST_CHECK(!table.get(42));
+  /* out of range */
+  BOOST_CHECK(!table.get(65535));
+
+  /* put it back, then retrieve it again */
+  BOOST_CHECK(table.restore(5, std::move(*ids)));
+  ids = table.get(5);
+  BOOST_REQUIRE(ids);
+  BOOST_CHECK_EQUAL(ids->origID, 1005U);
+  /* can only be restored into a free slot */
+  auto other = makeState(42);
+  BOOST_CHECK(!table.restore(6, std::move(other)));
+  BOOST_CHECK_EQUAL(other.origID, 42U);
+}
+
+BOOST_AUTO_TEST_CASE(test_Generation)
+{
+  /* 16 slots use 4 bits of the ID, the 12 others hold the generation */
+  IDStateTable table;
+  table.resize(16, false);
+
+  std::optional<InternalQueryState> evicted;
+  auto first = table.save(makeState(1), evicted);
+  BOOST_CHECK_EQUAL(first & 0xF, 0U);
+  BOOST_REQUIRE(table.get(first));
+
+  /* go around the table once, landing on the same slot */
+  std::vector<uint16_t> ids;
+  for (size_t idx = 0; idx < 16; idx++) {
+    ids.push_back(table.save(makeState(idx + 2), evicted));
+    BOOST_CHECK(!evicted);
+  }
+  const auto second = ids.at(15);
+  BOOST_CHECK_EQUAL(second & 0xF, 0U);
+  BOOST_CHECK_NE(first, second);
+
+  /* a late response for the first query does not match the new one */
+  BOOST_CHECK(!table.get(first));
+  auto ids2 = table.get(second);
+  BOOST_REQUIRE(ids2);
+  BOOST_CHECK_EQUAL(ids2->origID, 17U);
+
+  /* nor can the first query be restored into that slot */
+  auto late = makeState(1);
+  BOOST_CHECK(!table.restore(first, std::move(late)));
+}
+
+BOOST_AUTO_TEST_CASE(test_Eviction)
+{
+  IDStateTable table;
+  table.resize(8, false);
+
+  std::optional<InternalQueryState> evicted;
+  std::vector<uint16_t> ids;
+  for (uint16_t idx = 0; idx < 8; idx++) {
+    ids.push_back(table.save(makeState(idx), evicted));
+    BOOST_CHECK(!evicted);
+  }
+
+  /* every slot is in use, so after a few attempts one of them is overwritten */
+  auto id = table.save(makeState(100), evicted);
+  BOOST_REQUIRE(evicted);
+  BOOST_CHECK_EQUAL(evicted->origID, (IDStateTable::s_maxAttempts - 1) % 8);
+  auto state = table.get(id);
+  BOOST_REQUIRE(state);
+  BOOST_CHECK_EQUAL(state->origID, 100U);
+  /* the evicted query is gone */
+  BOOST_CHECK(!table.get(ids.at((IDStateTable::s_maxAttempts - 1) % 8)));
+
+  /* free the slot after the next one, it should be picked instead of the next one which is in use */
+  BOOST_REQUIRE(table.get(ids.at(6)));
+  evicted.reset();
+  id = table.save(makeState(101), evicted);
+  BOOST_CHECK(!evicted);
+  BOOST_CHECK_EQUAL(id & 0x7, 6U);
+}
+
+BOOST_AUTO_TEST_CASE(test_Expire)
+{
+  IDStateTable table;
+  table.resize(1000, false);
+
+  std::optional<InternalQueryState> evicted;
+  std::vector<uint16_t> ids;
+  for (uint16_t idx = 0; idx < 200; idx++) {
+    ids.push_back(table.save(makeState(idx), evicted));
+  }
+  /* half of them get a response */
+  for (size_t idx = 0; idx < ids.size(); idx += 2) {
+    BOOST_REQUIRE(table.get(ids.at(idx)));
+  }
+
+  std::set<uint16_t> expired;
+  auto expire = [&expired](InternalQueryState& state) {
+    expired.insert(state.origID);
+  };
+
+  /* the age goes 0 -> 1 -> 2, then expires */
+  table.expire(1, expire);
+  table.expire(1, expire);
+  BOOST_CHECK_EQUAL(expired.size(), 0U);
+  table.expire(1, expire);
+  BOOST_CHECK_EQUAL(expired.size(), 100U);
+  for (const auto& origID : expired) {
+    BOOST_CHECK_EQUAL(origID % 2, 1U);
+  }
+  for (const auto& id : ids) {
+    BOOST_CHECK(!table.get(id));
+  }
+
+  /* the freed slots are available again */
+  for (uint16_t idx = 0; idx < 1000; idx++) {
+    table.save(makeState(idx), evicted);
+    BOOST_CHECK(!evicted);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_Random)
+{
+  IDStateTable table;
+  table.resize(16, true);
+
+  std::optional<InternalQueryState> evicted;
+  std::set<uint16_t> highBits;
+  for (uint16_t idx = 0; idx < 100; idx++) {
+    auto id = table.save(makeState(idx), evicted);
+    highBits.insert(id >> 4);
+    auto ids = table.get(id);
+    BOOST_REQUIRE(ids);
+    BOOST_CHECK_EQUAL(ids->origID, idx);
+  }
+  /* the bits not used to select a slot are random as well */
+  BOOST_CHECK_GT(highBits.size(), 50U);
+}
+
+struct ThreadedRun
+{
+  size_t d_saved{0};
+  size_t d_evicted{0};
+  size_t d_retrieved{0};
+  double d_elapsed{0};
+};
+
+/* numberOfClients threads save states while a single responder thread retrieves
+   them, as the UDP client threads and the responder thread of a backend do */
+template <typename Save, typename Get>
+static ThreadedRun runThreaded(size_t numberOfClients, size_t queriesPerClient, Save save, Get get)
+{
+  ThreadedRun run;
+  std::atomic<bool> done{false};
+  std::atomic<size_t> evicted{0};
+
+  StopWatch sw;
+  sw.start();
+  std::thread responder([&]() {
+    uint16_t id = 0;
+    do {
+      if (get(id)) {
+        ++run.d_retrieved;
+      }
+      ++id;
+    } while (!done.load());
+    /* drain what is left */
+    for (uint32_t idx = 0; idx < 65536; idx++) {
+      if (get(static_cast<uint16_t>(idx))) {
+        ++run.d_retrieved;
+      }
+    }
+  });
+
+  std::vector<std::thread> clients;
+  for (size_t client = 0; client < numberOfClients; client++) {
+    clients.emplace_back([&]() {
+      size_t localEvicted = 0;
+      for (size_t idx = 0; idx < queriesPerClient; idx++) {
+        if (save(makeState(idx))) {
+          ++localEvicted;
+        }
+      }
+      evicted += localEvicted;
+    });
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  done = true;
+  responder.join();
+
+  run.d_elapsed = sw.udiff();
+  run.d_saved = numberOfClients * queriesPerClient;
+  run.d_evicted = evicted.load();
+  return run;
+}
+
+BOOST_AUTO_TEST_CASE(test_Threaded)
+{
+  for (const bool random : {false, true}) {
+    IDStateTable table;
+    table.resize(1024, random);
+    auto run = runThreaded(4, 50000, [&table](InternalQueryState&& ids) {
+      std::optional<InternalQueryState> evicted;
+      table.save(std::move(ids), evicted);
+      return evicted.has_value();
+    }, [&table](uint16_t id) {
+      return table.get(id).has_value();
+    });
+
+    /* every saved state has either been retrieved or evicted, exactly once */
+    BOOST_CHECK_EQUAL(run.d_retrieved + run.d_evicted, run.d_saved);
+  }
+}
+
+#ifdef BENCH_IDSTATE
+BOOST_AUTO_TEST_CASE(test_BenchContention)
+{
+  const size_t queriesPerClient = 1000000;
+  for (const bool random : {false, true}) {
+    for (const size_t numberOfClients : {1, 2, 4, 8, 16}) {
+      /* what the randomized IDs mode used to do: a map protected by a mutex */
+      {
+        LockGuarded<std::map<uint16_t, InternalQueryState>> map;
+        uint64_t cursor = 0;
+        auto run = runThreaded(numberOfClients, queriesPerClient, [&](InternalQueryState&& ids) {
+          auto locked = map.lock();
+          uint16_t id = random ? dnsdist::getRandomValue(65536) : static_cast<uint16_t>(cursor++);
+          auto [it, inserted] = locked->emplace(id, InternalQueryState());
+          it->second = std::move(ids);
+          return !inserted;
+        }, [&map](uint16_t id) {
+          auto locked = map.lock();
+          auto it = locked->find(id);
+          if (it == locked->end()) {
+            return false;
+          }
+          locked->erase(it);
+          return true;
+        });
+        cerr << "mutex+map (" << (random ? "random" : "sequential") << ") with " << numberOfClients << " client threads: " << std::to_string(static_cast<uint64_t>(run.d_saved * 1000000.0 / run.d_elapsed)) << " queries/s, " << run.d_evicted << " evicted" << endl;
+      }
+      {
+        IDStateTable table;
+        table.resize(65535, random);
+        auto run = runThreaded(numberOfClients, queriesPerClient, [&table](InternalQueryState&& ids) {
+          std::optional<InternalQueryState> evicted;
+          table.save(std::move(ids), evicted);
+          return evicted.has_value();
+        }, [&table](uint16_t id) {
+          return table.get(id).has_value();
+        });
+        cerr << "slot table (" << (random ? "random" : "sequential") << ") with " << numberOfClients << " client threads: " << std::to_string(static_cast<uint64_t>(run.d_saved * 1000000.0 / run.d_elapsed)) << " queries/s, " << run.d_evicted << " evicted" << endl;
+      }
+    }
+  }
+}
+#endif /* BENCH_IDSTATE */
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -98,7 +98,7 @@ bool setupDoTProtocolNegotiation(std::shared_ptr<TLSCtx>&)
   return true;
 }
 
-void responderThread(std::shared_ptr<DownstreamState> dss)
+void responderThread(std::shared_ptr<DownstreamState> dss, size_t responder)
 {
 }
 
@@ -43,9 +43,9 @@ static void test_ring(size_t maxEntries, size_t numberOfShards, size_t nbLockTri
   BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), maxEntries);
   BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), 0U);
   for (const auto& shard : rings.d_shards) {
-    auto ring = shard->queryRing.lock();
-    BOOST_CHECK_EQUAL(ring->size(), entriesPerShard);
-    for (const auto& entry : *ring) {
+    const auto ring = shard->queryRing.snapshot();
+    BOOST_CHECK_EQUAL(ring.size(), entriesPerShard);
+    for (const auto& entry : ring) {
       BOOST_CHECK_EQUAL(entry.name, qname);
       BOOST_CHECK_EQUAL(entry.qtype, qtype);
       BOOST_CHECK_EQUAL(entry.size, size);
@@ -61,9 +61,9 @@ static void test_ring(size_t maxEntries, size_t numberOfShards, size_t nbLockTri
   BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), maxEntries);
   BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), 0U);
   for (const auto& shard : rings.d_shards) {
-    auto ring = shard->queryRing.lock();
-    BOOST_CHECK_EQUAL(ring->size(), entriesPerShard);
-    for (const auto& entry : *ring) {
+    const auto ring = shard->queryRing.snapshot();
+    BOOST_CHECK_EQUAL(ring.size(), entriesPerShard);
+    for (const auto& entry : ring) {
       BOOST_CHECK_EQUAL(entry.name, qname);
       BOOST_CHECK_EQUAL(entry.qtype, qtype);
       BOOST_CHECK_EQUAL(entry.size, size);
@@ -82,9 +82,9 @@ static void test_ring(size_t maxEntries, size_t numberOfShards, size_t nbLockTri
   BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), maxEntries);
   BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), maxEntries);
   for (const auto& shard : rings.d_shards) {
-    auto ring = shard->respRing.lock();
-    BOOST_CHECK_EQUAL(ring->size(), entriesPerShard);
-    for (const auto& entry : *ring) {
+    const auto ring = shard->respRing.snapshot();
+    BOOST_CHECK_EQUAL(ring.size(), entriesPerShard);
+    for (const auto& entry : ring) {
       BOOST_CHECK_EQUAL(entry.name, qname);
       BOOST_CHECK_EQUAL(entry.qtype, qtype);
       BOOST_CHECK_EQUAL(entry.size, size);
@@ -102,9 +102,9 @@ static void test_ring(size_t maxEntries, size_t numberOfShards, size_t nbLockTri
   BOOST_CHECK_EQUAL(rings.getNumberOfQueryEntries(), maxEntries);
   BOOST_CHECK_EQUAL(rings.getNumberOfResponseEntries(), maxEntries);
   for (const auto& shard : rings.d_shards) {
-    auto ring = shard->respRing.lock();
-    BOOST_CHECK_EQUAL(ring->size(), entriesPerShard);
-    for (const auto& entry : *ring) {
+    const auto ring = shard->respRing.snapshot();
+    BOOST_CHECK_EQUAL(ring.size(), entriesPerShard);
+    for (const auto& entry : ring) {
       BOOST_CHECK_EQUAL(entry.name, qname);
       BOOST_CHECK_EQUAL(entry.qtype, qtype);
       BOOST_CHECK_EQUAL(entry.size, size);
@@ -137,8 +137,8 @@ static void ringReaderThread(Rings& rings, std::atomic<bool>& done, size_t numbe
 
     for (const auto& shard : rings.d_shards) {
       {
-        auto rl = shard->queryRing.lock();
-        for(const auto& c : *rl) {
+        const auto rl = shard->queryRing.snapshot();
+        for(const auto& c : rl) {
           numberOfQueries++;
           // BOOST_CHECK* is slow as hell..
           if(c.qtype != qtype) {
@@ -148,8 +148,8 @@ static void ringReaderThread(Rings& rings, std::atomic<bool>& done, size_t numbe
         }
       }
       {
-        auto rl = shard->respRing.lock();
-        for(const auto& c : *rl) {
+        const auto rl = shard->respRing.snapshot();
+        for(const auto& c : rl) {
           if(c.qtype != qtype) {
             cerr<<"Invalid response QType!"<<endl;
             return;
@@ -248,14 +248,14 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
   size_t totalResponses = 0;
   for (const auto& shard : rings.d_shards) {
     {
-      auto ring = shard->queryRing.lock();
-      BOOST_CHECK_LE(ring->size(), entriesPerShard);
+      const auto ring = shard->queryRing.snapshot();
+      BOOST_CHECK_LE(ring.size(), entriesPerShard);
       // verify that the shard is not empty
-      BOOST_CHECK_GT(ring->size(), (entriesPerShard * 0.5) + 1);
+      BOOST_CHECK_GT(ring.size(), (entriesPerShard * 0.5) + 1);
       // this would be optimal
-      BOOST_WARN_GT(ring->size(), entriesPerShard * 0.95);
-      totalQueries += ring->size();
-      for (const auto& entry : *ring) {
+      BOOST_WARN_GT(ring.size(), entriesPerShard * 0.95);
+      totalQueries += ring.size();
+      for (const auto& entry : ring) {
         BOOST_CHECK_EQUAL(entry.name, qname);
         BOOST_CHECK_EQUAL(entry.qtype, qtype);
         BOOST_CHECK_EQUAL(entry.size, size);
@@ -264,14 +264,14 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
       }
     }
     {
-      auto ring = shard->respRing.lock();
-      BOOST_CHECK_LE(ring->size(), entriesPerShard);
+      const auto ring = shard->respRing.snapshot();
+      BOOST_CHECK_LE(ring.size(), entriesPerShard);
       // verify that the shard is not empty
-      BOOST_CHECK_GT(ring->size(), (entriesPerShard * 0.5) + 1);
+      BOOST_CHECK_GT(ring.size(), (entriesPerShard * 0.5) + 1);
       // this would be optimal
-      BOOST_WARN_GT(ring->size(), entriesPerShard * 0.95);
-      totalResponses += ring->size();
-      for (const auto& entry : *ring) {
+      BOOST_WARN_GT(ring.size(), entriesPerShard * 0.95);
+      totalResponses += ring.size();
+      for (const auto& entry : ring) {
         BOOST_CHECK_EQUAL(entry.name, qname);
         BOOST_CHECK_EQUAL(entry.qtype, qtype);
         BOOST_CHECK_EQUAL(entry.size, size);
@@ -293,4 +293,107 @@ BOOST_AUTO_TEST_CASE(test_Rings_Threaded) {
 #endif
 }
 
+BOOST_AUTO_TEST_CASE(test_Rings_LongNames) {
+  /* names longer than what fits in the slot itself go to the overflow area,
+     entries with a short name must not see the leftovers of a longer one */
+  const size_t maxEntries = 16;
+  Rings rings(maxEntries, 1);
+  rings.init();
+
+  dnsheader dh;
+  memset(&dh, 0, sizeof(dh));
+  ComboAddress requestor("192.0.2.1");
+  struct timespec now;
+  gettime(&now);
+
+  const DNSName shortName("short.powerdns.com.");
+  const DNSName longName(std::string(63, 'a') + "." + std::string(63, 'b') + "." + std::string(63, 'c') + "." + std::string(61, 'd') + ".");
+  BOOST_REQUIRE_EQUAL(longName.wirelength(), 255U);
+  BOOST_REQUIRE_GT(longName.wirelength(), Rings::StoredName::s_inlineLength);
+  const DNSName mediumName(std::string(63, 'e') + ".powerdns.com.");
+  BOOST_REQUIRE_GT(mediumName.wirelength(), Rings::StoredName::s_inlineLength);
+
+  const std::vector<DNSName> names{longName, shortName, mediumName, DNSName(), shortName, longName};
+  for (size_t idx = 0; idx < maxEntries * 2; idx++) {
+    const auto& name = names.at(idx % names.size());
+    rings.insertQuery(now, requestor, name, QType::A, idx, dh, dnsdist::Protocol::DoUDP);
+    rings.insertResponse(now, requestor, name, QType::A, 0, idx, dh, requestor, dnsdist::Protocol::DoUDP);
+  }
+
+  const auto queries = rings.d_shards.at(0)->queryRing.snapshot();
+  BOOST_REQUIRE_EQUAL(queries.size(), maxEntries);
+  for (const auto& entry : queries) {
+    BOOST_CHECK_EQUAL(entry.name, names.at(entry.size % names.size()));
+  }
+  const auto responses = rings.d_shards.at(0)->respRing.snapshot();
+  BOOST_REQUIRE_EQUAL(responses.size(), maxEntries);
+  for (const auto& entry : responses) {
+    BOOST_CHECK_EQUAL(entry.name, names.at(entry.size % names.size()));
+  }
+
+  /* the wire name can be read without building a DNSName */
+  size_t visited = 0;
+  rings.d_shards.at(0)->queryRing.visit([&visited, &names](const Rings::StoredQuery& entry) {
+    const auto& storage = names.at(entry.size % names.size()).getStorage();
+    BOOST_CHECK(entry.name.getWire() == std::string_view(storage.data(), storage.size()));
+    visited++;
+  });
+  BOOST_CHECK_EQUAL(visited, maxEntries);
+}
+
+BOOST_AUTO_TEST_CASE(test_LockFreeRing_Wraparound) {
+  /* several writers pushing twice the capacity of a small ring, so that entries
+     compete for the same slots: an entry can only be missing from the last
+     'capacity' positions if its writer reported it as dropped, never because
+     an older entry, whose writer was delayed, has overwritten it */
+  struct Entry
+  {
+    static constexpr size_t getInlineSize()
+    {
+      return sizeof(Entry);
+    }
+    size_t getStoredSize() const
+    {
+      return sizeof(Entry);
+    }
+    uint64_t value;
+    uint64_t get() const
+    {
+      return value;
+    }
+  };
+  const size_t capacity = 8;
+  const size_t numberOfWriters = 4;
+  const size_t perWriter = (capacity * 2) / numberOfWriters;
+
+  for (size_t round = 0; round < 500; round++) {
+    LockFreeRing<uint64_t, Entry> ring;
+    ring.set_capacity(capacity);
+    std::atomic<bool> start{false};
+    std::atomic<size_t> dropped{0};
+    std::vector<std::thread> writers;
+    for (size_t idx = 0; idx < numberOfWriters; idx++) {
+      writers.emplace_back([&ring, &start, &dropped, idx, perWriter]() {
+        while (!start.load()) {
+          std::this_thread::yield();
+        }
+        for (size_t count = 0; count < perWriter; count++) {
+          bool replaced = false;
+          if (!ring.push_back(Entry{(idx * perWriter) + count}, replaced)) {
+            dropped++;
+          }
+        }
+      });
+    }
+    start.store(true);
+    for (auto& writer : writers) {
+      writer.join();
+    }
+
+    const auto entries = ring.snapshot();
+    BOOST_REQUIRE_LE(entries.size(), capacity);
+    BOOST_REQUIRE_GE(entries.size() + dropped.load(), capacity);
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
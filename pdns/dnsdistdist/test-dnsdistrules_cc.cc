@@ -5,6 +5,7 @@
 #include <thread>
 #include <boost/test/unit_test.hpp>
 
+#include "dnsdist-rule-chain.hh"
 #include "dnsdist-rules.hh"
 
 void checkParameterBound(const std::string& parameter, uint64_t value, size_t max);
@@ -154,4 +155,197 @@ BOOST_AUTO_TEST_CASE(test_poolOutstandingRule) {
   BOOST_CHECK_EQUAL(pOR2.matches(&dq), false);
 }
 
+static std::vector<DNSDistRuleAction> getRuleChain(const std::vector<std::shared_ptr<DNSRule>>& rules)
+{
+  std::vector<DNSDistRuleAction> chain;
+  for (const auto& rule : rules) {
+    chain.push_back({rule, nullptr, "", boost::uuids::uuid(), chain.size()});
+  }
+  return chain;
+}
+
+/* every entry of the compiled chain should match exactly when the rule itself does */
+static void checkCompiledChain(const dnsdist::rules::CompiledRuleChain& compiled, const DNSQuestion& dq)
+{
+  const auto leaves = compiled.getMatchingLeaves(dq);
+  for (const auto& entry : compiled.getEntries()) {
+    BOOST_CHECK_MESSAGE(compiled.matches(entry, dq, leaves) == entry.d_rule->matches(&dq), entry.d_rule->toString() + " for " + dq.ids.qname.toString() + "/" + QType(dq.ids.qtype).toString() + " from " + dq.ids.origRemote.toString() + " to " + dq.ids.origDest.toString());
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_CompiledRuleChain) {
+  SuffixMatchNode smnCom;
+  smnCom.add(DNSName("com."));
+  SuffixMatchNode smnPowerDNS;
+  smnPowerDNS.add(DNSName("powerdns.com."));
+  smnPowerDNS.add(DNSName("PowerDNS.org."));
+  SuffixMatchNode smnRoot;
+  smnRoot.add(g_rootdnsname);
+
+  NetmaskGroup nmgSources;
+  nmgSources.addMask("192.0.2.0/24");
+  nmgSources.addMask("!192.0.2.128/25");
+  nmgSources.addMask("192.0.2.192/26");
+  nmgSources.addMask("2001:db8::/32");
+  NetmaskGroup nmgOther;
+  nmgOther.addMask("192.0.0.0/8");
+  nmgOther.addMask("!192.0.2.0/24");
+  NetmaskGroup nmgDestinations;
+  nmgDestinations.addMask("127.0.0.0/8");
+
+  std::shared_ptr<DNSRule> qtypeA = std::make_shared<QTypeRule>(QType::A);
+  std::shared_ptr<DNSRule> qtypeAAAA = std::make_shared<QTypeRule>(QType::AAAA);
+  std::shared_ptr<DNSRule> com = std::make_shared<SuffixMatchNodeRule>(smnCom);
+  std::shared_ptr<DNSRule> powerdns = std::make_shared<SuffixMatchNodeRule>(smnPowerDNS);
+  std::shared_ptr<DNSRule> sources = std::make_shared<NetmaskGroupRule>(nmgSources, true);
+  std::shared_ptr<DNSRule> other = std::make_shared<NetmaskGroupRule>(nmgOther, true);
+  std::shared_ptr<DNSRule> tcp = std::make_shared<TCPRule>(false);
+  std::shared_ptr<DNSRule> notCom = std::make_shared<NotRule>(com);
+
+  std::vector<std::shared_ptr<DNSRule>> rules = {
+    qtypeA,
+    qtypeAAAA,
+    com,
+    powerdns,
+    std::make_shared<SuffixMatchNodeRule>(smnRoot),
+    sources,
+    other,
+    std::make_shared<NetmaskGroupRule>(nmgDestinations, false),
+    std::make_shared<AllRule>(),
+    notCom,
+    std::make_shared<AndRule>(std::vector<std::pair<int, std::shared_ptr<DNSRule>>>{{1, powerdns}, {2, qtypeAAAA}, {3, sources}}),
+    std::make_shared<OrRule>(std::vector<std::pair<int, std::shared_ptr<DNSRule>>>{{1, notCom}, {2, qtypeA}}),
+    /* not compiled */
+    tcp,
+    std::make_shared<AndRule>(std::vector<std::pair<int, std::shared_ptr<DNSRule>>>{{1, powerdns}, {2, tcp}}),
+  };
+  const auto chain = getRuleChain(rules);
+  dnsdist::rules::CompiledRuleChain compiled(chain);
+  BOOST_CHECK(compiled.isCompiledFrom(chain));
+  BOOST_REQUIRE_EQUAL(compiled.getEntries().size(), rules.size());
+  /* everything except AllRule and the last two */
+  BOOST_CHECK_EQUAL(compiled.getNumberOfCompiledRules(), rules.size() - 3);
+
+  InternalQueryState ids;
+  ids.qclass = QClass::IN;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+  PacketBuffer packet(sizeof(dnsheader));
+  DNSQuestion dq(ids, packet);
+
+  for (const auto& name : {"powerdns.com.", "www.powerdns.com.", "WWW.POWERDNS.ORG.", "powerdns.org.", "com.", "example.com.", "example.net.", "."}) {
+    for (const auto qtype : {QType::A, QType::AAAA, QType::TXT}) {
+      for (const auto& source : {"192.0.2.1", "192.0.2.130", "192.0.2.200", "192.0.3.1", "198.51.100.1", "2001:db8::1", "2001:db9::1"}) {
+        for (const auto& destination : {"127.0.0.1", "192.0.2.53"}) {
+          ids.qname = DNSName(name);
+          ids.qtype = qtype;
+          ids.origRemote = ComboAddress(source, 42);
+          ids.origDest = ComboAddress(destination, 53);
+          checkCompiledChain(compiled, dq);
+        }
+      }
+    }
+  }
+
+  /* any change to the rules is detected */
+  auto changed = chain;
+  std::swap(changed.at(0), changed.at(1));
+  BOOST_CHECK(!compiled.isCompiledFrom(changed));
+  changed = chain;
+  changed.pop_back();
+  BOOST_CHECK(!compiled.isCompiledFrom(changed));
+}
+
+BOOST_AUTO_TEST_CASE(test_CompiledRuleChainTooManyLeaves) {
+  std::vector<std::shared_ptr<DNSRule>> rules;
+  for (size_t idx = 0; idx < dnsdist::rules::CompiledRuleChain::s_maxLeaves + 10; idx++) {
+    SuffixMatchNode smn;
+    smn.add(DNSName("name" + std::to_string(idx) + ".powerdns.com."));
+    rules.push_back(std::make_shared<SuffixMatchNodeRule>(smn));
+  }
+  const auto chain = getRuleChain(rules);
+  dnsdist::rules::CompiledRuleChain compiled(chain);
+  /* the remaining rules are evaluated the usual way */
+  BOOST_CHECK_EQUAL(compiled.getNumberOfCompiledRules(), dnsdist::rules::CompiledRuleChain::s_maxLeaves);
+
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.origRemote = ComboAddress("192.0.2.1:42");
+  ids.origDest = ComboAddress("127.0.0.1:53");
+  PacketBuffer packet(sizeof(dnsheader));
+  DNSQuestion dq(ids, packet);
+  for (const auto idx : {size_t(0), dnsdist::rules::CompiledRuleChain::s_maxLeaves - 1, dnsdist::rules::CompiledRuleChain::s_maxLeaves, dnsdist::rules::CompiledRuleChain::s_maxLeaves + 9}) {
+    ids.qname = DNSName("www.name" + std::to_string(idx) + ".powerdns.com.");
+    checkCompiledChain(compiled, dq);
+  }
+}
+
+#ifdef BENCH_RULECHAIN
+BOOST_AUTO_TEST_CASE(test_BenchRuleChain) {
+  /* a chain of a few hundred rules, none of which match most queries,
+     as when blocking a list of domains and networks */
+  std::vector<std::shared_ptr<DNSRule>> rules;
+  std::shared_ptr<DNSRule> qtype = std::make_shared<QTypeRule>(QType::ANY);
+  for (size_t idx = 0; idx < 100; idx++) {
+    SuffixMatchNode smn;
+    smn.add(DNSName("blocked" + std::to_string(idx) + ".example.com."));
+    smn.add(DNSName("blocked" + std::to_string(idx) + ".example.net."));
+    std::shared_ptr<DNSRule> names = std::make_shared<SuffixMatchNodeRule>(smn);
+    NetmaskGroup nmg;
+    nmg.addMask("10." + std::to_string(idx) + ".0.0/16");
+    std::shared_ptr<DNSRule> sources = std::make_shared<NetmaskGroupRule>(nmg, true);
+    rules.push_back(names);
+    rules.push_back(sources);
+    rules.push_back(std::make_shared<AndRule>(std::vector<std::pair<int, std::shared_ptr<DNSRule>>>{{1, names}, {2, qtype}}));
+  }
+  const auto chain = getRuleChain(rules);
+  dnsdist::rules::CompiledRuleChain compiled(chain);
+  BOOST_REQUIRE_EQUAL(compiled.getNumberOfCompiledRules(), rules.size());
+
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.origDest = ComboAddress("127.0.0.1:53");
+  PacketBuffer packet(sizeof(dnsheader));
+  DNSQuestion dq(ids, packet);
+  std::vector<DNSName> names;
+  std::vector<ComboAddress> sources;
+  for (size_t idx = 0; idx < 1000; idx++) {
+    names.emplace_back("www" + std::to_string(idx) + ".powerdns.com.");
+    sources.emplace_back("192.0.2." + std::to_string(idx % 256), 42);
+  }
+
+  const size_t iterations = 100000;
+  size_t matched = 0;
+  StopWatch sw;
+  sw.start();
+  for (size_t idx = 0; idx < iterations; idx++) {
+    ids.qname = names.at(idx % names.size());
+    ids.origRemote = sources.at(idx % sources.size());
+    for (const auto& entry : chain) {
+      if (entry.d_rule->matches(&dq)) {
+        matched++;
+      }
+    }
+  }
+  auto elapsed = sw.udiff();
+  cerr << "rules evaluated one by one: " << std::to_string(static_cast<uint64_t>(iterations * 1000000.0 / elapsed)) << " queries/s (" << matched << " matches)" << endl;
+
+  matched = 0;
+  sw.start();
+  for (size_t idx = 0; idx < iterations; idx++) {
+    ids.qname = names.at(idx % names.size());
+    ids.origRemote = sources.at(idx % sources.size());
+    const auto leaves = compiled.getMatchingLeaves(dq);
+    for (const auto& entry : compiled.getEntries()) {
+      if (compiled.matches(entry, dq, leaves)) {
+        matched++;
+      }
+    }
+  }
+  elapsed = sw.udiff();
+  cerr << "compiled rule chain: " << std::to_string(static_cast<uint64_t>(iterations * 1000000.0 / elapsed)) << " queries/s (" << matched << " matches)" << endl;
+}
+#endif /* BENCH_RULECHAIN */
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,96 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-sketch.hh"
+#include "dnsname.hh"
+#include "iputils.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistsketch_hh)
+
+BOOST_AUTO_TEST_CASE(test_CountMinSketch) {
+  dnsdist::CountMinSketch sketch(1000, 4);
+  /* rounded up to the next power of two */
+  BOOST_CHECK_EQUAL(sketch.getWidth(), 1024U);
+  BOOST_CHECK_EQUAL(sketch.getDepth(), 4U);
+
+  std::hash<DNSName> hasher;
+  const DNSName name("powerdns.com.");
+  BOOST_CHECK_EQUAL(sketch.estimate(hasher(name)), 0U);
+
+  BOOST_CHECK_EQUAL(sketch.add(hasher(name)), 1U);
+  BOOST_CHECK_EQUAL(sketch.add(hasher(name), 41), 42U);
+  BOOST_CHECK_EQUAL(sketch.estimate(hasher(name)), 42U);
+  /* case-insensitive, like the hash */
+  BOOST_CHECK_EQUAL(sketch.estimate(hasher(DNSName("PowerDNS.COM."))), 42U);
+
+  /* insert a lot of other names, the estimate can only go up */
+  for (size_t idx = 0; idx < 10000; idx++) {
+    sketch.add(hasher(DNSName(std::to_string(idx)) + name));
+  }
+  BOOST_CHECK_GE(sketch.estimate(hasher(name)), 42U);
+  for (size_t idx = 0; idx < 10000; idx++) {
+    BOOST_CHECK_GE(sketch.estimate(hasher(DNSName(std::to_string(idx)) + name)), 1U);
+  }
+
+  sketch.clear();
+  BOOST_CHECK_EQUAL(sketch.estimate(hasher(name)), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_HeavyHitters) {
+  const size_t capacity = 10;
+  dnsdist::HeavyHitters<ComboAddress, ComboAddress::addressOnlyHash, ComboAddress::addressOnlyEqual> hitters(capacity);
+  BOOST_CHECK_EQUAL(hitters.size(), 0U);
+  BOOST_CHECK(hitters.getTop().empty());
+
+  /* 5 heavy hitters, sending 5000 to 25000 queries, hidden among 100000 clients sending a single query each */
+  uint64_t total = 0;
+  for (size_t idx = 0; idx < 100000; idx++) {
+    ComboAddress client("2001:db8::");
+    client.sin6.sin6_addr.s6_addr[13] = static_cast<uint8_t>(idx >> 16);
+    client.sin6.sin6_addr.s6_addr[14] = static_cast<uint8_t>(idx >> 8);
+    client.sin6.sin6_addr.s6_addr[15] = static_cast<uint8_t>(idx & 0xff);
+    hitters.add(client);
+    total++;
+
+    if (idx % 20 == 0) {
+      for (uint8_t heavy = 1; heavy <= 5; heavy++) {
+        ComboAddress heavyClient("192.0.2." + std::to_string(heavy), 53);
+        hitters.add(heavyClient, heavy);
+        total += heavy;
+      }
+    }
+  }
+
+  BOOST_CHECK_EQUAL(hitters.getTotal(), total);
+  BOOST_CHECK_EQUAL(hitters.size(), capacity);
+
+  const auto top = hitters.getTop(5);
+  BOOST_REQUIRE_EQUAL(top.size(), 5U);
+  for (size_t idx = 0; idx < top.size(); idx++) {
+    const uint8_t heavy = 5 - idx;
+    /* the port is not taken into account */
+    BOOST_CHECK_EQUAL(top.at(idx).first.toString(), "192.0.2." + std::to_string(heavy));
+    const uint64_t expected = 5000U * heavy;
+    BOOST_CHECK_GE(top.at(idx).second, expected);
+    /* the estimate should be quite close to the real count */
+    BOOST_CHECK_LE(top.at(idx).second, expected + (expected / 10));
+    /* the estimate can only have increased since that key was last seen */
+    BOOST_CHECK_GE(hitters.estimate(top.at(idx).first), top.at(idx).second);
+  }
+
+  size_t visited = 0;
+  hitters.visit([&visited](const ComboAddress&, uint64_t count) {
+    BOOST_CHECK_GE(count, 1U);
+    visited++;
+  });
+  BOOST_CHECK_EQUAL(visited, capacity);
+
+  hitters.clear();
+  BOOST_CHECK_EQUAL(hitters.size(), 0U);
+  BOOST_CHECK_EQUAL(hitters.getTotal(), 0U);
+  BOOST_CHECK_EQUAL(hitters.estimate(ComboAddress("192.0.2.1")), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
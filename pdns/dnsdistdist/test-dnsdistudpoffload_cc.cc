@@ -0,0 +1,328 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-udp-offload.hh"
+
+BOOST_AUTO_TEST_SUITE(dnsdistudpoffload_cc)
+
+struct TestMessages
+{
+  TestMessages(const std::vector<std::pair<ComboAddress, size_t>>& specs) :
+    d_remotes(specs.size()), d_iovs(specs.size()), d_msgs(specs.size())
+  {
+    for (size_t idx = 0; idx < specs.size(); idx++) {
+      d_remotes.at(idx) = specs.at(idx).first;
+      d_buffers.emplace_back(specs.at(idx).second, static_cast<uint8_t>(idx));
+      fillMSGHdr(&d_msgs.at(idx).msg_hdr, &d_iovs.at(idx), nullptr, 0, reinterpret_cast<char*>(d_buffers.at(idx).data()), d_buffers.at(idx).size(), &d_remotes.at(idx));
+    }
+  }
+
+  std::vector<ComboAddress> d_remotes;
+  std::vector<std::vector<uint8_t>> d_buffers;
+  std::vector<struct iovec> d_iovs;
+  std::vector<struct mmsghdr> d_msgs;
+};
+
+BOOST_AUTO_TEST_CASE(test_GSOCoalescer)
+{
+  /* coalescing does not depend on the running kernel supporting GSO, only on the headers */
+#ifdef UDP_SEGMENT
+  const ComboAddress first("192.0.2.1:53000");
+  const ComboAddress second("192.0.2.2:53000");
+  dnsdist::udp::GSOCoalescer coalescer;
+
+  {
+    /* same destination, same size, and a smaller last one: everything fits into one message */
+    TestMessages messages({{first, 100}, {first, 100}, {first, 100}, {first, 42}});
+    auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+    BOOST_REQUIRE_EQUAL(count, 1U);
+    BOOST_CHECK_EQUAL(msgs[0].msg_hdr.msg_iovlen, 4U);
+    BOOST_CHECK(msgs[0].msg_hdr.msg_name == &messages.d_remotes.at(0));
+    BOOST_CHECK_EQUAL(msgs[0].msg_hdr.msg_iov[3].iov_len, 42U);
+    BOOST_CHECK(msgs[0].msg_hdr.msg_iov[3].iov_base == messages.d_buffers.at(3).data());
+    const auto* cmsg = CMSG_FIRSTHDR(&msgs[0].msg_hdr);
+    BOOST_REQUIRE(cmsg != nullptr);
+    BOOST_CHECK_EQUAL(cmsg->cmsg_level, SOL_UDP);
+    BOOST_CHECK_EQUAL(cmsg->cmsg_type, UDP_SEGMENT);
+    uint16_t segmentSize = 0;
+    memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+    BOOST_CHECK_EQUAL(segmentSize, 100U);
+  }
+
+  {
+    /* different destinations, a smaller message ending a run and a larger one that cannot be part of one */
+    TestMessages messages({{first, 100}, {second, 100}, {second, 50}, {second, 100}, {second, 100}, {second, 100}, {second, 200}});
+    auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+    BOOST_REQUIRE_EQUAL(count, 4U);
+    BOOST_CHECK_EQUAL(msgs[0].msg_hdr.msg_iovlen, 1U);
+    BOOST_CHECK(msgs[0].msg_hdr.msg_control == nullptr);
+    BOOST_CHECK_EQUAL(msgs[1].msg_hdr.msg_iovlen, 2U);
+    BOOST_CHECK_EQUAL(msgs[1].msg_hdr.msg_iov[1].iov_len, 50U);
+    BOOST_CHECK_EQUAL(msgs[2].msg_hdr.msg_iovlen, 3U);
+    BOOST_CHECK_EQUAL(msgs[3].msg_hdr.msg_iovlen, 1U);
+    BOOST_CHECK_EQUAL(msgs[3].msg_hdr.msg_iov[0].iov_len, 200U);
+  }
+
+  {
+    /* no more than s_maxSegments segments per message */
+    std::vector<std::pair<ComboAddress, size_t>> specs(dnsdist::udp::s_maxSegments + 1, {first, 100});
+    TestMessages messages(specs);
+    auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+    BOOST_REQUIRE_EQUAL(count, 2U);
+    BOOST_CHECK_EQUAL(msgs[0].msg_hdr.msg_iovlen, dnsdist::udp::s_maxSegments);
+    BOOST_CHECK_EQUAL(msgs[1].msg_hdr.msg_iovlen, 1U);
+  }
+#else
+  /* without UDP_SEGMENT the messages are passed through untouched */
+  const ComboAddress first("192.0.2.1:53000");
+  dnsdist::udp::GSOCoalescer coalescer;
+  TestMessages messages({{first, 100}, {first, 100}});
+  auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+  BOOST_CHECK(msgs == messages.d_msgs.data());
+  BOOST_CHECK_EQUAL(count, 2U);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(test_GSOToGROOverLoopback)
+{
+  if (!dnsdist::udp::isGSOSupported()) {
+    BOOST_TEST_MESSAGE("Skipping, GSO is not supported");
+    return;
+  }
+
+  ComboAddress local("127.0.0.1:0");
+  int receiver = SSocket(AF_INET, SOCK_DGRAM, 0);
+  SBind(receiver, local);
+  socklen_t addrLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(receiver, reinterpret_cast<struct sockaddr*>(&local), &addrLen), 0);
+  if (!dnsdist::udp::enableGRO(receiver)) {
+    BOOST_TEST_MESSAGE("Skipping, GRO is not supported");
+    close(receiver);
+    return;
+  }
+  int sender = SSocket(AF_INET, SOCK_DGRAM, 0);
+
+  /* 16 datagrams sent with a single message and a single system call */
+  const size_t datagrams = 16;
+  std::vector<std::pair<ComboAddress, size_t>> specs(datagrams, {local, 100});
+  TestMessages messages(specs);
+  dnsdist::udp::GSOCoalescer coalescer;
+  auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+  BOOST_REQUIRE_EQUAL(count, 1U);
+  BOOST_REQUIRE_EQUAL(sendmmsg(sender, msgs, count, 0), 1);
+
+  /* and received with as few system calls as possible, the kernel keeping them coalesced */
+  std::vector<uint8_t> buffer(dnsdist::udp::s_maxPayloadSize);
+  size_t received = 0;
+  size_t syscalls = 0;
+  bool coalesced = false;
+  while (received < datagrams) {
+    ComboAddress from("0.0.0.0");
+    struct msghdr msgh;
+    struct iovec iov;
+    cmsgbuf_aligned cbuf;
+    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), reinterpret_cast<char*>(buffer.data()), buffer.size(), &from);
+    ssize_t got = recvmsg(receiver, &msgh, 0);
+    BOOST_REQUIRE(got > 0);
+    ++syscalls;
+
+    size_t segmentSize = dnsdist::udp::getGROSegmentSize(&msgh);
+    if (segmentSize == 0) {
+      segmentSize = static_cast<size_t>(got);
+    }
+    else {
+      coalesced = true;
+    }
+    BOOST_REQUIRE_EQUAL(segmentSize, 100U);
+    for (size_t offset = 0; offset < static_cast<size_t>(got); offset += segmentSize) {
+      /* every datagram is filled with its index */
+      BOOST_CHECK_EQUAL(buffer.at(offset), received);
+      ++received;
+    }
+  }
+  BOOST_CHECK_EQUAL(received, datagrams);
+  BOOST_TEST_MESSAGE("Received " << received << " datagrams in " << syscalls << " system call(s)");
+  if (coalesced) {
+    /* GRO was active, so the kernel must have handed us more than one datagram per call */
+    BOOST_CHECK_LT(syscalls, datagrams);
+  }
+  else {
+    BOOST_TEST_MESSAGE("The kernel did not coalesce the datagrams on reception, not checking the number of system calls");
+  }
+
+  close(sender);
+  close(receiver);
+}
+
+BOOST_AUTO_TEST_CASE(test_SendMessages)
+{
+  ComboAddress local("127.0.0.1:0");
+  int receiver = SSocket(AF_INET, SOCK_DGRAM, 0);
+  SBind(receiver, local);
+  socklen_t addrLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(receiver, reinterpret_cast<struct sockaddr*>(&local), &addrLen), 0);
+  setNonBlocking(receiver);
+  int sender = SSocket(AF_INET, SOCK_DGRAM, 0);
+  /* an IPv4 socket cannot send to an IPv6 destination */
+  const ComboAddress unreachable("[2001:db8::1]:53");
+
+  const auto check = [&](bool gso) {
+    TestMessages messages({{local, 100}, {local, 100}, {unreachable, 100}, {local, 100}, {local, 100}});
+    dnsdist::udp::GSOCoalescer coalescer;
+    struct mmsghdr* msgs = messages.d_msgs.data();
+    unsigned int count = messages.d_msgs.size();
+    if (gso) {
+      std::tie(msgs, count) = coalescer.coalesce(msgs, count);
+      BOOST_REQUIRE_EQUAL(count, 3U);
+    }
+
+    std::vector<std::pair<size_t, int>> reported;
+    dnsdist::udp::sendMessages(sender, msgs, count, [&reported](size_t index, int error) {
+      reported.emplace_back(index, error);
+    });
+
+    /* the messages after the one that could not be sent have been sent anyway */
+    BOOST_REQUIRE_EQUAL(reported.size(), messages.d_msgs.size());
+    for (size_t idx = 0; idx < reported.size(); idx++) {
+      BOOST_CHECK_EQUAL(reported.at(idx).first, idx);
+      if (idx == 2) {
+        BOOST_CHECK_NE(reported.at(idx).second, 0);
+      }
+      else {
+        BOOST_CHECK_EQUAL(reported.at(idx).second, 0);
+      }
+    }
+
+    std::vector<uint8_t> received;
+    std::vector<uint8_t> buffer(dnsdist::udp::s_maxPayloadSize);
+    while (true) {
+      ssize_t got = recv(receiver, buffer.data(), buffer.size(), 0);
+      if (got <= 0) {
+        break;
+      }
+      /* every datagram is filled with its index */
+      received.push_back(buffer.at(0));
+    }
+    BOOST_CHECK(received == std::vector<uint8_t>({0, 1, 3, 4}));
+  };
+
+  check(false);
+  if (dnsdist::udp::isGSOSupported()) {
+    check(true);
+  }
+
+  close(sender);
+  close(receiver);
+}
+
+BOOST_AUTO_TEST_CASE(test_SendMessagesGSOFallback)
+{
+  if (!dnsdist::udp::isGSOSupported()) {
+    BOOST_TEST_MESSAGE("Skipping, GSO is not supported");
+    return;
+  }
+
+  ComboAddress local("127.0.0.1:0");
+  int receiver = SSocket(AF_INET, SOCK_DGRAM, 0);
+  SBind(receiver, local);
+  socklen_t addrLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(receiver, reinterpret_cast<struct sockaddr*>(&local), &addrLen), 0);
+  setNonBlocking(receiver);
+  int sender = SSocket(AF_INET, SOCK_DGRAM, 0);
+  /* the kernel refuses to segment datagrams without a checksum */
+  int on = 1;
+  if (setsockopt(sender, SOL_SOCKET, SO_NO_CHECK, &on, sizeof(on)) != 0) {
+    BOOST_TEST_MESSAGE("Skipping, unable to disable the UDP checksums");
+    close(sender);
+    close(receiver);
+    return;
+  }
+
+  TestMessages messages({{local, 100}, {local, 100}, {local, 100}, {local, 50}});
+  dnsdist::udp::GSOCoalescer coalescer;
+  auto [msgs, count] = coalescer.coalesce(messages.d_msgs.data(), messages.d_msgs.size());
+  BOOST_REQUIRE_EQUAL(count, 1U);
+
+  /* the coalesced message is refused, and its datagrams sent one by one instead */
+  std::vector<std::pair<size_t, int>> reported;
+  BOOST_CHECK(!dnsdist::udp::sendMessages(sender, msgs, count, [&reported](size_t index, int error) {
+    reported.emplace_back(index, error);
+  }));
+  BOOST_REQUIRE_EQUAL(reported.size(), messages.d_msgs.size());
+  for (size_t idx = 0; idx < reported.size(); idx++) {
+    BOOST_CHECK_EQUAL(reported.at(idx).first, idx);
+    BOOST_CHECK_EQUAL(reported.at(idx).second, 0);
+  }
+
+  std::vector<std::pair<uint8_t, ssize_t>> received;
+  std::vector<uint8_t> buffer(dnsdist::udp::s_maxPayloadSize);
+  while (true) {
+    ssize_t got = recv(receiver, buffer.data(), buffer.size(), 0);
+    if (got <= 0) {
+      break;
+    }
+    received.emplace_back(buffer.at(0), got);
+  }
+  const std::vector<std::pair<uint8_t, ssize_t>> expected = {{0, 100}, {1, 100}, {2, 100}, {3, 50}};
+  BOOST_CHECK(received == expected);
+
+  /* messages that are not coalesced are not affected */
+  BOOST_CHECK(dnsdist::udp::sendMessages(sender, messages.d_msgs.data(), messages.d_msgs.size(), [](size_t, int error) {
+    BOOST_CHECK_EQUAL(error, 0);
+  }));
+
+  close(sender);
+  close(receiver);
+}
+
+#if 0
+/* measures the cost of sending response-sized datagrams to a single client over the loopback, coalesced
+   or not. Only the sending side is measured, datagrams dropped by the receiving side are not accounted for */
+BOOST_AUTO_TEST_CASE(test_GSOLoopbackBench)
+{
+  const size_t datagrams = 1000000;
+  const size_t batchSize = 64;
+  const size_t datagramSize = 512;
+
+  ComboAddress local("127.0.0.1:0");
+  int receiver = SSocket(AF_INET, SOCK_DGRAM, 0);
+  SBind(receiver, local);
+  socklen_t addrLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(receiver, reinterpret_cast<struct sockaddr*>(&local), &addrLen), 0);
+  setNonBlocking(receiver);
+  dnsdist::udp::enableGRO(receiver);
+  int sender = SSocket(AF_INET, SOCK_DGRAM, 0);
+
+  std::vector<std::pair<ComboAddress, size_t>> specs(batchSize, {local, datagramSize});
+  TestMessages messages(specs);
+  std::vector<uint8_t> buffer(dnsdist::udp::s_maxPayloadSize);
+
+  for (const bool gso : {false, true}) {
+    dnsdist::udp::GSOCoalescer coalescer;
+    size_t sendCalls = 0;
+    DTime dt;
+    dt.set();
+    for (size_t sent = 0; sent < datagrams; sent += batchSize) {
+      struct mmsghdr* msgs = messages.d_msgs.data();
+      unsigned int count = messages.d_msgs.size();
+      if (gso) {
+        std::tie(msgs, count) = coalescer.coalesce(msgs, count);
+      }
+      dnsdist::udp::sendMessages(sender, msgs, count, [](size_t, int) {});
+      ++sendCalls;
+      /* drain the receiving side so that the socket buffer does not fill up */
+      while (recv(receiver, buffer.data(), buffer.size(), 0) > 0) {
+      }
+    }
+    const auto elapsed = dt.udiff();
+    cerr << (gso ? "GSO" : "no GSO") << ": " << datagrams << " datagrams of " << datagramSize << " bytes in " << elapsed / 1000 << " ms, " << (datagrams * 1000000.0 / elapsed) << " datagrams/s, " << sendCalls << " sendmmsg() batches" << endl;
+  }
+
+  close(sender);
+  close(receiver);
+}
+#endif
+
+BOOST_AUTO_TEST_SUITE_END()
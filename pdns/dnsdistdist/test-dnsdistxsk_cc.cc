@@ -0,0 +1,239 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include "dnsdist-xsk.hh"
+
+#ifdef HAVE_XSK
+#include <net/ethernet.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+BOOST_AUTO_TEST_SUITE(dnsdistxsk_cc)
+
+static const uint8_t s_clientMAC[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+static const uint8_t s_serverMAC[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x02};
+
+static uint16_t verifyChecksum(const uint8_t* data, size_t len, uint32_t sum)
+{
+  for (size_t idx = 0; idx < len; idx += 2) {
+    sum += (static_cast<uint32_t>(data[idx]) << 8) | (idx + 1 < len ? data[idx + 1] : 0);
+  }
+  while (sum >> 16) {
+    sum = (sum & 0xffff) + (sum >> 16);
+  }
+  /* a valid checksum makes the sum of everything, including the checksum itself, 0xffff */
+  return static_cast<uint16_t>(~sum);
+}
+
+static uint32_t pseudoHeaderSum(const uint8_t* addresses, size_t addressesLen, uint16_t udpLength)
+{
+  uint32_t sum = 0;
+  for (size_t idx = 0; idx < addressesLen; idx += 2) {
+    sum += (static_cast<uint32_t>(addresses[idx]) << 8) | addresses[idx + 1];
+  }
+  return sum + IPPROTO_UDP + udpLength;
+}
+
+/* builds an Ethernet frame holding payload over UDP, from 'from' to 'to' */
+static std::vector<uint8_t> buildFrame(const ComboAddress& from, const ComboAddress& to, const PacketBuffer& payload)
+{
+  std::vector<uint8_t> frame;
+  struct ether_header eth;
+  memcpy(eth.ether_shost, s_clientMAC, sizeof(s_clientMAC));
+  memcpy(eth.ether_dhost, s_serverMAC, sizeof(s_serverMAC));
+  eth.ether_type = htons(from.isIPv4() ? ETHERTYPE_IP : ETHERTYPE_IPV6);
+  frame.insert(frame.end(), reinterpret_cast<const uint8_t*>(&eth), reinterpret_cast<const uint8_t*>(&eth) + sizeof(eth));
+
+  const uint16_t udpLength = sizeof(struct udphdr) + payload.size();
+  if (from.isIPv4()) {
+    struct iphdr ip;
+    memset(&ip, 0, sizeof(ip));
+    ip.version = 4;
+    ip.ihl = 5;
+    ip.tot_len = htons(sizeof(ip) + udpLength);
+    ip.ttl = 42;
+    ip.protocol = IPPROTO_UDP;
+    ip.saddr = from.sin4.sin_addr.s_addr;
+    ip.daddr = to.sin4.sin_addr.s_addr;
+    frame.insert(frame.end(), reinterpret_cast<const uint8_t*>(&ip), reinterpret_cast<const uint8_t*>(&ip) + sizeof(ip));
+  }
+  else {
+    struct ip6_hdr ip6;
+    memset(&ip6, 0, sizeof(ip6));
+    ip6.ip6_vfc = 6 << 4;
+    ip6.ip6_plen = htons(udpLength);
+    ip6.ip6_nxt = IPPROTO_UDP;
+    ip6.ip6_hlim = 42;
+    memcpy(&ip6.ip6_src, &from.sin6.sin6_addr, sizeof(ip6.ip6_src));
+    memcpy(&ip6.ip6_dst, &to.sin6.sin6_addr, sizeof(ip6.ip6_dst));
+    frame.insert(frame.end(), reinterpret_cast<const uint8_t*>(&ip6), reinterpret_cast<const uint8_t*>(&ip6) + sizeof(ip6));
+  }
+
+  struct udphdr udp;
+  udp.source = from.sin4.sin_port;
+  udp.dest = to.sin4.sin_port;
+  udp.len = htons(udpLength);
+  udp.check = 0;
+  frame.insert(frame.end(), reinterpret_cast<const uint8_t*>(&udp), reinterpret_cast<const uint8_t*>(&udp) + sizeof(udp));
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  return frame;
+}
+
+static void checkResponse(const std::vector<uint8_t>& frame, const dnsdist::xsk::XskPacket& packet, const ComboAddress& client, const ComboAddress& server, const PacketBuffer& response)
+{
+  const size_t ipHeaderSize = client.isIPv4() ? sizeof(struct iphdr) : sizeof(struct ip6_hdr);
+  BOOST_REQUIRE_EQUAL(packet.getLength(), sizeof(struct ether_header) + ipHeaderSize + sizeof(struct udphdr) + response.size());
+
+  struct ether_header eth;
+  memcpy(&eth, frame.data(), sizeof(eth));
+  BOOST_CHECK(memcmp(eth.ether_shost, s_serverMAC, sizeof(s_serverMAC)) == 0);
+  BOOST_CHECK(memcmp(eth.ether_dhost, s_clientMAC, sizeof(s_clientMAC)) == 0);
+
+  const uint8_t* l3 = frame.data() + sizeof(eth);
+  const uint16_t udpLength = sizeof(struct udphdr) + response.size();
+  uint32_t sum = 0;
+  if (client.isIPv4()) {
+    struct iphdr ip;
+    memcpy(&ip, l3, sizeof(ip));
+    BOOST_CHECK_EQUAL(ip.saddr, server.sin4.sin_addr.s_addr);
+    BOOST_CHECK_EQUAL(ip.daddr, client.sin4.sin_addr.s_addr);
+    BOOST_CHECK_EQUAL(ntohs(ip.tot_len), sizeof(ip) + udpLength);
+    BOOST_CHECK_EQUAL(verifyChecksum(l3, sizeof(ip), 0), 0U);
+    sum = pseudoHeaderSum(l3 + offsetof(struct iphdr, saddr), 8, udpLength);
+  }
+  else {
+    struct ip6_hdr ip6;
+    memcpy(&ip6, l3, sizeof(ip6));
+    BOOST_CHECK(memcmp(&ip6.ip6_src, &server.sin6.sin6_addr, sizeof(ip6.ip6_src)) == 0);
+    BOOST_CHECK(memcmp(&ip6.ip6_dst, &client.sin6.sin6_addr, sizeof(ip6.ip6_dst)) == 0);
+    BOOST_CHECK_EQUAL(ntohs(ip6.ip6_plen), udpLength);
+    sum = pseudoHeaderSum(l3 + offsetof(struct ip6_hdr, ip6_src), 32, udpLength);
+  }
+
+  const uint8_t* l4 = l3 + ipHeaderSize;
+  struct udphdr udp;
+  memcpy(&udp, l4, sizeof(udp));
+  BOOST_CHECK_EQUAL(udp.source, server.sin4.sin_port);
+  BOOST_CHECK_EQUAL(udp.dest, client.sin4.sin_port);
+  BOOST_CHECK_EQUAL(ntohs(udp.len), udpLength);
+  BOOST_CHECK(udp.check != 0);
+  BOOST_CHECK_EQUAL(verifyChecksum(l4, udpLength, sum), 0U);
+  BOOST_CHECK(memcmp(l4 + sizeof(udp), response.data(), response.size()) == 0);
+}
+
+BOOST_AUTO_TEST_CASE(test_XskPacket_V4)
+{
+  const ComboAddress client("192.0.2.1:42000");
+  const ComboAddress server("192.0.2.53:53");
+  const PacketBuffer query(42, 'Q');
+  auto frame = buildFrame(client, server, query);
+  const size_t queryFrameSize = frame.size();
+  /* room for the response */
+  frame.resize(dnsdist::xsk::s_frameSize - 256);
+
+  dnsdist::xsk::XskPacket packet(frame.data(), queryFrameSize, frame.size(), 4096 + 256);
+  BOOST_REQUIRE(packet.parse());
+  BOOST_CHECK(packet.getFrom() == client);
+  BOOST_CHECK(packet.getTo() == server);
+  BOOST_CHECK(packet.getPayload() == query);
+  BOOST_CHECK_EQUAL(packet.getAddress(), 4096U + 256U);
+
+  /* larger and odd-sized, to exercise the checksum of a trailing byte */
+  const PacketBuffer response(513, 'R');
+  BOOST_REQUIRE(packet.setResponse(response));
+  checkResponse(frame, packet, client, server, response);
+
+  /* does not fit in the frame */
+  BOOST_CHECK(!packet.setResponse(PacketBuffer(frame.size(), 'R')));
+}
+
+BOOST_AUTO_TEST_CASE(test_XskPacket_V6)
+{
+  const ComboAddress client("[2001:db8::1]:42000");
+  const ComboAddress server("[2001:db8::53]:53");
+  const PacketBuffer query(42, 'Q');
+  auto frame = buildFrame(client, server, query);
+  const size_t queryFrameSize = frame.size();
+  frame.resize(dnsdist::xsk::s_frameSize - 256);
+
+  dnsdist::xsk::XskPacket packet(frame.data(), queryFrameSize, frame.size(), 256);
+  BOOST_REQUIRE(packet.parse());
+  BOOST_CHECK(packet.getFrom() == client);
+  BOOST_CHECK(packet.getTo() == server);
+  BOOST_CHECK(packet.getPayload() == query);
+
+  const PacketBuffer response(100, 'R');
+  BOOST_REQUIRE(packet.setResponse(response));
+  checkResponse(frame, packet, client, server, response);
+}
+
+BOOST_AUTO_TEST_CASE(test_XskPacket_Invalid)
+{
+  const ComboAddress client("192.0.2.1:42000");
+  const ComboAddress server("192.0.2.53:53");
+  const PacketBuffer query(42, 'Q');
+  const auto valid = buildFrame(client, server, query);
+
+  {
+    /* truncated */
+    auto frame = valid;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size() - 1, frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+
+  {
+    /* padded, which is fine */
+    auto frame = valid;
+    frame.resize(frame.size() + 10);
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_REQUIRE(packet.parse());
+    BOOST_CHECK(packet.getPayload() == query);
+  }
+
+  {
+    /* fragment */
+    auto frame = valid;
+    frame.at(sizeof(struct ether_header) + offsetof(struct iphdr, frag_off)) = 0x20;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+
+  {
+    /* IP options */
+    auto frame = valid;
+    frame.at(sizeof(struct ether_header)) = 0x46;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+
+  {
+    /* not UDP */
+    auto frame = valid;
+    frame.at(sizeof(struct ether_header) + offsetof(struct iphdr, protocol)) = IPPROTO_TCP;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+
+  {
+    /* not IP */
+    auto frame = valid;
+    frame.at(offsetof(struct ether_header, ether_type)) = 0x08;
+    frame.at(offsetof(struct ether_header, ether_type) + 1) = 0x06;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+
+  {
+    /* UDP length larger than the IP payload */
+    auto frame = valid;
+    frame.at(sizeof(struct ether_header) + sizeof(struct iphdr) + offsetof(struct udphdr, len) + 1) += 1;
+    dnsdist::xsk::XskPacket packet(frame.data(), frame.size(), frame.size(), 0);
+    BOOST_CHECK(!packet.parse());
+  }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif /* HAVE_XSK */
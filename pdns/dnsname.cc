@@ -24,6 +24,12 @@
 #include <string>
 #include <cinttypes>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "dnswriter.hh"
 #include "misc.hh"
 
@@ -175,6 +181,61 @@ void DNSName::packetParser(const char* qpos, int len, int offset, bool uncompres
   }
 }
 
+DNSNameView::DNSNameView(const char* p, size_t len, size_t offset, uint16_t* qtype, uint16_t* qclass, unsigned int* consumed)
+{
+  if (offset >= len) {
+    throw std::range_error("Trying to read past the end of the buffer (" + std::to_string(offset) + " >= " + std::to_string(len) + ")");
+  }
+
+  const unsigned char* const begin = reinterpret_cast<const unsigned char*>(p) + offset;
+  const unsigned char* const end = reinterpret_cast<const unsigned char*>(p) + len;
+  const unsigned char* pos = begin;
+  unsigned char labellen;
+  while ((labellen = *pos++)) {
+    if (labellen >= 0xc0) {
+      throw std::range_error("Found compressed label, instructed not to follow");
+    }
+    else if (labellen & 0xc0) {
+      throw std::range_error("Found an invalid label length in qname (only one of the first two bits is set)");
+    }
+    if (pos + labellen >= end) {
+      throw std::range_error("Found an invalid label length in qname");
+    }
+    /* the length of the labels so far, this one and the root label */
+    if (static_cast<size_t>(pos - begin) + labellen + 1 > DNSName::s_maxDNSNameLength) {
+      throw std::range_error("name too long to append");
+    }
+    pos += labellen;
+  }
+
+  d_storage = std::string_view(reinterpret_cast<const char*>(begin), pos - begin);
+  if (consumed) {
+    *consumed = d_storage.size();
+  }
+  if (qtype) {
+    if (pos + 2 > end) {
+      throw std::range_error("Trying to read qtype past the end of the buffer (" + std::to_string((pos - begin) + offset + 2) + " > " + std::to_string(len) + ")");
+    }
+    *qtype = (*pos) * 256 + *(pos + 1);
+  }
+  pos += 2;
+  if (qclass) {
+    if (pos + 2 > end) {
+      throw std::range_error("Trying to read qclass past the end of the buffer (" + std::to_string((pos - begin) + offset + 2) + " > " + std::to_string(len) + ")");
+    }
+    *qclass = (*pos) * 256 + *(pos + 1);
+  }
+}
+
+DNSName DNSNameView::toDNSName() const
+{
+  /* the view has already been validated, either by the packet parser or because it
+     comes from an existing name, so the storage can be copied as is */
+  DNSName ret;
+  ret.d_storage.assign(d_storage.data(), d_storage.size());
+  return ret;
+}
+
 std::string DNSName::toString(const std::string& separator, const bool trailing) const
 {
   std::string ret;
@@ -635,3 +696,69 @@ bool DNSName::RawLabelsVisitor::empty() const
 {
   return d_position == 0;
 }
+
+#if defined(__SSE2__)
+static inline __m128i dns_tolower_16(__m128i chunk)
+{
+  const __m128i beforeA = _mm_set1_epi8('A' - 1);
+  const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+  const __m128i offset = _mm_set1_epi8('a' - 'A');
+  /* the comparisons are signed, so bytes above 0x7F are never considered uppercase */
+  const __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(chunk, beforeA), _mm_cmplt_epi8(chunk, afterZ));
+  return _mm_add_epi8(chunk, _mm_and_si128(upper, offset));
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static inline uint8x16_t dns_tolower_16(uint8x16_t chunk)
+{
+  /* anything below 'A' wraps around, so it is not in the range either */
+  const uint8x16_t upper = vcltq_u8(vsubq_u8(chunk, vdupq_n_u8('A')), vdupq_n_u8('Z' - 'A' + 1));
+  return vaddq_u8(chunk, vandq_u8(upper, vdupq_n_u8('a' - 'A')));
+}
+#endif
+
+void dns_tolower_n(const unsigned char* in, size_t length, unsigned char* out)
+{
+  size_t idx = 0;
+#if defined(__SSE2__)
+  for (; (idx + sizeof(__m128i)) <= length; idx += sizeof(__m128i)) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + idx));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + idx), dns_tolower_16(chunk));
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; (idx + sizeof(uint8x16_t)) <= length; idx += sizeof(uint8x16_t)) {
+    vst1q_u8(out + idx, dns_tolower_16(vld1q_u8(in + idx)));
+  }
+#endif
+  for (; idx < length; idx++) {
+    out[idx] = dns_tolower(in[idx]);
+  }
+}
+
+size_t dns_imismatch(const unsigned char* lhs, const unsigned char* rhs, size_t length)
+{
+  size_t idx = 0;
+#if defined(__SSE2__)
+  for (; (idx + sizeof(__m128i)) <= length; idx += sizeof(__m128i)) {
+    const __m128i ours = dns_tolower_16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(lhs + idx)));
+    const __m128i theirs = dns_tolower_16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(rhs + idx)));
+    const auto equal = static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(ours, theirs)));
+    if (equal != 0xffff) {
+      return idx + __builtin_ctz(~equal);
+    }
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; (idx + sizeof(uint8x16_t)) <= length; idx += sizeof(uint8x16_t)) {
+    const uint8x16_t equal = vceqq_u8(dns_tolower_16(vld1q_u8(lhs + idx)), dns_tolower_16(vld1q_u8(rhs + idx)));
+    if (vminvq_u8(equal) != 0xff) {
+      /* the scalar loop below finds the exact position */
+      break;
+    }
+  }
+#endif
+  for (; idx < length; idx++) {
+    if (dns_tolower(lhs[idx]) != dns_tolower(rhs[idx])) {
+      return idx;
+    }
+  }
+  return length;
+}
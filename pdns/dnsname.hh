@@ -58,6 +58,16 @@ inline unsigned char dns_tolower(unsigned char c)
 
 #include "burtle.hh"
 
+/* Versions of dns_tolower() and of the comparisons built on it working on a whole buffer
+   at once, 16 bytes at a time when SSE2 or NEON is available. They are the building blocks
+   of the case-insensitive comparisons of names. */
+void dns_tolower_n(const unsigned char* in, size_t length, unsigned char* out); //!< in and out can be the same buffer
+size_t dns_imismatch(const unsigned char* lhs, const unsigned char* rhs, size_t length); //!< Position of the first byte differing other than by case, length if there is none
+inline bool dns_iequals_n(const unsigned char* lhs, const unsigned char* rhs, size_t length)
+{
+  return dns_imismatch(lhs, rhs, length) == length;
+}
+
 // #include "dns.hh"
 // #include "logger.hh"
 
@@ -129,8 +139,9 @@ public:
   }
   void makeUsLowerCase()
   {
-    for(auto & c : d_storage) {
-      c=dns_tolower(c);
+    if (!d_storage.empty()) {
+      auto* storage = reinterpret_cast<unsigned char*>(&d_storage[0]);
+      dns_tolower_n(storage, d_storage.size(), storage);
     }
   }
   void makeUsRelative(const DNSName& zone);
@@ -214,6 +225,7 @@ public:
   RawLabelsVisitor getRawLabelsVisitor() const;
 
 private:
+  friend class DNSNameView;
   string_t d_storage;
 
   void packetParser(const char* p, int len, int offset, bool uncompress, uint16_t* qtype, uint16_t* qclass, unsigned int* consumed, int depth, uint16_t minOffset);
@@ -224,8 +236,69 @@ private:
 
 size_t hash_value(DNSName const& d);
 
+/* A non-owning, read-only view of a name in uncompressed wire format, for example the
+   qname of a query or response, that never copies or allocates. It hashes and compares
+   exactly like the corresponding DNSName, so it can be used to look up or check a name
+   straight from a packet on hot paths, and converted to a DNSName only when it needs to
+   be kept.
+   The underlying memory must outlive the view, and must not be altered while the view exists. */
+class DNSNameView
+{
+public:
+  DNSNameView() {} //!< Constructs an *empty* view, NOT the root!
+  DNSNameView(const DNSName& name) :
+    d_storage(name.getStorage().data(), name.getStorage().size())
+  {
+  }
+  //! Parses an uncompressed name from a DNS packet, with the same checks and exceptions as the corresponding DNSName constructor
+  DNSNameView(const char* p, size_t len, size_t offset, uint16_t* qtype = nullptr, uint16_t* qclass = nullptr, unsigned int* consumed = nullptr);
+
+  std::string_view getStorage() const
+  {
+    return d_storage;
+  }
+  size_t wirelength() const
+  {
+    return d_storage.size();
+  }
+  bool empty() const
+  {
+    return d_storage.empty();
+  }
+  bool isRoot() const
+  {
+    return d_storage.size() == 1 && d_storage[0] == 0;
+  }
+  size_t hash(size_t init = 0) const
+  {
+    return burtleCI(reinterpret_cast<const unsigned char*>(d_storage.data()), d_storage.size(), init);
+  }
+
+  bool operator==(const DNSNameView& rhs) const
+  {
+    if (rhs.d_storage.size() != d_storage.size()) {
+      return false;
+    }
+    return dns_iequals_n(reinterpret_cast<const unsigned char*>(d_storage.data()), reinterpret_cast<const unsigned char*>(rhs.d_storage.data()), d_storage.size());
+  }
+  bool operator!=(const DNSNameView& rhs) const
+  {
+    return !(*this == rhs);
+  }
+  inline bool canonCompare(const DNSNameView& rhs) const;
+
+  DNSName toDNSName() const;
+
+private:
+  std::string_view d_storage;
+};
 
 inline bool DNSName::canonCompare(const DNSName& rhs) const
+{
+  return DNSNameView(*this).canonCompare(DNSNameView(rhs));
+}
+
+inline bool DNSNameView::canonCompare(const DNSNameView& rhs) const
 {
   //      01234567890abcd
   // us:  1a3www4ds9a2nl
@@ -238,13 +311,13 @@ inline bool DNSName::canonCompare(const DNSName& rhs) const
   uint8_t ourpos[64], rhspos[64];
   uint8_t ourcount=0, rhscount=0;
   //cout<<"Asked to compare "<<toString()<<" to "<<rhs.toString()<<endl;
-  for(const unsigned char* p = (const unsigned char*)d_storage.c_str(); p < (const unsigned char*)d_storage.c_str() + d_storage.size() && *p && ourcount < sizeof(ourpos); p+=*p+1)
-    ourpos[ourcount++]=(p-(const unsigned char*)d_storage.c_str());
-  for(const unsigned char* p = (const unsigned char*)rhs.d_storage.c_str(); p < (const unsigned char*)rhs.d_storage.c_str() + rhs.d_storage.size() && *p && rhscount < sizeof(rhspos); p+=*p+1)
-    rhspos[rhscount++]=(p-(const unsigned char*)rhs.d_storage.c_str());
+  for(const unsigned char* p = (const unsigned char*)d_storage.data(); p < (const unsigned char*)d_storage.data() + d_storage.size() && *p && ourcount < sizeof(ourpos); p+=*p+1)
+    ourpos[ourcount++]=(p-(const unsigned char*)d_storage.data());
+  for(const unsigned char* p = (const unsigned char*)rhs.d_storage.data(); p < (const unsigned char*)rhs.d_storage.data() + rhs.d_storage.size() && *p && rhscount < sizeof(rhspos); p+=*p+1)
+    rhspos[rhscount++]=(p-(const unsigned char*)rhs.d_storage.data());
 
   if(ourcount == sizeof(ourpos) || rhscount==sizeof(rhspos)) {
-    return slowCanonCompare(rhs);
+    return toDNSName().slowCanonCompare(rhs.toDNSName());
   }
 
   for(;;) {
@@ -255,29 +328,18 @@ inline bool DNSName::canonCompare(const DNSName& rhs) const
     ourcount--;
     rhscount--;
 
-    bool res=std::lexicographical_compare(
-					  d_storage.c_str() + ourpos[ourcount] + 1,
-					  d_storage.c_str() + ourpos[ourcount] + 1 + *(d_storage.c_str() + ourpos[ourcount]),
-					  rhs.d_storage.c_str() + rhspos[rhscount] + 1,
-					  rhs.d_storage.c_str() + rhspos[rhscount] + 1 + *(rhs.d_storage.c_str() + rhspos[rhscount]),
-					  [](const unsigned char& a, const unsigned char& b) {
-					    return dns_tolower(a) < dns_tolower(b);
-					  });
-
-    //    cout<<"Forward: "<<res<<endl;
-    if(res)
-      return true;
-
-    res=std::lexicographical_compare(	  rhs.d_storage.c_str() + rhspos[rhscount] + 1,
-					  rhs.d_storage.c_str() + rhspos[rhscount] + 1 + *(rhs.d_storage.c_str() + rhspos[rhscount]),
-					  d_storage.c_str() + ourpos[ourcount] + 1,
-					  d_storage.c_str() + ourpos[ourcount] + 1 + *(d_storage.c_str() + ourpos[ourcount]),
-					  [](const unsigned char& a, const unsigned char& b) {
-					    return dns_tolower(a) < dns_tolower(b);
-					  });
-    //    cout<<"Reverse: "<<res<<endl;
-    if(res)
-      return false;
+    const auto* ourLabel = reinterpret_cast<const unsigned char*>(d_storage.data()) + ourpos[ourcount];
+    const auto* rhsLabel = reinterpret_cast<const unsigned char*>(rhs.d_storage.data()) + rhspos[rhscount];
+    const size_t ourLength = *ourLabel++;
+    const size_t rhsLength = *rhsLabel++;
+    const size_t common = std::min(ourLength, rhsLength);
+    const size_t mismatch = dns_imismatch(ourLabel, rhsLabel, common);
+    if (mismatch < common) {
+      return dns_tolower(ourLabel[mismatch]) < dns_tolower(rhsLabel[mismatch]);
+    }
+    if (ourLength != rhsLength) {
+      return ourLength < rhsLength;
+    }
   }
   return false;
 }
@@ -614,6 +676,14 @@ struct SuffixMatchNode
       return d_tree.getBestMatch(name);
     }
 
+    template <typename V>
+    void visit(const V& v) const
+    {
+      for (const auto& n : d_nodes) {
+        v(n);
+      }
+    }
+
     std::string toString() const
     {
       std::string ret;
@@ -629,7 +699,7 @@ struct SuffixMatchNode
     }
 
   private:
-    mutable std::set<DNSName> d_nodes; // Only used for string generation
+    mutable std::set<DNSName> d_nodes; // Only used for string generation and visiting
 };
 
 std::ostream & operator<<(std::ostream &os, const DNSName& d);
@@ -638,6 +708,10 @@ namespace std {
     struct hash<DNSName> {
         size_t operator () (const DNSName& dn) const { return dn.hash(0); }
     };
+    template <>
+    struct hash<DNSNameView> {
+        size_t operator () (const DNSNameView& dn) const { return dn.hash(0); }
+    };
 }
 
 DNSName::string_t segmentDNSNameRaw(const char* input, size_t inputlen); // from ragel
@@ -648,14 +722,7 @@ bool DNSName::operator==(const DNSName& rhs) const
     return false;
   }
 
-  const auto* us = d_storage.cbegin();
-  const auto* p = rhs.d_storage.cbegin();
-  for (; us != d_storage.cend() && p != rhs.d_storage.cend(); ++us, ++p) {
-    if (dns_tolower(*p) != dns_tolower(*us)) {
-      return false;
-    }
-  }
-  return true;
+  return dns_iequals_n(reinterpret_cast<const unsigned char*>(d_storage.data()), reinterpret_cast<const unsigned char*>(rhs.d_storage.data()), d_storage.size());
 }
 
 struct DNSNameSet: public std::unordered_set<DNSName> {
@@ -0,0 +1,212 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include "lock.hh"
+
+/** Epoch-based reclamation, for data structures that are read without
+    holding any lock.
+
+    Readers enter a read-side section by calling read(), which returns a guard
+    object. As long as that guard is alive, no object retired via retire() after
+    the reader entered will be freed. Readers only touch a counter that is
+    (mostly) private to the current thread, so concurrent readers do not bounce
+    a shared cache line between CPUs the way a shared mutex does.
+
+    Writers are expected to serialize among themselves (usually via a regular
+    mutex), unlink an object from the shared structure and then hand it over
+    to retire(). Retired objects are actually freed by tryReclaim(), which never
+    blocks, or synchronize(), which waits for all readers that might still see
+    them to be gone.
+
+    Internally the epoch alternates between two parities, and every reader slot
+    holds one counter per parity. Objects retired during epoch N can be freed
+    once the epoch has moved to N+1 and no reader is left in the parity of N.
+*/
+class EpochReclaimer : public boost::noncopyable
+{
+  static constexpr size_t s_cacheLineSize{64};
+  /* threads are spread over these slots, sharing a slot is safe but
+     causes cache line sharing between the corresponding threads */
+  static constexpr size_t s_numberOfSlots{64};
+
+  struct alignas(s_cacheLineSize) ReaderSlot
+  {
+    std::array<std::atomic<uint64_t>, 2> d_counters{};
+  };
+
+public:
+  class ReadGuard : public boost::noncopyable
+  {
+  public:
+    explicit ReadGuard(EpochReclaimer& reclaimer): d_counter(reclaimer.enter())
+    {
+    }
+    ~ReadGuard()
+    {
+      d_counter->fetch_sub(1, std::memory_order_release);
+    }
+
+  private:
+    std::atomic<uint64_t>* d_counter;
+  };
+
+  EpochReclaimer()
+  {
+  }
+
+  ~EpochReclaimer()
+  {
+    /* there can't be any reader left at this point */
+    auto lists = d_lists.lock();
+    release(lists->d_waiting);
+    release(lists->d_pending);
+  }
+
+  ReadGuard read()
+  {
+    return ReadGuard(*this);
+  }
+
+  /* the object must not be reachable by new readers anymore,
+     and will be freed by calling Deleter()(object) */
+  template <typename T, typename Deleter = std::default_delete<T>>
+  void retire(T* object)
+  {
+    auto lists = d_lists.lock();
+    lists->d_pending.emplace_back(object, [](void* ptr) { Deleter()(static_cast<T*>(ptr)); });
+  }
+
+  /* free every retired object that no reader can see anymore, without waiting,
+     and return the number of objects that have been freed */
+  size_t tryReclaim()
+  {
+    size_t freed = 0;
+    auto lists = d_lists.lock();
+
+    if (!lists->d_waiting.empty()) {
+      if (!isQuiescent(lists->d_waitingParity)) {
+        return freed;
+      }
+      freed += release(lists->d_waiting);
+    }
+
+    if (!lists->d_pending.empty()) {
+      /* readers entering from now on will not be able to see the pending objects,
+         so we only need to wait for the ones in the current parity to leave */
+      auto epoch = d_epoch.load();
+      lists->d_waitingParity = epoch & 1;
+      lists->d_waiting = std::move(lists->d_pending);
+      lists->d_pending.clear();
+      d_epoch.store(epoch + 1);
+
+      if (isQuiescent(lists->d_waitingParity)) {
+        freed += release(lists->d_waiting);
+      }
+    }
+
+    return freed;
+  }
+
+  /* wait until every object retired so far has been freed */
+  void synchronize()
+  {
+    while (true) {
+      tryReclaim();
+      if (getPendingCount() == 0) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  size_t getPendingCount() const
+  {
+    auto lists = d_lists.lock();
+    return lists->d_pending.size() + lists->d_waiting.size();
+  }
+
+private:
+  using retired_t = std::vector<std::pair<void*, void (*)(void*)>>;
+
+  struct RetiredLists
+  {
+    retired_t d_pending;
+    retired_t d_waiting;
+    uint64_t d_waitingParity{0};
+  };
+
+  static size_t getSlotIndex()
+  {
+    static std::atomic<size_t> s_next{0};
+    thread_local size_t t_index = s_next++ % s_numberOfSlots;
+    return t_index;
+  }
+
+  std::atomic<uint64_t>* enter()
+  {
+    auto& slot = d_slots.at(getSlotIndex());
+    while (true) {
+      auto epoch = d_epoch.load();
+      auto& counter = slot.d_counters.at(epoch & 1);
+      counter.fetch_add(1);
+      /* if the epoch moved between our load and our increment, a writer might
+         already have checked that parity, so we need to try again */
+      if (d_epoch.load() == epoch) {
+        return &counter;
+      }
+      counter.fetch_sub(1, std::memory_order_release);
+    }
+  }
+
+  bool isQuiescent(uint64_t parity) const
+  {
+    for (const auto& slot : d_slots) {
+      if (slot.d_counters.at(parity).load(std::memory_order_acquire) != 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  static size_t release(retired_t& objects)
+  {
+    size_t count = objects.size();
+    for (auto& object : objects) {
+      object.second(object.first);
+    }
+    objects.clear();
+    return count;
+  }
+
+  std::array<ReaderSlot, s_numberOfSlots> d_slots;
+  std::atomic<uint64_t> d_epoch{0};
+  mutable LockGuarded<RetiredLists> d_lists;
+};
@@ -71,6 +71,7 @@ static struct EpollRegisterOurselves
   EpollRegisterOurselves()
   {
     FDMultiplexer::getMultiplexerMap().emplace(0, &makeEpoll); // priority 0!
+    FDMultiplexer::getMultiplexerNames().emplace("epoll", &makeEpoll);
   }
 } doItEpoll;
 
@@ -0,0 +1,443 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "mplexer.hh"
+#include "sstuff.hh"
+#include <iostream>
+#include <poll.h>
+#include <unistd.h>
+#include <unordered_map>
+#include "misc.hh"
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+#include "namespaces.hh"
+
+/* the kernel headers need to be recent enough to know about the features we rely on */
+#ifdef IORING_FEAT_EXT_ARG
+
+/* A multiplexer based on io_uring, talking directly to the kernel so that we do not depend on liburing.
+   Every watched descriptor has a one-shot IORING_OP_POLL_ADD request in flight, which is armed again
+   once the corresponding callbacks have been called, or have thrown, keeping the level-triggered semantics of the other
+   multiplexers. New and re-armed requests are not submitted right away but queued in the submission ring,
+   and submitted with the same io_uring_enter() call that waits for the next events, so that a busy loop
+   only does a single system call per iteration.
+   Removals are submitted immediately since the kernel holds a reference to the file as long as a poll
+   request is pending, which would delay the closing of a connection.
+   Requires a kernel providing IORING_FEAT_NODROP and IORING_FEAT_EXT_ARG (5.11+), the constructor throws
+   otherwise so that the next multiplexer is used instead. */
+class IOUringFDMultiplexer : public FDMultiplexer
+{
+public:
+  IOUringFDMultiplexer(unsigned int maxEventsHint);
+  ~IOUringFDMultiplexer();
+
+  int run(struct timeval* tv, int timeout = 500) override;
+  void getAvailableFDs(std::vector<int>& fds, int timeout) override;
+
+  void addFD(int fd, FDMultiplexer::EventKind kind) override;
+  void removeFD(int fd, FDMultiplexer::EventKind kind) override;
+  void alterFD(int fd, FDMultiplexer::EventKind from, FDMultiplexer::EventKind to) override;
+
+  string getName() const override
+  {
+    return "io_uring";
+  }
+
+private:
+  struct WatchedFD
+  {
+    uint32_t d_generation{0};
+    uint16_t d_events{0};
+    bool d_armed{false};
+  };
+  struct ReadyFD
+  {
+    int d_fd;
+    uint32_t d_generation;
+    int32_t d_result;
+  };
+
+  static uint64_t getUserData(int fd, uint32_t generation)
+  {
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+  }
+
+  struct io_uring_sqe* getSQE();
+  void arm(int fd, WatchedFD& watched);
+  void cancel(int fd, const WatchedFD& watched);
+  void submitAndWait(int timeout);
+  void reapCompletions();
+  void rearm(int fd, uint32_t generation);
+
+  std::unordered_map<int, WatchedFD> d_watched;
+  std::vector<ReadyFD> d_ready;
+  void* d_ringPtr{MAP_FAILED};
+  size_t d_ringSize{0};
+  void* d_sqesPtr{MAP_FAILED};
+  size_t d_sqesSize{0};
+  struct io_uring_sqe* d_sqes{nullptr};
+  unsigned int* d_sqHead{nullptr};
+  unsigned int* d_sqTail{nullptr};
+  unsigned int* d_sqArray{nullptr};
+  unsigned int* d_cqHead{nullptr};
+  unsigned int* d_cqTail{nullptr};
+  struct io_uring_cqe* d_cqes{nullptr};
+  unsigned int d_sqMask{0};
+  unsigned int d_sqEntries{0};
+  unsigned int d_cqMask{0};
+  unsigned int d_toSubmit{0};
+  uint32_t d_generation{0};
+  int d_ringfd{-1};
+};
+
+static FDMultiplexer* makeIOUring(unsigned int maxEventsHint)
+{
+  return new IOUringFDMultiplexer(maxEventsHint);
+}
+
+static struct IOUringRegisterOurselves
+{
+  IOUringRegisterOurselves()
+  {
+    FDMultiplexer::getMultiplexerMap().emplace(5, &makeIOUring); // priority 5, only used when explicitly preferred
+    FDMultiplexer::getMultiplexerNames().emplace("io_uring", &makeIOUring);
+  }
+} doItIOUring;
+
+IOUringFDMultiplexer::IOUringFDMultiplexer(unsigned int maxEventsHint)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  d_ringfd = static_cast<int>(syscall(__NR_io_uring_setup, std::max(maxEventsHint, 16U), &params));
+  if (d_ringfd < 0) {
+    throw FDMultiplexerException("Setting up io_uring: " + stringerror());
+  }
+
+  if (!(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+    close(d_ringfd);
+    throw FDMultiplexerException("Setting up io_uring: the kernel does not provide the required features");
+  }
+
+  d_ringSize = std::max(params.sq_off.array + params.sq_entries * sizeof(unsigned int), params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+  d_ringPtr = mmap(nullptr, d_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d_ringfd, IORING_OFF_SQ_RING);
+  if (d_ringPtr == MAP_FAILED) {
+    auto err = stringerror();
+    close(d_ringfd);
+    throw FDMultiplexerException("Mapping the io_uring rings: " + err);
+  }
+
+  d_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+  d_sqesPtr = mmap(nullptr, d_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, d_ringfd, IORING_OFF_SQES);
+  if (d_sqesPtr == MAP_FAILED) {
+    auto err = stringerror();
+    munmap(d_ringPtr, d_ringSize);
+    close(d_ringfd);
+    throw FDMultiplexerException("Mapping the io_uring submission entries: " + err);
+  }
+
+  auto* ring = static_cast<char*>(d_ringPtr);
+  d_sqHead = reinterpret_cast<unsigned int*>(ring + params.sq_off.head);
+  d_sqTail = reinterpret_cast<unsigned int*>(ring + params.sq_off.tail);
+  d_sqArray = reinterpret_cast<unsigned int*>(ring + params.sq_off.array);
+  d_sqMask = *reinterpret_cast<unsigned int*>(ring + params.sq_off.ring_mask);
+  d_sqEntries = params.sq_entries;
+  d_cqHead = reinterpret_cast<unsigned int*>(ring + params.cq_off.head);
+  d_cqTail = reinterpret_cast<unsigned int*>(ring + params.cq_off.tail);
+  d_cqMask = *reinterpret_cast<unsigned int*>(ring + params.cq_off.ring_mask);
+  d_cqes = reinterpret_cast<struct io_uring_cqe*>(ring + params.cq_off.cqes);
+  d_sqes = static_cast<struct io_uring_sqe*>(d_sqesPtr);
+  d_ready.reserve(maxEventsHint);
+}
+
+IOUringFDMultiplexer::~IOUringFDMultiplexer()
+{
+  if (d_sqesPtr != MAP_FAILED) {
+    munmap(d_sqesPtr, d_sqesSize);
+  }
+  if (d_ringPtr != MAP_FAILED) {
+    munmap(d_ringPtr, d_ringSize);
+  }
+  if (d_ringfd >= 0) {
+    close(d_ringfd);
+  }
+}
+
+struct io_uring_sqe* IOUringFDMultiplexer::getSQE()
+{
+  auto tail = *d_sqTail;
+  if (tail - __atomic_load_n(d_sqHead, __ATOMIC_ACQUIRE) >= d_sqEntries) {
+    /* the submission ring is full, hand the pending entries to the kernel */
+    submitAndWait(0);
+    if (tail - __atomic_load_n(d_sqHead, __ATOMIC_ACQUIRE) >= d_sqEntries) {
+      throw FDMultiplexerException("The io_uring submission ring is full");
+    }
+  }
+
+  auto index = tail & d_sqMask;
+  auto* sqe = &d_sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  d_sqArray[index] = index;
+  __atomic_store_n(d_sqTail, tail + 1, __ATOMIC_RELEASE);
+  ++d_toSubmit;
+  return sqe;
+}
+
+void IOUringFDMultiplexer::arm(int fd, WatchedFD& watched)
+{
+  auto* sqe = getSQE();
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = fd;
+  sqe->poll32_events = watched.d_events;
+  sqe->user_data = getUserData(fd, watched.d_generation);
+  watched.d_armed = true;
+}
+
+void IOUringFDMultiplexer::cancel(int fd, const WatchedFD& watched)
+{
+  auto* sqe = getSQE();
+  sqe->opcode = IORING_OP_POLL_REMOVE;
+  sqe->fd = -1;
+  sqe->addr = getUserData(fd, watched.d_generation);
+  /* the completion of the removal itself is ignored */
+  sqe->user_data = 0;
+}
+
+static uint16_t convertEventKind(FDMultiplexer::EventKind kind)
+{
+  switch (kind) {
+  case FDMultiplexer::EventKind::Read:
+    return POLLIN;
+  case FDMultiplexer::EventKind::Write:
+    return POLLOUT;
+  case FDMultiplexer::EventKind::Both:
+    return POLLIN | POLLOUT;
+  }
+
+  throw std::runtime_error("Unhandled event kind in the io_uring multiplexer");
+}
+
+void IOUringFDMultiplexer::addFD(int fd, FDMultiplexer::EventKind kind)
+{
+  if (fd < 0) {
+    throw FDMultiplexerException("Adding invalid fd " + std::to_string(fd) + " to the io_uring multiplexer");
+  }
+
+  auto [it, inserted] = d_watched.emplace(fd, WatchedFD());
+  if (!inserted) {
+    throw FDMultiplexerException("Adding fd " + std::to_string(fd) + " to the io_uring multiplexer twice");
+  }
+
+  it->second.d_generation = ++d_generation;
+  it->second.d_events = convertEventKind(kind);
+  try {
+    arm(fd, it->second);
+  }
+  catch (...) {
+    d_watched.erase(it);
+    throw;
+  }
+}
+
+void IOUringFDMultiplexer::removeFD(int fd, FDMultiplexer::EventKind)
+{
+  auto it = d_watched.find(fd);
+  if (it == d_watched.end()) {
+    throw FDMultiplexerException("Removing unknown fd " + std::to_string(fd) + " from the io_uring multiplexer");
+  }
+
+  bool armed = it->second.d_armed;
+  if (armed) {
+    cancel(fd, it->second);
+  }
+  d_watched.erase(it);
+
+  if (armed) {
+    /* the descriptor is likely to be closed right after that,
+       and the pending poll request holds a reference to it */
+    submitAndWait(0);
+  }
+}
+
+void IOUringFDMultiplexer::alterFD(int fd, FDMultiplexer::EventKind, FDMultiplexer::EventKind to)
+{
+  auto it = d_watched.find(fd);
+  if (it == d_watched.end()) {
+    throw FDMultiplexerException("Altering unknown fd " + std::to_string(fd) + " in the io_uring multiplexer");
+  }
+
+  if (it->second.d_armed) {
+    cancel(fd, it->second);
+  }
+  it->second.d_generation = ++d_generation;
+  it->second.d_events = convertEventKind(to);
+  arm(fd, it->second);
+}
+
+void IOUringFDMultiplexer::submitAndWait(int timeout)
+{
+  unsigned int flags = 0;
+  unsigned int minComplete = 0;
+  struct __kernel_timespec ts;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+
+  if (timeout != 0) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    minComplete = 1;
+    if (timeout > 0) {
+      ts.tv_sec = timeout / 1000;
+      ts.tv_nsec = static_cast<long long>(timeout % 1000) * 1000 * 1000;
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+    }
+  }
+
+  if (d_toSubmit == 0 && flags == 0) {
+    return;
+  }
+
+  int ret = static_cast<int>(syscall(__NR_io_uring_enter, d_ringfd, d_toSubmit, minComplete, flags, flags != 0 ? &arg : nullptr, sizeof(arg)));
+  if (ret < 0) {
+    if (errno == ETIME || errno == EINTR || errno == EBUSY) {
+      /* EBUSY means the completion ring needs to be drained first, we will try again on the next round */
+      return;
+    }
+    throw FDMultiplexerException("io_uring returned error: " + stringerror());
+  }
+
+  d_toSubmit -= std::min(d_toSubmit, static_cast<unsigned int>(ret));
+}
+
+void IOUringFDMultiplexer::reapCompletions()
+{
+  d_ready.clear();
+  auto head = *d_cqHead;
+  const auto tail = __atomic_load_n(d_cqTail, __ATOMIC_ACQUIRE);
+
+  for (; head != tail; ++head) {
+    const auto& cqe = d_cqes[head & d_cqMask];
+    if (cqe.user_data == 0) {
+      continue;
+    }
+
+    int fd = static_cast<int>(cqe.user_data & 0xffffffff);
+    uint32_t generation = cqe.user_data >> 32;
+    auto it = d_watched.find(fd);
+    if (it == d_watched.end() || it->second.d_generation != generation) {
+      /* removed or altered since then */
+      continue;
+    }
+    it->second.d_armed = false;
+
+    if (cqe.res == -ECANCELED) {
+      continue;
+    }
+    d_ready.push_back({fd, generation, cqe.res});
+  }
+
+  __atomic_store_n(d_cqHead, head, __ATOMIC_RELEASE);
+}
+
+void IOUringFDMultiplexer::rearm(int fd, uint32_t generation)
+{
+  auto it = d_watched.find(fd);
+  if (it != d_watched.end() && it->second.d_generation == generation && !it->second.d_armed) {
+    arm(fd, it->second);
+  }
+}
+
+void IOUringFDMultiplexer::getAvailableFDs(std::vector<int>& fds, int timeout)
+{
+  submitAndWait(timeout);
+  reapCompletions();
+
+  for (const auto& ready : d_ready) {
+    fds.push_back(ready.d_fd);
+    rearm(ready.d_fd, ready.d_generation);
+  }
+}
+
+int IOUringFDMultiplexer::run(struct timeval* now, int timeout)
+{
+  if (d_inrun) {
+    throw FDMultiplexerException("FDMultiplexer::run() is not reentrant!\n");
+  }
+
+  submitAndWait(timeout);
+  gettimeofday(now, nullptr); // MANDATORY
+  reapCompletions();
+
+  if (d_ready.empty()) {
+    return 0;
+  }
+
+  d_inrun = true;
+  int count = 0;
+  size_t idx = 0;
+  try {
+    for (; idx < d_ready.size(); ++idx) {
+      const auto& ready = d_ready.at(idx);
+      /* an error while polling, for example because the descriptor is not valid, is reported as POLLERR */
+      const uint32_t events = ready.d_result < 0 ? POLLERR : static_cast<uint32_t>(ready.d_result);
+
+      if ((events & POLLIN) || (events & POLLERR) || (events & POLLHUP)) {
+        const auto& iter = d_readCallbacks.find(ready.d_fd);
+        if (iter != d_readCallbacks.end()) {
+          iter->d_callback(iter->d_fd, iter->d_parameter);
+          count++;
+        }
+      }
+
+      if ((events & POLLOUT) || (events & POLLERR) || (events & POLLHUP)) {
+        const auto& iter = d_writeCallbacks.find(ready.d_fd);
+        if (iter != d_writeCallbacks.end()) {
+          iter->d_callback(iter->d_fd, iter->d_parameter);
+          count++;
+        }
+      }
+
+      /* the callbacks might have removed or altered the descriptor, in which case there is nothing to do.
+         Otherwise the descriptor is polled again even after an error, so that, like with the other
+         multiplexers, the error keeps being reported until the descriptor is removed */
+      rearm(ready.d_fd, ready.d_generation);
+    }
+  }
+  catch (...) {
+    /* the descriptor whose callback threw and the ones whose callbacks have not been called yet
+       would otherwise never be reported again */
+    for (; idx < d_ready.size(); ++idx) {
+      rearm(d_ready.at(idx).d_fd, d_ready.at(idx).d_generation);
+    }
+    d_inrun = false;
+    throw;
+  }
+
+  d_inrun = false;
+  return count;
+}
+
+#endif /* IORING_FEAT_EXT_ARG */
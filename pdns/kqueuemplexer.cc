@@ -72,6 +72,7 @@ static struct KqueueRegisterOurselves
   KqueueRegisterOurselves()
   {
     FDMultiplexer::getMultiplexerMap().emplace(0, &make); // priority 0!
+    FDMultiplexer::getMultiplexerNames().emplace("kqueue", &make);
   }
 } kQueueDoIt;
 
@@ -349,6 +349,11 @@ public:
     return d_lock.owns_lock();
   }
 
+  void lock()
+  {
+    d_lock.lock();
+  }
+
 private:
   std::unique_lock<std::shared_mutex> d_lock;
   T& d_value;
@@ -405,6 +410,11 @@ public:
     return d_lock.owns_lock();
   }
 
+  void lock()
+  {
+    d_lock.lock();
+  }
+
 private:
   std::shared_lock<std::shared_mutex> d_lock;
   const T& d_value;
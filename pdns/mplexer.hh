@@ -81,6 +81,9 @@ public:
   /* The maximum number of events processed in a single run will be capped to the
      minimum value of maxEventsHint and s_maxevents, to reduce memory usage. */
   static FDMultiplexer* getMultiplexerSilent(unsigned int maxEventsHint = s_maxevents);
+  /* Name of the multiplexer getMultiplexerSilent() should return if it is available,
+     instead of the one with the highest priority. Not thread-safe, set it before creating any multiplexer. */
+  static std::string s_preferredMultiplexer;
 
   /* tv will be updated to 'now' before run returns */
   /* timeout is in ms */
@@ -154,6 +157,11 @@ public:
     }
   }
 
+  bool isWatchedForRead(int fd) const
+  {
+    return d_readCallbacks.find(fd) != d_readCallbacks.end();
+  }
+
   void setReadTTD(int fd, struct timeval tv, int timeout)
   {
     const auto& it = d_readCallbacks.find(fd);
@@ -219,6 +227,16 @@ public:
     return theMap;
   }
 
+  /* the same factories, indexed by the name of the multiplexer they create, so that the preferred one
+     can be picked without instantiating the others */
+  typedef std::map<std::string, getMultiplexer_t*> FDMultiplexerNames_t;
+
+  static FDMultiplexerNames_t& getMultiplexerNames()
+  {
+    static FDMultiplexerNames_t theNames;
+    return theNames;
+  }
+
   virtual std::string getName() const = 0;
 
   size_t getWatchedFDCount(bool writeFDs) const
@@ -170,12 +170,8 @@ int main()
     \return returns -1 in case of error, 0 in case of timeout, 1 in case of an answer 
 */
 
-template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal,Cmp>::waitEvent(EventKey &key, EventVal *val, unsigned int timeoutMsec, const struct timeval* now)
+template<class EventKey, class EventVal, class Hash, class Equal, class GroupHash, class GroupEqual>int MTasker<EventKey,EventVal,Hash,Equal,GroupHash,GroupEqual>::waitEvent(EventKey &key, EventVal *val, unsigned int timeoutMsec, const struct timeval* now)
 {
-  if(d_waiters.count(key)) { // there was already an exact same waiter
-    return -1;
-  }
-
   Waiter w;
   w.context=std::make_shared<pdns_ucontext_t>();
   w.ttd.tv_sec = 0; w.ttd.tv_usec = 0;
@@ -183,25 +179,28 @@ template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal
     struct timeval increment;
     increment.tv_sec = timeoutMsec / 1000;
     increment.tv_usec = 1000 * (timeoutMsec % 1000);
+    struct timeval realnow;
     if(now) 
-      w.ttd = increment + *now;
-    else {
-      struct timeval realnow;
+      realnow = *now;
+    else
       gettimeofday(&realnow, 0);
-      w.ttd = increment + realnow;
-    }
+    w.ttd = increment + realnow;
+    w.timeout = d_timeouts.add(realnow, w.ttd, key);
   }
 
   w.tid=d_tid;
   w.key=key;
 
-  d_waiters.insert(w);
+  if(!d_waiters.insert(w).second) { // there was already an exact same waiter
+    d_timeouts.cancel(w.timeout);
+    return -1;
+  }
 #ifdef MTASKERTIMING
   unsigned int diff=d_threads[d_tid].dt.ndiff()/1000;
   d_threads[d_tid].totTime+=diff;
 #endif
   notifyStackSwitchToKernel();
-  pdns_swapcontext(*d_waiters.find(key)->context,d_kernel); // 'A' will return here when 'key' has arrived, hands over control to kernel first
+  pdns_swapcontext(*w.context,d_kernel); // 'A' will return here when 'key' has arrived, hands over control to kernel first
   notifyStackSwitchDone();
 #ifdef MTASKERTIMING
   d_threads[d_tid].dt.start();
@@ -219,7 +218,7 @@ template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal
 //! yields control to the kernel or other threads
 /** Hands over control to the kernel, allowing other processes to run, or events to arrive */
 
-template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::yield()
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>void MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::yield()
 {
   d_runQueue.push(d_tid);
   notifyStackSwitchToKernel();
@@ -235,7 +234,7 @@ template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::yield()
 
     WARNING: when passing val as zero, d_waitval is undefined, and hence waitEvent will return undefined!
 */
-template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal,Cmp>::sendEvent(const EventKey& key, const EventVal* val)
+template<class EventKey, class EventVal, class Hash, class Equal, class GroupHash, class GroupEqual>int MTasker<EventKey,EventVal,Hash,Equal,GroupHash,GroupEqual>::sendEvent(const EventKey& key, const EventVal* val)
 {
   typename waiters_t::iterator waiter=d_waiters.find(key);
 
@@ -247,6 +246,7 @@ template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal
   if(val)
     d_waitval=*val;
   
+  d_timeouts.cancel(waiter->timeout);
   d_tid=waiter->tid;         // set tid 
   d_eventkey=waiter->key;        // pass waitEvent the exact key it was woken for
   auto userspace=std::move(waiter->context);
@@ -262,7 +262,7 @@ template<class EventKey, class EventVal, class Cmp>int MTasker<EventKey,EventVal
     \param start Pointer to the function which will form the start of the thread
     \param val A void pointer that can be used to pass data to the thread
 */
-template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::makeThread(tfunc_t *start, void* val)
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>void MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::makeThread(tfunc_t *start, void* val)
 {
   auto uc=std::make_shared<pdns_ucontext_t>();
   
@@ -303,7 +303,7 @@ template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::makeThread(t
     \return Returns if there is more work scheduled and recalling schedule now would be useful
       
 */
-template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::schedule(const struct timeval*  now)
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>bool MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::schedule(const struct timeval*  now)
 {
   if(!d_runQueue.empty()) {
     d_tid=d_runQueue.front();
@@ -330,26 +330,23 @@ template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::schedule(con
     else
       rnow = *now;
 
-    typedef typename waiters_t::template index<KeyTag>::type waiters_by_ttd_index_t;
-    //    waiters_by_ttd_index_t& ttdindex=d_waiters.template get<KeyTag>();
-    waiters_by_ttd_index_t& ttdindex=boost::multi_index::get<KeyTag>(d_waiters);
-
-    for(typename waiters_by_ttd_index_t::iterator i=ttdindex.begin(); i != ttdindex.end(); ) {
-      if(i->ttd.tv_sec && i->ttd < rnow) {
-        d_waitstatus=TimeOut;
-        d_eventkey=i->key;        // pass waitEvent the exact key it was woken for
-        auto uc = i->context;
-        d_tid = i->tid;
-        ttdindex.erase(i++);                  // removes the waitpoint
-
-        notifyStackSwitch(d_threads[d_tid].startOfStack, d_stacksize);
-        pdns_swapcontext(d_kernel, *uc); // swaps back to the above point 'A'
-        notifyStackSwitchDone();
+    d_expired.clear();
+    d_timeouts.advance(rnow, d_expired);
+    for(const auto& expired : d_expired) {
+      auto waiter = d_waiters.find(expired.second);
+      // the waiter might have been replaced by one with an equal key since its timer was armed
+      if(waiter == d_waiters.end() || waiter->timeout != expired.first) {
+        continue;
       }
-      else if(i->ttd.tv_sec)
-        break;
-      else
-	++i;
+      d_waitstatus=TimeOut;
+      d_eventkey=waiter->key;        // pass waitEvent the exact key it was woken for
+      auto uc = waiter->context;
+      d_tid = waiter->tid;
+      d_waiters.erase(waiter);                  // removes the waitpoint
+
+      notifyStackSwitch(d_threads[d_tid].startOfStack, d_stacksize);
+      pdns_swapcontext(d_kernel, *uc); // swaps back to the above point 'A'
+      notifyStackSwitchDone();
     }
   }
   return false;
@@ -359,7 +356,7 @@ template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::schedule(con
 /** Call this to check if no processes are running anymore
     \return true if no processes are left
  */
-template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::noProcesses() const
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>bool MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::noProcesses() const
 {
   return d_threadsCount == 0;
 }
@@ -368,7 +365,7 @@ template<class Key, class Val, class Cmp>bool MTasker<Key,Val,Cmp>::noProcesses(
 /** Call this to perhaps limit activities if too many threads are running
     \return number of processes running
  */
-template<class Key, class Val, class Cmp>unsigned int MTasker<Key,Val,Cmp>::numProcesses() const
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>unsigned int MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::numProcesses() const
 {
   return d_threadsCount;
 }
@@ -380,7 +377,7 @@ template<class Key, class Val, class Cmp>unsigned int MTasker<Key,Val,Cmp>::numP
 
     \param events Vector which is to be filled with keys threads are waiting for
 */
-template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::getEvents(std::vector<Key>& events)
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>void MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::getEvents(std::vector<Key>& events)
 {
   events.clear();
   for(typename waiters_t::const_iterator i=d_waiters.begin();i!=d_waiters.end();++i) {
@@ -392,19 +389,19 @@ template<class Key, class Val, class Cmp>void MTasker<Key,Val,Cmp>::getEvents(st
 /** Processes can call this to get a numerical representation of their current thread ID.
     This can be useful for logging purposes.
 */
-template<class Key, class Val, class Cmp>int MTasker<Key,Val,Cmp>::getTid() const
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>int MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::getTid() const
 {
   return d_tid;
 }
 
 //! Returns the maximum stack usage so far of this MThread
-template<class Key, class Val, class Cmp>uint64_t MTasker<Key,Val,Cmp>::getMaxStackUsage()
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>uint64_t MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::getMaxStackUsage()
 {
   return d_threads[d_tid].startOfStack - d_threads[d_tid].highestStackSeen;
 }
 
 //! Returns the maximum stack usage so far of this MThread
-template<class Key, class Val, class Cmp>unsigned int MTasker<Key,Val,Cmp>::getUsec()
+template<class Key, class Val, class Hash, class Equal, class GroupHash, class GroupEqual>unsigned int MTasker<Key,Val,Hash,Equal,GroupHash,GroupEqual>::getUsec()
 {
 #ifdef MTASKERTIMING
   return d_threads[d_tid].totTime + d_threads[d_tid].dt.ndiff()/1000;
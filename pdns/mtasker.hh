@@ -26,27 +26,31 @@
 #include <map>
 #include <time.h>
 #include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/key_extractors.hpp>
 #include "namespaces.hh"
 #include "misc.hh"
 #include "mtasker_context.hh"
+#include "timerwheel.hh"
 #include <memory>
 
 using namespace ::boost::multi_index;
 
 // #define MTASKERTIMING 1
 
-struct KeyTag {};
+struct GroupTag {};
 
 //! The main MTasker class    
 /** The main MTasker class. See the main page for more information.
     \tparam EventKey Type of the key with which events are to be identified. Defaults to int.
     \tparam EventVal Type of the content or value of an event. Defaults to int. Cannot be set to void.
-    \note The EventKey needs to have an operator< defined because it is used as the key of an associative array
+    \tparam Hash, Equal Hash and equality of the keys, waiters are looked up in a hash table
+    \tparam GroupHash, GroupEqual Hash and equality of a coarser grouping of the keys, to find all
+    the waiters of a group via the GroupTag index. Defaults to the same as Hash and Equal
 */
 
-template<class EventKey=int, class EventVal=int, class Cmp = std::less<EventKey>> class MTasker
+template<class EventKey=int, class EventVal=int, class Hash = std::hash<EventKey>, class Equal = std::equal_to<EventKey>, class GroupHash = Hash, class GroupEqual = Equal> class MTasker
 {
 private:
   pdns_ucontext_t d_kernel;
@@ -75,6 +79,11 @@ private:
   EventVal d_waitval;
   enum waitstatusenum {Error=-1,TimeOut=0,Answer} d_waitstatus;
 
+  // the timeouts of the waiters, most of them are cancelled by an answer long before they expire
+  typedef pdns::TimerWheel<EventKey> timeouts_t;
+  timeouts_t d_timeouts;
+  std::vector<std::pair<typename timeouts_t::Handle, EventKey>> d_expired;
+
 public:
   struct Waiter
   {
@@ -82,13 +91,14 @@ public:
     std::shared_ptr<pdns_ucontext_t> context;
     struct timeval ttd;
     int tid;
+    typename timeouts_t::Handle timeout{0}; // 0 if there is no timeout
   };
 
   typedef multi_index_container<
     Waiter,
     indexed_by <
-      ordered_unique<member<Waiter,EventKey,&Waiter::key>, Cmp>,
-      ordered_non_unique<tag<KeyTag>, member<Waiter,struct timeval,&Waiter::ttd> >
+      hashed_unique<member<Waiter,EventKey,&Waiter::key>, Hash, Equal>,
+      hashed_non_unique<tag<GroupTag>, member<Waiter,EventKey,&Waiter::key>, GroupHash, GroupEqual>
       >
     > waiters_t;
 
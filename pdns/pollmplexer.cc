@@ -9,9 +9,23 @@
 #include "misc.hh"
 #include "namespaces.hh"
 
+std::string FDMultiplexer::s_preferredMultiplexer;
+
 FDMultiplexer* FDMultiplexer::getMultiplexerSilent(unsigned int maxEventsHint)
 {
   FDMultiplexer* ret = nullptr;
+  if (!s_preferredMultiplexer.empty()) {
+    const auto& names = FDMultiplexer::getMultiplexerNames();
+    const auto preferred = names.find(s_preferredMultiplexer);
+    if (preferred != names.end()) {
+      try {
+        return preferred->second(std::min(maxEventsHint, FDMultiplexer::s_maxevents));
+      }
+      catch (...) {
+      }
+    }
+  }
+
   for (const auto& i : FDMultiplexer::getMultiplexerMap()) {
     try {
       ret = i.second(std::min(maxEventsHint, FDMultiplexer::s_maxevents));
@@ -60,6 +74,7 @@ static struct RegisterOurselves
   RegisterOurselves()
   {
     FDMultiplexer::getMultiplexerMap().emplace(2, &make);
+    FDMultiplexer::getMultiplexerNames().emplace("poll", &make);
   }
 } doIt;
 
@@ -49,6 +49,7 @@ static struct PortsRegisterOurselves
   PortsRegisterOurselves()
   {
     FDMultiplexer::getMultiplexerMap().emplace(0, &makePorts); // priority 0!
+    FDMultiplexer::getMultiplexerNames().emplace("solaris completion ports", &makePorts);
   }
 } doItPorts;
 
@@ -24,6 +24,7 @@
 #include "aggressive_nsec.hh"
 #include "cachecleaner.hh"
 #include "recursor_cache.hh"
+#include "rec-cache-snapshot.hh"
 #include "logger.hh"
 #include "validate.hh"
 
@@ -243,10 +244,10 @@ static bool isMinimallyCoveringNSEC3(const DNSName& owner, const std::shared_ptr
   return ownerHash == nextHash;
 }
 
-void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3)
+bool AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3)
 {
   if (signatures.empty()) {
-    return;
+    return false;
   }
 
   std::shared_ptr<LockGuarded<AggressiveNSECCache::ZoneEntry>> entry = getZone(zone);
@@ -269,12 +270,12 @@ void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner,
       if (next.canonCompare(owner) && next != zone) {
         /* not accepting a NSEC whose next domain name is before the owner
            unless the next domain name is the apex, sorry */
-        return;
+        return false;
       }
 
       if (isMinimallyCoveringNSEC(owner, content)) {
         /* not accepting minimally covering answers since they only deny one name */
-        return;
+        return false;
       }
     }
     else {
@@ -285,17 +286,17 @@ void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner,
 
       if (content->isOptOut()) {
         /* doesn't prove anything, sorry */
-        return;
+        return false;
       }
 
       if (g_maxNSEC3Iterations && content->d_iterations > g_maxNSEC3Iterations) {
         /* can't use that */
-        return;
+        return false;
       }
 
       if (isMinimallyCoveringNSEC3(owner, content)) {
         /* not accepting minimally covering answers since they only deny one name */
-        return;
+        return false;
       }
 
       // XXX: Ponder storing everything in raw form, without the zone instead. It still needs to be a DNSName for NSEC, though,
@@ -320,12 +321,14 @@ void AggressiveNSECCache::insertNSEC(const DNSName& zone, const DNSName& owner,
       if (pair.second) {
         ++d_entriesCount;
       }
+      return pair.second;
     }
     else {
       auto pair = zoneEntry->d_entries.insert({record.d_content, signatures, owner, std::move(next), record.d_ttl});
       if (pair.second) {
         ++d_entriesCount;
       }
+      return pair.second;
     }
   }
 }
@@ -904,3 +907,69 @@ size_t AggressiveNSECCache::dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp
 
   return ret;
 }
+
+size_t AggressiveNSECCache::saveSnapshot(CacheSnapshotWriter& writer, time_t now)
+{
+  size_t count = 0;
+
+  auto zones = d_zones.read_lock();
+  zones->visit([&count, now, &writer](const SuffixMatchTree<std::shared_ptr<LockGuarded<ZoneEntry>>>& node) {
+    if (!node.d_value) {
+      return;
+    }
+
+    auto zone = node.d_value->lock();
+    for (const auto& entry : zone->d_entries) {
+      if (entry.d_ttd <= now) {
+        continue;
+      }
+      writer.write8(1);
+      writer.writeName(zone->d_zone);
+      writer.write8(zone->d_nsec3 ? 1 : 0);
+      writer.writeName(entry.d_owner);
+      writer.write64(static_cast<uint64_t>(entry.d_ttd));
+      writer.writeContent(entry.d_owner, *entry.d_record);
+      writer.write16(entry.d_signatures.size());
+      for (const auto& signature : entry.d_signatures) {
+        writer.writeContent(entry.d_owner, *signature);
+      }
+      ++count;
+    }
+  });
+
+  writer.write8(0);
+  return count;
+}
+
+size_t AggressiveNSECCache::loadSnapshot(CacheSnapshotReader& reader, time_t now)
+{
+  size_t count = 0;
+  while (reader.get8() != 0) {
+    const auto zone = reader.getName();
+    const bool nsec3 = reader.get8() != 0;
+    DNSRecord record;
+    record.d_name = reader.getName();
+    record.d_type = nsec3 ? QType::NSEC3 : QType::NSEC;
+    record.d_ttl = static_cast<uint32_t>(reader.get64());
+    record.d_content = reader.getContent(record.d_name, record.d_type);
+    std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+    const auto signaturesCount = reader.get16();
+    for (uint16_t idx = 0; idx < signaturesCount; idx++) {
+      auto signature = std::dynamic_pointer_cast<RRSIGRecordContent>(reader.getContent(record.d_name, QType::RRSIG));
+      if (signature) {
+        signatures.push_back(std::move(signature));
+      }
+    }
+
+    /* the rest of the section still has to be read, but the cache is not allowed
+       to grow beyond its maximum size, pruning would not happen before a while */
+    if (static_cast<time_t>(record.d_ttl) <= now || d_entriesCount >= d_maxEntries) {
+      continue;
+    }
+    /* the TTL is a TTD, as expected by insertNSEC() */
+    if (insertNSEC(zone, record.d_name, record, signatures, nsec3)) {
+      ++count;
+    }
+  }
+  return count;
+}
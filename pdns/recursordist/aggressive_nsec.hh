@@ -36,6 +36,9 @@ using namespace ::boost::multi_index;
 #include "lock.hh"
 #include "stat_t.hh"
 
+class CacheSnapshotReader;
+class CacheSnapshotWriter;
+
 class AggressiveNSECCache
 {
 public:
@@ -44,7 +47,8 @@ public:
   {
   }
 
-  void insertNSEC(const DNSName& zone, const DNSName& owner, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3);
+  /* returns true if a new entry has been added */
+  bool insertNSEC(const DNSName& zone, const DNSName& owner, const DNSRecord& record, const std::vector<std::shared_ptr<RRSIGRecordContent>>& signatures, bool nsec3);
   bool getDenial(time_t, const DNSName& name, const QType& type, std::vector<DNSRecord>& ret, int& res, const ComboAddress& who, const boost::optional<std::string>& routingTag, bool doDNSSEC);
 
   void removeZoneInfo(const DNSName& zone, bool subzones);
@@ -76,6 +80,8 @@ public:
 
   void prune(time_t now);
   size_t dumpToFile(std::unique_ptr<FILE, int (*)(FILE*)>& fp, const struct timeval& now);
+  size_t saveSnapshot(CacheSnapshotWriter& writer, time_t now);
+  size_t loadSnapshot(CacheSnapshotReader& reader, time_t now);
 
 private:
   struct ZoneEntry
@@ -26,9 +26,11 @@
 #include "cachecleaner.hh"
 #include "utility.hh"
 #include "rec-taskqueue.hh"
+#include "rec-cache-snapshot.hh"
 
 // For a description on how ServeStale works, see recursor_cache.cc, the general structure is the same.
 uint16_t NegCache::s_maxServedStaleExtensions;
+bool NegCache::s_secondChanceEviction{false};
 
 NegCache::NegCache(size_t mapsCount) :
   d_maps(mapsCount == 0 ? 1 : mapsCount)
@@ -75,7 +77,7 @@ bool NegCache::getRootNXTrust(const DNSName& qname, const struct timeval& now, N
     // We have something
     if (now.tv_sec < ni->d_ttd) {
       ne = *ni;
-      moveCacheItemToBack<SequenceTag>(content->d_map, ni);
+      touchCacheItem<SequenceTag>(content->d_map, ni, s_secondChanceEviction);
       return true;
     }
     if (ni->d_servedStale == 0 && !serveStale) {
@@ -133,7 +135,7 @@ bool NegCache::get(const DNSName& qname, QType qtype, const struct timeval& now,
       if (now.tv_sec < ni->d_ttd && !(refresh && ni->d_servedStale > 0)) {
         // Not expired
         ne = *ni;
-        moveCacheItemToBack<SequenceTag>(content->d_map, firstIndexIterator);
+        touchCacheItem<SequenceTag>(content->d_map, firstIndexIterator, s_secondChanceEviction);
         return true;
       }
       // expired
@@ -319,3 +321,75 @@ size_t NegCache::doDump(int fd, size_t maxCacheEntries)
   fprintf(fp.get(), "; negcache size: %zu/%zu shards: %zu min/max shard size: %zu/%zu\n", size(), maxCacheEntries, d_maps.size(), min, max);
   return ret;
 }
+
+static void saveRecords(CacheSnapshotWriter& writer, const vector<DNSRecord>& records)
+{
+  writer.write16(records.size());
+  for (const auto& record : records) {
+    writer.writeRecord(record);
+  }
+}
+
+static void loadRecords(CacheSnapshotReader& reader, vector<DNSRecord>& records)
+{
+  const auto count = reader.get16();
+  records.reserve(count);
+  for (uint16_t idx = 0; idx < count; idx++) {
+    records.push_back(reader.getRecord());
+  }
+}
+
+size_t NegCache::saveSnapshot(CacheSnapshotWriter& writer, time_t now)
+{
+  size_t count = 0;
+  for (auto& mc : d_maps) {
+    auto map = mc.lock();
+    for (const auto& ne : map->d_map) {
+      if (ne.d_ttd <= now) {
+        continue;
+      }
+      writer.write8(1);
+      writer.writeName(ne.d_name);
+      writer.writeName(ne.d_auth);
+      writer.write16(ne.d_qtype.getCode());
+      writer.write64(static_cast<uint64_t>(ne.d_ttd));
+      writer.write32(ne.d_orig_ttl);
+      writer.write8(static_cast<uint8_t>(ne.d_validationState));
+      saveRecords(writer, ne.authoritySOA.records);
+      saveRecords(writer, ne.authoritySOA.signatures);
+      saveRecords(writer, ne.DNSSECRecords.records);
+      saveRecords(writer, ne.DNSSECRecords.signatures);
+      count++;
+    }
+  }
+  writer.write8(0);
+  return count;
+}
+
+size_t NegCache::loadSnapshot(CacheSnapshotReader& reader, time_t now, size_t maxEntries)
+{
+  size_t count = 0;
+  /* the remaining entries still have to be read once the cache is full, to get to the next section */
+  size_t cacheSize = size();
+  while (reader.get8() != 0) {
+    NegCacheEntry ne;
+    ne.d_name = reader.getName();
+    ne.d_auth = reader.getName();
+    ne.d_qtype = QType(reader.get16());
+    ne.d_ttd = static_cast<time_t>(reader.get64());
+    ne.d_orig_ttl = reader.get32();
+    ne.d_validationState = static_cast<vState>(reader.get8());
+    loadRecords(reader, ne.authoritySOA.records);
+    loadRecords(reader, ne.authoritySOA.signatures);
+    loadRecords(reader, ne.DNSSECRecords.records);
+    loadRecords(reader, ne.DNSSECRecords.signatures);
+
+    if (ne.d_ttd <= now || cacheSize >= maxEntries) {
+      continue;
+    }
+    add(ne);
+    count++;
+    cacheSize++;
+  }
+  return count;
+}
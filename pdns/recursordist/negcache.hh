@@ -31,12 +31,16 @@
 #include "dnsparser.hh"
 #include "dnsname.hh"
 #include "dns.hh"
+#include "cachecleaner.hh"
 #include "lock.hh"
 #include "stat_t.hh"
 #include "validate.hh"
 
 using namespace ::boost::multi_index;
 
+class CacheSnapshotReader;
+class CacheSnapshotWriter;
+
 /* FIXME should become part of the normal cache (I think) and should become more like
  * struct {
  *   vector<DNSRecord> records;
@@ -61,6 +65,8 @@ public:
   static uint16_t s_maxServedStaleExtensions;
   // The time a stale cache entry is extended
   static constexpr uint32_t s_serveStaleExtensionPeriod = 30;
+  // Whether a hit only flags the entry instead of moving it in the LRU index, see ReferencedFlag
+  static bool s_secondChanceEviction;
 
   struct NegCacheEntry
   {
@@ -73,6 +79,7 @@ public:
     mutable uint16_t d_servedStale{0};
     mutable vState d_validationState{vState::Indeterminate};
     QType d_qtype; // The denied type
+    mutable ReferencedFlag d_referenced; // used by second chance eviction
 
     bool isStale(time_t now) const
     {
@@ -95,6 +102,8 @@ public:
   void prune(size_t maxEntries);
   void clear();
   size_t doDump(int fd, size_t maxCacheEntries);
+  size_t saveSnapshot(CacheSnapshotWriter& writer, time_t now);
+  size_t loadSnapshot(CacheSnapshotReader& reader, time_t now, size_t maxEntries);
   size_t wipe(const DNSName& name, bool subtree = false);
   size_t size() const;
 
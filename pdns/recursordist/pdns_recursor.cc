@@ -65,6 +65,7 @@ static set<int> g_fromtosockets; // listen sockets that use 'sendfromto()' mecha
 NetmaskGroup g_paddingFrom;
 size_t g_proxyProtocolMaximumSize;
 size_t g_maxUDPQueriesPerRound;
+size_t g_udpBatchSize;
 unsigned int g_maxMThreads;
 unsigned int g_paddingTag;
 PaddingMode g_paddingMode;
@@ -96,55 +97,6 @@ GlobalStateHolder<NetmaskGroup> g_dontThrottleNetmasks;
 GlobalStateHolder<SuffixMatchNode> g_DoTToAuthNames;
 uint64_t g_latencyStatSize;
 
-LWResult::Result UDPClientSocks::getSocket(const ComboAddress& toaddr, int* fd)
-{
-  *fd = makeClientSocket(toaddr.sin4.sin_family);
-  if (*fd < 0) { // temporary error - receive exception otherwise
-    return LWResult::Result::OSLimitError;
-  }
-
-  if (connect(*fd, (struct sockaddr*)(&toaddr), toaddr.getSocklen()) < 0) {
-    int err = errno;
-    try {
-      closesocket(*fd);
-    }
-    catch (const PDNSException& e) {
-      SLOG(g_log << Logger::Error << "Error closing UDP socket after connect() failed: " << e.reason << endl,
-           g_slogout->error(Logr::Error, e.reason, "Error closing UDP socket after connect() failed", "exception", Logging::Loggable("PDNSException")));
-    }
-
-    if (err == ENETUNREACH) { // Seth "My Interfaces Are Like A Yo Yo" Arnold special
-      return LWResult::Result::OSLimitError;
-    }
-
-    return LWResult::Result::PermanentError;
-  }
-
-  d_numsocks++;
-  return LWResult::Result::Success;
-}
-
-// return a socket to the pool, or simply erase it
-void UDPClientSocks::returnSocket(int fd)
-{
-  try {
-    t_fdm->removeReadFD(fd);
-  }
-  catch (const FDMultiplexerException& e) {
-    // we sometimes return a socket that has not yet been assigned to t_fdm
-  }
-
-  try {
-    closesocket(fd);
-  }
-  catch (const PDNSException& e) {
-    SLOG(g_log << Logger::Error << "Error closing returned UDP socket: " << e.reason << endl,
-         g_slogout->error(Logr::Error, e.reason, "Error closing returned UDP socket", "exception", Logging::Loggable("PDNSException")));
-  }
-
-  --d_numsocks;
-}
-
 // returns -1 for errors which might go away, throws for ones that won't
 int UDPClientSocks::makeClientSocket(int family)
 {
@@ -261,6 +213,19 @@ static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t&);
 
 thread_local std::unique_ptr<UDPClientSocks> t_udpclientsocks;
 
+// stop watching a socket we sent a query from, and return it to the pool
+static void returnUDPClientSocket(int fd, bool answered = false)
+{
+  try {
+    t_fdm->removeReadFD(fd);
+  }
+  catch (const FDMultiplexerException& e) {
+    // we sometimes return a socket that has not yet been assigned to t_fdm
+  }
+
+  t_udpclientsocks->returnSocket(fd, g_now, answered);
+}
+
 /* these two functions are used by LWRes */
 LWResult::Result asendto(const char* data, size_t len, int flags,
                          const ComboAddress& toaddr, uint16_t id, const DNSName& domain, uint16_t qtype, int* fd)
@@ -273,11 +238,9 @@ LWResult::Result asendto(const char* data, size_t len, int flags,
 
   // see if there is an existing outstanding request we can chain on to, using partial equivalence function looking for the same
   // query (qname and qtype) to the same host, but with a different message ID
-  pair<MT_t::waiters_t::iterator, MT_t::waiters_t::iterator> chain = MT->d_waiters.equal_range(pident, PacketIDBirthdayCompare());
+  auto chain = MT->d_waiters.get<GroupTag>().equal_range(pident);
 
   for (; chain.first != chain.second; chain.first++) {
-    // Line below detected an issue with the two ways of ordering PackeIDs (birtday and non-birthday)
-    assert(chain.first->key->domain == pident->domain);
     if (chain.first->key->fd > -1 && !chain.first->key->closed) { // don't chain onto existing chained waiter or a chain already processed
       // cerr << "Insert " << id << ' ' << pident << " into chain for  " << chain.first->key << endl;
       chain.first->key->chain.insert(id); // we can chain
@@ -286,7 +249,7 @@ LWResult::Result asendto(const char* data, size_t len, int flags,
     }
   }
 
-  auto ret = t_udpclientsocks->getSocket(toaddr, fd);
+  auto ret = t_udpclientsocks->getSocket(toaddr, g_now, fd);
   if (ret != LWResult::Result::Success) {
     return ret;
   }
@@ -300,7 +263,7 @@ LWResult::Result asendto(const char* data, size_t len, int flags,
   int tmp = errno;
 
   if (sent < 0) {
-    t_udpclientsocks->returnSocket(*fd);
+    returnUDPClientSocket(*fd);
     errno = tmp; // this is for logging purposes only
     return LWResult::Result::PermanentError;
   }
@@ -349,7 +312,7 @@ LWResult::Result arecvfrom(PacketBuffer& packet, int flags, const ComboAddress&
   else {
     /* getting there means error or timeout, it's up to us to close the socket */
     if (fd >= 0) {
-      t_udpclientsocks->returnSocket(fd);
+      returnUDPClientSocket(fd);
     }
   }
 
@@ -420,7 +383,13 @@ static bool addRecordToPacket(DNSPacketWriter& pw, const DNSRecord& rec, uint32_
   if (rec.d_type != QType::OPT) // their TTL ain't real
     minTTL = min(minTTL, rec.d_ttl);
 
-  rec.d_content->toPacket(pw);
+  // contents coming from the record cache might already be in wire format
+  if (const auto* wire = MemRecursorCache::getCachedWire(rec.d_content)) {
+    pw.xfrBlob(*wire);
+  }
+  else {
+    rec.d_content->toPacket(pw);
+  }
   if (pw.size() > static_cast<size_t>(maxAnswerSize)) {
     pw.rollback();
     if (rec.d_place != DNSResourceRecord::ADDITIONAL) {
@@ -1978,11 +1947,7 @@ void requestWipeCaches(const DNSName& canon)
   ThreadMSG* tmsg = new ThreadMSG();
   tmsg->func = [=] { return pleaseWipeCaches(canon, true, 0xffff); };
   tmsg->wantAnswer = false;
-  if (write(RecThreadInfo::info(0).pipes.writeToThread, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) {
-    delete tmsg;
-
-    unixDie("write to thread pipe returned wrong size or error");
-  }
+  sendThreadMessage(RecThreadInfo::info(0), tmsg);
   // coverity[leaked_storage]
 }
 
@@ -1996,7 +1961,96 @@ bool expectProxyProtocol(const ComboAddress& from)
 // source: the address we assume the query is coming from, might be set by proxy protocol
 // destination: the address we assume the query was sent to, might be set by proxy protocol
 // mappedSource: the address we assume the query is coming from. Differs from source if table based mapping has been applied
-static string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, const ComboAddress& destaddr, ComboAddress source, ComboAddress destination, const ComboAddress& mappedSource, struct timeval tv, int fd, std::vector<ProxyProtocolValue>& proxyProtocolValues, RecEventTrace& eventTrace)
+/* The answers from the packet cache to the queries received on a socket in a single batch,
+   sent with one sendmmsg() call once all the queries of that batch have been processed */
+class UDPCacheHitBatch
+{
+public:
+  UDPCacheHitBatch(size_t maxSize) :
+    d_slots(maxSize)
+#ifdef HAVE_SENDMMSG
+    ,
+    d_msgs(maxSize)
+#endif
+  {
+  }
+
+  /* local is the address to send the answer from, for the sockets using the 'sendfromto()' mechanism */
+  void add(int fd, std::string&& response, const ComboAddress& remote, const ComboAddress* local, const ComboAddress& source)
+  {
+    if (d_count == d_slots.size() || (d_count > 0 && fd != d_fd)) {
+      flush();
+    }
+
+    auto& slot = d_slots.at(d_count);
+    slot.response = std::move(response);
+    slot.remote = remote;
+    slot.source = source;
+    fillMSGHdr(&getMsgHdr(d_count), &slot.iov, nullptr, 0, &slot.response.at(0), slot.response.size(), &slot.remote);
+    if (local) {
+      addCMsgSrcAddr(&getMsgHdr(d_count), &slot.cbuf, local, 0);
+    }
+    d_fd = fd;
+    ++d_count;
+  }
+
+  void flush()
+  {
+    size_t sent = 0;
+    while (sent < d_count) {
+#ifdef HAVE_SENDMMSG
+      int res = sendmmsg(d_fd, &d_msgs.at(sent), d_count - sent, 0);
+      if (res > 0) {
+        sent += res;
+        continue;
+      }
+#endif
+      /* sendmmsg() failed on the first remaining answer, or is not available: send that one on its
+         own, which takes care of the EAGAIN handling needed on some systems and gives us the error */
+      int sendErr = sendOnNBSocket(d_fd, &getMsgHdr(sent));
+      if (sendErr && g_logCommonErrors) {
+        const auto& slot = d_slots.at(sent);
+        SLOG(g_log << Logger::Warning << "Sending UDP reply to client " << slot.source.toStringWithPort()
+                   << (slot.source != slot.remote ? " (via " + slot.remote.toStringWithPort() + ")" : "") << " failed with: "
+                   << strerror(sendErr) << endl,
+             g_slogudpin->error(Logr::Error, sendErr, "Sending UDP reply to client failed", "source", Logging::Loggable(slot.source), "remote", Logging::Loggable(slot.remote)));
+      }
+      ++sent;
+    }
+    d_count = 0;
+  }
+
+private:
+  struct msghdr& getMsgHdr(size_t idx)
+  {
+#ifdef HAVE_SENDMMSG
+    return d_msgs.at(idx).msg_hdr;
+#else
+    return d_slots.at(idx).msgh;
+#endif
+  }
+
+  struct Slot
+  {
+    std::string response;
+    ComboAddress remote;
+    ComboAddress source;
+    struct iovec iov;
+#ifndef HAVE_SENDMMSG
+    struct msghdr msgh;
+#endif
+    cmsgbuf_aligned cbuf;
+  };
+
+  std::vector<Slot> d_slots;
+#ifdef HAVE_SENDMMSG
+  std::vector<struct mmsghdr> d_msgs;
+#endif
+  size_t d_count{0};
+  int d_fd{-1};
+};
+
+static string* doProcessUDPQuestion(const std::string& question, const ComboAddress& fromaddr, const ComboAddress& destaddr, ComboAddress source, ComboAddress destination, const ComboAddress& mappedSource, struct timeval tv, int fd, std::vector<ProxyProtocolValue>& proxyProtocolValues, RecEventTrace& eventTrace, UDPCacheHitBatch* cacheHitBatch)
 {
   ++(RecThreadInfo::self().numberOfDistributedQueries);
   gettimeofday(&g_now, nullptr);
@@ -2142,16 +2196,23 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
                                  "qname", Logging::Loggable(qname), "qtype", Logging::Loggable(QType(qtype)),
                                  "source", Logging::Loggable(source), "remote", Logging::Loggable(fromaddr)));
         }
-        struct msghdr msgh;
-        struct iovec iov;
-        cmsgbuf_aligned cbuf;
-        fillMSGHdr(&msgh, &iov, &cbuf, 0, (char*)response.c_str(), response.length(), const_cast<ComboAddress*>(&fromaddr));
-        msgh.msg_control = NULL;
-
-        if (g_fromtosockets.count(fd)) {
-          addCMsgSrcAddr(&msgh, &cbuf, &destaddr, 0);
+        int sendErr = 0;
+        if (cacheHitBatch != nullptr) {
+          /* sent once the whole batch of queries has been processed */
+          cacheHitBatch->add(fd, std::move(response), fromaddr, g_fromtosockets.count(fd) ? &destaddr : nullptr, source);
+        }
+        else {
+          struct msghdr msgh;
+          struct iovec iov;
+          cmsgbuf_aligned cbuf;
+          fillMSGHdr(&msgh, &iov, &cbuf, 0, (char*)response.c_str(), response.length(), const_cast<ComboAddress*>(&fromaddr));
+          msgh.msg_control = NULL;
+
+          if (g_fromtosockets.count(fd)) {
+            addCMsgSrcAddr(&msgh, &cbuf, &destaddr, 0);
+          }
+          sendErr = sendOnNBSocket(fd, &msgh);
         }
-        int sendErr = sendOnNBSocket(fd, &msgh);
         eventTrace.add(RecEventTrace::AnswerSent);
 
         if (t_protobufServers.servers && logResponse && !(luaconfsLocal->protobufExportConfig.taggedOnly && pbData && !pbData->d_tagged)) {
@@ -2270,213 +2331,291 @@ static string* doProcessUDPQuestion(const std::string& question, const ComboAddr
   return 0;
 }
 
-static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+/* Processes a query received over UDP in data, len being the size actually received. Returns false if
+   the query has been dropped for a reason that should end the current round of reads from that socket */
+static bool handleUDPQuestionPacket(int fd, std::string& data, ssize_t len, struct msghdr& msgh, const ComboAddress& fromaddr, std::vector<ProxyProtocolValue>& proxyProtocolValues, RecEventTrace& eventTrace, UDPCacheHitBatch* cacheHitBatch)
 {
-  ssize_t len;
-  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
-  static thread_local std::string data;
-  ComboAddress fromaddr; // the address the query is coming from
   ComboAddress source; // the address we assume the query is coming from, might be set by proxy protocol
   ComboAddress destination; // the address we assume the query was sent to, might be set by proxy protocol
-  struct msghdr msgh;
-  struct iovec iov;
-  cmsgbuf_aligned cbuf;
-  bool firstQuery = true;
-  std::vector<ProxyProtocolValue> proxyProtocolValues;
-  RecEventTrace eventTrace;
+  bool proxyProto = false;
+  proxyProtocolValues.clear();
 
-  for (size_t queriesCounter = 0; queriesCounter < g_maxUDPQueriesPerRound; queriesCounter++) {
-    bool proxyProto = false;
-    proxyProtocolValues.clear();
-    data.resize(maxIncomingQuerySize);
-    fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
-    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
+  eventTrace.clear();
+  eventTrace.setEnabled(SyncRes::s_event_trace_enabled);
+  eventTrace.add(RecEventTrace::ReqRecv);
 
-    if ((len = recvmsg(fd, &msgh, 0)) >= 0) {
-      eventTrace.clear();
-      eventTrace.setEnabled(SyncRes::s_event_trace_enabled);
-      eventTrace.add(RecEventTrace::ReqRecv);
+  if (msgh.msg_flags & MSG_TRUNC) {
+    t_Counters.at(rec::Counter::truncatedDrops)++;
+    if (!g_quiet) {
+      SLOG(g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toString() << endl,
+           g_slogudpin->info(Logr::Error, "Ignoring truncated query", "remote", Logging::Loggable(fromaddr)));
+    }
+    return false;
+  }
 
-      firstQuery = false;
+  data.resize(static_cast<size_t>(len));
 
-      if (msgh.msg_flags & MSG_TRUNC) {
-        t_Counters.at(rec::Counter::truncatedDrops)++;
-        if (!g_quiet) {
-          SLOG(g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toString() << endl,
-               g_slogudpin->info(Logr::Error, "Ignoring truncated query", "remote", Logging::Loggable(fromaddr)));
-        }
-        return;
+  if (expectProxyProtocol(fromaddr)) {
+    bool tcp;
+    ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
+    if (used <= 0) {
+      ++t_Counters.at(rec::Counter::proxyProtocolInvalidCount);
+      if (!g_quiet) {
+        SLOG(g_log << Logger::Error << "Ignoring invalid proxy protocol (" << std::to_string(len) << ", " << std::to_string(used) << ") query from " << fromaddr.toStringWithPort() << endl,
+             g_slogudpin->info(Logr::Error, "Ignoring invalid proxy protocol query", "length", Logging::Loggable(len),
+                               "used", Logging::Loggable(used), "remote", Logging::Loggable(fromaddr)));
       }
+      return false;
+    }
+    else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
+      if (g_quiet) {
+        SLOG(g_log << Logger::Error << "Proxy protocol header in UDP packet from " << fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping" << endl,
+             g_slogudpin->info(Logr::Error, "Proxy protocol header in UDP packet  is larger than proxy-protocol-maximum-size",
+                               "used", Logging::Loggable(used), "remote", Logging::Loggable(fromaddr)));
+      }
+      ++t_Counters.at(rec::Counter::proxyProtocolInvalidCount);
+      return false;
+    }
 
-      data.resize(static_cast<size_t>(len));
+    data.erase(0, used);
+  }
+  else if (len > 512) {
+    /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
+    t_Counters.at(rec::Counter::truncatedDrops)++;
+    if (!g_quiet) {
+      SLOG(g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toStringWithPort() << endl,
+           g_slogudpin->info(Logr::Error, "Ignoring truncated query", "remote", Logging::Loggable(fromaddr)));
+    }
+    return false;
+  }
 
-      if (expectProxyProtocol(fromaddr)) {
-        bool tcp;
-        ssize_t used = parseProxyHeader(data, proxyProto, source, destination, tcp, proxyProtocolValues);
-        if (used <= 0) {
-          ++t_Counters.at(rec::Counter::proxyProtocolInvalidCount);
-          if (!g_quiet) {
-            SLOG(g_log << Logger::Error << "Ignoring invalid proxy protocol (" << std::to_string(len) << ", " << std::to_string(used) << ") query from " << fromaddr.toStringWithPort() << endl,
-                 g_slogudpin->info(Logr::Error, "Ignoring invalid proxy protocol query", "length", Logging::Loggable(len),
-                                   "used", Logging::Loggable(used), "remote", Logging::Loggable(fromaddr)));
-          }
-          return;
-        }
-        else if (static_cast<size_t>(used) > g_proxyProtocolMaximumSize) {
-          if (g_quiet) {
-            SLOG(g_log << Logger::Error << "Proxy protocol header in UDP packet from " << fromaddr.toStringWithPort() << " is larger than proxy-protocol-maximum-size (" << used << "), dropping" << endl,
-                 g_slogudpin->info(Logr::Error, "Proxy protocol header in UDP packet  is larger than proxy-protocol-maximum-size",
-                                   "used", Logging::Loggable(used), "remote", Logging::Loggable(fromaddr)));
-          }
-          ++t_Counters.at(rec::Counter::proxyProtocolInvalidCount);
-          return;
-        }
+  if (data.size() < sizeof(dnsheader)) {
+    t_Counters.at(rec::Counter::ignoredCount)++;
+    if (!g_quiet) {
+      SLOG(g_log << Logger::Error << "Ignoring too-short (" << std::to_string(data.size()) << ") query from " << fromaddr.toString() << endl,
+           g_slogudpin->info(Logr::Error, "Ignoring too-short query", "length", Logging::Loggable(data.size()),
+                             "remote", Logging::Loggable(fromaddr)));
+    }
+    return false;
+  }
+
+  if (!proxyProto) {
+    source = fromaddr;
+  }
+  ComboAddress mappedSource = source;
+  if (t_proxyMapping) {
+    if (auto it = t_proxyMapping->lookup(source)) {
+      mappedSource = it->second.address;
+      ++it->second.stats.netmaskMatches;
+    }
+  }
+  if (t_remotes) {
+    t_remotes->push_back(fromaddr);
+  }
+
+  if (t_allowFrom && !t_allowFrom->match(&mappedSource)) {
+    if (!g_quiet) {
+      SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << mappedSource.toString() << ", address not matched by allow-from" << endl,
+           g_slogudpin->info(Logr::Error, "Dropping UDP query, address not matched by allow-from", "source", Logging::Loggable(mappedSource)));
+    }
 
-        data.erase(0, used);
+    t_Counters.at(rec::Counter::unauthorizedUDP)++;
+    return false;
+  }
+
+  BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
+  if (!fromaddr.sin4.sin_port) { // also works for IPv6
+    if (!g_quiet) {
+      SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << fromaddr.toStringWithPort() << ", can't deal with port 0" << endl,
+           g_slogudpin->info(Logr::Error, "Dropping UDP query can't deal with port 0", "remote", Logging::Loggable(fromaddr)));
+    }
+
+    t_Counters.at(rec::Counter::clientParseError)++; // not quite the best place to put it, but needs to go somewhere
+    return false;
+  }
+
+  try {
+    const dnsheader_aligned headerdata(data.data());
+    const dnsheader* dh = headerdata.get();
+
+    if (dh->qr) {
+      t_Counters.at(rec::Counter::ignoredCount)++;
+      if (g_logCommonErrors) {
+        SLOG(g_log << Logger::Error << "Ignoring answer from " << fromaddr.toString() << " on server socket!" << endl,
+             g_slogudpin->info(Logr::Error, "Ignoring answer on server socket", "remote", Logging::Loggable(fromaddr)));
       }
-      else if (len > 512) {
-        /* we only allow UDP packets larger than 512 for those with a proxy protocol header */
-        t_Counters.at(rec::Counter::truncatedDrops)++;
-        if (!g_quiet) {
-          SLOG(g_log << Logger::Error << "Ignoring truncated query from " << fromaddr.toStringWithPort() << endl,
-               g_slogudpin->info(Logr::Error, "Ignoring truncated query", "remote", Logging::Loggable(fromaddr)));
-        }
-        return;
+    }
+    else if (dh->opcode != Opcode::Query && dh->opcode != Opcode::Notify) {
+      t_Counters.at(rec::Counter::ignoredCount)++;
+      if (g_logCommonErrors) {
+        SLOG(g_log << Logger::Error << "Ignoring unsupported opcode " << Opcode::to_s(dh->opcode) << " from " << fromaddr.toString() << " on server socket!" << endl,
+             g_slogudpin->info(Logr::Error, "Ignoring unsupported opcode server socket", "remote", Logging::Loggable(fromaddr), "opcode", Logging::Loggable(Opcode::to_s(dh->opcode))));
       }
+    }
+    else if (dh->qdcount == 0) {
+      t_Counters.at(rec::Counter::emptyQueriesCount)++;
+      if (g_logCommonErrors) {
+        SLOG(g_log << Logger::Error << "Ignoring empty (qdcount == 0) query from " << fromaddr.toString() << " on server socket!" << endl,
+             g_slogudpin->info(Logr::Error, "Ignoring empty (qdcount == 0) query on server socket!", "remote", Logging::Loggable(fromaddr)));
+      }
+    }
+    else {
+      if (dh->opcode == Opcode::Notify) {
+        if (!t_allowNotifyFrom || !t_allowNotifyFrom->match(&mappedSource)) {
+          if (!g_quiet) {
+            SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP NOTIFY from " << mappedSource.toString() << ", address not matched by allow-notify-from" << endl,
+                 g_slogudpin->info(Logr::Error, "Dropping UDP NOTIFY from address not matched by allow-notify-from",
+                                   "source", Logging::Loggable(mappedSource)));
+          }
 
-      if (data.size() < sizeof(dnsheader)) {
-        t_Counters.at(rec::Counter::ignoredCount)++;
-        if (!g_quiet) {
-          SLOG(g_log << Logger::Error << "Ignoring too-short (" << std::to_string(data.size()) << ") query from " << fromaddr.toString() << endl,
-               g_slogudpin->info(Logr::Error, "Ignoring too-short query", "length", Logging::Loggable(data.size()),
-                                 "remote", Logging::Loggable(fromaddr)));
+          t_Counters.at(rec::Counter::sourceDisallowedNotify)++;
+          return false;
         }
-        return;
       }
 
-      if (!proxyProto) {
-        source = fromaddr;
+      struct timeval tv = {0, 0};
+      HarvestTimestamp(&msgh, &tv);
+      ComboAddress dest; // the address the query was sent to to
+      dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
+      auto loc = rplookup(g_listenSocketsAddresses, fd);
+      if (HarvestDestinationAddress(&msgh, &dest)) {
+        // but.. need to get port too
+        if (loc) {
+          dest.sin4.sin_port = loc->sin4.sin_port;
+        }
       }
-      ComboAddress mappedSource = source;
-      if (t_proxyMapping) {
-        if (auto it = t_proxyMapping->lookup(source)) {
-          mappedSource = it->second.address;
-          ++it->second.stats.netmaskMatches;
+      else {
+        if (loc) {
+          dest = *loc;
+        }
+        else {
+          dest.sin4.sin_family = fromaddr.sin4.sin_family;
+          socklen_t slen = dest.getSocklen();
+          getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
         }
       }
-      if (t_remotes) {
-        t_remotes->push_back(fromaddr);
+      if (!proxyProto) {
+        destination = dest;
       }
 
-      if (t_allowFrom && !t_allowFrom->match(&mappedSource)) {
-        if (!g_quiet) {
-          SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << mappedSource.toString() << ", address not matched by allow-from" << endl,
-               g_slogudpin->info(Logr::Error, "Dropping UDP query, address not matched by allow-from", "source", Logging::Loggable(mappedSource)));
-        }
-
-        t_Counters.at(rec::Counter::unauthorizedUDP)++;
-        return;
+      if (RecThreadInfo::weDistributeQueries()) {
+        std::string localdata = data;
+        distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace]() mutable {
+          return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace, nullptr);
+        });
       }
+      else {
+        doProcessUDPQuestion(data, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace, cacheHitBatch);
+      }
+    }
+  }
+  catch (const MOADNSException& mde) {
+    t_Counters.at(rec::Counter::clientParseError)++;
+    if (g_logCommonErrors) {
+      SLOG(g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << mde.what() << endl,
+           g_slogudpin->error(Logr::Error, mde.what(), "Unable to parse packet from remote UDP client", "remote", Logging::Loggable(fromaddr), "exception", Logging::Loggable("MOADNSException")));
+    }
+  }
+  catch (const std::runtime_error& e) {
+    t_Counters.at(rec::Counter::clientParseError)++;
+    if (g_logCommonErrors) {
+      SLOG(g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << e.what() << endl,
+           g_slogudpin->error(Logr::Error, e.what(), "Unable to parse packet from remote UDP client", "remote", Logging::Loggable(fromaddr), "exception", Logging::Loggable("std::runtime_error")));
+    }
+  }
+  return true;
+}
 
-      BOOST_STATIC_ASSERT(offsetof(sockaddr_in, sin_port) == offsetof(sockaddr_in6, sin6_port));
-      if (!fromaddr.sin4.sin_port) { // also works for IPv6
-        if (!g_quiet) {
-          SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP query from " << fromaddr.toStringWithPort() << ", can't deal with port 0" << endl,
-               g_slogudpin->info(Logr::Error, "Dropping UDP query can't deal with port 0", "remote", Logging::Loggable(fromaddr)));
-        }
+#ifdef HAVE_RECVMMSG
+/* Reads the queries with recvmmsg(), up to g_udpBatchSize at a time, and sends the answers
+   from the packet cache to a whole batch of queries with a single sendmmsg() */
+static void handleNewUDPQuestionsBatch(int fd, size_t maxIncomingQuerySize)
+{
+  struct Slot
+  {
+    std::string data;
+    ComboAddress fromaddr; // the address the query is coming from
+    struct iovec iov;
+    cmsgbuf_aligned cbuf;
+  };
+  static thread_local std::vector<Slot> slots;
+  static thread_local std::vector<struct mmsghdr> msgs;
+  static thread_local std::unique_ptr<UDPCacheHitBatch> cacheHitBatch;
+  if (!cacheHitBatch) {
+    slots.resize(g_udpBatchSize);
+    msgs.resize(g_udpBatchSize);
+    cacheHitBatch = std::make_unique<UDPCacheHitBatch>(g_udpBatchSize);
+  }
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+  RecEventTrace eventTrace;
+  bool firstBatch = true;
 
-        t_Counters.at(rec::Counter::clientParseError)++; // not quite the best place to put it, but needs to go somewhere
-        return;
+  for (size_t queriesCounter = 0; queriesCounter < g_maxUDPQueriesPerRound;) {
+    const size_t wanted = std::min(slots.size(), g_maxUDPQueriesPerRound - queriesCounter);
+    for (size_t idx = 0; idx < wanted; idx++) {
+      auto& slot = slots.at(idx);
+      slot.data.resize(maxIncomingQuerySize);
+      slot.fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
+      fillMSGHdr(&msgs.at(idx).msg_hdr, &slot.iov, &slot.cbuf, sizeof(slot.cbuf), &slot.data[0], slot.data.size(), &slot.fromaddr);
+      msgs.at(idx).msg_len = 0;
+    }
+
+    int got = recvmmsg(fd, msgs.data(), wanted, 0, nullptr);
+    if (got <= 0) {
+      if (firstBatch && errno == EAGAIN) {
+        t_Counters.at(rec::Counter::noPacketError)++;
       }
+      break;
+    }
+    firstBatch = false;
+    queriesCounter += got;
 
-      try {
-        const dnsheader_aligned headerdata(data.data());
-        const dnsheader* dh = headerdata.get();
+    /* these queries have already been read from the socket, so a query dropped
+       for a reason that would end a round of recvmsg() does not stop us here */
+    for (int idx = 0; idx < got; idx++) {
+      auto& slot = slots.at(idx);
+      handleUDPQuestionPacket(fd, slot.data, msgs.at(idx).msg_len, msgs.at(idx).msg_hdr, slot.fromaddr, proxyProtocolValues, eventTrace, cacheHitBatch.get());
+    }
+    cacheHitBatch->flush();
 
-        if (dh->qr) {
-          t_Counters.at(rec::Counter::ignoredCount)++;
-          if (g_logCommonErrors) {
-            SLOG(g_log << Logger::Error << "Ignoring answer from " << fromaddr.toString() << " on server socket!" << endl,
-                 g_slogudpin->info(Logr::Error, "Ignoring answer on server socket", "remote", Logging::Loggable(fromaddr)));
-          }
-        }
-        else if (dh->opcode != Opcode::Query && dh->opcode != Opcode::Notify) {
-          t_Counters.at(rec::Counter::ignoredCount)++;
-          if (g_logCommonErrors) {
-            SLOG(g_log << Logger::Error << "Ignoring unsupported opcode " << Opcode::to_s(dh->opcode) << " from " << fromaddr.toString() << " on server socket!" << endl,
-                 g_slogudpin->info(Logr::Error, "Ignoring unsupported opcode server socket", "remote", Logging::Loggable(fromaddr), "opcode", Logging::Loggable(Opcode::to_s(dh->opcode))));
-          }
-        }
-        else if (dh->qdcount == 0) {
-          t_Counters.at(rec::Counter::emptyQueriesCount)++;
-          if (g_logCommonErrors) {
-            SLOG(g_log << Logger::Error << "Ignoring empty (qdcount == 0) query from " << fromaddr.toString() << " on server socket!" << endl,
-                 g_slogudpin->info(Logr::Error, "Ignoring empty (qdcount == 0) query on server socket!", "remote", Logging::Loggable(fromaddr)));
-          }
-        }
-        else {
-          if (dh->opcode == Opcode::Notify) {
-            if (!t_allowNotifyFrom || !t_allowNotifyFrom->match(&mappedSource)) {
-              if (!g_quiet) {
-                SLOG(g_log << Logger::Error << "[" << MT->getTid() << "] dropping UDP NOTIFY from " << mappedSource.toString() << ", address not matched by allow-notify-from" << endl,
-                     g_slogudpin->info(Logr::Error, "Dropping UDP NOTIFY from address not matched by allow-notify-from",
-                                       "source", Logging::Loggable(mappedSource)));
-              }
+    if (static_cast<size_t>(got) < wanted) {
+      /* the socket has been drained, no need to wait for EAGAIN */
+      break;
+    }
+  }
+  t_Counters.updateSnap(g_regressionTestMode);
+}
+#endif /* HAVE_RECVMMSG */
 
-              t_Counters.at(rec::Counter::sourceDisallowedNotify)++;
-              return;
-            }
-          }
+static void handleNewUDPQuestion(int fd, FDMultiplexer::funcparam_t& var)
+{
+  ssize_t len;
+  static const size_t maxIncomingQuerySize = g_proxyProtocolACL.empty() ? 512 : (512 + g_proxyProtocolMaximumSize);
+#ifdef HAVE_RECVMMSG
+  if (g_udpBatchSize > 1) {
+    handleNewUDPQuestionsBatch(fd, maxIncomingQuerySize);
+    return;
+  }
+#endif /* HAVE_RECVMMSG */
+  static thread_local std::string data;
+  ComboAddress fromaddr; // the address the query is coming from
+  struct msghdr msgh;
+  struct iovec iov;
+  cmsgbuf_aligned cbuf;
+  bool firstQuery = true;
+  std::vector<ProxyProtocolValue> proxyProtocolValues;
+  RecEventTrace eventTrace;
 
-          struct timeval tv = {0, 0};
-          HarvestTimestamp(&msgh, &tv);
-          ComboAddress dest; // the address the query was sent to to
-          dest.reset(); // this makes sure we ignore this address if not returned by recvmsg above
-          auto loc = rplookup(g_listenSocketsAddresses, fd);
-          if (HarvestDestinationAddress(&msgh, &dest)) {
-            // but.. need to get port too
-            if (loc) {
-              dest.sin4.sin_port = loc->sin4.sin_port;
-            }
-          }
-          else {
-            if (loc) {
-              dest = *loc;
-            }
-            else {
-              dest.sin4.sin_family = fromaddr.sin4.sin_family;
-              socklen_t slen = dest.getSocklen();
-              getsockname(fd, (sockaddr*)&dest, &slen); // if this fails, we're ok with it
-            }
-          }
-          if (!proxyProto) {
-            destination = dest;
-          }
+  for (size_t queriesCounter = 0; queriesCounter < g_maxUDPQueriesPerRound; queriesCounter++) {
+    data.resize(maxIncomingQuerySize);
+    fromaddr.sin6.sin6_family = AF_INET6; // this makes sure fromaddr is big enough
+    fillMSGHdr(&msgh, &iov, &cbuf, sizeof(cbuf), &data[0], data.size(), &fromaddr);
 
-          if (RecThreadInfo::weDistributeQueries()) {
-            std::string localdata = data;
-            distributeAsyncFunction(data, [localdata, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace]() mutable {
-              return doProcessUDPQuestion(localdata, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace);
-            });
-          }
-          else {
-            doProcessUDPQuestion(data, fromaddr, dest, source, destination, mappedSource, tv, fd, proxyProtocolValues, eventTrace);
-          }
-        }
-      }
-      catch (const MOADNSException& mde) {
-        t_Counters.at(rec::Counter::clientParseError)++;
-        if (g_logCommonErrors) {
-          SLOG(g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << mde.what() << endl,
-               g_slogudpin->error(Logr::Error, mde.what(), "Unable to parse packet from remote UDP client", "remote", Logging::Loggable(fromaddr), "exception", Logging::Loggable("MOADNSException")));
-        }
-      }
-      catch (const std::runtime_error& e) {
-        t_Counters.at(rec::Counter::clientParseError)++;
-        if (g_logCommonErrors) {
-          SLOG(g_log << Logger::Error << "Unable to parse packet from remote UDP client " << fromaddr.toString() << ": " << e.what() << endl,
-               g_slogudpin->error(Logr::Error, e.what(), "Unable to parse packet from remote UDP client", "remote", Logging::Loggable(fromaddr), "exception", Logging::Loggable("std::runtime_error")));
-        }
+    if ((len = recvmsg(fd, &msgh, 0)) >= 0) {
+      firstQuery = false;
+
+      if (!handleUDPQuestionPacket(fd, data, len, msgh, fromaddr, proxyProtocolValues, eventTrace, nullptr)) {
+        return;
       }
     }
     else {
@@ -2594,27 +2733,7 @@ static bool trySendingQueryToWorker(unsigned int target, ThreadMSG* tmsg)
     _exit(1);
   }
 
-  const auto& tps = targetInfo.pipes;
-
-  ssize_t written = write(tps.writeQueriesToThread, &tmsg, sizeof(tmsg));
-  if (written > 0) {
-    if (static_cast<size_t>(written) != sizeof(tmsg)) {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error");
-    }
-  }
-  else {
-    int error = errno;
-    if (error == EAGAIN || error == EWOULDBLOCK) {
-      return false;
-    }
-    else {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error:" + std::to_string(error));
-    }
-  }
-
-  return true;
+  return targetInfo.pipes.queriesToThread->push(tmsg);
 }
 
 static unsigned int getWorkerLoad(size_t workerIdx)
@@ -2678,7 +2797,7 @@ void distributeAsyncFunction(const string& packet, const pipefunc_t& func)
   tmsg->wantAnswer = false;
 
   if (!trySendingQueryToWorker(target, tmsg)) {
-    /* if this function failed but did not raise an exception, it means that the pipe
+    /* if this function failed but did not raise an exception, it means that the queue
        was full, let's try another one */
     unsigned int newTarget = 0;
     do {
@@ -2731,7 +2850,7 @@ static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
              g_slogout->info(Logr::Error, "Unable to parse packet from remote UDP server", "from", Logging::Loggable(fromaddr)));
     }
 
-    t_udpclientsocks->returnSocket(fd);
+    returnUDPClientSocket(fd);
     PacketBuffer empty;
 
     MT_t::waiters_t::iterator iter = MT->d_waiters.find(pid);
@@ -2770,6 +2889,7 @@ static void handleUDPServerResponse(int fd, FDMultiplexer::funcparam_t& var)
       t_Counters.at(rec::Counter::serverParseError)++; // won't be fed to lwres.cc, so we have to increment
       SLOG(g_log << Logger::Warning << "Error in packet from remote nameserver " << fromaddr.toStringWithPort() << ": " << e.what() << endl,
            g_slogudpin->error(Logr::Warning, e.what(), "Error in packet from remote nameserver", "from", Logging::Loggable(fromaddr)));
+      t_udpclientsocks->setSuspicious(fd);
       return;
     }
   }
@@ -2802,6 +2922,7 @@ retryWithName:
       }
     }
     t_Counters.at(rec::Counter::unexpectedCount)++; // if we made it here, it really is an unexpected answer
+    t_udpclientsocks->setSuspicious(fd);
     if (g_logCommonErrors) {
       SLOG(g_log << Logger::Warning << "Discarding unexpected packet from " << fromaddr.toStringWithPort() << ": " << (pident->domain.empty() ? "<empty>" : pident->domain.toString()) << ", " << pident->type << ", " << MT->d_waiters.size() << " waiters" << endl,
            g_slogudpin->info(Logr::Warning, "Discarding unexpected packet", "from", Logging::Loggable(fromaddr),
@@ -2812,6 +2933,6 @@ retryWithName:
   }
   else if (fd >= 0) {
     /* we either found a waiter (1) or encountered an issue (-1), it's up to us to clean the socket anyway */
-    t_udpclientsocks->returnSocket(fd);
+    returnUDPClientSocket(fd, true);
   }
 }
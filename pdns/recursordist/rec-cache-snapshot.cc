@@ -0,0 +1,345 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rec-cache-snapshot.hh"
+#include "aggressive_nsec.hh"
+#include "misc.hh"
+#include "negcache.hh"
+#include "recursor_cache.hh"
+
+static const std::string s_cacheSnapshotMagic{"PDNSRECSNAP"};
+static const uint16_t s_cacheSnapshotVersion{1};
+
+enum class CacheSnapshotSection : uint8_t
+{
+  End = 0,
+  RecordCache = 1,
+  NegCache = 2,
+  AggressiveNSECCache = 3
+};
+
+void CacheSnapshotWriter::write8(uint8_t value)
+{
+  d_buffer.push_back(static_cast<char>(value));
+  if (d_buffer.size() >= 1024 * 1024) {
+    flush();
+  }
+}
+
+void CacheSnapshotWriter::write16(uint16_t value)
+{
+  write8(value >> 8);
+  write8(value & 0xff);
+}
+
+void CacheSnapshotWriter::write32(uint32_t value)
+{
+  write16(value >> 16);
+  write16(value & 0xffff);
+}
+
+void CacheSnapshotWriter::write64(uint64_t value)
+{
+  write32(value >> 32);
+  write32(value & 0xffffffff);
+}
+
+void CacheSnapshotWriter::writeBlob(const std::string& blob)
+{
+  write32(blob.size());
+  d_buffer.append(blob);
+}
+
+void CacheSnapshotWriter::writeName(const DNSName& name)
+{
+  const auto& storage = name.getStorage();
+  write16(storage.size());
+  d_buffer.append(storage);
+}
+
+void CacheSnapshotWriter::writeContent(const DNSName& qname, DNSRecordContent& content)
+{
+  const auto serialized = content.serialize(qname, true);
+  write16(serialized.size());
+  d_buffer.append(serialized);
+}
+
+void CacheSnapshotWriter::writeRecord(const DNSRecord& record)
+{
+  writeName(record.d_name);
+  write16(record.d_type);
+  write16(record.d_class);
+  write32(record.d_ttl);
+  write8(static_cast<uint8_t>(record.d_place));
+  writeContent(record.d_name, *record.d_content);
+}
+
+void CacheSnapshotWriter::writeAddress(const ComboAddress& address)
+{
+  if (address.sin4.sin_family == AF_INET) {
+    write8(4);
+    d_buffer.append(reinterpret_cast<const char*>(&address.sin4.sin_addr.s_addr), sizeof(address.sin4.sin_addr.s_addr));
+  }
+  else if (address.sin4.sin_family == AF_INET6) {
+    write8(6);
+    d_buffer.append(reinterpret_cast<const char*>(&address.sin6.sin6_addr.s6_addr), sizeof(address.sin6.sin6_addr.s6_addr));
+  }
+  else {
+    write8(0);
+    return;
+  }
+  write16(ntohs(address.sin4.sin_port));
+}
+
+void CacheSnapshotWriter::writeNetmask(const Netmask& netmask)
+{
+  if (netmask.empty()) {
+    write8(0);
+    return;
+  }
+  write8(1);
+  writeAddress(netmask.getNetwork());
+  write8(netmask.getBits());
+}
+
+void CacheSnapshotWriter::flush()
+{
+  size_t pos = 0;
+  while (pos < d_buffer.size()) {
+    auto res = write(d_fd, &d_buffer.at(pos), d_buffer.size() - pos);
+    if (res < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw std::runtime_error("Error writing the cache snapshot: " + stringerror());
+    }
+    pos += static_cast<size_t>(res);
+  }
+  d_buffer.clear();
+}
+
+CacheSnapshotReader::CacheSnapshotReader(const std::string& fileName)
+{
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Error opening the cache snapshot '" + fileName + "': " + stringerror());
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    auto err = stringerror();
+    close(fd);
+    throw std::runtime_error("Error getting the size of the cache snapshot '" + fileName + "': " + err);
+  }
+  if (st.st_size == 0) {
+    close(fd);
+    throw std::runtime_error("The cache snapshot '" + fileName + "' is empty");
+  }
+
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  auto err = stringerror();
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    throw std::runtime_error("Error mapping the cache snapshot '" + fileName + "': " + err);
+  }
+  /* we are going to read it once, from the beginning to the end */
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+
+  d_data = static_cast<const char*>(mapped);
+  d_size = static_cast<size_t>(st.st_size);
+}
+
+CacheSnapshotReader::~CacheSnapshotReader()
+{
+  munmap(const_cast<char*>(d_data), d_size);
+}
+
+const char* CacheSnapshotReader::getBytes(size_t len)
+{
+  if (len > d_size - d_pos) {
+    throw std::runtime_error("The cache snapshot is truncated");
+  }
+  const char* result = d_data + d_pos;
+  d_pos += len;
+  return result;
+}
+
+uint8_t CacheSnapshotReader::get8()
+{
+  return static_cast<uint8_t>(*getBytes(1));
+}
+
+uint16_t CacheSnapshotReader::get16()
+{
+  uint16_t value = get8() << 8;
+  return value | get8();
+}
+
+uint32_t CacheSnapshotReader::get32()
+{
+  uint32_t value = static_cast<uint32_t>(get16()) << 16;
+  return value | get16();
+}
+
+uint64_t CacheSnapshotReader::get64()
+{
+  uint64_t value = static_cast<uint64_t>(get32()) << 32;
+  return value | get32();
+}
+
+std::string CacheSnapshotReader::getBlob()
+{
+  const auto len = get32();
+  const char* data = getBytes(len);
+  return std::string(data, len);
+}
+
+DNSName CacheSnapshotReader::getName()
+{
+  const auto len = get16();
+  if (len == 0) {
+    return DNSName();
+  }
+  const char* data = getBytes(len);
+  return DNSName(data, len, 0, false);
+}
+
+std::shared_ptr<DNSRecordContent> CacheSnapshotReader::getContent(const DNSName& qname, uint16_t qtype)
+{
+  const auto len = get16();
+  const char* data = getBytes(len);
+  DNSRecord dr;
+  dr.d_name = qname;
+  dr.d_type = qtype;
+  dr.d_class = QClass::IN;
+  dr.d_clen = len;
+  return MemRecursorCache::parseContent(dr, data, len);
+}
+
+DNSRecord CacheSnapshotReader::getRecord()
+{
+  DNSRecord record;
+  record.d_name = getName();
+  record.d_type = get16();
+  record.d_class = get16();
+  record.d_ttl = get32();
+  record.d_place = static_cast<DNSResourceRecord::Place>(get8());
+  record.d_content = getContent(record.d_name, record.d_type);
+  return record;
+}
+
+ComboAddress CacheSnapshotReader::getAddress()
+{
+  ComboAddress address;
+  const auto family = get8();
+  if (family == 4) {
+    address.sin4.sin_family = AF_INET;
+    memcpy(&address.sin4.sin_addr.s_addr, getBytes(sizeof(address.sin4.sin_addr.s_addr)), sizeof(address.sin4.sin_addr.s_addr));
+  }
+  else if (family == 6) {
+    address.sin6.sin6_family = AF_INET6;
+    memcpy(&address.sin6.sin6_addr.s6_addr, getBytes(sizeof(address.sin6.sin6_addr.s6_addr)), sizeof(address.sin6.sin6_addr.s6_addr));
+  }
+  else {
+    return address;
+  }
+  address.sin4.sin_port = htons(get16());
+  return address;
+}
+
+Netmask CacheSnapshotReader::getNetmask()
+{
+  if (get8() == 0) {
+    return Netmask();
+  }
+  auto network = getAddress();
+  return Netmask(network, get8());
+}
+
+uint64_t saveCacheSnapshot(int fd, time_t now, MemRecursorCache& recordCache, NegCache& negCache, AggressiveNSECCache* aggressiveNSECCache)
+{
+  CacheSnapshotWriter writer(fd);
+  for (const auto character : s_cacheSnapshotMagic) {
+    writer.write8(character);
+  }
+  writer.write16(s_cacheSnapshotVersion);
+
+  uint64_t count = 0;
+  writer.write8(static_cast<uint8_t>(CacheSnapshotSection::RecordCache));
+  count += recordCache.saveSnapshot(writer, now);
+  writer.write8(static_cast<uint8_t>(CacheSnapshotSection::NegCache));
+  count += negCache.saveSnapshot(writer, now);
+  if (aggressiveNSECCache != nullptr) {
+    writer.write8(static_cast<uint8_t>(CacheSnapshotSection::AggressiveNSECCache));
+    count += aggressiveNSECCache->saveSnapshot(writer, now);
+  }
+  writer.write8(static_cast<uint8_t>(CacheSnapshotSection::End));
+  writer.flush();
+
+  return count;
+}
+
+uint64_t loadCacheSnapshot(const std::string& fileName, time_t now, MemRecursorCache& recordCache, size_t maxRecordCacheEntries, NegCache& negCache, size_t maxNegCacheEntries, AggressiveNSECCache* aggressiveNSECCache)
+{
+  CacheSnapshotReader reader(fileName);
+  for (const auto character : s_cacheSnapshotMagic) {
+    if (reader.get8() != static_cast<uint8_t>(character)) {
+      throw std::runtime_error("'" + fileName + "' is not a cache snapshot");
+    }
+  }
+  const auto version = reader.get16();
+  if (version != s_cacheSnapshotVersion) {
+    throw std::runtime_error("Unsupported cache snapshot version " + std::to_string(version) + " in '" + fileName + "'");
+  }
+
+  uint64_t count = 0;
+  while (true) {
+    const auto section = static_cast<CacheSnapshotSection>(reader.get8());
+    switch (section) {
+    case CacheSnapshotSection::End:
+      return count;
+    case CacheSnapshotSection::RecordCache:
+      count += recordCache.loadSnapshot(reader, now, maxRecordCacheEntries);
+      break;
+    case CacheSnapshotSection::NegCache:
+      count += negCache.loadSnapshot(reader, now, maxNegCacheEntries);
+      break;
+    case CacheSnapshotSection::AggressiveNSECCache:
+      if (aggressiveNSECCache == nullptr) {
+        /* always the last section, and we have nowhere to put it */
+        return count;
+      }
+      count += aggressiveNSECCache->loadSnapshot(reader, now);
+      break;
+    default:
+      throw std::runtime_error("Unknown section in the cache snapshot '" + fileName + "'");
+    }
+  }
+}
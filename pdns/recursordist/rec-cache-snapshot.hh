@@ -0,0 +1,104 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include "dnsname.hh"
+#include "dnsparser.hh"
+#include "iputils.hh"
+
+class AggressiveNSECCache;
+class MemRecursorCache;
+class NegCache;
+
+/* Binary snapshots of the record, negative and aggressive NSEC caches, so that a restarted
+   recursor does not start with empty caches.
+   A snapshot starts with a magic value and a format version, followed by one section per cache,
+   each entry of a section being preceded by a non-zero byte and the section ending with a zero one.
+   Integers are stored in network byte order, names in wire format and record contents serialized
+   without name compression. Only the entries that are still valid are saved, along with their
+   absolute expiration time so that the remaining TTLs are honoured when the snapshot is loaded.
+   The format is only meant to be read back by the same version of the recursor. */
+
+class CacheSnapshotWriter : public boost::noncopyable
+{
+public:
+  CacheSnapshotWriter(int fd) :
+    d_fd(fd)
+  {
+  }
+
+  void write8(uint8_t value);
+  void write16(uint16_t value);
+  void write32(uint32_t value);
+  void write64(uint64_t value);
+  void writeBlob(const std::string& blob);
+  void writeName(const DNSName& name);
+  void writeContent(const DNSName& qname, DNSRecordContent& content);
+  void writeRecord(const DNSRecord& record);
+  void writeAddress(const ComboAddress& address);
+  void writeNetmask(const Netmask& netmask);
+  void flush();
+
+private:
+  std::string d_buffer;
+  int d_fd;
+};
+
+/* reads a snapshot mapped in memory, throwing std::runtime_error if it is truncated */
+class CacheSnapshotReader : public boost::noncopyable
+{
+public:
+  CacheSnapshotReader(const std::string& fileName);
+  ~CacheSnapshotReader();
+
+  uint8_t get8();
+  uint16_t get16();
+  uint32_t get32();
+  uint64_t get64();
+  std::string getBlob();
+  DNSName getName();
+  std::shared_ptr<DNSRecordContent> getContent(const DNSName& qname, uint16_t qtype);
+  DNSRecord getRecord();
+  ComboAddress getAddress();
+  Netmask getNetmask();
+
+private:
+  const char* getBytes(size_t len);
+
+  const char* d_data{nullptr};
+  size_t d_size{0};
+  size_t d_pos{0};
+};
+
+/* Write a snapshot of the caches to fd, returning the number of saved entries.
+   aggressiveNSECCache can be null. Throws on error. */
+uint64_t saveCacheSnapshot(int fd, time_t now, MemRecursorCache& recordCache, NegCache& negCache, AggressiveNSECCache* aggressiveNSECCache);
+/* Load the snapshot stored in fileName into the caches, returning the number of loaded entries.
+   Entries that have expired since the snapshot was saved are skipped, as well as the ones that
+   do not fit once the record cache or the negative cache hold maxRecordCacheEntries or
+   maxNegCacheEntries entries. Throws on error. */
+uint64_t loadCacheSnapshot(const std::string& fileName, time_t now, MemRecursorCache& recordCache, size_t maxRecordCacheEntries, NegCache& negCache, size_t maxNegCacheEntries, AggressiveNSECCache* aggressiveNSECCache);
@@ -36,6 +36,7 @@
 #include "opensslsigners.hh"
 #include "ws-recursor.hh"
 #include "rec-taskqueue.hh"
+#include "rec-cache-snapshot.hh"
 #include "secpoll-recursor.hh"
 #include "logging.hh"
 
@@ -116,6 +117,12 @@ unsigned int RecThreadInfo::s_numDistributorThreads;
 unsigned int RecThreadInfo::s_numWorkerThreads;
 thread_local unsigned int RecThreadInfo::t_id;
 
+/* broadcast functions and cache wipes, producers wait if the queue is full. That is as many
+   messages as the pipe it replaces could hold with its default 64k buffer */
+static const size_t s_messageQueueSize = 8192;
+/* how many messages or distributed queries a thread processes before getting back to its other descriptors */
+static const size_t s_maxThreadMessagesPerWakeup = 256;
+
 static std::map<unsigned int, std::set<int>> parseCPUMap(Logr::log_t log)
 {
   std::map<unsigned int, std::set<int>> result;
@@ -298,56 +305,43 @@ int RecThreadInfo::runThreads(Logr::log_t log)
 
 void RecThreadInfo::makeThreadPipes(Logr::log_t log)
 {
-  auto pipeBufferSize = ::arg().asNum("distribution-pipe-buffer-size");
-  if (pipeBufferSize > 0) {
-    SLOG(g_log << Logger::Info << "Resizing the buffer of the distribution pipe to " << pipeBufferSize << endl,
-         log->info(Logr::Info, "Resizing the buffer of the distribution pipe", "size", Logging::Loggable(pipeBufferSize)));
+  if (::arg().asNum("distribution-pipe-buffer-size") > 0) {
+    SLOG(g_log << Logger::Warning << "distribution-pipe-buffer-size is ignored, queries are now passed to the workers via a queue whose size is set by distribution-queue-size" << endl,
+         log->info(Logr::Warning, "distribution-pipe-buffer-size is ignored, queries are now passed to the workers via a queue whose size is set by distribution-queue-size"));
   }
+  const auto queueSize = std::max(::arg().asNum("distribution-queue-size"), 1);
 
   /* thread 0 is the handler / SNMP, worker threads start at 1 */
   for (unsigned int n = 0; n < numRecursorThreads(); ++n) {
     auto& threadInfo = info(n);
 
-    int fd[2];
-    if (pipe(fd) < 0)
-      unixDie("Creating pipe for inter-thread communications");
-
-    threadInfo.pipes.readToThread = fd[0];
-    threadInfo.pipes.writeToThread = fd[1];
+    threadInfo.pipes.messagesToThread = std::make_unique<rec::ThreadQueue<ThreadMSG>>(s_messageQueueSize);
 
-    // handler thread only gets first pipe, not the others
+    // handler thread only gets the first queue, not the others
     if (n == 0) {
       continue;
     }
 
+    int fd[2];
     if (pipe(fd) < 0)
       unixDie("Creating pipe for inter-thread communications");
 
     threadInfo.pipes.readFromThread = fd[0];
     threadInfo.pipes.writeFromThread = fd[1];
 
-    if (pipe(fd) < 0)
-      unixDie("Creating pipe for inter-thread communications");
-
-    threadInfo.pipes.readQueriesToThread = fd[0];
-    threadInfo.pipes.writeQueriesToThread = fd[1];
-
-    if (pipeBufferSize > 0) {
-      if (!setPipeBufferSize(threadInfo.pipes.writeQueriesToThread, pipeBufferSize)) {
-        int err = errno;
-        SLOG(g_log << Logger::Warning << "Error resizing the buffer of the distribution pipe for thread " << n << " to " << pipeBufferSize << ": " << strerror(err) << endl,
-             log->error(Logr::Warning, err, "Error resizing the buffer of the distribution pipe for thread", "thread", Logging::Loggable(n), "size", Logging::Loggable(pipeBufferSize)));
-        auto existingSize = getPipeBufferSize(threadInfo.pipes.writeQueriesToThread);
-        if (existingSize > 0) {
-          SLOG(g_log << Logger::Warning << "The current size of the distribution pipe's buffer for thread " << n << " is " << existingSize << endl,
-               log->info(Logr::Warning, "The current size of the distribution pipe's buffer for thread", "thread", Logging::Loggable(n), "size", Logging::Loggable(existingSize)));
-        }
-      }
-    }
+    threadInfo.pipes.queriesToThread = std::make_unique<rec::ThreadQueue<ThreadMSG>>(queueSize);
+  }
+}
 
-    if (!setNonBlocking(threadInfo.pipes.writeQueriesToThread)) {
-      unixDie("Making pipe for inter-thread communications non-blocking");
-    }
+void sendThreadMessage(const RecThreadInfo& target, ThreadMSG* tmsg)
+{
+  /* these messages are rare and the consumer is alive, so that queue should never
+     stay full for long. This replaces a blocking write to a pipe, so wait for the
+     consumer to catch up, sleeping longer and longer rather than spinning */
+  std::chrono::microseconds delay{10};
+  while (!target.pipes.messagesToThread->push(tmsg)) {
+    std::this_thread::sleep_for(delay);
+    delay = std::min(delay * 2, std::chrono::microseconds(1000));
   }
 }
 
@@ -851,6 +845,8 @@ static void checkOrFixFDS(Logr::log_t log)
   unsigned int availFDs = getFilenumLimit();
   unsigned int wantFDs = g_maxMThreads * RecThreadInfo::numWorkers() + 25; // even healthier margin then before
   wantFDs += RecThreadInfo::numWorkers() * TCPOutConnectionManager::s_maxIdlePerThread;
+  const size_t udpOutFDs = UDPClientSocks::s_maxIdlePerThread + 2 * UDPClientSocks::s_poolSize;
+  wantFDs += RecThreadInfo::numWorkers() * udpOutFDs;
 
   if (wantFDs > availFDs) {
     unsigned int hardlimit = getFilenumLimit(true);
@@ -860,7 +856,7 @@ static void checkOrFixFDS(Logr::log_t log)
            log->info(Logr::Warning, "Raised soft limit on number of filedescriptors to match max-mthreads and threads settings", "limit", Logging::Loggable(wantFDs)));
     }
     else {
-      int newval = (hardlimit - 25 - TCPOutConnectionManager::s_maxIdlePerThread) / RecThreadInfo::numWorkers();
+      int newval = (hardlimit - 25 - TCPOutConnectionManager::s_maxIdlePerThread - udpOutFDs) / RecThreadInfo::numWorkers();
       SLOG(g_log << Logger::Warning << "Insufficient number of filedescriptors available for max-mthreads*threads setting! (" << hardlimit << " < " << wantFDs << "), reducing max-mthreads to " << newval << endl,
            log->info(Logr::Warning, "Insufficient number of filedescriptors available for max-mthreads*threads setting! Reducing max-mthreads", "hardlimit", Logging::Loggable(hardlimit), "want", Logging::Loggable(wantFDs), "max-mthreads", Logging::Loggable(newval)));
       g_maxMThreads = newval;
@@ -1249,11 +1245,7 @@ void broadcastFunction(const pipefunc_t& func)
     ThreadMSG* tmsg = new ThreadMSG();
     tmsg->func = func;
     tmsg->wantAnswer = true;
-    if (write(threadInfo.pipes.writeToThread, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) {
-      delete tmsg;
-
-      unixDie("write to thread pipe returned wrong size or error");
-    }
+    sendThreadMessage(threadInfo, tmsg);
 
     string* resp = nullptr;
     if (read(threadInfo.pipes.readFromThread, &resp, sizeof(resp)) != sizeof(resp))
@@ -1327,11 +1319,7 @@ T broadcastAccFunction(const std::function<T*()>& func)
     ThreadMSG* tmsg = new ThreadMSG();
     tmsg->func = [func] { return voider<T>(func); };
     tmsg->wantAnswer = true;
-
-    if (write(tps.writeToThread, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) {
-      delete tmsg;
-      unixDie("write to thread pipe returned wrong size or error");
-    }
+    sendThreadMessage(threadInfo, tmsg);
 
     T* resp = nullptr;
     if (read(tps.readFromThread, &resp, sizeof(resp)) != sizeof(resp))
@@ -1529,6 +1517,10 @@ static int serviceMain(int argc, char* argv[], Logr::log_t log)
   SyncRes::s_refresh_ttlperc = ::arg().asNum("refresh-on-ttl-perc");
   SyncRes::s_locked_ttlperc = ::arg().asNum("record-cache-locked-ttl-perc");
   RecursorPacketCache::s_refresh_ttlperc = SyncRes::s_refresh_ttlperc;
+  MemRecursorCache::s_secondChanceEviction = ::arg().mustDo("cache-second-chance-eviction");
+  NegCache::s_secondChanceEviction = MemRecursorCache::s_secondChanceEviction;
+  RecursorPacketCache::s_secondChanceEviction = MemRecursorCache::s_secondChanceEviction;
+  MemRecursorCache::s_compactStorage = ::arg().mustDo("record-cache-compact-storage");
   SyncRes::s_tcp_fast_open = ::arg().asNum("tcp-fast-open");
   SyncRes::s_tcp_fast_open_connect = ::arg().mustDo("tcp-fast-open-connect");
 
@@ -1698,6 +1690,13 @@ static int serviceMain(int argc, char* argv[], Logr::log_t log)
   TCPOutConnectionManager::s_maxQueries = ::arg().asNum("tcp-out-max-queries");
   TCPOutConnectionManager::s_maxIdlePerThread = ::arg().asNum("tcp-out-max-idle-per-thread");
 
+  millis = ::arg().asNum("udp-out-max-idle-ms");
+  UDPClientSocks::s_maxIdleTime = timeval{millis / 1000, (static_cast<suseconds_t>(millis) % 1000) * 1000};
+  UDPClientSocks::s_maxIdlePerAuth = ::arg().asNum("udp-out-max-idle-per-auth");
+  UDPClientSocks::s_maxQueries = ::arg().asNum("udp-out-max-queries");
+  UDPClientSocks::s_maxIdlePerThread = ::arg().asNum("udp-out-max-idle-per-thread");
+  UDPClientSocks::s_poolSize = ::arg().asNum("udp-out-pool-size");
+
   g_gettagNeedsEDNSOptions = ::arg().mustDo("gettag-needs-edns-options");
 
   s_statisticsInterval = ::arg().asNum("statistics-interval");
@@ -1714,6 +1713,20 @@ static int serviceMain(int argc, char* argv[], Logr::log_t log)
     }
   }
 
+  if (!::arg()["cache-snapshot-file"].empty()) {
+    const auto& snapshotFile = ::arg()["cache-snapshot-file"];
+    try {
+      auto loaded = loadCacheSnapshot(snapshotFile, time(nullptr), *g_recCache, g_maxCacheEntries, *g_negCache, g_maxCacheEntries / 8, g_aggressiveNSECCache.get());
+      SLOG(g_log << Logger::Notice << "Loaded " << loaded << " cache entries from the snapshot in " << snapshotFile << endl,
+           log->info(Logr::Info, "Loaded cache entries from snapshot", "file", Logging::Loggable(snapshotFile), "count", Logging::Loggable(loaded)));
+    }
+    catch (const std::exception& e) {
+      /* not fatal, we will just start with cold caches */
+      SLOG(g_log << Logger::Error << "Unable to load the cache snapshot from " << snapshotFile << ": " << e.what() << endl,
+           log->error(Logr::Error, e.what(), "Unable to load the cache snapshot", "file", Logging::Loggable(snapshotFile)));
+    }
+  }
+
   {
     SuffixMatchNode dontThrottleNames;
     vector<string> parts;
@@ -1945,6 +1958,7 @@ static int serviceMain(int argc, char* argv[], Logr::log_t log)
   g_maxTCPPerClient = ::arg().asNum("max-tcp-per-client");
   g_tcpMaxQueriesPerConn = ::arg().asNum("max-tcp-queries-per-connection");
   g_maxUDPQueriesPerRound = ::arg().asNum("max-udp-queries-per-round");
+  g_udpBatchSize = std::min(std::max(::arg().asNum("udp-batch-size"), 1), 1024);
 
   g_useKernelTimestamp = ::arg().mustDo("protobuf-use-kernel-timestamp");
 
@@ -2005,14 +2019,8 @@ static int serviceMain(int argc, char* argv[], Logr::log_t log)
   return RecThreadInfo::runThreads(log);
 }
 
-static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
+static void runThreadMessage(ThreadMSG* tmsg)
 {
-  ThreadMSG* tmsg = nullptr;
-
-  if (read(fd, &tmsg, sizeof(tmsg)) != sizeof(tmsg)) { // fd == readToThread || fd == readQueriesToThread
-    unixDie("read from thread pipe returned wrong size or error");
-  }
-
   void* resp = 0;
   try {
     resp = tmsg->func();
@@ -2039,6 +2047,23 @@ static void handlePipeRequest(int fd, FDMultiplexer::funcparam_t& var)
   delete tmsg;
 }
 
+static void handleThreadQueue(int fd, FDMultiplexer::funcparam_t& var)
+{
+  auto* queue = boost::any_cast<rec::ThreadQueue<ThreadMSG>*>(var);
+  queue->clearNotification();
+
+  /* process everything queued since the last wakeup, but do not starve the other
+     descriptors if producers keep up with us */
+  for (size_t count = 0; count < s_maxThreadMessagesPerWakeup; count++) {
+    ThreadMSG* tmsg = queue->pop();
+    if (tmsg == nullptr) {
+      return;
+    }
+    runThreadMessage(tmsg);
+  }
+  queue->rearm();
+}
+
 static void handleRCC(int fd, FDMultiplexer::funcparam_t& var)
 {
   auto log = g_slog->withName("control");
@@ -2148,6 +2173,9 @@ static void houseKeeping(void*)
       t_tcp_manager.cleanup(now);
     });
 
+    // not a periodic task, the sockets kept ready are replaced well before a second has passed
+    t_udpclientsocks->cleanup(now);
+
     const auto& info = RecThreadInfo::self();
 
     // Threads handling packets process config changes in the input path, but not all threads process input packets
@@ -2423,7 +2451,7 @@ static void recursorThread()
 
     std::unique_ptr<RecursorWebServer> rws;
 
-    t_fdm->addReadFD(threadInfo.pipes.readToThread, handlePipeRequest);
+    t_fdm->addReadFD(threadInfo.pipes.messagesToThread->getDescriptor(), handleThreadQueue, threadInfo.pipes.messagesToThread.get());
 
     if (threadInfo.isHandler()) {
       if (::arg().mustDo("webserver")) {
@@ -2442,7 +2470,7 @@ static void recursorThread()
            log->info(Logr::Info, "Enabled multiplexer", "name", Logging::Loggable(t_fdm->getName())));
     }
     else {
-      t_fdm->addReadFD(threadInfo.pipes.readQueriesToThread, handlePipeRequest);
+      t_fdm->addReadFD(threadInfo.pipes.queriesToThread->getDescriptor(), handleThreadQueue, threadInfo.pipes.queriesToThread.get());
 
       if (threadInfo.isListener()) {
         if (g_reusePort) {
@@ -2499,18 +2527,7 @@ static void recursorThread()
         }
       }
 
-      if (!(s_counter % 55)) {
-        typedef vector<pair<int, FDMultiplexer::funcparam_t>> expired_t;
-        expired_t expired = t_fdm->getTimeouts(g_now);
-
-        for (expired_t::iterator i = expired.begin(); i != expired.end(); ++i) {
-          shared_ptr<TCPConnection> conn = boost::any_cast<shared_ptr<TCPConnection>>(i->second);
-          if (g_logCommonErrors)
-            SLOG(g_log << Logger::Warning << "Timeout from remote TCP client " << conn->d_remote.toStringWithPort() << endl,
-                 g_slogtcpin->info(Logr::Warning, "Timeout from remote TCP client", "remote", Logging::Loggable(conn->d_remote)));
-          t_fdm->removeReadFD(i->first);
-        }
-      }
+      expireTCPConnections(g_now);
 
       s_counter++;
 
@@ -2748,8 +2765,10 @@ int main(int argc, char** argv)
     ::arg().set("max-total-msec", "Maximum total wall-clock time per query in milliseconds, 0 for unlimited") = "7000";
     ::arg().set("max-recursion-depth", "Maximum number of internal recursion calls per query, 0 for unlimited") = "40";
     ::arg().set("max-udp-queries-per-round", "Maximum number of UDP queries processed per recvmsg() round, before returning back to normal processing") = "10000";
+    ::arg().set("udp-batch-size", "Maximum number of UDP queries read with a single recvmmsg() call, the answers from the packet cache being sent with a single sendmmsg() call. 1 disables batching") = "16";
     ::arg().set("protobuf-use-kernel-timestamp", "Compute the latency of queries in protobuf messages by using the timestamp set by the kernel when the query was received (when available)") = "";
-    ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to pass incoming queries to a worker thread") = "0";
+    ::arg().set("distribution-pipe-buffer-size", "Size in bytes of the internal buffer of the pipe used by the distributor to pass incoming queries to a worker thread (deprecated, ignored)") = "0";
+    ::arg().set("distribution-queue-size", "Maximum number of queries waiting in the queue between the distributor threads and each worker thread") = "8192";
 
     ::arg().set("include-dir", "Include *.conf files from this directory") = "";
     ::arg().set("security-poll-suffix", "Domain name from which to query security update notifications") = "secpoll.powerdns.com.";
@@ -2795,6 +2814,11 @@ int main(int argc, char** argv)
     ::arg().set("udp-source-port-min", "Minimum UDP port to bind on") = "1024";
     ::arg().set("udp-source-port-max", "Maximum UDP port to bind on") = "65535";
     ::arg().set("udp-source-port-avoid", "List of comma separated UDP port number to avoid") = "11211";
+    ::arg().set("udp-out-max-idle-ms", "Time an outgoing UDP socket is kept open for queries to the same IP and port, in milliseconds, 0 means sockets are not reused") = "0";
+    ::arg().set("udp-out-max-idle-per-auth", "Maximum number of idle outgoing UDP sockets to a specific IP and port per thread, 0 means sockets are not reused") = "4";
+    ::arg().set("udp-out-max-queries", "Maximum total number of queries per outgoing UDP socket, 0 means no limit") = "20";
+    ::arg().set("udp-out-max-idle-per-thread", "Maximum number of idle outgoing UDP sockets per thread") = "100";
+    ::arg().set("udp-out-pool-size", "Maximum number of bound outgoing UDP sockets kept ready per thread and address family, 0 means sockets are created when needed") = "16";
     ::arg().set("rng", "Specify random number generator to use. Valid values are auto,sodium,openssl,getrandom,arc4random,urandom.") = "auto";
     ::arg().set("public-suffix-list-file", "Path to the Public Suffix List file, if any") = "";
     ::arg().set("distribution-load-factor", "The load factor used when PowerDNS is distributing queries to worker threads") = "0.0";
@@ -2804,6 +2828,10 @@ int main(int argc, char** argv)
     ::arg().set("max-generate-steps", "Maximum number of $GENERATE steps when loading a zone from a file") = "0";
     ::arg().set("max-include-depth", "Maximum nested $INCLUDE depth when loading a zone from a file") = "20";
     ::arg().set("record-cache-shards", "Number of shards in the record cache") = "1024";
+    ::arg().set("record-cache-read-optimized", "Serve record cache hits while holding only a shared lock on the shard") = "no";
+    ::arg().set("cache-snapshot-file", "If set, load the contents of the caches at startup from this snapshot, saved with 'rec_control dump-cache-snapshot'") = "";
+    ::arg().set("record-cache-compact-storage", "Store the records in the record cache in wire format, using less memory but parsing them on every hit") = "no";
+    ::arg().set("cache-second-chance-eviction", "Only flag cache entries on a hit and give them a second chance when evicting, instead of maintaining a strict LRU order") = "no";
     ::arg().set("refresh-on-ttl-perc", "If a record is requested from the cache and only this % of original TTL remains, refetch") = "0";
     ::arg().set("record-cache-locked-ttl-perc", "Replace records in record cache only after this % of original TTL has passed") = "0";
 
@@ -3025,7 +3053,7 @@ int main(int argc, char** argv)
       ::arg().set("distributor-threads") = "0";
     }
 
-    g_recCache = std::make_unique<MemRecursorCache>(::arg().asNum("record-cache-shards"));
+    g_recCache = std::make_unique<MemRecursorCache>(::arg().asNum("record-cache-shards"), ::arg().mustDo("record-cache-read-optimized"));
     g_negCache = std::make_unique<NegCache>(::arg().asNum("record-cache-shards") / 8);
 
     ret = serviceMain(argc, argv, startupLog);
@@ -36,8 +36,10 @@
 #include "syncres.hh"
 #include "rec-snmp.hh"
 #include "rec_channel.hh"
+#include "rec-thread-queue.hh"
 #include "threadname.hh"
 #include "recpacketcache.hh"
+#include "rec-udpout.hh"
 
 #ifdef NOD_ENABLED
 #include "nod.hh"
@@ -156,36 +158,13 @@ extern uint16_t g_minUdpSourcePort;
 extern uint16_t g_maxUdpSourcePort;
 extern bool g_regressionTestMode;
 
-// you can ask this class for a UDP socket to send a query from
-// this socket is not yours, don't even think about deleting it
-// but after you call 'returnSocket' on it, don't assume anything anymore
-class UDPClientSocks
-{
-  unsigned int d_numsocks;
-
-public:
-  UDPClientSocks() :
-    d_numsocks(0)
-  {
-  }
-
-  LWResult::Result getSocket(const ComboAddress& toaddr, int* fd);
-
-  // return a socket to the pool, or simply erase it
-  void returnSocket(int fd);
-
-private:
-  // returns -1 for errors which might go away, throws for ones that won't
-  static int makeClientSocket(int family);
-};
-
 enum class PaddingMode
 {
   Always,
   PaddedQueries
 };
 
-typedef MTasker<std::shared_ptr<PacketID>, PacketBuffer, PacketIDCompare> MT_t;
+typedef MTasker<std::shared_ptr<PacketID>, PacketBuffer, PacketIDHash, PacketIDEqual, PacketIDBirthdayHash, PacketIDBirthdayEqual> MT_t;
 extern thread_local std::unique_ptr<MT_t> MT; // the big MTasker
 extern thread_local std::unique_ptr<RecursorPacketCache> t_packetCache;
 
@@ -208,6 +187,7 @@ extern int g_tcpTimeout;
 extern uint16_t g_udpTruncationThreshold;
 extern double g_balancingFactor;
 extern size_t g_maxUDPQueriesPerRound;
+extern size_t g_udpBatchSize;
 extern bool g_useKernelTimestamp;
 extern thread_local std::shared_ptr<NetmaskGroup> t_allowFrom;
 extern thread_local std::shared_ptr<NetmaskGroup> t_allowNotifyFrom;
@@ -325,16 +305,19 @@ static bool sendResponseOverTCP(const std::unique_ptr<DNSComboWriter>& dc, const
 // First we have the handler thread, t_id == 0 (some other helper
 // threads like SNMP might have t_id == 0 as well) then the
 // distributor threads if any and finally the workers
+struct ThreadMSG;
+
 struct RecThreadInfo
 {
   struct ThreadPipeSet
   {
-    int writeToThread{-1};
-    int readToThread{-1};
+    // messages (broadcast functions, cache wipes) to this thread, every thread has one
+    std::unique_ptr<rec::ThreadQueue<ThreadMSG>> messagesToThread;
+    // answers to these messages, when wanted
     int writeFromThread{-1};
     int readFromThread{-1};
-    int writeQueriesToThread{-1}; // this one is non-blocking
-    int readQueriesToThread{-1};
+    // queries handed over by the distributors, when the queue is full they are dropped
+    std::unique_ptr<rec::ThreadQueue<ThreadMSG>> queriesToThread;
   };
 
 public:
@@ -514,6 +497,9 @@ struct ThreadMSG
   bool wantAnswer;
 };
 
+// Queue a message for that thread, waiting if its queue is full. Takes ownership of tmsg
+void sendThreadMessage(const RecThreadInfo& target, ThreadMSG* tmsg);
+
 void parseACLs();
 PacketBuffer GenUDPQueryResponse(const ComboAddress& dest, const string& query);
 bool checkProtobufExport(LocalStateHolder<LuaConfigItems>& luaconfsLocal);
@@ -546,6 +532,7 @@ void checkFastOpenSysctl(bool active, Logr::log_t);
 void checkTFOconnect(Logr::log_t);
 void makeTCPServerSockets(deferredAdd_t& deferredAdds, std::set<int>& tcpSockets, Logr::log_t);
 void handleNewTCPQuestion(int fd, FDMultiplexer::funcparam_t&);
+void expireTCPConnections(const struct timeval& now);
 
 void makeUDPServerSockets(deferredAdd_t& deferredAdds, Logr::log_t);
 
@@ -36,6 +36,13 @@ uint16_t TCPConnection::s_maxInFlight;
 
 thread_local std::unique_ptr<tcpClientCounts_t> t_tcpClientCounts;
 
+/* The read timeouts of the incoming TCP connections. They are re-armed after every
+   query, so we don't keep them in the multiplexer's ordered index of ttds.
+   A connection closed before its timer expires leaves it in the wheel, where it
+   only holds a weak pointer until it expires. */
+static thread_local pdns::TimerWheel<std::weak_ptr<TCPConnection>> t_tcpTimeouts;
+static thread_local std::vector<std::pair<uint64_t, std::weak_ptr<TCPConnection>>> t_tcpExpired;
+
 static void handleRunningTCPQuestion(int fd, FDMultiplexer::funcparam_t& var);
 
 #if 0
@@ -73,6 +80,32 @@ TCPConnection::~TCPConnection()
   --s_currentConnections;
 }
 
+static void armTCPTimeout(const std::shared_ptr<TCPConnection>& conn, const struct timeval& now)
+{
+  t_tcpTimeouts.cancel(conn->d_idleTimer);
+  struct timeval ttd = now;
+  ttd.tv_sec += g_tcpTimeout;
+  conn->d_idleTimer = t_tcpTimeouts.add(now, ttd, conn);
+}
+
+void expireTCPConnections(const struct timeval& now)
+{
+  t_tcpExpired.clear();
+  t_tcpTimeouts.advance(now, t_tcpExpired);
+  for (const auto& expired : t_tcpExpired) {
+    auto conn = expired.second.lock();
+    // the timer might have been re-armed while the connection was not being read from
+    if (!conn || conn->d_idleTimer != expired.first || !t_fdm->isWatchedForRead(conn->getFD())) {
+      continue;
+    }
+    if (g_logCommonErrors) {
+      SLOG(g_log << Logger::Warning << "Timeout from remote TCP client " << conn->d_remote.toStringWithPort() << endl,
+           g_slogtcpin->info(Logr::Warning, "Timeout from remote TCP client", "remote", Logging::Loggable(conn->d_remote)));
+    }
+    t_fdm->removeReadFD(conn->getFD());
+  }
+}
+
 static void terminateTCPConnection(int fd)
 {
   try {
@@ -144,26 +177,21 @@ void finishTCPReply(std::unique_ptr<DNSComboWriter>& dc, bool hadError, bool upd
   }
 
   Utility::gettimeofday(&g_now, nullptr); // needs to be updated
-  struct timeval ttd = g_now;
+  armTCPTimeout(dc->d_tcpConnection, g_now);
 
   // If we cross from max to max-1 in flight requests, the fd was not listened to, add it back
   if (updateInFlight && dc->d_tcpConnection->d_requestsInFlight == TCPConnection::s_maxInFlight - 1) {
     // A read error might have happened. If we add the fd back, it will most likely error again.
     // This is not a big issue, the next handleTCPClientReadable() will see another read error
     // and take action.
-    ttd.tv_sec += g_tcpTimeout;
-    t_fdm->addReadFD(dc->d_socket, handleRunningTCPQuestion, dc->d_tcpConnection, &ttd);
+    t_fdm->addReadFD(dc->d_socket, handleRunningTCPQuestion, dc->d_tcpConnection);
     return;
   }
-  // fd might have been removed by read error code, or a read timeout, so expect an exception
-  try {
-    t_fdm->setReadTTD(dc->d_socket, ttd, g_tcpTimeout);
-  }
-  catch (const FDMultiplexerException&) {
+  // fd might have been removed by read error code, or a read timeout
+  if (!t_fdm->isWatchedForRead(dc->d_socket)) {
     // but if the FD was removed because of a timeout while we were sending a response,
     // we need to re-arm it. If it was an error it will error again.
-    ttd.tv_sec += g_tcpTimeout;
-    t_fdm->addReadFD(dc->d_socket, handleRunningTCPQuestion, dc->d_tcpConnection, &ttd);
+    t_fdm->addReadFD(dc->d_socket, handleRunningTCPQuestion, dc->d_tcpConnection);
   }
 }
 
@@ -599,8 +627,7 @@ static void handleRunningTCPQuestion(int fd, FDMultiplexer::funcparam_t& var)
         }
         else {
           Utility::gettimeofday(&g_now, nullptr); // needed?
-          struct timeval ttd = g_now;
-          t_fdm->setReadTTD(fd, ttd, g_tcpTimeout);
+          armTCPTimeout(conn, g_now);
         }
         tcpGuard.keep();
         MT->makeThread(startDoResolve, dc.release()); // deletes dc
@@ -690,11 +717,11 @@ void handleNewTCPQuestion(int fd, FDMultiplexer::funcparam_t&)
       tc->state = TCPConnection::BYTE0;
     }
 
-    struct timeval ttd;
-    Utility::gettimeofday(&ttd, nullptr);
-    ttd.tv_sec += g_tcpTimeout;
+    struct timeval now;
+    Utility::gettimeofday(&now, nullptr);
+    armTCPTimeout(tc, now);
 
-    t_fdm->addReadFD(tc->getFD(), handleRunningTCPQuestion, tc, &ttd);
+    t_fdm->addReadFD(tc->getFD(), handleRunningTCPQuestion, tc);
   }
 }
 
@@ -0,0 +1,100 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <cerrno>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "rec-thread-queue.hh"
+#include "misc.hh"
+
+namespace rec
+{
+ThreadQueueNotifier::ThreadQueueNotifier()
+{
+#ifdef __linux__
+  d_readFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (d_readFD < 0) {
+    unixDie("Creating eventfd for inter-thread communications");
+  }
+  d_writeFD = d_readFD;
+#else
+  int fds[2];
+  if (pipe(fds) < 0) {
+    unixDie("Creating pipe for inter-thread communications");
+  }
+  d_readFD = fds[0];
+  d_writeFD = fds[1];
+  if (!setNonBlocking(d_readFD) || !setNonBlocking(d_writeFD)) {
+    unixDie("Making pipe for inter-thread communications non-blocking");
+  }
+  setCloseOnExec(d_readFD);
+  setCloseOnExec(d_writeFD);
+#endif
+}
+
+ThreadQueueNotifier::~ThreadQueueNotifier()
+{
+  if (d_writeFD != d_readFD) {
+    close(d_writeFD);
+  }
+  close(d_readFD);
+}
+
+void ThreadQueueNotifier::notify() const
+{
+#ifdef __linux__
+  const uint64_t value = 1;
+#else
+  const char value = 0;
+#endif
+  ssize_t res = 0;
+  do {
+    res = write(d_writeFD, &value, sizeof(value));
+  } while (res < 0 && errno == EINTR);
+  /* EAGAIN means that the descriptor is already readable, which is all we want */
+  if (res < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+    unixDie("Notifying a thread of a new message");
+  }
+}
+
+void ThreadQueueNotifier::clear() const
+{
+#ifdef __linux__
+  uint64_t value = 0;
+  /* reading an eventfd resets its counter */
+  while (read(d_readFD, &value, sizeof(value)) < 0 && errno == EINTR) {
+  }
+#else
+  char buffer[64];
+  while (true) {
+    ssize_t res = read(d_readFD, buffer, sizeof(buffer));
+    if (res > 0 || (res < 0 && errno == EINTR)) {
+      continue;
+    }
+    break;
+  }
+#endif
+}
+}
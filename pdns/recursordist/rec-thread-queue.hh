@@ -0,0 +1,169 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace rec
+{
+/* Wakes up the consumer of a ThreadQueue via a file descriptor that can be
+   watched by a multiplexer: an eventfd on Linux, a pipe elsewhere. Both ends
+   are non-blocking. */
+class ThreadQueueNotifier
+{
+public:
+  ThreadQueueNotifier();
+  ~ThreadQueueNotifier();
+  ThreadQueueNotifier(const ThreadQueueNotifier&) = delete;
+  ThreadQueueNotifier& operator=(const ThreadQueueNotifier&) = delete;
+
+  /* makes the descriptor readable, can be called from any thread */
+  void notify() const;
+  /* makes the descriptor not readable anymore, consumer only */
+  void clear() const;
+
+  int getDescriptor() const
+  {
+    return d_readFD;
+  }
+
+private:
+  int d_readFD{-1};
+  int d_writeFD{-1};
+};
+
+/* A bounded, lock-free queue of pointers, with any number of producers and a
+   single consumer (the thread watching getDescriptor() in its multiplexer).
+   Producers only wake the consumer up when it might be sleeping: the first push
+   after the consumer called clearNotification() writes to the descriptor, the
+   next ones don't, so a busy consumer processes many items per wakeup and
+   producers usually don't do any system call.
+   The ring itself is D. Vyukov's bounded queue: every slot carries a sequence
+   number telling whether it is ready to be written to or read from for the
+   current lap, so producers only contend on the tail index. */
+template <typename T>
+class ThreadQueue
+{
+public:
+  /* the capacity is rounded up to the next power of two */
+  explicit ThreadQueue(size_t capacity)
+  {
+    size_t actual = 1;
+    while (actual < capacity) {
+      actual <<= 1;
+    }
+    d_mask = actual - 1;
+    d_slots = std::make_unique<Slot[]>(actual);
+    for (size_t idx = 0; idx < actual; idx++) {
+      d_slots[idx].d_sequence.store(idx, std::memory_order_relaxed);
+    }
+  }
+
+  /* returns false, without taking ownership of the item, if the queue is full */
+  bool push(T* item)
+  {
+    size_t pos = d_tail.load(std::memory_order_relaxed);
+    Slot* slot = nullptr;
+    while (true) {
+      slot = &d_slots[pos & d_mask];
+      const size_t sequence = slot->d_sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (d_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          break;
+        }
+      }
+      else if (diff < 0) {
+        /* that slot has not been consumed since the previous lap */
+        return false;
+      }
+      else {
+        pos = d_tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    slot->d_item = item;
+    slot->d_sequence.store(pos + 1, std::memory_order_release);
+
+    /* the consumer clears the flag before draining the queue, so either it will see
+       our item, or we see the flag cleared and wake it up */
+    if (!d_notified.exchange(true, std::memory_order_seq_cst)) {
+      d_notifier.notify();
+    }
+    return true;
+  }
+
+  /* consumer only, returns nullptr if the queue is empty */
+  T* pop()
+  {
+    Slot& slot = d_slots[d_head & d_mask];
+    if (slot.d_sequence.load(std::memory_order_acquire) != d_head + 1) {
+      return nullptr;
+    }
+    T* item = slot.d_item;
+    slot.d_sequence.store(d_head + d_mask + 1, std::memory_order_release);
+    d_head++;
+    return item;
+  }
+
+  /* consumer only, to be called when the descriptor is readable, before draining the queue */
+  void clearNotification()
+  {
+    d_notifier.clear();
+    d_notified.store(false, std::memory_order_seq_cst);
+  }
+
+  /* consumer only, to be woken up again later when it stopped draining before the queue was empty */
+  void rearm()
+  {
+    d_notified.store(true, std::memory_order_seq_cst);
+    d_notifier.notify();
+  }
+
+  int getDescriptor() const
+  {
+    return d_notifier.getDescriptor();
+  }
+
+  size_t capacity() const
+  {
+    return d_mask + 1;
+  }
+
+private:
+  struct Slot
+  {
+    std::atomic<size_t> d_sequence{0};
+    T* d_item{nullptr};
+  };
+
+  std::unique_ptr<Slot[]> d_slots;
+  size_t d_mask{0};
+  ThreadQueueNotifier d_notifier;
+  alignas(64) std::atomic<size_t> d_tail{0};
+  alignas(64) std::atomic<bool> d_notified{false};
+  alignas(64) size_t d_head{0};
+};
+}
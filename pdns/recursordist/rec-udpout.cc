@@ -0,0 +1,203 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "rec-udpout.hh"
+
+#include "dns_random.hh"
+#include "logger.hh"
+#include "logging.hh"
+#include "misc.hh"
+#include "query-local-address.hh"
+
+struct timeval UDPClientSocks::s_maxIdleTime;
+size_t UDPClientSocks::s_maxIdlePerAuth;
+size_t UDPClientSocks::s_maxQueries;
+size_t UDPClientSocks::s_maxIdlePerThread;
+size_t UDPClientSocks::s_poolSize;
+// short enough that a port found by scanning is very likely to have been closed before it is used
+const struct timeval UDPClientSocks::s_maxBoundAge = {0, 250000};
+
+static void closeUDPClientSocket(int fd)
+{
+  try {
+    closesocket(fd);
+  }
+  catch (const PDNSException& e) {
+    SLOG(g_log << Logger::Error << "Error closing returned UDP socket: " << e.reason << endl,
+         g_slog->withName("out")->error(Logr::Error, e.reason, "Error closing returned UDP socket", "exception", Logging::Loggable("PDNSException")));
+  }
+}
+
+// discard whatever has been received on that socket before it was (re)connected, or since it was last used,
+// returns false if it could not be emptied
+static bool drainUDPClientSocket(int fd)
+{
+  std::array<char, 512> buffer{};
+  for (size_t count = 0; count < 64; count++) {
+    if (recv(fd, buffer.data(), buffer.size(), 0) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    }
+    // other errors, like ECONNREFUSED, are pending ICMP errors we consume as well
+  }
+  return false;
+}
+
+UDPClientSocks::~UDPClientSocks()
+{
+  for (const auto& entry : d_idle) {
+    close(entry.d_fd);
+  }
+  for (const auto& entry : d_bound4) {
+    close(entry.d_fd);
+  }
+  for (const auto& entry : d_bound6) {
+    close(entry.d_fd);
+  }
+}
+
+void UDPClientSocks::pruneBound(std::deque<Bound>& bound, const struct timeval& now)
+{
+  while (!bound.empty() && s_maxBoundAge < now - bound.front().d_created) {
+    closeUDPClientSocket(bound.front().d_fd);
+    bound.pop_front();
+  }
+}
+
+LWResult::Result UDPClientSocks::getSocket(const ComboAddress& toaddr, const struct timeval& now, int* fd)
+{
+  auto& byRemote = d_idle.get<RemoteTag>();
+  for (auto iter = byRemote.find(toaddr); iter != byRemote.end(); iter = byRemote.find(toaddr)) {
+    const auto idle = *iter;
+    byRemote.erase(iter);
+    if (s_maxIdleTime < now - idle.d_last_used || !drainUDPClientSocket(idle.d_fd)) {
+      closeUDPClientSocket(idle.d_fd);
+      continue;
+    }
+    *fd = idle.d_fd;
+    d_inUse[*fd] = InUse{toaddr, idle.d_numqueries + 1};
+    return LWResult::Result::Success;
+  }
+
+  getNeeded(toaddr.sin4.sin_family)++;
+  auto& bound = getBound(toaddr.sin4.sin_family);
+  pruneBound(bound, now);
+  if (!bound.empty()) {
+    // not the most recently created one, so that knowing which ports are ready does not tell which one is used next
+    auto pos = dns_random(bound.size());
+    *fd = bound.at(pos).d_fd;
+    bound.erase(bound.begin() + pos);
+  }
+  else {
+    *fd = makeClientSocket(toaddr.sin4.sin_family);
+    if (*fd < 0) { // temporary error - receive exception otherwise
+      return LWResult::Result::OSLimitError;
+    }
+  }
+
+  if (connect(*fd, (struct sockaddr*)(&toaddr), toaddr.getSocklen()) < 0) {
+    int err = errno;
+    try {
+      closesocket(*fd);
+    }
+    catch (const PDNSException& e) {
+      SLOG(g_log << Logger::Error << "Error closing UDP socket after connect() failed: " << e.reason << endl,
+           g_slog->withName("out")->error(Logr::Error, e.reason, "Error closing UDP socket after connect() failed", "exception", Logging::Loggable("PDNSException")));
+    }
+
+    if (err == ENETUNREACH) { // Seth "My Interfaces Are Like A Yo Yo" Arnold special
+      return LWResult::Result::OSLimitError;
+    }
+
+    return LWResult::Result::PermanentError;
+  }
+
+  // a socket kept ready might have received datagrams from anyone until now
+  if (!drainUDPClientSocket(*fd)) {
+    closeUDPClientSocket(*fd);
+    return LWResult::Result::OSLimitError;
+  }
+
+  d_inUse[*fd] = InUse{toaddr, 1};
+  return LWResult::Result::Success;
+}
+
+// return a socket to the pool, or simply erase it
+void UDPClientSocks::returnSocket(int fd, const struct timeval& now, bool answered)
+{
+  auto iter = d_inUse.find(fd);
+  if (iter != d_inUse.end()) {
+    const auto inUse = iter->second;
+    d_inUse.erase(iter);
+
+    if (answered && !inUse.d_suspicious && (s_maxQueries == 0 || inUse.d_numqueries < s_maxQueries) && (s_maxIdleTime.tv_sec != 0 || s_maxIdleTime.tv_usec != 0) && s_maxIdlePerAuth > 0 && s_maxIdlePerThread > 0 && d_idle.get<RemoteTag>().count(inUse.d_remote) < s_maxIdlePerAuth) {
+      if (d_idle.size() >= s_maxIdlePerThread) {
+        closeUDPClientSocket(d_idle.front().d_fd);
+        d_idle.pop_front();
+      }
+      d_idle.push_back(Idle{inUse.d_remote, now, inUse.d_numqueries, fd});
+      return;
+    }
+  }
+
+  closeUDPClientSocket(fd);
+}
+
+void UDPClientSocks::setSuspicious(int fd)
+{
+  auto iter = d_inUse.find(fd);
+  if (iter != d_inUse.end()) {
+    iter->second.d_suspicious = true;
+  }
+}
+
+void UDPClientSocks::cleanup(const struct timeval& now)
+{
+  while (!d_idle.empty() && s_maxIdleTime < now - d_idle.front().d_last_used) {
+    closeUDPClientSocket(d_idle.front().d_fd);
+    d_idle.pop_front();
+  }
+
+  for (const auto family : {AF_INET, AF_INET6}) {
+    auto& bound = getBound(family);
+    pruneBound(bound, now);
+
+    auto& needed = getNeeded(family);
+    const size_t target = std::min(needed, s_poolSize);
+    needed = 0;
+    if (!pdns::isQueryLocalAddressFamilyEnabled(family)) {
+      continue;
+    }
+    try {
+      while (bound.size() < target) {
+        int sock = makeClientSocket(family);
+        if (sock < 0) {
+          break;
+        }
+        bound.push_back(Bound{now, sock});
+      }
+    }
+    catch (const PDNSException& e) {
+      SLOG(g_log << Logger::Error << "Unable to create a UDP socket to keep ready: " << e.reason << endl,
+           g_slog->withName("out")->error(Logr::Error, e.reason, "Unable to create a UDP socket to keep ready", "exception", Logging::Loggable("PDNSException")));
+    }
+  }
+}
@@ -0,0 +1,148 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#pragma once
+
+#include <deque>
+#include <unordered_map>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
+#include <boost/multi_index/sequenced_index.hpp>
+
+#include "iputils.hh"
+#include "lwres.hh"
+
+// you can ask this class for a UDP socket to send a query from
+// this socket is not yours, don't even think about deleting it
+// but after you call 'returnSocket' on it, don't assume anything anymore
+//
+// Sockets are bound to a random port, then connected to the destination. Optionally, to save the setup
+// of a socket for every query, a few bound but not yet connected ones are kept ready for a very short
+// time, and a socket that got a proper answer is kept connected for a while, to be reused for queries to
+// the very same destination only. Both weaken the source port randomization a bit, so they are disabled
+// by default: a port kept ready can be discovered by an attacker before it is used, and a reused socket
+// keeps the same port for several queries.
+class UDPClientSocks
+{
+public:
+  // Max idle time of a connected socket, 0 means sockets are not reused
+  static struct timeval s_maxIdleTime;
+  // Per thread maximum of idle sockets connected to a specific destination, 0 means sockets are not reused
+  static size_t s_maxIdlePerAuth;
+  // Max total number of queries sent over a socket, 0 is no max
+  static size_t s_maxQueries;
+  // Per thread max # of idle connected sockets
+  static size_t s_maxIdlePerThread;
+  // Per thread and address family maximum number of bound sockets kept ready, 0 means sockets are created when needed
+  static size_t s_poolSize;
+  // sockets kept ready are closed, unused, after that time
+  static const struct timeval s_maxBoundAge;
+
+  UDPClientSocks() = default;
+  ~UDPClientSocks();
+  UDPClientSocks(const UDPClientSocks&) = delete;
+  UDPClientSocks& operator=(const UDPClientSocks&) = delete;
+
+  LWResult::Result getSocket(const ComboAddress& toaddr, const struct timeval& now, int* fd);
+
+  // return a socket to the pool, or simply erase it
+  // only a socket that received the answer it was waiting for, and nothing unexpected, can be reused
+  void returnSocket(int fd, const struct timeval& now, bool answered = false);
+
+  // something that was not the expected answer has been received on that socket, never reuse it
+  void setSuspicious(int fd);
+
+  // close the sockets that have been idle or kept ready for too long, and refill the pool of bound ones
+  // with as many sockets as have been needed since the previous call, up to s_poolSize
+  void cleanup(const struct timeval& now);
+
+  size_t getIdleCount() const
+  {
+    return d_idle.size();
+  }
+
+  size_t getBoundCount(int family) const
+  {
+    return family == AF_INET ? d_bound4.size() : d_bound6.size();
+  }
+
+private:
+  // returns -1 for errors which might go away, throws for ones that won't
+  static int makeClientSocket(int family);
+
+  struct InUse
+  {
+    ComboAddress d_remote;
+    size_t d_numqueries{0};
+    bool d_suspicious{false};
+  };
+
+  struct Idle
+  {
+    ComboAddress d_remote;
+    struct timeval d_last_used;
+    size_t d_numqueries;
+    int d_fd;
+  };
+
+  struct Bound
+  {
+    struct timeval d_created;
+    int d_fd;
+  };
+
+  struct RemoteTag
+  {
+  };
+
+  // the least recently used sockets first
+  typedef boost::multi_index::multi_index_container<
+    Idle,
+    boost::multi_index::indexed_by<
+      boost::multi_index::sequenced<>,
+      boost::multi_index::hashed_non_unique<boost::multi_index::tag<RemoteTag>, boost::multi_index::member<Idle, ComboAddress, &Idle::d_remote>, ComboAddress::addressOnlyHash>>>
+    idle_t;
+
+  std::deque<Bound>& getBound(int family)
+  {
+    return family == AF_INET ? d_bound4 : d_bound6;
+  }
+
+  size_t& getNeeded(int family)
+  {
+    return family == AF_INET ? d_needed4 : d_needed6;
+  }
+
+  void pruneBound(std::deque<Bound>& bound, const struct timeval& now);
+
+  std::unordered_map<int, InUse> d_inUse;
+  idle_t d_idle;
+  // the most recently created sockets last
+  std::deque<Bound> d_bound4;
+  std::deque<Bound> d_bound6;
+  // number of sockets that could not be reused since the last cleanup, so that sockets are only kept
+  // ready, for a very short time, in threads that have been sending queries
+  size_t d_needed4{0};
+  size_t d_needed6{0};
+};
@@ -37,6 +37,7 @@
 #include "rec-taskqueue.hh"
 #include "rec-tcpout.hh"
 #include "rec-main.hh"
+#include "rec-cache-snapshot.hh"
 
 std::pair<std::string, std::string> PrefixDashNumberCompare::prefixAndTrailingNum(const std::string& a)
 {
@@ -424,6 +425,28 @@ static RecursorControlChannel::Answer doDumpCache(int s)
   return {0, "dumped " + std::to_string(total) + " records\n"};
 }
 
+// Writes binary data instead of text, for loading at startup via cache-snapshot-file
+static RecursorControlChannel::Answer doDumpCacheSnapshot(int s)
+{
+  auto fdw = getfd(s);
+
+  if (fdw < 0) {
+    return {1, "Error opening snapshot file for writing: " + stringerror() + "\n"};
+  }
+  uint64_t total = 0;
+  try {
+    total = saveCacheSnapshot(fdw, time(nullptr), *g_recCache, *g_negCache, g_aggressiveNSECCache.get());
+  }
+  catch (const std::exception& e) {
+    return {1, "Error saving the cache snapshot: " + string(e.what()) + "\n"};
+  }
+  catch (const PDNSException& e) {
+    return {1, "Error saving the cache snapshot: " + e.reason + "\n"};
+  }
+
+  return {0, "saved " + std::to_string(total) + " cache entries\n"};
+}
+
 // Does not follow the generic dump to file pattern, has an argument
 template <typename T>
 static RecursorControlChannel::Answer doDumpRPZ(int s, T begin, T end)
@@ -2074,6 +2097,7 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
             "clear-nta [DOMAIN]...            Clear the Negative Trust Anchor for DOMAINs, if no DOMAIN is specified, remove all\n"
             "clear-ta [DOMAIN]...             Clear the Trust Anchor for DOMAINs\n"
             "dump-cache <filename>            dump cache contents to the named file\n"
+            "dump-cache-snapshot <filename>   save a binary snapshot of the caches to the named file\n"
             "dump-dot-probe-map <filename>    dump the contents of the DoT probe map to the named file\n"
             "dump-edns [status] <filename>    dump EDNS status to the named file\n"
             "dump-failedservers <filename>    dump the failed servers to the named file\n"
@@ -2150,6 +2174,9 @@ RecursorControlChannel::Answer RecursorControlParser::getAnswer(int s, const str
   if (cmd == "dump-cache") {
     return doDumpCache(s);
   }
+  if (cmd == "dump-cache-snapshot") {
+    return doDumpCacheSnapshot(s);
+  }
   if (cmd == "dump-dot-probe-map") {
     return doDumpToFile(s, pleaseDumpDoTProbeMap, cmd, false);
   }
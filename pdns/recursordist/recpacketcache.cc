@@ -11,6 +11,7 @@
 #include "rec-taskqueue.hh"
 
 unsigned int RecursorPacketCache::s_refresh_ttlperc{0};
+bool RecursorPacketCache::s_secondChanceEviction{false};
 
 int RecursorPacketCache::doWipePacketCache(const DNSName& name, uint16_t qtype, bool subtree)
 {
@@ -78,7 +79,7 @@ bool RecursorPacketCache::checkResponseMatches(std::pair<packetCache_t::index<Ha
       }
 
       d_hits++;
-      moveCacheItemToBack<SequencedTag>(d_packetCache, iter);
+      touchCacheItem<SequencedTag>(d_packetCache, iter, s_secondChanceEviction);
 
       if (pbdata != nullptr) {
         if (iter->d_pbdata) {
@@ -186,7 +187,14 @@ void RecursorPacketCache::insertResponsePacket(unsigned int tag, uint32_t qhash,
 
   if (d_packetCache.size() > d_maxSize) {
     auto& seq_idx = d_packetCache.get<SequencedTag>();
-    seq_idx.erase(seq_idx.begin());
+    auto victim = seq_idx.begin();
+    /* the entry we just inserted is at the back, stop before the other ones
+       could be moved behind it so that it never is the one to go */
+    size_t chances = d_packetCache.size() > 2 ? d_packetCache.size() - 2 : 0;
+    while (chances > 0 && giveSecondChance(seq_idx, victim)) {
+      chances--;
+    }
+    seq_idx.erase(victim);
   }
 }
 
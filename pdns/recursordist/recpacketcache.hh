@@ -32,6 +32,7 @@
 #include <boost/multi_index/key_extractors.hpp>
 #include <boost/optional.hpp>
 
+#include "cachecleaner.hh"
 #include "packetcache.hh"
 #include "validate.hh"
 
@@ -50,6 +51,8 @@ class RecursorPacketCache : public PacketCache
 {
 public:
   static unsigned int s_refresh_ttlperc;
+  // Whether a hit only flags the entry instead of moving it in the LRU index, see ReferencedFlag
+  static bool s_secondChanceEviction;
 
   struct PBData
   {
@@ -116,6 +119,7 @@ private:
     mutable vState d_vstate;
     mutable bool d_submitted{false}; // whether this entry has been queued for refetch
     bool d_tcp; // whether this entry was created from a TCP query
+    mutable ReferencedFlag d_referenced; // used by second chance eviction
     inline bool operator<(const struct Entry& rhs) const;
 
     bool isStale(time_t now) const
@@ -14,6 +14,7 @@
 #include "namespaces.hh"
 #include "cachecleaner.hh"
 #include "rec-taskqueue.hh"
+#include "rec-cache-snapshot.hh"
 
 /*
  * SERVE-STALE: the general approach
@@ -53,9 +54,11 @@
  */
 
 uint16_t MemRecursorCache::s_maxServedStaleExtensions;
+bool MemRecursorCache::s_secondChanceEviction{false};
+bool MemRecursorCache::s_compactStorage{false};
 
-MemRecursorCache::MemRecursorCache(size_t mapsCount) :
-  d_maps(mapsCount == 0 ? 1 : mapsCount)
+MemRecursorCache::MemRecursorCache(size_t mapsCount, bool readOptimized) :
+  d_maps(mapsCount == 0 ? 1 : mapsCount), d_readOptimized(readOptimized)
 {
 }
 
@@ -71,10 +74,9 @@ size_t MemRecursorCache::size() const
 pair<uint64_t, uint64_t> MemRecursorCache::stats()
 {
   uint64_t c = 0, a = 0;
-  for (auto& mc : d_maps) {
-    auto content = mc.lock();
-    c += content->d_contended_count;
-    a += content->d_acquired_count;
+  for (const auto& mc : d_maps) {
+    c += mc.d_contended_count;
+    a += mc.d_acquired_count;
   }
   return pair<uint64_t, uint64_t>(c, a);
 }
@@ -84,29 +86,72 @@ size_t MemRecursorCache::ecsIndexSize()
   // XXX!
   size_t count = 0;
   for (auto& mc : d_maps) {
-    auto content = mc.lock();
+    auto content = mc.read_lock();
     count += content->d_ecsIndex.size();
   }
   return count;
 }
 
-// this function is too slow to poll!
 size_t MemRecursorCache::bytes()
 {
   size_t ret = 0;
   for (auto& mc : d_maps) {
-    auto m = mc.lock();
-    for (const auto& i : m->d_map) {
-      ret += sizeof(struct CacheEntry);
-      ret += i.d_qname.toString().length();
-      for (const auto& record : i.d_records) {
-        ret += sizeof(record); // XXX WRONG we don't know the stored size!
-      }
-    }
+    ret += mc.read_lock()->d_bytes;
   }
   return ret;
 }
 
+/* Parses a record content serialized without name compression. PacketReader refuses to read
+   a name from where the DNS header would be in a real packet, so the content is first copied
+   after a fake DNS header and record header, into a buffer that is reused by this thread. */
+std::shared_ptr<DNSRecordContent> MemRecursorCache::parseContent(const DNSRecord& dr, const char* data, uint16_t len)
+{
+  static thread_local std::string buffer;
+  constexpr size_t headersSize = sizeof(dnsheader) + sizeof(dnsrecordheader);
+  buffer.resize(headersSize + len);
+
+  dnsrecordheader drh{};
+  drh.d_type = htons(dr.d_type);
+  drh.d_class = htons(dr.d_class);
+  drh.d_clen = htons(len);
+  memcpy(&buffer.at(sizeof(dnsheader)), &drh, sizeof(drh));
+  if (len > 0) {
+    memcpy(&buffer.at(headersSize), data, len);
+  }
+
+  PacketReader pr(pdns_string_view(buffer.data(), buffer.size()), sizeof(dnsheader));
+  pr.getDnsrecordheader(drh);
+  return DNSRecordContent::mastermake(dr, pr);
+}
+
+bool MemRecursorCache::canReuseWire(uint16_t qtype)
+{
+  // the types whose names are compressed by toPacket()
+  switch (qtype) {
+  case QType::NS:
+  case QType::PTR:
+  case QType::CNAME:
+  case QType::MB:
+  case QType::MG:
+  case QType::MR:
+  case QType::MINFO:
+  case QType::MX:
+  case QType::SOA:
+    return false;
+  default:
+    return true;
+  }
+}
+
+const std::string* MemRecursorCache::getCachedWire(const std::shared_ptr<DNSRecordContent>& content)
+{
+  const auto* cached = std::get_deleter<CachedWire>(content);
+  if (cached == nullptr) {
+    return nullptr;
+  }
+  return &cached->d_wire;
+}
+
 static void updateDNSSECValidationStateFromCache(boost::optional<vState>& state, const vState stateUpdate)
 {
   // if there was no state it's easy */
@@ -139,55 +184,70 @@ static void updateDNSSECValidationStateFromCache(boost::optional<vState>& state,
   }
 }
 
-time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursorCache::OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
+time_t MemRecursorCache::handleHit(const CacheEntry& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
 {
-  // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
-  time_t ttd = entry->d_ttd;
-  origTTL = entry->d_orig_ttl;
+  // MUTEX SHOULD BE ACQUIRED, AT LEAST IN SHARED MODE
+  time_t ttd = entry.d_ttd;
+  origTTL = entry.d_orig_ttl;
 
-  if (variable && (!entry->d_netmask.empty() || entry->d_rtag)) {
+  if (variable && (!entry.d_netmask.empty() || entry.d_rtag)) {
     *variable = true;
   }
 
   if (res) {
-    res->reserve(res->size() + entry->d_records.size());
-
-    for (const auto& k : entry->d_records) {
+    entry.d_records.visit(entry.d_qname, entry.d_qtype.getCode(), [&](const std::shared_ptr<DNSRecordContent>& k) {
       DNSRecord dr;
       dr.d_name = qname;
-      dr.d_type = entry->d_qtype;
+      dr.d_type = entry.d_qtype;
       dr.d_class = QClass::IN;
       dr.d_content = k;
       // coverity[store_truncates_time_t]
-      dr.d_ttl = static_cast<uint32_t>(entry->d_ttd);
+      dr.d_ttl = static_cast<uint32_t>(entry.d_ttd);
       dr.d_place = DNSResourceRecord::ANSWER;
       res->push_back(std::move(dr));
-    }
+    });
   }
 
   if (signatures) {
-    signatures->insert(signatures->end(), entry->d_signatures.begin(), entry->d_signatures.end());
+    entry.d_signatures.visit(entry.d_qname, QType::RRSIG, [&](const std::shared_ptr<RRSIGRecordContent>& sig) {
+      signatures->push_back(sig);
+    });
   }
 
   if (authorityRecs) {
-    authorityRecs->insert(authorityRecs->end(), entry->d_authorityRecs.begin(), entry->d_authorityRecs.end());
+    authorityRecs->insert(authorityRecs->end(), entry.d_authorityRecs.begin(), entry.d_authorityRecs.end());
   }
 
-  updateDNSSECValidationStateFromCache(state, entry->d_state);
+  updateDNSSECValidationStateFromCache(state, entry.d_state);
 
   if (wasAuth) {
-    *wasAuth = *wasAuth && entry->d_auth;
+    *wasAuth = *wasAuth && entry.d_auth;
   }
 
   if (fromAuthZone) {
-    *fromAuthZone = entry->d_authZone;
+    *fromAuthZone = entry.d_authZone;
   }
 
   if (fromAuthIP) {
-    *fromAuthIP = entry->d_from;
+    *fromAuthIP = entry.d_from;
   }
 
-  moveCacheItemToBack<SequencedTag>(content.d_map, entry);
+  return ttd;
+}
+
+time_t MemRecursorCache::handleHit(MapCombo::LockedContent& content, MemRecursorCache::OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
+{
+  // MUTEX SHOULD BE ACQUIRED (as indicated by the reference to the content which is protected by a lock)
+  // a compact entry that gets hit is likely to be hit again, keep the parsed contents
+  if (entry->d_records.isPacked() || entry->d_signatures.isPacked()) {
+    content.d_bytes -= entry->bytes();
+    entry->d_records.unpack(entry->d_qname, entry->d_qtype.getCode());
+    entry->d_signatures.unpack(entry->d_qname, QType::RRSIG);
+    content.d_bytes += entry->bytes();
+  }
+  time_t ttd = handleHit(*entry, qname, origTTL, res, signatures, authorityRecs, variable, state, wasAuth, fromAuthZone, fromAuthIP);
+
+  touchCacheItem<SequencedTag>(content.d_map, entry, s_secondChanceEviction);
 
   return ttd;
 }
@@ -216,12 +276,18 @@ void MemRecursorCache::updateStaleEntry(time_t now, MemRecursorCache::OrderedTag
   pushRefreshTask(entry->d_qname, entry->d_qtype, entry->d_ttd, entry->d_netmask);
 }
 
+// Whether serving that entry would require updating its serve-stale status
+static bool needsServeStaleBookkeeping(time_t now, bool serveStale, time_t ttd, uint16_t servedStale)
+{
+  return (serveStale || servedStale > 0) && ttd <= now && servedStale < MemRecursorCache::s_maxServedStaleExtensions;
+}
+
 // If we are serving this record stale (or *should*) and the ttd has
 // passed increase ttd to the future and remember that we did. Also
 // push a refresh task.
 void MemRecursorCache::handleServeStaleBookkeeping(time_t now, bool serveStale, MemRecursorCache::OrderedTagIterator_t& entry)
 {
-  if ((serveStale || entry->d_servedStale > 0) && entry->d_ttd <= now && entry->d_servedStale < s_maxServedStaleExtensions) {
+  if (needsServeStaleBookkeeping(now, serveStale, entry->d_ttd, entry->d_servedStale)) {
     updateStaleEntry(now, entry);
   }
 }
@@ -304,26 +370,26 @@ MemRecursorCache::Entries MemRecursorCache::getEntries(MapCombo::LockedContent&
   return map.d_cachecache;
 }
 
-bool MemRecursorCache::entryMatches(MemRecursorCache::OrderedTagIterator_t& entry, const QType qt, bool requireAuth, const ComboAddress& who)
+bool MemRecursorCache::entryMatches(const CacheEntry& entry, const QType qt, bool requireAuth, const ComboAddress& who)
 {
   // This code assumes that if a routing tag is present, it matches
   // MUTEX SHOULD BE ACQUIRED
-  if (requireAuth && !entry->d_auth)
+  if (requireAuth && !entry.d_auth)
     return false;
 
-  bool match = (entry->d_qtype == qt || qt == QType::ANY || (qt == QType::ADDR && (entry->d_qtype == QType::A || entry->d_qtype == QType::AAAA)))
-    && (entry->d_netmask.empty() || entry->d_netmask.match(who));
+  bool match = (entry.d_qtype == qt || qt == QType::ANY || (qt == QType::ADDR && (entry.d_qtype == QType::A || entry.d_qtype == QType::AAAA)))
+    && (entry.d_netmask.empty() || entry.d_netmask.match(who));
   return match;
 }
 
 // Fake a cache miss if more than refreshTTLPerc of the original TTL has passed
-time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh)
+time_t MemRecursorCache::fakeTTD(const CacheEntry& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh)
 {
   time_t ttl = ret - now;
   // If we are checking an entry being served stale in refresh mode,
   // we always consider it stale so a real refresh attempt will be
   // kicked by SyncRes
-  if (refresh && entry->d_servedStale > 0) {
+  if (refresh && entry.d_servedStale > 0) {
     return -1;
   }
   if (ttl > 0 && SyncRes::s_refresh_ttlperc > 0) {
@@ -335,15 +401,103 @@ time_t MemRecursorCache::fakeTTD(MemRecursorCache::OrderedTagIterator_t& entry,
         return -1;
       }
       else {
-        if (!entry->d_submitted) {
-          pushRefreshTask(qname, qtype, entry->d_ttd, entry->d_netmask);
-          entry->d_submitted = true;
+        if (!entry.d_submitted) {
+          pushRefreshTask(qname, qtype, entry.d_ttd, entry.d_netmask);
+          entry.d_submitted = true;
         }
       }
     }
   }
   return ttl;
 }
+
+// Whether fakeTTD() would push a refresh task for that entry
+static bool needsRefreshTask(const DNSName& qname, time_t ttd, uint32_t origTTL, bool submitted, time_t now, bool refresh)
+{
+  if (refresh || submitted || SyncRes::s_refresh_ttlperc == 0) {
+    return false;
+  }
+  const time_t ttl = ttd - now;
+  if (ttl <= 0) {
+    return false;
+  }
+  const uint32_t deadline = origTTL * SyncRes::s_refresh_ttlperc / 100;
+  // coverity[store_truncates_time_t]
+  return static_cast<uint32_t>(ttl) <= deadline && qname != g_rootdnsname;
+}
+
+// Lookup done while holding only the shared lock of the shard, so that concurrent hits
+// on the same shard do not serialize. Instead of moving the entries to the back of the LRU
+// index, they are flagged as referenced. Returns false, without touching the output
+// parameters, whenever the lookup requires modifying the shard (ECS index, expired
+// entries being served stale, refresh tasks, compact entries to unpack), in which case the
+// regular path should be used.
+bool MemRecursorCache::getWithReadLock(MapCombo& mc, time_t now, const DNSName& qname, const QType qt, Flags flags, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP, time_t& result)
+{
+  bool requireAuth = flags & RequireAuth;
+  bool refresh = flags & Refresh;
+  bool serveStale = flags & ServeStale;
+  const uint16_t qtype = qt.getCode();
+
+  auto map = mc.read_lock();
+  if (qtype != QType::ANY && !map->d_ecsIndex.empty()) {
+    return false;
+  }
+
+  const OptTag noTag = boost::none;
+  const auto& idx = map->d_map.get<NameAndRTagOnlyHashedTag>();
+  const auto entries = idx.equal_range(std::tie(qname, noTag));
+
+  /* first pass, check that we can serve this without modifying anything. Unlike
+     the regular path we do not move expired entries to the front of the expunge
+     queue, they will be removed when pruning anyway */
+  const CacheEntry* last = nullptr;
+  for (auto i = entries.first; i != entries.second; ++i) {
+    if (!i->isEntryUsable(now, serveStale) || !entryMatches(*i, qtype, requireAuth, who)) {
+      continue;
+    }
+    if (needsServeStaleBookkeeping(now, serveStale, i->d_ttd, i->d_servedStale)) {
+      return false;
+    }
+    if (i->d_records.isPacked() || i->d_signatures.isPacked()) {
+      // first hit on a compact entry, it has to be unpacked
+      return false;
+    }
+    last = &*i;
+    if (qt != QType::ANY && qt != QType::ADDR) { // normally if we have a hit, we are done
+      break;
+    }
+  }
+
+  if (last == nullptr) {
+    result = -1;
+    return true;
+  }
+
+  if (needsRefreshTask(qname, last->d_ttd, last->d_orig_ttl, last->d_submitted, now, refresh)) {
+    return false;
+  }
+
+  boost::optional<vState> cachedState{boost::none};
+  uint32_t origTTL = 0;
+  time_t ttd = 0;
+  for (auto i = entries.first; i != entries.second; ++i) {
+    if (!i->isEntryUsable(now, serveStale) || !entryMatches(*i, qtype, requireAuth, who)) {
+      continue;
+    }
+    ttd = handleHit(*i, qname, origTTL, res, signatures, authorityRecs, variable, cachedState, wasAuth, fromAuthZone, fromAuthIP);
+    i->d_referenced.set();
+    if (&*i == last) {
+      break;
+    }
+  }
+
+  if (state && cachedState) {
+    *state = *cachedState;
+  }
+  result = fakeTTD(*last, qname, qtype, ttd, now, origTTL, refresh);
+  return true;
+}
 // returns -1 for no hits
 time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, Flags flags, vector<DNSRecord>* res, const ComboAddress& who, const OptTag& routingTag, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP)
 {
@@ -365,6 +519,13 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
   }
 
   auto& mc = getMap(qname);
+  if (d_readOptimized && !routingTag) {
+    time_t ret = -1;
+    if (getWithReadLock(mc, now, qname, qt, flags, res, who, signatures, authorityRecs, variable, state, wasAuth, fromAuthZone, fromAuthIP, ret)) {
+      return ret;
+    }
+  }
+
   auto map = mc.lock();
 
   /* If we don't have any netmask-specific entries at all, let's just skip this
@@ -401,7 +562,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
         if (state && cachedState) {
           *state = *cachedState;
         }
-        return fakeTTD(entry, qname, qtype, ret, now, origTTL, refresh);
+        return fakeTTD(*entry, qname, qtype, ret, now, origTTL, refresh);
       }
       return -1;
     }
@@ -423,7 +584,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
           continue;
         }
 
-        if (!entryMatches(firstIndexIterator, qtype, requireAuth, who)) {
+        if (!entryMatches(*firstIndexIterator, qtype, requireAuth, who)) {
           continue;
         }
         found = true;
@@ -440,7 +601,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
         if (state && cachedState) {
           *state = *cachedState;
         }
-        return fakeTTD(firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
+        return fakeTTD(*firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
       }
       else {
         return -1;
@@ -464,7 +625,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
         continue;
       }
 
-      if (!entryMatches(firstIndexIterator, qtype, requireAuth, who)) {
+      if (!entryMatches(*firstIndexIterator, qtype, requireAuth, who)) {
         continue;
       }
       found = true;
@@ -481,7 +642,7 @@ time_t MemRecursorCache::get(time_t now, const DNSName& qname, const QType qt, F
       if (state && cachedState) {
         *state = *cachedState;
       }
-      return fakeTTD(firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
+      return fakeTTD(*firstIndexIterator, qname, qtype, ttd, now, origTTL, refresh);
     }
   }
   return -1;
@@ -548,6 +709,7 @@ void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt,
   if (stored == map->d_map.end()) {
     stored = map->d_map.insert(CacheEntry(key, auth)).first;
     ++mc.d_entriesCount;
+    map->d_bytes += stored->bytes();
     isNew = true;
   }
 
@@ -590,10 +752,15 @@ void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt,
     ce.d_auth = true;
   }
 
-  ce.d_signatures = signatures;
+  size_t signaturesWireSize = 0;
+  for (const auto& signature : signatures) {
+    // the fixed part of the RRSIG content, then the signer and the signature
+    signaturesWireSize += 18 + signature->d_signer.wirelength() + signature->d_signature.size();
+  }
+  ce.d_signatures.set(qname, signatures, s_compactStorage, signaturesWireSize);
   ce.d_authorityRecs = authorityRecs;
-  ce.d_records.clear();
-  ce.d_records.reserve(content.size());
+  CacheEntry::records_t records;
+  records.reserve(content.size());
   ce.d_authZone = authZone;
   if (from) {
     ce.d_from = *from;
@@ -602,19 +769,24 @@ void MemRecursorCache::replace(time_t now, const DNSName& qname, const QType qt,
     ce.d_from = ComboAddress();
   }
 
+  size_t recordsWireSize = 0;
   for (const auto& i : content) {
     /* Yes, we have altered the d_ttl value by adding time(nullptr) to it
        prior to calling this function, so the TTL actually holds a TTD. */
     ce.d_ttd = min(maxTTD, static_cast<time_t>(i.d_ttl)); // XXX this does weird things if TTLs differ in the set
     ce.d_orig_ttl = ce.d_ttd - now;
-    ce.d_records.push_back(i.d_content);
+    records.push_back(i.d_content);
+    recordsWireSize += i.d_clen;
   }
+  ce.d_records.set(qname, records, s_compactStorage, recordsWireSize);
 
   if (!isNew) {
     moveCacheItemToBack<SequencedTag>(map->d_map, stored);
   }
   ce.d_submitted = false;
   ce.d_servedStale = 0;
+  map->d_bytes -= stored->bytes();
+  map->d_bytes += ce.bytes();
   map->d_map.replace(stored, ce);
 }
 
@@ -631,6 +803,7 @@ size_t MemRecursorCache::doWipeCache(const DNSName& name, bool sub, const QType
     auto i = range.first;
     while (i != range.second) {
       if (i->d_qtype == qtype || qtype == 0xffff) {
+        map->d_bytes -= i->bytes();
         i = idx.erase(i);
         count++;
         --mc.d_entriesCount;
@@ -661,6 +834,7 @@ size_t MemRecursorCache::doWipeCache(const DNSName& name, bool sub, const QType
           break;
         if (i->d_qtype == qtype || qtype == 0xffff) {
           count++;
+          map->d_bytes -= i->bytes();
           i = idx.erase(i);
           --mc.d_entriesCount;
         }
@@ -745,7 +919,7 @@ bool MemRecursorCache::updateValidationStatus(time_t now, const DNSName& qname,
   for (auto i = entries.first; i != entries.second; ++i) {
     auto firstIndexIterator = map->d_map.project<OrderedTag>(i);
 
-    if (!entryMatches(firstIndexIterator, qtype, requireAuth, who)) {
+    if (!entryMatches(*firstIndexIterator, qtype, requireAuth, who)) {
       continue;
     }
 
@@ -779,7 +953,7 @@ uint64_t MemRecursorCache::doDump(int fd, size_t maxCacheEntries)
   size_t min = std::numeric_limits<size_t>::max();
   size_t max = 0;
   for (auto& mc : d_maps) {
-    auto map = mc.lock();
+    auto map = mc.read_lock();
     const auto shardSize = map->d_map.size();
     fprintf(fp.get(), "; record cache shard %zu; size %zu\n", shard, shardSize);
     min = std::min(min, shardSize);
@@ -788,23 +962,29 @@ uint64_t MemRecursorCache::doDump(int fd, size_t maxCacheEntries)
     const auto& sidx = map->d_map.get<SequencedTag>();
     time_t now = time(nullptr);
     for (const auto& i : sidx) {
-      for (const auto& j : i.d_records) {
-        count++;
-        try {
-          fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN %s %s ; (%s) auth=%i zone=%s from=%s nm=%s rtag=%s ss=%hd\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), i.d_qtype.toString().c_str(), j->getZoneRepresentation().c_str(), vStateToString(i.d_state).c_str(), i.d_auth, i.d_authZone.toLogString().c_str(), i.d_from.toString().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str(), !i.d_rtag ? "" : i.d_rtag.get().c_str(), i.d_servedStale);
-        }
-        catch (...) {
-          fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
-        }
+      try {
+        i.d_records.visit(i.d_qname, i.d_qtype.getCode(), [&](const std::shared_ptr<DNSRecordContent>& j) {
+          count++;
+          try {
+            fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN %s %s ; (%s) auth=%i zone=%s from=%s nm=%s rtag=%s ss=%hd\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), i.d_qtype.toString().c_str(), j->getZoneRepresentation().c_str(), vStateToString(i.d_state).c_str(), i.d_auth, i.d_authZone.toLogString().c_str(), i.d_from.toString().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str(), !i.d_rtag ? "" : i.d_rtag.get().c_str(), i.d_servedStale);
+          }
+          catch (...) {
+            fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
+          }
+        });
+        i.d_signatures.visit(i.d_qname, QType::RRSIG, [&](const std::shared_ptr<RRSIGRecordContent>& sig) {
+          count++;
+          try {
+            fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN RRSIG %s ; %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), sig->getZoneRepresentation().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str());
+          }
+          catch (...) {
+            fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
+          }
+        });
       }
-      for (const auto& sig : i.d_signatures) {
-        count++;
-        try {
-          fprintf(fp.get(), "%s %" PRIu32 " %" PRId64 " IN RRSIG %s ; %s\n", i.d_qname.toString().c_str(), i.d_orig_ttl, static_cast<int64_t>(i.d_ttd - now), sig->getZoneRepresentation().c_str(), i.d_netmask.empty() ? "" : i.d_netmask.toString().c_str());
-        }
-        catch (...) {
-          fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
-        }
+      catch (...) {
+        /* parsing the contents of a compact entry failed */
+        fprintf(fp.get(), "; error printing '%s'\n", i.d_qname.empty() ? "EMPTY" : i.d_qname.toString().c_str());
       }
     }
   }
@@ -812,6 +992,109 @@ uint64_t MemRecursorCache::doDump(int fd, size_t maxCacheEntries)
   return count;
 }
 
+size_t MemRecursorCache::saveSnapshot(CacheSnapshotWriter& writer, time_t now)
+{
+  size_t count = 0;
+  for (auto& mc : d_maps) {
+    auto map = mc.read_lock();
+    for (const auto& entry : map->d_map) {
+      if (entry.d_ttd <= now) {
+        continue;
+      }
+      writer.write8(1);
+      writer.writeName(entry.d_qname);
+      writer.write16(entry.d_qtype.getCode());
+      writer.write64(static_cast<uint64_t>(entry.d_ttd));
+      writer.write32(entry.d_orig_ttl);
+      writer.write8(static_cast<uint8_t>(entry.d_state));
+      writer.write8(entry.d_auth ? 1 : 0);
+      writer.writeName(entry.d_authZone);
+      writer.writeAddress(entry.d_from);
+      writer.writeNetmask(entry.d_netmask);
+      writer.write8(entry.d_rtag ? 1 : 0);
+      if (entry.d_rtag) {
+        writer.writeBlob(*entry.d_rtag);
+      }
+      writer.writeBlob(entry.d_records.getPacked(entry.d_qname));
+      writer.writeBlob(entry.d_signatures.getPacked(entry.d_qname));
+      writer.write16(entry.d_authorityRecs.size());
+      for (const auto& record : entry.d_authorityRecs) {
+        writer.writeRecord(*record);
+      }
+      count++;
+    }
+  }
+  writer.write8(0);
+  return count;
+}
+
+size_t MemRecursorCache::loadSnapshot(CacheSnapshotReader& reader, time_t now, size_t maxEntries)
+{
+  size_t count = 0;
+  /* the remaining entries still have to be read once the cache is full, to get to the next section */
+  size_t cacheSize = size();
+  while (reader.get8() != 0) {
+    auto qname = reader.getName();
+    const QType qtype(reader.get16());
+    const auto ttd = static_cast<time_t>(reader.get64());
+    const auto origTTL = reader.get32();
+    const auto state = static_cast<vState>(reader.get8());
+    const bool auth = reader.get8() != 0;
+    auto authZone = reader.getName();
+    const auto from = reader.getAddress();
+    const auto netmask = reader.getNetmask();
+    OptTag rtag;
+    if (reader.get8() != 0) {
+      rtag = reader.getBlob();
+    }
+    auto records = reader.getBlob();
+    auto signatures = reader.getBlob();
+    std::vector<std::shared_ptr<DNSRecord>> authorityRecs;
+    const auto authorityRecsCount = reader.get16();
+    authorityRecs.reserve(authorityRecsCount);
+    for (uint16_t idx = 0; idx < authorityRecsCount; idx++) {
+      authorityRecs.push_back(std::make_shared<DNSRecord>(reader.getRecord()));
+    }
+
+    if (ttd <= now || cacheSize >= maxEntries) {
+      continue;
+    }
+
+    /* we are not going through replace() since we know exactly what to store,
+       and the entries are not supposed to be there already */
+    CacheEntry entry(std::make_tuple(qname, qtype, rtag, netmask), auth);
+    entry.d_records.setPacked(qname, qtype.getCode(), std::move(records), s_compactStorage);
+    entry.d_signatures.setPacked(qname, QType::RRSIG, std::move(signatures), s_compactStorage);
+    entry.d_authorityRecs = std::move(authorityRecs);
+    entry.d_authZone = std::move(authZone);
+    entry.d_from = from;
+    entry.d_state = state;
+    entry.d_ttd = ttd;
+    entry.d_orig_ttl = origTTL;
+
+    auto& mc = getMap(qname);
+    auto map = mc.lock();
+    auto inserted = map->d_map.insert(std::move(entry));
+    if (!inserted.second) {
+      continue;
+    }
+    ++mc.d_entriesCount;
+    map->d_bytes += inserted.first->bytes();
+    map->d_cachecachevalid = false;
+    if (!rtag && !netmask.empty()) {
+      auto ecsIndexKey = std::make_tuple(qname, qtype);
+      auto ecsIndex = map->d_ecsIndex.find(ecsIndexKey);
+      if (ecsIndex == map->d_ecsIndex.end()) {
+        ecsIndex = map->d_ecsIndex.insert(ECSIndexEntry(qname, qtype)).first;
+      }
+      ecsIndex->addMask(netmask);
+    }
+    count++;
+    cacheSize++;
+  }
+  return count;
+}
+
 void MemRecursorCache::doPrune(size_t keep)
 {
   size_t cacheSize = size();
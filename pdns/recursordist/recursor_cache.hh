@@ -21,7 +21,9 @@
  */
 #pragma once
 #include <string>
+#include <atomic>
 #include <set>
+#include <variant>
 #include "dns.hh"
 #include "qtype.hh"
 #include "misc.hh"
@@ -35,6 +37,7 @@
 #include <boost/multi_index/key_extractors.hpp>
 #include <boost/multi_index/sequenced_index.hpp>
 #include <boost/version.hpp>
+#include "cachecleaner.hh"
 #include "iputils.hh"
 #include "lock.hh"
 #include "stat_t.hh"
@@ -44,15 +47,22 @@
 #include "namespaces.hh"
 using namespace ::boost::multi_index;
 
+class CacheSnapshotReader;
+class CacheSnapshotWriter;
+
 class MemRecursorCache : public boost::noncopyable //  : public RecursorCache
 {
 public:
-  MemRecursorCache(size_t mapsCount = 1024);
+  MemRecursorCache(size_t mapsCount = 1024, bool readOptimized = false);
 
   // The number of times a stale cache entry is extended
   static uint16_t s_maxServedStaleExtensions;
   // The time a stale cache entry is extended
   static constexpr uint32_t s_serveStaleExtensionPeriod = 30;
+  // Whether a hit only flags the entry instead of moving it in the LRU index, see ReferencedFlag
+  static bool s_secondChanceEviction;
+  // Whether newly stored records and signatures are kept in wire format, see RecordContents
+  static bool s_compactStorage;
 
   size_t size() const;
   size_t bytes();
@@ -73,6 +83,8 @@ public:
 
   void doPrune(size_t keep);
   uint64_t doDump(int fd, size_t maxCacheEntries);
+  size_t saveSnapshot(CacheSnapshotWriter& writer, time_t now);
+  size_t loadSnapshot(CacheSnapshotReader& reader, time_t now, size_t maxEntries);
 
   size_t doWipeCache(const DNSName& name, bool sub, QType qtype = 0xffff);
   bool doAgeCache(time_t now, const DNSName& name, QType qtype, uint32_t newTTL);
@@ -80,7 +92,163 @@ public:
 
   pdns::stat_t cacheHits{0}, cacheMisses{0};
 
+  // Parses a record content serialized without name compression
+  static std::shared_ptr<DNSRecordContent> parseContent(const DNSRecord& dr, const char* data, uint16_t len);
+
+  /* The wire format of a record content that was parsed from the compact form of an entry, if it
+     can be appended as-is to a response instead of calling toPacket(), nullptr otherwise */
+  static const std::string* getCachedWire(const std::shared_ptr<DNSRecordContent>& content);
+
 private:
+  /* Set as the deleter of the contents parsed from the compact form, so that their wire format
+     travels with them, see getCachedWire(). The deleter does nothing, the parsed content is
+     owned by d_content and released with the control block. */
+  struct CachedWire
+  {
+    void operator()(DNSRecordContent* /* content */) const
+    {
+    }
+
+    std::string d_wire;
+    std::shared_ptr<DNSRecordContent> d_content;
+  };
+
+  // whether the wire format of contents of this type, without name compression, is what toPacket() would write
+  static bool canReuseWire(uint16_t qtype);
+
+  /* The contents of the records of an RRset, or of its signatures. They are either kept as
+     shared pointers to the parsed contents or, in compact storage mode, serialized back to
+     back in a single string, each one preceded by its length on two bytes. The compact form
+     needs a single allocation at most (none for a small RRset), but the contents have to be
+     parsed before they can be used. Entries are therefore only kept compact until their first
+     hit, see unpack(): most entries of a large cache are never hit, while the hot ones would
+     otherwise be parsed over and over.
+     Names are not compressed in the serialized form, so that the contents can be parsed on
+     their own instead of being wrapped into a fake packet, see parseContent(). For the types
+     that do not compress names in responses anyway, the parsed contents keep their serialized
+     form so that it can be copied into responses, see getCachedWire(). */
+  template <typename T>
+  class RecordContents
+  {
+  public:
+    /* wireSize is the size of the contents in wire format, if known, only used to estimate
+       the memory used by the parsed contents */
+    void set(const DNSName& qname, const std::vector<std::shared_ptr<T>>& contents, bool compact, size_t wireSize)
+    {
+      if (!compact) {
+        d_storage = contents;
+        d_wireSize = wireSize;
+        return;
+      }
+
+      auto packed = pack(qname, contents);
+      d_wireSize = packed.size();
+      d_storage = std::move(packed);
+    }
+
+    /* the contents in the compact form, whatever the storage mode */
+    std::string getPacked(const DNSName& qname) const
+    {
+      if (const auto* contents = std::get_if<std::vector<std::shared_ptr<T>>>(&d_storage)) {
+        return pack(qname, *contents);
+      }
+      return std::get<std::string>(d_storage);
+    }
+
+    void setPacked(const DNSName& qname, uint16_t qtype, std::string&& packed, bool compact)
+    {
+      d_wireSize = packed.size();
+      d_storage = std::move(packed);
+      if (!compact) {
+        unpack(qname, qtype);
+      }
+    }
+
+    bool isPacked() const
+    {
+      return std::holds_alternative<std::string>(d_storage);
+    }
+
+    /* switch to the parsed form, qname and qtype have to be the ones of the records */
+    void unpack(const DNSName& qname, uint16_t qtype)
+    {
+      if (!isPacked()) {
+        return;
+      }
+      std::vector<std::shared_ptr<T>> contents;
+      visit(qname, qtype, [&contents](const std::shared_ptr<T>& content) {
+        contents.push_back(content);
+      });
+      d_storage = std::move(contents);
+    }
+
+    /* calls func(const std::shared_ptr<T>&) for every content, qname and qtype
+       have to be the ones of the records the contents belong to */
+    template <typename F>
+    void visit(const DNSName& qname, uint16_t qtype, F func) const
+    {
+      if (const auto* contents = std::get_if<std::vector<std::shared_ptr<T>>>(&d_storage)) {
+        for (const auto& content : *contents) {
+          func(content);
+        }
+        return;
+      }
+
+      const auto& packed = std::get<std::string>(d_storage);
+      DNSRecord dr;
+      dr.d_name = qname;
+      dr.d_type = qtype;
+      dr.d_class = QClass::IN;
+      const bool reuseWire = canReuseWire(qtype);
+      size_t pos = 0;
+      while (pos + 2 <= packed.size()) {
+        const uint16_t len = (static_cast<uint8_t>(packed[pos]) << 8) | static_cast<uint8_t>(packed[pos + 1]);
+        pos += 2;
+        if (pos + len > packed.size()) {
+          throw std::out_of_range("Truncated record content in the record cache");
+        }
+        dr.d_clen = len;
+        auto content = std::dynamic_pointer_cast<T>(parseContent(dr, packed.data() + pos, len));
+        if (content && reuseWire) {
+          auto* parsed = content.get();
+          content = std::shared_ptr<T>(parsed, CachedWire{packed.substr(pos, len), std::move(content)});
+        }
+        pos += len;
+        if (content) {
+          func(content);
+        }
+      }
+    }
+
+    /* the size of the parsed contents is estimated from their size in wire format,
+       which is cheap enough to be done every time an entry is stored, hit or removed */
+    size_t bytes() const
+    {
+      /* sizes instead of capacities, which are not preserved when an entry is copied */
+      if (const auto* contents = std::get_if<std::vector<std::shared_ptr<T>>>(&d_storage)) {
+        return (contents->size() * (sizeof(std::shared_ptr<T>) + sizeof(T))) + d_wireSize;
+      }
+      return std::get<std::string>(d_storage).size();
+    }
+
+  private:
+    static std::string pack(const DNSName& qname, const std::vector<std::shared_ptr<T>>& contents)
+    {
+      std::string packed;
+      for (const auto& content : contents) {
+        const auto serialized = content->serialize(qname, true);
+        packed.push_back(static_cast<char>(serialized.size() >> 8));
+        packed.push_back(static_cast<char>(serialized.size() & 0xff));
+        packed.append(serialized);
+      }
+      packed.shrink_to_fit();
+      return packed;
+    }
+
+    std::variant<std::vector<std::shared_ptr<T>>, std::string> d_storage;
+    uint32_t d_wireSize{0};
+  };
+
   struct CacheEntry
   {
     CacheEntry(const std::tuple<DNSName, QType, OptTag, Netmask>& key, bool auth) :
@@ -109,8 +277,16 @@ private:
 
     bool shouldReplace(time_t now, bool auth, vState state, bool refresh);
 
-    records_t d_records;
-    std::vector<std::shared_ptr<RRSIGRecordContent>> d_signatures;
+    // accounted for in the d_bytes of the shard, so it should not change while the entry is
+    // in there, except via the functions that update d_bytes (replace(), handleHit())
+    size_t bytes() const
+    {
+      return sizeof(CacheEntry) + d_qname.getStorage().size() + d_records.bytes() + d_signatures.bytes();
+    }
+
+    // unpacked on the first hit, which does not change the lookup keys
+    mutable RecordContents<DNSRecordContent> d_records;
+    mutable RecordContents<RRSIGRecordContent> d_signatures;
     std::vector<std::shared_ptr<DNSRecord>> d_authorityRecs;
     DNSName d_qname;
     DNSName d_authZone;
@@ -124,6 +300,8 @@ private:
     QType d_qtype;
     bool d_auth;
     mutable bool d_submitted; // whether this entry has been queued for refetch
+    // set on a hit found while holding only the shared lock, or in second chance eviction mode
+    mutable ReferencedFlag d_referenced;
   };
 
   /* The ECS Index (d_ecsIndex) keeps track of whether there is any ECS-specific
@@ -239,8 +417,8 @@ private:
       DNSName d_cachedqname;
       OptTag d_cachedrtag;
       Entries d_cachecache;
-      uint64_t d_contended_count{0};
-      uint64_t d_acquired_count{0};
+      // estimated memory used by the entries, see CacheEntry::bytes()
+      size_t d_bytes{0};
       bool d_cachecachevalid{false};
 
       void invalidate()
@@ -250,41 +428,59 @@ private:
     };
 
     pdns::stat_t d_entriesCount{0};
+    pdns::stat_t d_contended_count{0};
+    pdns::stat_t d_acquired_count{0};
+
+    SharedLockGuardedTryHolder<LockedContent> lock()
+    {
+      auto locked = d_content.try_write_lock();
+      if (!locked.owns_lock()) {
+        locked.lock();
+        ++d_contended_count;
+      }
+      ++d_acquired_count;
+      return locked;
+    }
 
-    LockGuardedTryHolder<LockedContent> lock()
+    SharedLockGuardedNonExclusiveTryHolder<LockedContent> read_lock()
     {
-      auto locked = d_content.try_lock();
+      auto locked = d_content.try_read_lock();
       if (!locked.owns_lock()) {
         locked.lock();
-        ++locked->d_contended_count;
+        ++d_contended_count;
       }
-      ++locked->d_acquired_count;
+      ++d_acquired_count;
       return locked;
     }
 
   private:
-    LockGuarded<LockedContent> d_content;
+    SharedLockGuarded<LockedContent> d_content;
   };
 
   vector<MapCombo> d_maps;
+  // whether get() first tries to serve the entry while holding only the shared lock of the shard
+  const bool d_readOptimized;
   MapCombo& getMap(const DNSName& qname)
   {
     return d_maps.at(qname.hash() % d_maps.size());
   }
 
-  static time_t fakeTTD(OrderedTagIterator_t& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh);
+  static time_t fakeTTD(const CacheEntry& entry, const DNSName& qname, QType qtype, time_t ret, time_t now, uint32_t origTTL, bool refresh);
 
-  bool entryMatches(OrderedTagIterator_t& entry, QType qt, bool requireAuth, const ComboAddress& who);
+  static bool entryMatches(const CacheEntry& entry, QType qt, bool requireAuth, const ComboAddress& who);
   Entries getEntries(MapCombo::LockedContent& content, const DNSName& qname, const QType qt, const OptTag& rtag);
   cache_t::const_iterator getEntryUsingECSIndex(MapCombo::LockedContent& content, time_t now, const DNSName& qname, QType qtype, bool requireAuth, const ComboAddress& who, bool serveStale);
 
+  static time_t handleHit(const CacheEntry& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* authZone, ComboAddress* fromAuthIP);
   time_t handleHit(MapCombo::LockedContent& content, OrderedTagIterator_t& entry, const DNSName& qname, uint32_t& origTTL, vector<DNSRecord>* res, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, boost::optional<vState>& state, bool* wasAuth, DNSName* authZone, ComboAddress* fromAuthIP);
   void updateStaleEntry(time_t now, OrderedTagIterator_t& entry);
   void handleServeStaleBookkeeping(time_t, bool, OrderedTagIterator_t&);
+  bool getWithReadLock(MapCombo& mc, time_t now, const DNSName& qname, QType qt, Flags flags, vector<DNSRecord>* res, const ComboAddress& who, vector<std::shared_ptr<RRSIGRecordContent>>* signatures, std::vector<std::shared_ptr<DNSRecord>>* authorityRecs, bool* variable, vState* state, bool* wasAuth, DNSName* fromAuthZone, ComboAddress* fromAuthIP, time_t& result);
 
 public:
   void preRemoval(MapCombo::LockedContent& map, const CacheEntry& entry)
   {
+    map.d_bytes -= entry.bytes();
     if (entry.d_netmask.empty()) {
       return;
     }
@@ -775,6 +775,52 @@ struct PacketIDBirthdayCompare
     return a->domain < b->domain;
   }
 };
+
+/*
+ * The hash and equality predicates used to find the MTasker waiter of a PacketID.
+ * They are consistent with the compare predicates above: two PacketIDs are equal
+ * when neither is smaller than the other. The birthday ones only look at the fields
+ * PacketIDBirthdayCompare looks at, to find the outstanding queries for the same
+ * question to the same server, whatever their ID and fd.
+ */
+struct PacketIDBirthdayHash
+{
+  size_t operator()(const std::shared_ptr<PacketID>& pid) const
+  {
+    uint32_t hash = ComboAddress::addressOnlyHash()(pid->remote);
+    hash = burtle(reinterpret_cast<const unsigned char*>(&pid->remote.sin4.sin_port), sizeof(pid->remote.sin4.sin_port), hash);
+    hash = burtle(reinterpret_cast<const unsigned char*>(&pid->tcpsock), sizeof(pid->tcpsock), hash);
+    hash = burtle(reinterpret_cast<const unsigned char*>(&pid->type), sizeof(pid->type), hash);
+    return pid->domain.hash(hash);
+  }
+};
+
+struct PacketIDBirthdayEqual
+{
+  bool operator()(const std::shared_ptr<PacketID>& a, const std::shared_ptr<PacketID>& b) const
+  {
+    return a->remote == b->remote && a->tcpsock == b->tcpsock && a->type == b->type && a->domain == b->domain;
+  }
+};
+
+struct PacketIDHash
+{
+  size_t operator()(const std::shared_ptr<PacketID>& pid) const
+  {
+    uint32_t hash = PacketIDBirthdayHash()(pid);
+    hash = burtle(reinterpret_cast<const unsigned char*>(&pid->fd), sizeof(pid->fd), hash);
+    return burtle(reinterpret_cast<const unsigned char*>(&pid->id), sizeof(pid->id), hash);
+  }
+};
+
+struct PacketIDEqual
+{
+  bool operator()(const std::shared_ptr<PacketID>& a, const std::shared_ptr<PacketID>& b) const
+  {
+    return a->id == b->id && a->fd == b->fd && PacketIDBirthdayEqual()(a, b);
+  }
+};
+
 extern std::unique_ptr<MemRecursorCache> g_recCache;
 
 extern rec::GlobalCounters g_Counters;
@@ -819,6 +865,7 @@ public:
   uint16_t qlen{0};
   uint16_t bytesread{0};
   uint16_t d_requestsInFlight{0}; // number of mthreads spawned for this connection
+  uint64_t d_idleTimer{0}; // handle of the read timeout of this connection in the timer wheel of its thread
   // The max number of concurrent TCP requests we're willing to process
   static uint16_t s_maxInFlight;
   static unsigned int getCurrentConnections() { return s_currentConnections; }
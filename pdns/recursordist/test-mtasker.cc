@@ -40,6 +40,48 @@ BOOST_AUTO_TEST_CASE(test_Simple)
   BOOST_CHECK_EQUAL(g_result, o);
 }
 
+static int g_timeoutResult;
+static struct timeval g_now;
+
+static void waitWithTimeout(void* p)
+{
+  MTasker<>* mt = reinterpret_cast<MTasker<>*>(p);
+  int i = 42, o = 0;
+  g_timeoutResult = mt->waitEvent(i, &o, 100, &g_now);
+}
+
+BOOST_AUTO_TEST_CASE(test_Timeout)
+{
+  MTasker<> mt;
+  g_now.tv_sec = 1000;
+  g_now.tv_usec = 500000;
+  g_timeoutResult = -2;
+  mt.makeThread(waitWithTimeout, &mt);
+  mt.makeThread(waitWithTimeout, &mt);
+  while (mt.schedule(&g_now))
+    ;
+  /* the second thread cannot wait on the same key */
+  BOOST_CHECK_EQUAL(g_timeoutResult, -1);
+  BOOST_CHECK_EQUAL(mt.d_waiters.size(), 1U);
+  g_timeoutResult = -2;
+
+  struct timeval now = g_now;
+  now.tv_usec += 99000;
+  while (mt.schedule(&now))
+    ;
+  BOOST_CHECK_EQUAL(g_timeoutResult, -2);
+  BOOST_CHECK_EQUAL(mt.d_waiters.size(), 1U);
+
+  now.tv_usec += 2000;
+  while (mt.schedule(&now))
+    ;
+  BOOST_CHECK_EQUAL(g_timeoutResult, 0);
+  BOOST_CHECK(mt.d_waiters.empty());
+  while (mt.schedule(&now))
+    ;
+  BOOST_CHECK(mt.noProcesses());
+}
+
 #if defined(HAVE_FIBER_SANITIZER) && defined(__APPLE__) && defined(__arm64__)
 
 // This test is buggy on MacOS when compiled with asan. It also causes subsequents tests to report spurious issues.
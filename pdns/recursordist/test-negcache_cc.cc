@@ -372,6 +372,42 @@ BOOST_AUTO_TEST_CASE(test_prune_valid_entries)
   BOOST_CHECK_EQUAL(got.d_auth, auth);
 }
 
+BOOST_AUTO_TEST_CASE(test_prune_second_chance)
+{
+  DNSName power1("powerdns.com.");
+  DNSName power2("powerdns-1.com.");
+  DNSName auth("com.");
+
+  struct timeval now;
+  Utility::gettimeofday(&now, 0);
+
+  NegCache::s_secondChanceEviction = true;
+  NegCache cache(1);
+
+  /* insert power1 then power2 */
+  cache.add(genNegCacheEntry(power1, auth, now));
+  cache.add(genNegCacheEntry(power2, auth, now));
+  BOOST_CHECK_EQUAL(cache.size(), 2U);
+
+  /* get a hit for power1, which does not move it but flags it */
+  NegCache::NegCacheEntry got;
+  BOOST_REQUIRE(cache.get(power1, QType(1), now, got));
+
+  /* power1 is the oldest one but has been referenced,
+     so it gets a second chance and power2 is removed */
+  cache.prune(1);
+  BOOST_CHECK_EQUAL(cache.size(), 1U);
+  BOOST_CHECK(cache.get(power1, QType(1), now, got));
+  BOOST_CHECK(!cache.get(power2, QType(1), now, got));
+
+  /* power1 has been referenced again, but the flag is cleared
+     when the second chance is given so we can still remove it */
+  cache.prune(0);
+  BOOST_CHECK_EQUAL(cache.size(), 0U);
+
+  NegCache::s_secondChanceEviction = false;
+}
+
 BOOST_AUTO_TEST_CASE(test_wipe_single)
 {
   string qname(".powerdns.com");
@@ -0,0 +1,233 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include <boost/test/unit_test.hpp>
+#include <sys/stat.h>
+
+#include "aggressive_nsec.hh"
+#include "negcache.hh"
+#include "rec-cache-snapshot.hh"
+#include "recursor_cache.hh"
+
+BOOST_AUTO_TEST_SUITE(rec_cache_snapshot)
+
+static constexpr size_t unlimited = std::numeric_limits<size_t>::max();
+
+static std::string saveSnapshot(time_t now, MemRecursorCache& recordCache, NegCache& negCache, AggressiveNSECCache* aggressiveNSECCache, uint64_t expectedCount)
+{
+  char temp[] = "/tmp/rcsXXXXXXXXXX";
+  int fd = mkstemp(temp);
+  BOOST_REQUIRE(fd > 0);
+  BOOST_CHECK_EQUAL(saveCacheSnapshot(fd, now, recordCache, negCache, aggressiveNSECCache), expectedCount);
+  BOOST_REQUIRE(close(fd) == 0);
+  return temp;
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_snapshot)
+{
+  const time_t now = time(nullptr);
+  const time_t ttd = now + 3600;
+  const DNSName authZone("powerdns.com.");
+  const DNSName power("www.powerdns.com.");
+  const DNSName ecs("ecs.powerdns.com.");
+  const DNSName expired("expired.powerdns.com.");
+  const ComboAddress who("192.0.2.128");
+
+  MemRecursorCache recordCache(4);
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+
+  DNSRecord dr;
+  dr.d_name = power;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  records.push_back(dr);
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.2"));
+  records.push_back(dr);
+  signatures.push_back(std::make_shared<RRSIGRecordContent>("A 13 3 3600 20370101000000 20220101000000 24567 powerdns.com. data"));
+  auto authRec = std::make_shared<DNSRecord>(dr);
+  authRec->d_name = DNSName("*.powerdns.com.");
+  authRec->d_type = QType::NSEC;
+  authRec->d_place = DNSResourceRecord::AUTHORITY;
+  authRec->d_content = DNSRecordContent::mastermake(QType::NSEC, QClass::IN, "z.powerdns.com. A RRSIG NSEC");
+  authRecs.push_back(authRec);
+  recordCache.replace(now, power, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none, boost::none, vState::Secure, ComboAddress("2001:db8::53", 53));
+
+  records.clear();
+  signatures.clear();
+  authRecs.clear();
+  dr.d_name = ecs;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.3"));
+  records.push_back(dr);
+  recordCache.replace(now, ecs, QType(QType::A), records, signatures, authRecs, true, authZone, Netmask("192.0.2.0/24"));
+  recordCache.replace(now, ecs, QType(QType::A), records, signatures, authRecs, true, authZone, Netmask("198.51.100.0/24"), std::string("tag"));
+
+  records.clear();
+  dr.d_name = expired;
+  dr.d_ttl = static_cast<uint32_t>(now - 1);
+  records.push_back(dr);
+  recordCache.replace(now - 10, expired, QType(QType::A), records, signatures, authRecs, true, authZone);
+  BOOST_CHECK_EQUAL(recordCache.size(), 4U);
+
+  NegCache negCache(1);
+  NegCache::NegCacheEntry ne;
+  ne.d_name = DNSName("nx.powerdns.com.");
+  ne.d_auth = authZone;
+  ne.d_qtype = QType::ENT;
+  ne.d_ttd = ttd;
+  ne.d_orig_ttl = 3600;
+  ne.d_validationState = vState::Insecure;
+  DNSRecord soa;
+  soa.d_name = authZone;
+  soa.d_type = QType::SOA;
+  soa.d_class = QClass::IN;
+  soa.d_ttl = 3600;
+  soa.d_place = DNSResourceRecord::AUTHORITY;
+  soa.d_content = DNSRecordContent::mastermake(QType::SOA, QClass::IN, "ns1.powerdns.com. hostmaster.powerdns.com. 1 2 3 4 5");
+  ne.authoritySOA.records.push_back(soa);
+  negCache.add(ne);
+
+  AggressiveNSECCache aggressiveNSECCache(100);
+  DNSRecord nsec;
+  nsec.d_name = DNSName("a.powerdns.com.");
+  nsec.d_type = QType::NSEC;
+  nsec.d_ttl = static_cast<uint32_t>(ttd);
+  nsec.d_content = DNSRecordContent::mastermake(QType::NSEC, QClass::IN, "z.powerdns.com. A RRSIG NSEC");
+  auto rrsig = std::make_shared<RRSIGRecordContent>("NSEC 13 3 10 20370101000000 20220101000000 24567 powerdns.com. data");
+  aggressiveNSECCache.insertNSEC(authZone, nsec.d_name, nsec, {rrsig}, false);
+  BOOST_CHECK_EQUAL(aggressiveNSECCache.getEntriesCount(), 1U);
+
+  /* the expired entry is not saved */
+  const auto snapshot = saveSnapshot(now, recordCache, negCache, &aggressiveNSECCache, 5U);
+
+  for (const bool compact : {false, true}) {
+    MemRecursorCache::s_compactStorage = compact;
+    MemRecursorCache loadedRecordCache(2);
+    NegCache loadedNegCache(4);
+    AggressiveNSECCache loadedAggressiveNSECCache(100);
+    BOOST_CHECK_EQUAL(loadCacheSnapshot(snapshot, now, loadedRecordCache, unlimited, loadedNegCache, unlimited, &loadedAggressiveNSECCache), 5U);
+    BOOST_CHECK_EQUAL(loadedRecordCache.size(), 3U);
+    BOOST_CHECK_EQUAL(loadedRecordCache.ecsIndexSize(), 1U);
+    BOOST_CHECK_EQUAL(loadedNegCache.size(), 1U);
+    BOOST_CHECK_EQUAL(loadedAggressiveNSECCache.getEntriesCount(), 1U);
+
+    std::vector<DNSRecord> retrieved;
+    std::vector<std::shared_ptr<RRSIGRecordContent>> retrievedSigs;
+    std::vector<std::shared_ptr<DNSRecord>> retrievedAuthRecs;
+    vState state = vState::Indeterminate;
+    bool wasAuth = false;
+    DNSName fromAuthZone;
+    ComboAddress fromAuthIP;
+    BOOST_CHECK_EQUAL(loadedRecordCache.get(now, power, QType(QType::A), MemRecursorCache::None, &retrieved, who, boost::none, &retrievedSigs, &retrievedAuthRecs, nullptr, &state, &wasAuth, &fromAuthZone, &fromAuthIP), ttd - now);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 2U);
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_content->getZoneRepresentation(), "192.0.2.1");
+    BOOST_CHECK_EQUAL(retrieved.at(1).d_content->getZoneRepresentation(), "192.0.2.2");
+    BOOST_REQUIRE_EQUAL(retrievedSigs.size(), 1U);
+    BOOST_CHECK_EQUAL(retrievedSigs.at(0)->getZoneRepresentation(), "A 13 3 3600 20370101000000 20220101000000 24567 powerdns.com. data");
+    BOOST_REQUIRE_EQUAL(retrievedAuthRecs.size(), 1U);
+    BOOST_CHECK_EQUAL(retrievedAuthRecs.at(0)->d_name, DNSName("*.powerdns.com."));
+    BOOST_CHECK_EQUAL(retrievedAuthRecs.at(0)->d_content->getZoneRepresentation(), "z.powerdns.com. A RRSIG NSEC");
+    BOOST_CHECK(state == vState::Secure);
+    BOOST_CHECK(wasAuth);
+    BOOST_CHECK_EQUAL(fromAuthZone, authZone);
+    BOOST_CHECK_EQUAL(fromAuthIP.toStringWithPort(), "[2001:db8::53]:53");
+
+    /* the ECS-specific entry is only returned for clients in the right subnet */
+    BOOST_CHECK_EQUAL(loadedRecordCache.get(now, ecs, QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+    BOOST_CHECK_EQUAL(loadedRecordCache.get(now, ecs, QType(QType::A), MemRecursorCache::None, &retrieved, ComboAddress("192.0.3.1")), -1);
+    /* and the tagged one for that tag */
+    BOOST_CHECK_EQUAL(loadedRecordCache.get(now, ecs, QType(QType::A), MemRecursorCache::None, &retrieved, ComboAddress("192.0.3.1"), std::string("tag")), ttd - now);
+
+    BOOST_CHECK_EQUAL(loadedRecordCache.get(now, expired, QType(QType::A), MemRecursorCache::None, &retrieved, who), -1);
+
+    NegCache::NegCacheEntry loadedNE;
+    struct timeval tv = {now, 0};
+    BOOST_REQUIRE(loadedNegCache.get(ne.d_name, QType::A, tv, loadedNE));
+    BOOST_CHECK_EQUAL(loadedNE.d_auth, authZone);
+    BOOST_CHECK_EQUAL(loadedNE.d_ttd, ttd);
+    BOOST_CHECK(loadedNE.d_validationState == vState::Insecure);
+    BOOST_REQUIRE_EQUAL(loadedNE.authoritySOA.records.size(), 1U);
+    BOOST_CHECK_EQUAL(loadedNE.authoritySOA.records.at(0).d_content->getZoneRepresentation(), soa.d_content->getZoneRepresentation());
+  }
+  MemRecursorCache::s_compactStorage = false;
+
+  /* the maximum size of the aggressive NSEC cache is enforced, and entries that are not
+     loaded are not counted */
+  {
+    MemRecursorCache loadedRecordCache(2);
+    NegCache loadedNegCache(4);
+    AggressiveNSECCache loadedAggressiveNSECCache(0);
+    BOOST_CHECK_EQUAL(loadCacheSnapshot(snapshot, now, loadedRecordCache, unlimited, loadedNegCache, unlimited, &loadedAggressiveNSECCache), 4U);
+    BOOST_CHECK_EQUAL(loadedAggressiveNSECCache.getEntriesCount(), 0U);
+  }
+
+  /* the maximum sizes of the record cache and of the negative cache are enforced, counting
+     the entries already there, and the following sections are still loaded */
+  {
+    MemRecursorCache loadedRecordCache(2);
+    NegCache loadedNegCache(4);
+    AggressiveNSECCache loadedAggressiveNSECCache(100);
+    BOOST_CHECK_EQUAL(loadCacheSnapshot(snapshot, now, loadedRecordCache, 2, loadedNegCache, 0, &loadedAggressiveNSECCache), 3U);
+    BOOST_CHECK_EQUAL(loadedRecordCache.size(), 2U);
+    BOOST_CHECK_EQUAL(loadedNegCache.size(), 0U);
+    BOOST_CHECK_EQUAL(loadedAggressiveNSECCache.getEntriesCount(), 1U);
+
+    BOOST_CHECK_EQUAL(loadCacheSnapshot(snapshot, now, loadedRecordCache, 2, loadedNegCache, 1, nullptr), 1U);
+    BOOST_CHECK_EQUAL(loadedRecordCache.size(), 2U);
+    BOOST_CHECK_EQUAL(loadedNegCache.size(), 1U);
+  }
+
+  /* entries that expired since the snapshot was saved are skipped */
+  {
+    MemRecursorCache loadedRecordCache(2);
+    NegCache loadedNegCache(4);
+    BOOST_CHECK_EQUAL(loadCacheSnapshot(snapshot, ttd, loadedRecordCache, unlimited, loadedNegCache, unlimited, nullptr), 0U);
+    BOOST_CHECK_EQUAL(loadedRecordCache.size(), 0U);
+    BOOST_CHECK_EQUAL(loadedNegCache.size(), 0U);
+  }
+
+  unlink(snapshot.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(test_cache_snapshot_invalid)
+{
+  const time_t now = time(nullptr);
+  MemRecursorCache recordCache(1);
+  NegCache negCache(1);
+
+  BOOST_CHECK_THROW(loadCacheSnapshot("/this/file/does/not/exist", now, recordCache, unlimited, negCache, unlimited, nullptr), std::runtime_error);
+
+  char temp[] = "/tmp/rcsXXXXXXXXXX";
+  int fd = mkstemp(temp);
+  BOOST_REQUIRE(fd > 0);
+  const std::string garbage("this is not a snapshot");
+  BOOST_REQUIRE(write(fd, garbage.data(), garbage.size()) == static_cast<ssize_t>(garbage.size()));
+  BOOST_REQUIRE(close(fd) == 0);
+  BOOST_CHECK_THROW(loadCacheSnapshot(temp, now, recordCache, unlimited, negCache, unlimited, nullptr), std::runtime_error);
+  unlink(temp);
+
+  /* a truncated snapshot */
+  DNSRecord dr;
+  dr.d_name = DNSName("powerdns.com.");
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_ttl = static_cast<uint32_t>(now + 3600);
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  recordCache.replace(now, dr.d_name, QType(QType::A), {dr}, {}, {}, true, DNSName("."));
+  const auto snapshot = saveSnapshot(now, recordCache, negCache, nullptr, 1U);
+  struct stat st;
+  BOOST_REQUIRE(stat(snapshot.c_str(), &st) == 0);
+  BOOST_REQUIRE(truncate(snapshot.c_str(), st.st_size - 4) == 0);
+  MemRecursorCache loadedRecordCache(1);
+  BOOST_CHECK_THROW(loadCacheSnapshot(snapshot, now, loadedRecordCache, unlimited, negCache, unlimited, nullptr), std::runtime_error);
+  unlink(snapshot.c_str());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
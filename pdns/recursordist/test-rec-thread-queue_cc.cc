@@ -0,0 +1,188 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include <poll.h>
+#include <thread>
+#include <unistd.h>
+
+#include "misc.hh"
+#include "rec-thread-queue.hh"
+
+static bool isReadable(int fd, int timeoutMS = 0)
+{
+  struct pollfd pfd
+  {
+    fd, POLLIN, 0
+  };
+  return poll(&pfd, 1, timeoutMS) == 1 && (pfd.revents & POLLIN) != 0;
+}
+
+BOOST_AUTO_TEST_SUITE(test_rec_thread_queue_cc)
+
+BOOST_AUTO_TEST_CASE(test_push_pop)
+{
+  rec::ThreadQueue<size_t> queue(5);
+  BOOST_CHECK_EQUAL(queue.capacity(), 8U);
+  BOOST_CHECK(queue.pop() == nullptr);
+
+  std::vector<size_t> items(queue.capacity() + 1);
+  for (size_t round = 0; round < 3; round++) {
+    for (size_t idx = 0; idx < queue.capacity(); idx++) {
+      BOOST_CHECK(queue.push(&items.at(idx)));
+    }
+    /* full */
+    BOOST_CHECK(!queue.push(&items.back()));
+
+    for (size_t idx = 0; idx < queue.capacity(); idx++) {
+      BOOST_CHECK(queue.pop() == &items.at(idx));
+    }
+    BOOST_CHECK(queue.pop() == nullptr);
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_notifications)
+{
+  rec::ThreadQueue<size_t> queue(16);
+  size_t item = 0;
+
+  BOOST_CHECK(!isReadable(queue.getDescriptor()));
+  BOOST_CHECK(queue.push(&item));
+  BOOST_CHECK(isReadable(queue.getDescriptor()));
+  BOOST_CHECK(queue.push(&item));
+
+  queue.clearNotification();
+  BOOST_CHECK(!isReadable(queue.getDescriptor()));
+  /* the items pushed before the notification was cleared are still there */
+  BOOST_CHECK(queue.pop() == &item);
+  BOOST_CHECK(queue.pop() == &item);
+  BOOST_CHECK(queue.pop() == nullptr);
+
+  /* the first push after the consumer cleared the notification wakes it up */
+  BOOST_CHECK(queue.push(&item));
+  BOOST_CHECK(isReadable(queue.getDescriptor()));
+  queue.clearNotification();
+  BOOST_CHECK(queue.pop() == &item);
+
+  /* and the consumer can ask to be woken up again */
+  queue.rearm();
+  BOOST_CHECK(isReadable(queue.getDescriptor()));
+}
+
+BOOST_AUTO_TEST_CASE(test_producers)
+{
+  const size_t numberOfProducers = 4;
+  const size_t itemsPerProducer = 100000;
+  rec::ThreadQueue<size_t> queue(64);
+  std::vector<std::vector<size_t>> items(numberOfProducers);
+  for (size_t producer = 0; producer < numberOfProducers; producer++) {
+    items.at(producer).resize(itemsPerProducer, producer);
+  }
+
+  std::vector<std::thread> producers;
+  for (size_t producer = 0; producer < numberOfProducers; producer++) {
+    producers.emplace_back([&queue, &items, producer]() {
+      for (auto& item : items.at(producer)) {
+        while (!queue.push(&item)) {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<size_t> received(numberOfProducers);
+  size_t total = 0;
+  while (total < numberOfProducers * itemsPerProducer) {
+    BOOST_REQUIRE(isReadable(queue.getDescriptor(), 10000));
+    queue.clearNotification();
+    while (const size_t* item = queue.pop()) {
+      received.at(*item)++;
+      total++;
+    }
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  BOOST_CHECK(queue.pop() == nullptr);
+  for (size_t producer = 0; producer < numberOfProducers; producer++) {
+    BOOST_CHECK_EQUAL(received.at(producer), itemsPerProducer);
+  }
+}
+
+#ifdef BENCH_THREADQUEUE
+/* the distributor to worker handoff: one thread passes pointers to another one,
+   which waits for them with poll() like the worker does with its multiplexer */
+BOOST_AUTO_TEST_CASE(test_bench_handoff)
+{
+  const size_t count = 2000000;
+  std::vector<size_t> items(count);
+
+  {
+    int fds[2];
+    BOOST_REQUIRE(pipe(fds) == 0);
+    BOOST_REQUIRE(setNonBlocking(fds[1]));
+    DTime dt;
+    dt.set();
+    std::thread consumer([fds, count]() {
+      size_t received = 0;
+      while (received < count) {
+        if (!isReadable(fds[0], 1000)) {
+          continue;
+        }
+        size_t* item = nullptr;
+        if (read(fds[0], &item, sizeof(item)) == sizeof(item)) {
+          received++;
+        }
+      }
+    });
+    for (auto& item : items) {
+      size_t* ptr = &item;
+      while (write(fds[1], &ptr, sizeof(ptr)) != sizeof(ptr)) {
+        std::this_thread::yield();
+      }
+    }
+    consumer.join();
+    auto elapsed = dt.udiff();
+    cerr << "pipe: " << std::to_string(static_cast<uint64_t>(count * 1000000.0 / elapsed)) << " messages/s" << endl;
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  {
+    rec::ThreadQueue<size_t> queue(8192);
+    DTime dt;
+    dt.set();
+    std::thread consumer([&queue, count]() {
+      size_t received = 0;
+      size_t wakeups = 0;
+      while (received < count) {
+        if (!isReadable(queue.getDescriptor(), 1000)) {
+          continue;
+        }
+        wakeups++;
+        queue.clearNotification();
+        while (queue.pop() != nullptr) {
+          received++;
+        }
+      }
+      cerr << "queue: " << std::to_string(count / wakeups) << " messages per wakeup" << endl;
+    });
+    for (auto& item : items) {
+      while (!queue.push(&item)) {
+        std::this_thread::yield();
+      }
+    }
+    consumer.join();
+    auto elapsed = dt.udiff();
+    cerr << "queue: " << std::to_string(static_cast<uint64_t>(count * 1000000.0 / elapsed)) << " messages/s" << endl;
+  }
+}
+#endif /* BENCH_THREADQUEUE */
+
+BOOST_AUTO_TEST_SUITE_END()
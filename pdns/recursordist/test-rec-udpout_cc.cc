@@ -0,0 +1,197 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "iputils.hh"
+#include "misc.hh"
+#include "query-local-address.hh"
+#include "rec-udpout.hh"
+
+// the real one lives in pdns_recursor.cc and binds to a random port of query-local-address
+int UDPClientSocks::makeClientSocket(int family)
+{
+  int sock = SSocket(family, SOCK_DGRAM, 0);
+  SBind(sock, ComboAddress(family == AF_INET ? "127.0.0.1" : "::1"));
+  setNonBlocking(sock);
+  return sock;
+}
+
+struct UDPClientSocksFixture
+{
+  UDPClientSocksFixture()
+  {
+    UDPClientSocks::s_maxIdleTime = {5, 0};
+    UDPClientSocks::s_maxIdlePerAuth = 4;
+    UDPClientSocks::s_maxQueries = 3;
+    UDPClientSocks::s_maxIdlePerThread = 100;
+    UDPClientSocks::s_poolSize = 0;
+
+    d_server = SSocket(AF_INET, SOCK_DGRAM, 0);
+    SBind(d_server, d_serverAddr);
+    socklen_t addrLen = d_serverAddr.getSocklen();
+    BOOST_REQUIRE_EQUAL(getsockname(d_server, reinterpret_cast<struct sockaddr*>(&d_serverAddr), &addrLen), 0);
+  }
+
+  ~UDPClientSocksFixture()
+  {
+    close(d_server);
+    UDPClientSocks::s_maxIdleTime = {0, 0};
+    UDPClientSocks::s_maxIdlePerAuth = 0;
+    UDPClientSocks::s_maxQueries = 0;
+    UDPClientSocks::s_maxIdlePerThread = 0;
+    UDPClientSocks::s_poolSize = 0;
+  }
+
+  static bool isClosed(int fd)
+  {
+    return fcntl(fd, F_GETFD) == -1 && errno == EBADF;
+  }
+
+  ComboAddress d_serverAddr{"127.0.0.1:0"};
+  struct timeval d_now = {1000, 0};
+  int d_server{-1};
+};
+
+BOOST_FIXTURE_TEST_SUITE(rec_udpout_cc, UDPClientSocksFixture)
+
+BOOST_AUTO_TEST_CASE(test_no_reuse_by_default)
+{
+  UDPClientSocks::s_maxIdleTime = {0, 0};
+  UDPClientSocks socks;
+  int fd = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  socks.returnSocket(fd, d_now, true);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 0U);
+  BOOST_CHECK(isClosed(fd));
+}
+
+BOOST_AUTO_TEST_CASE(test_reuse)
+{
+  UDPClientSocks socks;
+  int first = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &first) == LWResult::Result::Success);
+  socks.returnSocket(first, d_now, true);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 1U);
+
+  /* not for a different destination, even on the same IP */
+  ComboAddress other(d_serverAddr);
+  other.setPort(d_serverAddr.getPort() + 1);
+  int fd = -1;
+  BOOST_REQUIRE(socks.getSocket(other, d_now, &fd) == LWResult::Result::Success);
+  BOOST_CHECK_NE(fd, first);
+  /* and a socket that did not get its answer is not kept */
+  socks.returnSocket(fd, d_now);
+  BOOST_CHECK(isClosed(fd));
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 1U);
+
+  /* but for the same one, until s_maxQueries queries have been sent over it */
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  BOOST_CHECK_EQUAL(fd, first);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 0U);
+  socks.returnSocket(fd, d_now, true);
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  BOOST_CHECK_EQUAL(fd, first);
+  socks.returnSocket(fd, d_now, true);
+  BOOST_CHECK(isClosed(first));
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(test_suspicious)
+{
+  UDPClientSocks socks;
+  int fd = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  socks.setSuspicious(fd);
+  socks.returnSocket(fd, d_now, true);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 0U);
+  BOOST_CHECK(isClosed(fd));
+}
+
+BOOST_AUTO_TEST_CASE(test_drain)
+{
+  UDPClientSocks socks;
+  int fd = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  ComboAddress local("127.0.0.1");
+  socklen_t addrLen = local.getSocklen();
+  BOOST_REQUIRE_EQUAL(getsockname(fd, reinterpret_cast<struct sockaddr*>(&local), &addrLen), 0);
+  socks.returnSocket(fd, d_now, true);
+
+  /* a late answer received while the socket was idle */
+  const std::string late("late answer");
+  BOOST_REQUIRE_EQUAL(sendto(d_server, late.data(), late.size(), 0, reinterpret_cast<const struct sockaddr*>(&local), local.getSocklen()), static_cast<ssize_t>(late.size()));
+
+  int reused = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &reused) == LWResult::Result::Success);
+  BOOST_CHECK_EQUAL(reused, fd);
+  char buffer[64];
+  BOOST_CHECK_EQUAL(recv(reused, buffer, sizeof(buffer), 0), -1);
+  BOOST_CHECK(errno == EAGAIN || errno == EWOULDBLOCK);
+  socks.returnSocket(reused, d_now);
+}
+
+BOOST_AUTO_TEST_CASE(test_cleanup)
+{
+  if (!pdns::isQueryLocalAddressFamilyEnabled(AF_INET)) {
+    pdns::parseQueryLocalAddress("127.0.0.1");
+  }
+  UDPClientSocks::s_poolSize = 4;
+  UDPClientSocks socks;
+
+  /* nothing is kept ready until queries have been sent */
+  socks.cleanup(d_now);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 0U);
+
+  int fd = -1;
+  BOOST_REQUIRE(socks.getSocket(d_serverAddr, d_now, &fd) == LWResult::Result::Success);
+  socks.returnSocket(fd, d_now, true);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 1U);
+
+  /* as many sockets as have been needed since the previous cleanup are kept ready */
+  socks.cleanup(d_now);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 1U);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET6), 0U);
+
+  /* a socket kept ready is used for a new destination */
+  ComboAddress other(d_serverAddr);
+  other.setPort(d_serverAddr.getPort() + 1);
+  int boundFD = -1;
+  BOOST_REQUIRE(socks.getSocket(other, d_now, &boundFD) == LWResult::Result::Success);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 0U);
+  socks.returnSocket(boundFD, d_now);
+
+  /* but no more than s_poolSize */
+  for (size_t idx = 0; idx < 5; idx++) {
+    BOOST_REQUIRE(socks.getSocket(other, d_now, &boundFD) == LWResult::Result::Success);
+    socks.returnSocket(boundFD, d_now);
+  }
+  socks.cleanup(d_now);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 4U);
+
+  /* and not once it has been kept ready for too long */
+  struct timeval later = d_now;
+  later.tv_sec += 1;
+  BOOST_REQUIRE(socks.getSocket(other, later, &boundFD) == LWResult::Result::Success);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 0U);
+  socks.returnSocket(boundFD, later);
+
+  socks.cleanup(later);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 1U);
+
+  /* nothing is refilled after a period without queries, idle sockets are closed after s_maxIdleTime */
+  later.tv_sec += 5;
+  socks.cleanup(later);
+  BOOST_CHECK_EQUAL(socks.getBoundCount(AF_INET), 0U);
+  BOOST_CHECK_EQUAL(socks.getIdleCount(), 0U);
+  BOOST_CHECK(isClosed(fd));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
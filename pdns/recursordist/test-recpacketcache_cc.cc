@@ -382,4 +382,67 @@ BOOST_AUTO_TEST_CASE(test_recPacketCache_TCP)
   BOOST_CHECK_EQUAL(fpacket, r1packet);
 }
 
+BOOST_AUTO_TEST_CASE(test_recPacketCache_SecondChance)
+{
+  RecursorPacketCache::s_secondChanceEviction = true;
+  RecursorPacketCache rpc(2);
+  unsigned int tag = 0;
+  uint32_t ttd = 3600;
+  const time_t now = time(nullptr);
+
+  std::vector<DNSName> names;
+  std::vector<std::string> queries;
+  std::vector<uint32_t> hashes;
+  for (size_t idx = 0; idx < 3; idx++) {
+    names.push_back(DNSName("www" + std::to_string(idx) + ".powerdns.com."));
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, names.back(), QType::A);
+    pw.getHeader()->rd = true;
+    pw.getHeader()->qr = false;
+    pw.getHeader()->id = dns_random_uint16();
+    queries.emplace_back(reinterpret_cast<const char*>(&packet[0]), packet.size());
+    hashes.push_back(RecursorPacketCache::canHashPacket(queries.back()));
+  }
+
+  auto insert = [&](size_t idx) {
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, names.at(idx), QType::A);
+    pw.getHeader()->rd = true;
+    pw.getHeader()->qr = true;
+    pw.startRecord(names.at(idx), QType::A, ttd);
+    ARecordContent ar("127.0.0.1");
+    ar.toPacket(pw);
+    pw.commit();
+    rpc.insertResponsePacket(tag, hashes.at(idx), string(queries.at(idx)), names.at(idx), QType::A, QClass::IN, string(reinterpret_cast<const char*>(&packet[0]), packet.size()), now, ttd, vState::Indeterminate, boost::none, false);
+  };
+  auto lookup = [&](size_t idx) {
+    string fpacket;
+    uint32_t age = 0;
+    uint32_t qhash = 0;
+    return rpc.getResponsePacket(tag, queries.at(idx), names.at(idx), QType::A, QClass::IN, now, &fpacket, &age, &qhash);
+  };
+
+  insert(0);
+  insert(1);
+  BOOST_CHECK_EQUAL(rpc.size(), 2U);
+
+  /* the oldest entry is referenced, so inserting a new one evicts the second one instead */
+  BOOST_CHECK(lookup(0));
+  insert(2);
+  BOOST_CHECK_EQUAL(rpc.size(), 2U);
+  BOOST_CHECK(lookup(0));
+  BOOST_CHECK(!lookup(1));
+  BOOST_CHECK(lookup(2));
+
+  /* both remaining entries have been referenced, the flags are cleared as they get
+     their second chance, and then the one at the front (www2, since www0 has been
+     moved behind it when it got its previous second chance) goes */
+  rpc.doPruneTo(1);
+  BOOST_CHECK_EQUAL(rpc.size(), 1U);
+  BOOST_CHECK(lookup(0));
+  BOOST_CHECK(!lookup(2));
+
+  RecursorPacketCache::s_secondChanceEviction = false;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
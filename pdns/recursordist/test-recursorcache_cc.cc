@@ -5,6 +5,7 @@
 #include "config.h"
 #endif
 #include <boost/test/unit_test.hpp>
+#include <thread>
 
 #include "iputils.hh"
 #include "recursor_cache.hh"
@@ -1227,4 +1228,323 @@ BOOST_AUTO_TEST_CASE(test_RecursorCacheTagged)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_RecursorCache_SecondChance)
+{
+  MemRecursorCache::s_secondChanceEviction = true;
+  MemRecursorCache MRC(1);
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  time_t now = time(nullptr);
+  time_t ttd = now + 30;
+  std::vector<DNSRecord> retrieved;
+  ComboAddress who("192.0.2.1");
+
+  std::vector<DNSName> names;
+  for (size_t idx = 0; idx < 4; idx++) {
+    names.push_back(DNSName("powerdns-" + std::to_string(idx) + ".com."));
+    DNSRecord dr;
+    dr.d_name = names.back();
+    dr.d_type = QType::A;
+    dr.d_class = QClass::IN;
+    dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2." + std::to_string(idx)));
+    dr.d_ttl = static_cast<uint32_t>(ttd);
+    dr.d_place = DNSResourceRecord::ANSWER;
+    records = {dr};
+    MRC.replace(now, names.back(), QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+  }
+  BOOST_CHECK_EQUAL(MRC.size(), 4U);
+
+  /* hits for the two oldest entries */
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(0), QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(1), QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+
+  /* they get a second chance, so the two other ones are removed */
+  MRC.doPrune(2);
+  BOOST_CHECK_EQUAL(MRC.size(), 2U);
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(2), QType(QType::A), MemRecursorCache::None, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(3), QType(QType::A), MemRecursorCache::None, &retrieved, who), -1);
+
+  /* their flag has been cleared, so only the one we get a hit for now is kept */
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(1), QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+  MRC.doPrune(1);
+  BOOST_CHECK_EQUAL(MRC.size(), 1U);
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(0), QType(QType::A), MemRecursorCache::None, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(MRC.get(now, names.at(1), QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+
+  MemRecursorCache::s_secondChanceEviction = false;
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_CompactStorage)
+{
+  MemRecursorCache MRC(1);
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  const DNSName power("powerdns.com.");
+  const DNSName legacy("legacy.powerdns.com.");
+  time_t now = time(nullptr);
+  time_t ttd = now + 30;
+  std::vector<DNSRecord> retrieved;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> retrievedSigs;
+  ComboAddress who("192.0.2.1");
+
+  DNSRecord dr;
+  dr.d_name = legacy;
+  dr.d_type = QType::A;
+  dr.d_class = QClass::IN;
+  dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+  dr.d_ttl = static_cast<uint32_t>(ttd);
+  dr.d_place = DNSResourceRecord::ANSWER;
+  records = {dr};
+  /* stored before enabling the compact mode, still usable after */
+  MRC.replace(now, legacy, QType(QType::A), records, signatures, authRecs, true, authZone, boost::none);
+
+  MemRecursorCache::s_compactStorage = true;
+
+  records.clear();
+  dr.d_name = power;
+  dr.d_type = QType::MX;
+  /* the exchange names can be compressed against the owner name */
+  dr.d_content = DNSRecordContent::mastermake(QType::MX, QClass::IN, "10 mx1.powerdns.com.");
+  records.push_back(dr);
+  dr.d_content = DNSRecordContent::mastermake(QType::MX, QClass::IN, "20 mx2.example.net.");
+  records.push_back(dr);
+  signatures.push_back(std::dynamic_pointer_cast<RRSIGRecordContent>(DNSRecordContent::mastermake(QType::RRSIG, QClass::IN, "MX 13 2 30 20370101000000 20220101000000 42 powerdns.com. c2lnbmF0dXJl")));
+  BOOST_REQUIRE(signatures.back() != nullptr);
+  MRC.replace(now, power, QType(QType::MX), records, signatures, authRecs, true, authZone, boost::none);
+  BOOST_CHECK_EQUAL(MRC.size(), 2U);
+  const auto packedBytes = MRC.bytes();
+
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::MX), MemRecursorCache::None, &retrieved, who, boost::none, &retrievedSigs), ttd - now);
+  /* the parsed contents take more room */
+  BOOST_CHECK_GT(MRC.bytes(), packedBytes);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), records.size());
+  for (size_t idx = 0; idx < records.size(); idx++) {
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_name, power);
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_type, QType::MX);
+    BOOST_CHECK_EQUAL(retrieved.at(idx).d_content->getZoneRepresentation(), records.at(idx).d_content->getZoneRepresentation());
+  }
+  BOOST_REQUIRE_EQUAL(retrievedSigs.size(), 1U);
+  BOOST_CHECK_EQUAL(retrievedSigs.at(0)->getZoneRepresentation(), signatures.at(0)->getZoneRepresentation());
+  /* the exchange names are compressed in responses, so the wire format can't be reused for MX,
+     but it can for the signatures */
+  BOOST_CHECK(MemRecursorCache::getCachedWire(retrieved.at(0).d_content) == nullptr);
+  const auto* sigWire = MemRecursorCache::getCachedWire(retrievedSigs.at(0));
+  BOOST_REQUIRE(sigWire != nullptr);
+  BOOST_CHECK(*sigWire == signatures.at(0)->serialize(power));
+
+  /* the contents have been parsed on the first hit, and are not parsed again */
+  std::vector<DNSRecord> retrievedAgain;
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::MX), MemRecursorCache::None, &retrievedAgain, who), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrievedAgain.size(), retrieved.size());
+  BOOST_CHECK(retrievedAgain.at(0).d_content == retrieved.at(0).d_content);
+
+  /* ANY lookups get the contents of every type */
+  retrieved.clear();
+  BOOST_CHECK_EQUAL(MRC.get(now, power, QType(QType::ANY), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(retrieved.size(), records.size());
+
+  BOOST_CHECK_EQUAL(MRC.get(now, legacy, QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(retrieved.at(0).d_content->getZoneRepresentation(), "192.0.2.1");
+  /* not stored in the compact form */
+  BOOST_CHECK(MemRecursorCache::getCachedWire(retrieved.at(0).d_content) == nullptr);
+
+  /* names at the very beginning of the content, contents read up to the end of the record,
+     and types we don't know about */
+  signatures.clear();
+  const std::vector<std::pair<uint16_t, std::string>> contents = {
+    {QType::CNAME, "www.powerdns.com."},
+    {QType::NS, "ns1.powerdns.com."},
+    {QType::DS, "12345 13 2 0102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f20"},
+    {QType::SOA, "ns1.powerdns.com. hostmaster.powerdns.com. 2022010101 10800 3600 604800 3600"},
+    {65534, "\\# 3 010203"},
+  };
+  for (const auto& [type, zone] : contents) {
+    const DNSName name("type" + std::to_string(type) + ".powerdns.com.");
+    dr.d_name = name;
+    dr.d_type = type;
+    dr.d_content = DNSRecordContent::mastermake(type, QClass::IN, zone);
+    records = {dr};
+    MRC.replace(now, name, QType(type), records, signatures, authRecs, true, authZone, boost::none);
+    BOOST_CHECK_EQUAL(MRC.get(now, name, QType(type), MemRecursorCache::None, &retrieved, who), ttd - now);
+    BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_type, type);
+    BOOST_CHECK_EQUAL(retrieved.at(0).d_content->getZoneRepresentation(), dr.d_content->getZoneRepresentation());
+    /* the wire format is only kept for the types toPacket() does not compress, and it is what toPacket() writes */
+    const auto* wire = MemRecursorCache::getCachedWire(retrieved.at(0).d_content);
+    if (type == QType::CNAME || type == QType::NS || type == QType::SOA) {
+      BOOST_CHECK(wire == nullptr);
+    }
+    else {
+      BOOST_REQUIRE(wire != nullptr);
+      BOOST_CHECK(*wire == dr.d_content->serialize(name));
+    }
+  }
+
+  /* the memory used by the entries is accounted for until they are removed */
+  BOOST_CHECK_GT(MRC.bytes(), 0U);
+  MRC.doPrune(0);
+  BOOST_CHECK_EQUAL(MRC.size(), 0U);
+  BOOST_CHECK_EQUAL(MRC.bytes(), 0U);
+
+  MemRecursorCache::s_compactStorage = false;
+}
+
+BOOST_AUTO_TEST_CASE(test_RecursorCache_ReadOptimized)
+{
+  MemRecursorCache MRC(1, true);
+
+  std::vector<DNSRecord> records;
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  const DNSName authZone(".");
+  time_t now = time(nullptr);
+  DNSName power1("powerdns.com.");
+  DNSName power2("powerdns-1.com.");
+  time_t ttd = now + 30;
+  std::vector<DNSRecord> retrieved;
+  ComboAddress who("192.0.2.1");
+
+  DNSRecord dr1;
+  ComboAddress dr1Content("2001:DB8::1");
+  dr1.d_name = power1;
+  dr1.d_type = QType::AAAA;
+  dr1.d_class = QClass::IN;
+  dr1.d_content = std::make_shared<AAAARecordContent>(dr1Content);
+  dr1.d_ttl = static_cast<uint32_t>(ttd);
+  dr1.d_place = DNSResourceRecord::ANSWER;
+
+  DNSRecord dr2;
+  ComboAddress dr2Content("192.0.2.2");
+  dr2.d_name = power1;
+  dr2.d_type = QType::A;
+  dr2.d_class = QClass::IN;
+  dr2.d_content = std::make_shared<ARecordContent>(dr2Content);
+  dr2.d_ttl = static_cast<uint32_t>(ttd);
+  dr2.d_place = DNSResourceRecord::ANSWER;
+
+  DNSRecord dr3;
+  ComboAddress dr3Content("2001:DB8::3");
+  dr3.d_name = power2;
+  dr3.d_type = QType::AAAA;
+  dr3.d_class = QClass::IN;
+  dr3.d_content = std::make_shared<AAAARecordContent>(dr3Content);
+  dr3.d_ttl = static_cast<uint32_t>(ttd);
+  dr3.d_place = DNSResourceRecord::ANSWER;
+
+  records.push_back(dr1);
+  MRC.replace(now, power1, QType(dr1.d_type), records, signatures, authRecs, true, authZone, boost::none);
+  records.clear();
+  records.push_back(dr2);
+  MRC.replace(now, power1, QType(dr2.d_type), records, signatures, authRecs, true, authZone, boost::none);
+  records.clear();
+  records.push_back(dr3);
+  MRC.replace(now, power2, QType(dr3.d_type), records, signatures, authRecs, true, authZone, boost::none);
+  records.clear();
+  BOOST_CHECK_EQUAL(MRC.size(), 3U);
+
+  /* regular hit */
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::AAAA), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(getRR<AAAARecordContent>(retrieved.at(0))->getCA().toString(), dr1Content.toString());
+
+  /* ADDR and ANY return several entries */
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::ADDR), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(retrieved.size(), 2U);
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::ANY), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(retrieved.size(), 2U);
+
+  /* miss */
+  BOOST_CHECK_EQUAL(MRC.get(now, power2, QType(QType::A), MemRecursorCache::None, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(retrieved.size(), 0U);
+
+  /* expired, and no longer returned */
+  BOOST_CHECK_EQUAL(MRC.get(ttd + 1, power2, QType(QType::AAAA), MemRecursorCache::None, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(retrieved.size(), 0U);
+
+  /* the entries for power1 have been inserted first but were hit via the shared lock,
+     so they should get a second chance and the entry for power2 should be removed first */
+  MRC.doPrune(2);
+  BOOST_CHECK_EQUAL(MRC.size(), 2U);
+  BOOST_CHECK_EQUAL(MRC.get(now, power2, QType(QType::AAAA), MemRecursorCache::None, &retrieved, who), -1);
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::AAAA), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::A), MemRecursorCache::None, &retrieved, who), ttd - now);
+
+  /* the flag is cleared when the second chance is given, so we can still remove everything */
+  MRC.doPrune(0);
+  BOOST_CHECK_EQUAL(MRC.size(), 0U);
+
+  /* ECS-specific entries take the regular path */
+  records.push_back(dr1);
+  MRC.replace(now, power1, QType(dr1.d_type), records, signatures, authRecs, true, authZone, Netmask("192.0.2.0/24"));
+  records.clear();
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::AAAA), MemRecursorCache::None, &retrieved, who), ttd - now);
+  BOOST_REQUIRE_EQUAL(retrieved.size(), 1U);
+  BOOST_CHECK_EQUAL(MRC.get(now, power1, QType(QType::AAAA), MemRecursorCache::None, &retrieved, ComboAddress("198.51.100.1")), -1);
+  BOOST_CHECK_EQUAL(MRC.ecsIndexSize(), 1U);
+
+  auto stats = MRC.stats();
+  BOOST_CHECK_GT(stats.second, 0U);
+}
+
+#ifdef BENCH_RECORDCACHE
+BOOST_AUTO_TEST_CASE(test_RecursorCacheBenchReads)
+{
+  const size_t numberOfEntries = 100000;
+  const size_t rounds = 20;
+  const time_t now = time(nullptr);
+  const DNSName authZone(".");
+  std::vector<std::shared_ptr<RRSIGRecordContent>> signatures;
+  std::vector<std::shared_ptr<DNSRecord>> authRecs;
+  std::vector<DNSName> names;
+  names.reserve(numberOfEntries);
+  for (size_t idx = 0; idx < numberOfEntries; idx++) {
+    names.push_back(DNSName(std::to_string(idx) + ".powerdns.com."));
+  }
+
+  for (const bool readOptimized : {false, true}) {
+    for (const size_t numberOfThreads : {1, 2, 4, 8, 16}) {
+      MemRecursorCache MRC(1024, readOptimized);
+      for (const auto& name : names) {
+        DNSRecord dr;
+        dr.d_name = name;
+        dr.d_type = QType::A;
+        dr.d_class = QClass::IN;
+        dr.d_content = std::make_shared<ARecordContent>(ComboAddress("192.0.2.1"));
+        dr.d_ttl = static_cast<uint32_t>(now + 3600);
+        dr.d_place = DNSResourceRecord::ANSWER;
+        MRC.replace(now, name, QType(QType::A), {dr}, signatures, authRecs, true, authZone, boost::none);
+      }
+
+      std::vector<std::thread> threads;
+      DTime dt;
+      dt.set();
+      for (size_t idx = 0; idx < numberOfThreads; ++idx) {
+        threads.emplace_back([&MRC, &names, now, rounds]() {
+          std::vector<DNSRecord> retrieved;
+          const ComboAddress who("192.0.2.1");
+          for (size_t round = 0; round < rounds; round++) {
+            for (const auto& name : names) {
+              MRC.get(now, name, QType(QType::A), MemRecursorCache::None, &retrieved, who);
+            }
+          }
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+      auto elapsed = dt.udiff();
+      auto stats = MRC.stats();
+      cerr << (readOptimized ? "read-optimized" : "exclusive lock") << " lookups with " << numberOfThreads << " threads: " << (numberOfThreads * numberOfEntries * rounds) << " lookups in " << (elapsed / 1000) << " ms, " << static_cast<uint64_t>(numberOfThreads * numberOfEntries * rounds * 1000000.0 / elapsed) << " lookups/s, " << stats.first << "/" << stats.second << " contended" << endl;
+    }
+  }
+}
+#endif /* BENCH_RECORDCACHE */
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -1061,6 +1061,41 @@ BOOST_AUTO_TEST_CASE(test_PacketIDCompare)
   BOOST_CHECK(!br2);
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketIDHash)
+{
+  auto hash = PacketIDHash();
+  auto equal = PacketIDEqual();
+  auto bhash = PacketIDBirthdayHash();
+  auto bequal = PacketIDBirthdayEqual();
+
+  auto a = createPID("1.2.3.4", -1, 1, "powerdns.com", 1, 1000);
+  /* the qname is case-insensitive */
+  auto b = createPID("1.2.3.4", -1, 1, "PowerDNS.COM", 1, 1000);
+  BOOST_CHECK(equal(a, b));
+  BOOST_CHECK_EQUAL(hash(a), hash(b));
+  BOOST_CHECK(bequal(a, b));
+  BOOST_CHECK_EQUAL(bhash(a), bhash(b));
+
+  /* a different ID or fd is a different waiter, but the same question */
+  for (const auto& other : {createPID("1.2.3.4", -1, 1, "powerdns.com", 1, 999), createPID("1.2.3.4", -1, 1, "powerdns.com", -1, 1000)}) {
+    BOOST_CHECK(!equal(a, other));
+    BOOST_CHECK(bequal(a, other));
+    BOOST_CHECK_EQUAL(bhash(a), bhash(other));
+  }
+
+  /* and everything else is a different question */
+  for (const auto& other : {createPID("1.2.3.5", -1, 1, "powerdns.com", 1, 1000), createPID("1.2.3.4:54", -1, 1, "powerdns.com", 1, 1000), createPID("1.2.3.4", 42, 1, "powerdns.com", 1, 1000), createPID("1.2.3.4", -1, 28, "powerdns.com", 1, 1000), createPID("1.2.3.4", -1, 1, "powerdns.net", 1, 1000)}) {
+    BOOST_CHECK(!equal(a, other));
+    BOOST_CHECK(!bequal(a, other));
+  }
+
+  /* consistent with the compare predicates */
+  auto cmp = PacketIDCompare();
+  auto bcmp = PacketIDBirthdayCompare();
+  BOOST_CHECK(!cmp(a, b) && !cmp(b, a));
+  BOOST_CHECK(!bcmp(a, b) && !bcmp(b, a));
+}
+
 BOOST_AUTO_TEST_CASE(test_servestale)
 {
   std::unique_ptr<SyncRes> sr;
@@ -0,0 +1,268 @@
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_NO_MAIN
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <boost/test/unit_test.hpp>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#ifdef BENCH_TIMERWHEEL
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/key_extractors.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+#endif
+
+#include "misc.hh"
+#include "timerwheel.hh"
+
+using wheel_t = pdns::TimerWheel<uint64_t>;
+
+static std::vector<uint64_t> expire(wheel_t& wheel, uint64_t now)
+{
+  std::vector<std::pair<wheel_t::Handle, uint64_t>> expired;
+  wheel.advance(now, expired);
+  std::vector<uint64_t> result;
+  for (const auto& entry : expired) {
+    result.push_back(entry.second);
+  }
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+BOOST_AUTO_TEST_SUITE(timerwheel_hh)
+
+BOOST_AUTO_TEST_CASE(test_simple)
+{
+  wheel_t wheel;
+  const uint64_t now = 1000000;
+  BOOST_CHECK(wheel.empty());
+
+  auto first = wheel.add(now, now + 10, 1);
+  auto second = wheel.add(now, now + 20, 2);
+  BOOST_CHECK_NE(first, 0U);
+  BOOST_CHECK_NE(first, second);
+  BOOST_CHECK_EQUAL(wheel.size(), 2U);
+
+  BOOST_CHECK(expire(wheel, now + 9).empty());
+  BOOST_CHECK(expire(wheel, now + 10) == std::vector<uint64_t>({1}));
+  /* it has expired, it can't be cancelled anymore */
+  BOOST_CHECK(!wheel.cancel(first));
+  BOOST_CHECK(wheel.cancel(second));
+  BOOST_CHECK(!wheel.cancel(second));
+  BOOST_CHECK(wheel.empty());
+  BOOST_CHECK(expire(wheel, now + 100).empty());
+
+  /* the slot of 'second' has been reused, the old handle does not cancel the new timer */
+  auto third = wheel.add(now + 100, now + 150, 3);
+  BOOST_CHECK_NE(third, second);
+  BOOST_CHECK(!wheel.cancel(second));
+  BOOST_CHECK(!wheel.cancel(0));
+
+  /* timers that are already due expire at the next advance */
+  wheel.add(now + 100, now, 4);
+  BOOST_CHECK(expire(wheel, now + 100) == std::vector<uint64_t>({4}));
+  BOOST_CHECK(expire(wheel, now + 1000) == std::vector<uint64_t>({3}));
+}
+
+BOOST_AUTO_TEST_CASE(test_timeval)
+{
+  wheel_t wheel;
+  struct timeval now = {1000, 500000};
+  struct timeval when = {1001, 500001};
+  wheel.add(now, when, 1);
+
+  std::vector<std::pair<wheel_t::Handle, uint64_t>> expired;
+  struct timeval later = {1001, 500999};
+  wheel.advance(later, expired);
+  /* rounded up to the next millisecond */
+  BOOST_CHECK(expired.empty());
+  later.tv_usec = 501000;
+  wheel.advance(later, expired);
+  BOOST_CHECK_EQUAL(expired.size(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_levels)
+{
+  /* one timer per level, plus one beyond the range of the wheel */
+  const std::vector<uint64_t> delays = {100, 10000, 1000000, 100000000, 10000000000};
+  wheel_t wheel;
+  const uint64_t now = 123456789;
+  for (const auto delay : delays) {
+    wheel.add(now, now + delay, delay);
+  }
+
+  uint64_t current = now;
+  for (const auto delay : delays) {
+    BOOST_CHECK(expire(wheel, now + delay - 1).empty());
+    BOOST_CHECK(expire(wheel, now + delay) == std::vector<uint64_t>({delay}));
+    current = now + delay;
+  }
+  BOOST_CHECK(wheel.empty());
+  BOOST_CHECK(expire(wheel, current + 10000000000).empty());
+}
+
+BOOST_AUTO_TEST_CASE(test_random)
+{
+  /* compare against a simple ordered map, advancing by random steps */
+  std::mt19937_64 gen(42);
+  wheel_t wheel;
+  std::multimap<uint64_t, uint64_t> reference;
+  std::map<uint64_t, std::pair<wheel_t::Handle, uint64_t>> pending;
+  uint64_t now = 5000;
+  uint64_t counter = 0;
+
+  for (size_t round = 0; round < 20000; round++) {
+    const auto action = gen() % 10;
+    if (action < 5) {
+      uint64_t delay = gen() % 5000;
+      if (action == 0) {
+        delay = gen() % 100000000;
+      }
+      const auto id = counter++;
+      pending[id] = {wheel.add(now, now + delay, id), now + delay};
+      reference.emplace(now + delay, id);
+    }
+    else if (action < 7 && !pending.empty()) {
+      auto iter = pending.lower_bound(gen() % counter);
+      if (iter == pending.end()) {
+        iter = pending.begin();
+      }
+      BOOST_REQUIRE(wheel.cancel(iter->second.first));
+      auto range = reference.equal_range(iter->second.second);
+      for (auto ref = range.first; ref != range.second; ++ref) {
+        if (ref->second == iter->first) {
+          reference.erase(ref);
+          break;
+        }
+      }
+      pending.erase(iter);
+    }
+    else {
+      now += (action == 9) ? gen() % 1000000 : gen() % 300;
+      std::vector<uint64_t> expected;
+      while (!reference.empty() && reference.begin()->first <= now) {
+        expected.push_back(reference.begin()->second);
+        pending.erase(reference.begin()->second);
+        reference.erase(reference.begin());
+      }
+      std::sort(expected.begin(), expected.end());
+      BOOST_REQUIRE(expire(wheel, now) == expected);
+    }
+    BOOST_REQUIRE_EQUAL(wheel.size(), reference.size());
+  }
+}
+
+#ifdef BENCH_TIMERWHEEL
+/* 100k outstanding queries, each one waiting for an answer with a 1.5s timeout. Most
+   of them get answered, and their timer cancelled, within 100 ms; the others time out.
+   Compares the wheel to the ordered index MTasker used to keep the timeouts in. */
+BOOST_AUTO_TEST_CASE(test_bench_outstanding)
+{
+  const size_t outstanding = 100000;
+  const size_t operations = 5000000;
+  const uint64_t timeout = 1500;
+
+  struct Query
+  {
+    uint64_t id;
+    uint64_t answerAt;
+  };
+  std::mt19937_64 gen(42);
+  std::vector<Query> queries;
+  uint64_t counter = 0;
+  auto newQuery = [&gen, &counter](uint64_t now) {
+    /* one in ten never gets an answer */
+    return Query{counter++, (gen() % 10 == 0) ? std::numeric_limits<uint64_t>::max() : now + gen() % 100};
+  };
+
+  {
+    wheel_t wheel;
+    std::vector<wheel_t::Handle> handles;
+    std::vector<std::pair<wheel_t::Handle, uint64_t>> expired;
+    uint64_t now = 1000000;
+    size_t timeouts = 0;
+    gen.seed(42);
+    for (size_t idx = 0; idx < outstanding; idx++) {
+      queries.push_back(newQuery(now));
+      handles.push_back(wheel.add(now, now + timeout, idx));
+    }
+
+    DTime dt;
+    dt.set();
+    for (size_t idx = 0; idx < operations; idx++) {
+      if (idx % 100 == 0) {
+        now++;
+        expired.clear();
+        wheel.advance(now, expired);
+        for (const auto& entry : expired) {
+          timeouts++;
+          queries.at(entry.second) = newQuery(now);
+          handles.at(entry.second) = wheel.add(now, now + timeout, entry.second);
+        }
+      }
+      const auto slot = gen() % outstanding;
+      if (queries.at(slot).answerAt <= now) {
+        wheel.cancel(handles.at(slot));
+        queries.at(slot) = newQuery(now);
+        handles.at(slot) = wheel.add(now, now + timeout, slot);
+      }
+    }
+    auto elapsed = dt.udiff();
+    cerr << "timer wheel: " << std::to_string(static_cast<uint64_t>(operations * 1000000.0 / elapsed)) << " operations/s, " << timeouts << " timeouts" << endl;
+  }
+
+  {
+    struct Timeout
+    {
+      uint64_t ttd;
+      size_t slot;
+    };
+    using namespace boost::multi_index;
+    using timeouts_t = multi_index_container<
+      Timeout,
+      indexed_by<
+        ordered_non_unique<member<Timeout, uint64_t, &Timeout::ttd>>,
+        hashed_unique<member<Timeout, size_t, &Timeout::slot>>>>;
+    timeouts_t index;
+    uint64_t now = 1000000;
+    size_t timeouts = 0;
+    gen.seed(42);
+    queries.clear();
+    for (size_t idx = 0; idx < outstanding; idx++) {
+      queries.push_back(newQuery(now));
+      index.insert({now + timeout, idx});
+    }
+
+    DTime dt;
+    dt.set();
+    auto& bySlot = index.get<1>();
+    for (size_t idx = 0; idx < operations; idx++) {
+      if (idx % 100 == 0) {
+        now++;
+        while (!index.empty() && index.begin()->ttd <= now) {
+          const auto slot = index.begin()->slot;
+          index.erase(index.begin());
+          timeouts++;
+          queries.at(slot) = newQuery(now);
+          index.insert({now + timeout, slot});
+        }
+      }
+      const auto slot = gen() % outstanding;
+      if (queries.at(slot).answerAt <= now) {
+        bySlot.erase(slot);
+        queries.at(slot) = newQuery(now);
+        index.insert({now + timeout, slot});
+      }
+    }
+    auto elapsed = dt.udiff();
+    cerr << "ordered index: " << std::to_string(static_cast<uint64_t>(operations * 1000000.0 / elapsed)) << " operations/s, " << timeouts << " timeouts" << endl;
+  }
+}
+#endif /* BENCH_TIMERWHEEL */
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1 @@
+../timerwheel.hh
\ No newline at end of file
@@ -794,7 +794,7 @@ const std::map<std::string, MetricDefinition> MetricDefinitionStorage::d_metrics
                     "Shows the current latency average, in microseconds, exponentially weighted over past 'latency-statistic-size' packets")},
   {"query-pipe-full-drops",
    MetricDefinition(PrometheusMetricType::counter,
-                    "Number of questions dropped because the query distribution pipe was full")},
+                    "Number of questions dropped because the query distribution queue was full")},
   {"questions",
    MetricDefinition(PrometheusMetricType::counter,
                     "Counts all end-user initiated queries with the RD bit set")},
@@ -8,6 +8,7 @@
 #include "dnswriter.hh"
 #include "dnsrecords.hh"
 #include "iputils.hh"
+#include "packetcache.hh"
 #include <fstream>
 #include "uuid-utils.hh"
 #include "dnssecinfra.hh"
@@ -769,6 +770,128 @@ struct DNSNameRootTest
 
 };
 
+struct DNSNamePacketParseTest
+{
+  explicit DNSNamePacketParseTest(const DNSName& name)
+  {
+    DNSPacketWriter pw(d_packet, name, QType::A);
+  }
+
+  string getName() const
+  {
+    return "DNSName packet parse";
+  }
+
+  void operator()() const
+  {
+    uint16_t qtype;
+    uint16_t qclass;
+    DNSName name(reinterpret_cast<const char*>(d_packet.data()), d_packet.size(), sizeof(dnsheader), false, &qtype, &qclass);
+  }
+
+private:
+  vector<uint8_t> d_packet;
+};
+
+struct DNSNameViewPacketParseTest
+{
+  explicit DNSNameViewPacketParseTest(const DNSName& name)
+  {
+    DNSPacketWriter pw(d_packet, name, QType::A);
+  }
+
+  string getName() const
+  {
+    return "DNSNameView packet parse";
+  }
+
+  void operator()() const
+  {
+    uint16_t qtype;
+    uint16_t qclass;
+    DNSNameView name(reinterpret_cast<const char*>(d_packet.data()), d_packet.size(), sizeof(dnsheader), &qtype, &qclass);
+  }
+
+private:
+  vector<uint8_t> d_packet;
+};
+
+template <typename N>
+struct DNSNameHashTest
+{
+  explicit DNSNameHashTest(const DNSName& name) :
+    d_stored(name), d_name(d_stored)
+  {
+  }
+
+  string getName() const
+  {
+    return std::is_same<N, DNSName>::value ? "DNSName hash" : "DNSNameView hash";
+  }
+
+  void operator()() const
+  {
+    /* volatile so the computation is not optimized away */
+    d_result = d_name.hash();
+  }
+
+private:
+  const DNSName d_stored;
+  const N d_name;
+  mutable volatile size_t d_result{0};
+};
+
+template <typename N>
+struct DNSNameCompareTest
+{
+  DNSNameCompareTest(const DNSName& lhs, const DNSName& rhs) :
+    d_storedLHS(lhs), d_storedRHS(rhs), d_lhs(d_storedLHS), d_rhs(d_storedRHS)
+  {
+  }
+
+  string getName() const
+  {
+    return std::is_same<N, DNSName>::value ? "DNSName compare" : "DNSNameView compare";
+  }
+
+  void operator()() const
+  {
+    if (!(d_lhs == d_rhs)) {
+      throw std::runtime_error("Names should be equal in DNSNameCompareTest");
+    }
+    if (d_lhs.canonCompare(d_rhs)) {
+      throw std::runtime_error("Names should be equal in DNSNameCompareTest");
+    }
+  }
+
+private:
+  const DNSName d_storedLHS;
+  const DNSName d_storedRHS;
+  const N d_lhs;
+  const N d_rhs;
+};
+
+struct DNSNameLowerCaseTest
+{
+  explicit DNSNameLowerCaseTest(const DNSName& name) :
+    d_name(name)
+  {
+  }
+
+  string getName() const
+  {
+    return "DNSName lowercase";
+  }
+
+  void operator()() const
+  {
+    d_name.makeUsLowerCase();
+  }
+
+private:
+  mutable DNSName d_name;
+};
+
 struct SuffixMatchNodeTest
 {
   SuffixMatchNodeTest()
@@ -1131,11 +1254,12 @@ struct BurtleHashTest
 
   void operator()() const
   {
-    burtle(reinterpret_cast<const unsigned char*>(d_name.data()), d_name.length(), 0);
+    d_result = burtle(reinterpret_cast<const unsigned char*>(d_name.data()), d_name.length(), 0);
   }
 
 private:
   const string d_name;
+  mutable volatile uint32_t d_result{0};
 };
 
 struct BurtleHashCITest
@@ -1149,11 +1273,39 @@ struct BurtleHashCITest
 
   void operator()() const
   {
-    burtleCI(reinterpret_cast<const unsigned char*>(d_name.data()), d_name.length(), 0);
+    d_result = burtleCI(reinterpret_cast<const unsigned char*>(d_name.data()), d_name.length(), 0);
   }
 
 private:
   const string d_name;
+  mutable volatile uint32_t d_result{0};
+};
+
+struct PacketCacheKeyTest
+{
+  explicit PacketCacheKeyTest(const DNSName& qname)
+  {
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, qname, QType::A);
+    pw.getHeader()->rd = 1;
+    pw.addOpt(4096, 0, EDNSOpts::DNSSECOK);
+    pw.commit();
+    d_packet = string(packet.begin(), packet.end());
+  }
+
+  string getName() const
+  {
+    return "PacketCache key";
+  }
+
+  void operator()() const
+  {
+    d_result = PacketCache::canHashPacket(d_packet);
+  }
+
+private:
+  string d_packet;
+  mutable volatile uint32_t d_result{0};
 };
 
 
@@ -1284,6 +1436,19 @@ try
   doRun(DNSNameParseTest());
   doRun(DNSNameRootTest());
 
+  {
+    /* long enough not to fit in the small buffer of DNSName */
+    const DNSName name("a-rather-long-label.www.powerdns.com.");
+    const DNSName upper("A-RATHER-LONG-LABEL.WWW.PowerDNS.COM.");
+    doRun(DNSNamePacketParseTest(name));
+    doRun(DNSNameViewPacketParseTest(name));
+    doRun(DNSNameHashTest<DNSName>(name));
+    doRun(DNSNameHashTest<DNSNameView>(name));
+    doRun(DNSNameCompareTest<DNSName>(name, upper));
+    doRun(DNSNameCompareTest<DNSNameView>(name, upper));
+    doRun(DNSNameLowerCaseTest(upper));
+  }
+
   doRun(SuffixMatchNodeTest());
 
   doRun(NetmaskTreeTest());
@@ -1333,6 +1498,12 @@ try
 
   doRun(BurtleHashTest("a string of chars"));
   doRun(BurtleHashCITest("A String Of Chars"));
+  {
+    /* the qname part of the packet cache keys */
+    const auto qname = DNSName("A-Rather-Long-Label.WWW.PowerDNS.COM.").toDNSString();
+    doRun(BurtleHashCITest(qname));
+    doRun(PacketCacheKeyTest(DNSName("A-Rather-Long-Label.WWW.PowerDNS.COM.")));
+  }
 #ifdef HAVE_LIBSODIUM
   doRun(SipHashTest("a string of chars"));
 #endif
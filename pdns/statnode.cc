@@ -57,7 +57,32 @@ void StatNode::submit(const DNSName& domain, int rcode, unsigned int bytes, boos
   }
 
   auto last = tmp.end() - 1;
-  children[*last].submit(last, tmp.begin(), "", rcode, bytes, remote, 1);
+  auto& stat = children[*last].submit(last, tmp.begin(), "", 1);
+  stat.queries++;
+  stat.bytes += bytes;
+  if(rcode<0)
+    stat.drops++;
+  else if(rcode==0)
+    stat.noerrors++;
+  else if(rcode==2)
+    stat.servfails++;
+  else if(rcode==3)
+    stat.nxdomains++;
+
+  if (remote) {
+    stat.remotes[*remote]++;
+  }
+}
+
+void StatNode::submit(const DNSName& domain, const Stat& stat)
+{
+  std::vector<string> tmp = domain.getRawLabels();
+  if (tmp.empty()) {
+    return;
+  }
+
+  auto last = tmp.end() - 1;
+  children[*last].submit(last, tmp.begin(), "", 1) += stat;
 }
 
 /* www.powerdns.com. -> 
@@ -67,7 +92,7 @@ void StatNode::submit(const DNSName& domain, int rcode, unsigned int bytes, boos
    www.powerdns.com. 
 */
 
-void StatNode::submit(std::vector<string>::const_iterator end, std::vector<string>::const_iterator begin, const std::string& domain, int rcode, unsigned int bytes, boost::optional<const ComboAddress&> remote, unsigned int count)
+StatNode::Stat& StatNode::submit(std::vector<string>::const_iterator end, std::vector<string>::const_iterator begin, const std::string& domain, unsigned int count)
 {
   //  cerr<<"Submit called for domain='"<<domain<<"': ";
   //  for(const std::string& n :  labels) 
@@ -94,20 +119,7 @@ void StatNode::submit(std::vector<string>::const_iterator end, std::vector<strin
       labelsCount = count;
     }
     //    cerr<<"Hit the end, set our fullname to '"<<fullname<<"'"<<endl<<endl;
-    s.queries++;
-    s.bytes += bytes;
-    if(rcode<0)
-      s.drops++;
-    else if(rcode==0)
-      s.noerrors++;
-    else if(rcode==2)
-      s.servfails++;
-    else if(rcode==3)
-      s.nxdomains++;
-
-    if (remote) {
-      s.remotes[*remote]++;
-    }
+    return s;
   }
   else {
     if (fullname.empty()) {
@@ -122,6 +134,6 @@ void StatNode::submit(std::vector<string>::const_iterator end, std::vector<strin
     }
     //    cerr<<"Not yet end, set our fullname to '"<<fullname<<"', recursing"<<endl;
     --end;
-    children[*end].submit(end, begin, fullname, rcode, bytes, remote, count+1);
+    return children[*end].submit(end, begin, fullname, count+1);
   }
 }
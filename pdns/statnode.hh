@@ -58,6 +58,8 @@ public:
   uint8_t labelsCount{0};
 
   void submit(const DNSName& domain, int rcode, unsigned int bytes, boost::optional<const ComboAddress&> remote);
+  /* add already aggregated statistics to the node corresponding to that domain */
+  void submit(const DNSName& domain, const Stat& stat);
 
   Stat print(unsigned int depth=0, Stat newstat=Stat(), bool silent=false) const;
   typedef std::function<void(const StatNode*, const Stat& selfstat, const Stat& childstat)> visitor_t;
@@ -70,5 +72,6 @@ public:
   children_t children;
 
 private:
-  void submit(std::vector<string>::const_iterator end, std::vector<string>::const_iterator begin, const std::string& domain, int rcode, unsigned int bytes, boost::optional<const ComboAddress&> remote, unsigned int count);
+  /* creates the nodes down to the one corresponding to the domain if needed, and returns its statistics */
+  Stat& submit(std::vector<string>::const_iterator end, std::vector<string>::const_iterator begin, const std::string& domain, unsigned int count);
 };
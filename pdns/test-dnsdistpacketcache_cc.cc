@@ -509,6 +509,62 @@ BOOST_AUTO_TEST_CASE(test_PacketCacheTruncated) {
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheCaseInsensitive) {
+  for (const bool lockFreeReads : {false, true}) {
+    const size_t maxEntries = 150000;
+    DNSDistPacketCache PC(maxEntries, 86400, 1, 60, 3600, 60, false, 1, true, false, lockFreeReads);
+
+    InternalQueryState ids;
+    ids.qtype = QType::A;
+    ids.qclass = QClass::IN;
+    ids.protocol = dnsdist::Protocol::DoUDP;
+    bool dnssecOK = false;
+
+    const DNSName name("www.PowerDNS.com.");
+    const DNSName lowerName("www.powerdns.com.");
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, name, QType::A, QClass::IN, 0);
+    pwR.getHeader()->rd = 1;
+    pwR.getHeader()->ra = 1;
+    pwR.getHeader()->qr = 1;
+    pwR.startRecord(name, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+
+    {
+      ids.qname = name;
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      BOOST_CHECK(!PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP));
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, ids.qname, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+      BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+    }
+
+    {
+      /* same name with a different case, the response should use the case of the query */
+      ids.qname = lowerName;
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      BOOST_REQUIRE(PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP));
+      BOOST_REQUIRE_EQUAL(dq.getData().size(), response.size());
+      BOOST_CHECK_EQUAL(DNSName(reinterpret_cast<const char*>(dq.getData().data()), dq.getData().size(), sizeof(dnsheader), false).toString(), lowerName.toString());
+    }
+
+    BOOST_CHECK_EQUAL(PC.getRecordsForDomain(lowerName).size(), 1U);
+    BOOST_CHECK_EQUAL(PC.getDomainsContainingRecords(ComboAddress("1.2.3.4")).count(name), 1U);
+    BOOST_CHECK_EQUAL(PC.expungeByName(DNSName("POWERDNS.com."), QType::A, true), 1U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+  }
+}
+
 static DNSDistPacketCache g_PC(500000);
 
 static void threadMangler(unsigned int offset)
@@ -618,6 +674,307 @@ BOOST_AUTO_TEST_CASE(test_PacketCacheThreaded) {
 
 }
 
+BOOST_AUTO_TEST_CASE(test_PacketCacheLockFreeReads) {
+  const size_t maxEntries = 150000;
+  const size_t numberOfShards = 10;
+  DNSDistPacketCache PC(maxEntries, 86400, 1, 60, 3600, 60, false, numberOfShards, true, false, true);
+  BOOST_CHECK(PC.hasLockFreeReads());
+  BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+
+  size_t counter = 0;
+  size_t skipped = 0;
+  bool dnssecOK = false;
+  const time_t now = time(nullptr);
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+
+  try {
+    for (counter = 0; counter < 100000; ++counter) {
+      ids.qname = DNSName(std::to_string(counter) + ".powerdns.com.");
+
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+
+      PacketBuffer response;
+      GenericDNSPacketWriter<PacketBuffer> pwR(response, ids.qname, QType::A, QClass::IN, 0);
+      pwR.getHeader()->rd = 1;
+      pwR.getHeader()->ra = 1;
+      pwR.getHeader()->qr = 1;
+      pwR.getHeader()->id = pwQ.getHeader()->id;
+      pwR.startRecord(ids.qname, QType::A, 7200, QClass::IN, DNSResourceRecord::ANSWER);
+      pwR.xfr32BitInt(0x01020304);
+      pwR.commit();
+
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      bool found = PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP);
+      BOOST_CHECK_EQUAL(found, false);
+
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, ids.qname, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+
+      found = PC.get(dq, pwR.getHeader()->id, &key, subnet, dnssecOK, receivedOverUDP, 0, true);
+      if (found == true) {
+        BOOST_CHECK_EQUAL(dq.getData().size(), response.size());
+        int match = memcmp(dq.getData().data(), response.data(), dq.getData().size());
+        BOOST_CHECK_EQUAL(match, 0);
+      }
+      else {
+        skipped++;
+      }
+    }
+
+    BOOST_CHECK_EQUAL(skipped, PC.getInsertCollisions());
+    BOOST_CHECK_EQUAL(PC.getSize(), counter - skipped);
+    BOOST_CHECK_EQUAL(PC.getDeferredLookups(), 0U);
+
+    /* inserting the same entries again with a longer TTL replaces them */
+    size_t matches = 0;
+    for (counter = 0; counter < 1000; ++counter) {
+      ids.qname = DNSName(std::to_string(counter) + ".powerdns.com.");
+
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+
+      PacketBuffer response;
+      GenericDNSPacketWriter<PacketBuffer> pwR(response, ids.qname, QType::A, QClass::IN, 0);
+      pwR.getHeader()->rd = 1;
+      pwR.getHeader()->ra = 1;
+      pwR.getHeader()->qr = 1;
+      pwR.getHeader()->id = pwQ.getHeader()->id;
+      pwR.startRecord(ids.qname, QType::A, 7300, QClass::IN, DNSResourceRecord::ANSWER);
+      pwR.xfr32BitInt(0x05060708);
+      pwR.commit();
+
+      uint32_t key = PC.getKey(ids.qname.getStorage(), ids.qname.wirelength(), query, receivedOverUDP);
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, ids.qname, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+      bool found = PC.get(dq, pwR.getHeader()->id, &key, subnet, dnssecOK, receivedOverUDP, 0, true);
+      if (!found) {
+        /* the initial insertion collided */
+        continue;
+      }
+      BOOST_REQUIRE_EQUAL(dq.getData().size(), response.size());
+      BOOST_CHECK_EQUAL(memcmp(dq.getData().data(), response.data(), dq.getData().size()), 0);
+      matches++;
+    }
+    BOOST_CHECK_EQUAL(PC.getSize(), 100000U - skipped);
+    BOOST_CHECK_GT(matches, 0U);
+
+    auto removed = PC.expungeByName(DNSName("1.powerdns.com."));
+    BOOST_CHECK_EQUAL(removed, 1U);
+    ids.qname = DNSName("1.powerdns.com.");
+    {
+      PacketBuffer query;
+      GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+      pwQ.getHeader()->rd = 1;
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      BOOST_CHECK_EQUAL(PC.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP), false);
+    }
+
+    auto remaining = PC.getSize();
+
+    /* no entry should have expired */
+    BOOST_CHECK_EQUAL(PC.purgeExpired(0, now), 0U);
+
+    /* but after the TTL .. let's ask for at most 1k entries */
+    removed = PC.purgeExpired(1000, now + 7300 + 3600);
+    BOOST_CHECK_EQUAL(removed, remaining - 1000U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 1000U);
+
+    /* now remove everything */
+    removed = PC.expunge(0);
+    BOOST_CHECK_EQUAL(removed, 1000U);
+    BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+  }
+  catch (const PDNSException& e) {
+    cerr<<"Had error: "<<e.reason<<endl;
+    throw;
+  }
+}
+
+static void insertIntoCache(DNSDistPacketCache& cache, unsigned int offset, unsigned int count)
+{
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+  bool dnssecOK = false;
+
+  for (unsigned int counter = 0; counter < count; ++counter) {
+    ids.qname = DNSName("hello ")+DNSName(std::to_string(counter+offset));
+    PacketBuffer query;
+    GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, ids.qname, QType::A, QClass::IN, 0);
+    pwR.getHeader()->rd = 1;
+    pwR.getHeader()->ra = 1;
+    pwR.getHeader()->qr = 1;
+    pwR.getHeader()->id = pwQ.getHeader()->id;
+    pwR.startRecord(ids.qname, QType::A, 3600, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+
+    uint32_t key = 0;
+    boost::optional<Netmask> subnet;
+    DNSQuestion dq(ids, query);
+    cache.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP);
+
+    cache.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, ids.qname, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+  }
+}
+
+static size_t lookupFromCache(DNSDistPacketCache& cache, unsigned int offset, unsigned int count, unsigned int rounds)
+{
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+  bool dnssecOK = false;
+  size_t hits = 0;
+
+  std::vector<PacketBuffer> queries;
+  std::vector<DNSName> names;
+  queries.reserve(count);
+  names.reserve(count);
+  for (unsigned int counter = 0; counter < count; ++counter) {
+    names.push_back(DNSName("hello ")+DNSName(std::to_string(counter+offset)));
+    PacketBuffer query;
+    GenericDNSPacketWriter<PacketBuffer> pwQ(query, names.back(), QType::A, QClass::IN, 0);
+    pwQ.getHeader()->rd = 1;
+    queries.push_back(std::move(query));
+  }
+
+  PacketBuffer query;
+  for (unsigned int round = 0; round < rounds; ++round) {
+    for (unsigned int counter = 0; counter < count; ++counter) {
+      ids.qname = names.at(counter);
+      query = queries.at(counter);
+      uint32_t key = 0;
+      boost::optional<Netmask> subnet;
+      DNSQuestion dq(ids, query);
+      if (cache.get(dq, 0, &key, subnet, dnssecOK, receivedOverUDP)) {
+        hits++;
+      }
+    }
+  }
+
+  return hits;
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheLockFreeReclaim) {
+  const size_t maxEntries = 100;
+  DNSDistPacketCache PC(maxEntries, 86400, 1, 60, 3600, 60, false, 1, true, false, true);
+
+  bool dnssecOK = false;
+  const time_t now = time(nullptr);
+  InternalQueryState ids;
+  ids.qtype = QType::A;
+  ids.qclass = QClass::IN;
+  ids.protocol = dnsdist::Protocol::DoUDP;
+  ids.qname = DNSName("refreshed.powerdns.com.");
+
+  PacketBuffer query;
+  GenericDNSPacketWriter<PacketBuffer> pwQ(query, ids.qname, QType::A, QClass::IN, 0);
+  pwQ.getHeader()->rd = 1;
+  uint32_t key = PC.getKey(ids.qname.getStorage(), ids.qname.wirelength(), query, receivedOverUDP);
+  boost::optional<Netmask> subnet;
+  DNSQuestion dq(ids, query);
+
+  /* refreshing the same entry with a longer TTL replaces it every time,
+     while the cache stays well under its maximum size */
+  const size_t refreshes = 5000;
+  for (size_t idx = 0; idx < refreshes; idx++) {
+    PacketBuffer response;
+    GenericDNSPacketWriter<PacketBuffer> pwR(response, ids.qname, QType::A, QClass::IN, 0);
+    pwR.getHeader()->qr = 1;
+    pwR.startRecord(ids.qname, QType::A, 100 + idx, QClass::IN, DNSResourceRecord::ANSWER);
+    pwR.xfr32BitInt(0x01020304);
+    pwR.commit();
+    PC.insert(key, subnet, *(getFlagsFromDNSHeader(dq.getHeader())), dnssecOK, ids.qname, QType::A, QClass::IN, response, receivedOverUDP, 0, boost::none);
+  }
+  BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+  /* the replaced values are freed along the way */
+  BOOST_CHECK_GT(PC.getRetiredCount(), 0U);
+  BOOST_CHECK_LT(PC.getRetiredCount(), refreshes / 2);
+
+  /* and by a cleanup pass that does not remove anything */
+  BOOST_CHECK_EQUAL(PC.purgeExpired(maxEntries, now), 0U);
+  BOOST_CHECK_EQUAL(PC.getRetiredCount(), 0U);
+  BOOST_CHECK_EQUAL(PC.getSize(), 1U);
+}
+
+BOOST_AUTO_TEST_CASE(test_PacketCacheLockFreeReadsThreaded) {
+  /* readers and writers at the same time, while entries are being removed */
+  DNSDistPacketCache PC(500000, 86400, 0, 60, 3600, 60, false, 10, false, false, true);
+  insertIntoCache(PC, 0, 100000);
+  BOOST_CHECK_EQUAL(PC.getSize() + PC.getInsertCollisions(), 100000U);
+
+  std::atomic<size_t> hits{0};
+  std::vector<std::thread> threads;
+  for (unsigned int idx = 0; idx < 4; ++idx) {
+    threads.push_back(std::thread([&PC, &hits]() {
+      hits += lookupFromCache(PC, 0, 100000, 1);
+    }));
+  }
+  for (unsigned int idx = 0; idx < 2; ++idx) {
+    threads.push_back(std::thread([&PC, idx]() {
+      insertIntoCache(PC, (idx + 1) * 1000000, 50000);
+    }));
+  }
+  threads.push_back(std::thread([&PC]() {
+    for (unsigned int idx = 0; idx < 100; ++idx) {
+      PC.expungeByName(DNSName("hello ")+DNSName(std::to_string(idx)));
+      PC.purgeExpired(0, time(nullptr));
+    }
+  }));
+
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  BOOST_CHECK_GT(hits.load(), 0U);
+  auto remaining = PC.getSize();
+  BOOST_CHECK_EQUAL(PC.expunge(0), remaining);
+  BOOST_CHECK_EQUAL(PC.getSize(), 0U);
+}
+
+#ifdef BENCH_PACKETCACHE
+BOOST_AUTO_TEST_CASE(test_PacketCacheBenchReads) {
+  const unsigned int numberOfEntries = 100000;
+  const unsigned int rounds = 20;
+  for (const bool lockFree : {false, true}) {
+    for (const unsigned int numberOfThreads : {1, 2, 4, 8, 16}) {
+      DNSDistPacketCache PC(numberOfEntries * 2, 86400, 0, 60, 3600, 60, false, 20, true, false, lockFree);
+      insertIntoCache(PC, 0, numberOfEntries);
+
+      std::vector<std::thread> threads;
+      StopWatch sw;
+      sw.start();
+      for (unsigned int idx = 0; idx < numberOfThreads; ++idx) {
+        threads.push_back(std::thread([&PC]() {
+          lookupFromCache(PC, 0, numberOfEntries, rounds);
+        }));
+      }
+      for (auto& t : threads) {
+        t.join();
+      }
+      auto elapsed = sw.udiff();
+      cerr<<(lockFree ? "lock-free" : "shared lock")<<" reads with "<<numberOfThreads<<" threads: "<<(numberOfThreads * numberOfEntries * rounds)<<" lookups in "<<std::to_string(elapsed / 1000)<<" ms, "<<std::to_string(static_cast<uint64_t>(numberOfThreads * numberOfEntries * rounds * 1000000.0 / elapsed))<<" lookups/s, "<<PC.getDeferredLookups()<<" deferred"<<endl;
+    }
+  }
+}
+#endif /* BENCH_PACKETCACHE */
+
 BOOST_AUTO_TEST_CASE(test_PCCollision) {
   const size_t maxEntries = 150000;
   DNSDistPacketCache PC(maxEntries, 86400, 1, 60, 3600, 60, false, 1, true, true);
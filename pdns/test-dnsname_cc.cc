@@ -1029,4 +1029,132 @@ BOOST_AUTO_TEST_CASE(test_getcommonlabels) {
   BOOST_CHECK_EQUAL(name4.getCommonLabels(name3), name4);
 }
 
+BOOST_AUTO_TEST_CASE(test_view) {
+  const std::vector<std::string> names{".", "powerdns.com.", "PowerDNS.COM.", "www.powerdns.com.", "bert.com.", "alpha.nl.", "\\128.com.", "a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.0.1.2.3.4.5.6.7.8.9.a.b.c.d.e.f.g.h.i.j.k.l.m.n.o.p.q.r.s.t.u.v.w.x.y.z.0.1.2.3.4.5.6.7.8.9."};
+
+  for (const auto& first : names) {
+    const DNSName name(first);
+    vector<uint8_t> packet;
+    DNSPacketWriter pw(packet, name, QType::AAAA, QClass::CHAOS);
+
+    uint16_t qtype = 0;
+    uint16_t qclass = 0;
+    unsigned int consumed = 0;
+    const DNSNameView view(reinterpret_cast<const char*>(packet.data()), packet.size(), sizeof(dnsheader), &qtype, &qclass, &consumed);
+    BOOST_CHECK_EQUAL(qtype, QType::AAAA);
+    BOOST_CHECK_EQUAL(qclass, QClass::CHAOS);
+    BOOST_CHECK_EQUAL(consumed, name.wirelength());
+    BOOST_CHECK_EQUAL(view.wirelength(), name.wirelength());
+    BOOST_CHECK_EQUAL(view.isRoot(), name.isRoot());
+    BOOST_CHECK_EQUAL(view.hash(), name.hash());
+    BOOST_CHECK_EQUAL(view.hash(42), name.hash(42));
+    BOOST_CHECK_EQUAL(std::hash<DNSNameView>()(view), std::hash<DNSName>()(name));
+    BOOST_CHECK_EQUAL(view.toDNSName(), name);
+    BOOST_CHECK(view == name);
+
+    for (const auto& second : names) {
+      const DNSName other(second);
+      BOOST_CHECK_EQUAL(view == DNSNameView(other), name == other);
+      BOOST_CHECK_EQUAL(view != other, name != other);
+      BOOST_CHECK_EQUAL(view.canonCompare(other), name.canonCompare(other));
+      BOOST_CHECK_EQUAL(DNSNameView(other).canonCompare(view), other.canonCompare(name));
+    }
+  }
+
+  const DNSNameView empty;
+  BOOST_CHECK(empty.empty());
+  BOOST_CHECK(empty.toDNSName().empty());
+  BOOST_CHECK(empty == DNSName());
+  BOOST_CHECK(empty != g_rootdnsname);
+}
+
+BOOST_AUTO_TEST_CASE(test_view_invalid) {
+  /* compression */
+  string name("\x03""com\x00""\x07""example\xc0""\x00", 15);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), 5), std::range_error);
+  BOOST_CHECK_EQUAL(DNSNameView(name.c_str(), name.size(), 0).toDNSName(), DNSName("com."));
+
+  /* invalid label length */
+  name = string("\x02""ns\x07""example\x04""com\x00", 16);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), 0), std::range_error);
+  name = string("\x03""com\x80", 5);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), 0), std::range_error);
+
+  /* not terminated */
+  name = string("\x03""com", 4);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), 0), std::range_error);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), name.size()), std::range_error);
+
+  /* no room for the qtype or qclass */
+  name = string("\x03""com\x00""\x00""\x01""\x00", 8);
+  uint16_t qtype = 0;
+  uint16_t qclass = 0;
+  BOOST_CHECK_NO_THROW(DNSNameView(name.c_str(), name.size(), 0, &qtype));
+  BOOST_CHECK_EQUAL(qtype, QType::A);
+  BOOST_CHECK_THROW(DNSNameView(name.c_str(), name.size(), 0, &qtype, &qclass), std::range_error);
+
+  /* 255 is the longest valid name, the same as DNSName */
+  string wire;
+  for (size_t idx = 0; idx < 4; idx++) {
+    wire.append(1, static_cast<char>(62));
+    wire.append(62, 'a');
+  }
+  wire.append(1, static_cast<char>(1));
+  wire.append(1, 'b');
+  wire.append(1, '\0');
+  BOOST_REQUIRE_EQUAL(wire.size(), 255U);
+  BOOST_CHECK_EQUAL(DNSNameView(wire.c_str(), wire.size(), 0).wirelength(), DNSName(wire.c_str(), wire.size(), 0, false).wirelength());
+  wire.insert(wire.size() - 1, "c");
+  wire.at(wire.size() - 4) = 2;
+  BOOST_CHECK_THROW(DNSName(wire.c_str(), wire.size(), 0, false), std::range_error);
+  BOOST_CHECK_THROW(DNSNameView(wire.c_str(), wire.size(), 0), std::range_error);
+}
+
+BOOST_AUTO_TEST_CASE(test_tolower_n) {
+  /* every byte value, at every position relative to the 16-byte chunks */
+  std::vector<unsigned char> input(256 + 17);
+  for (size_t idx = 0; idx < input.size(); idx++) {
+    input.at(idx) = static_cast<unsigned char>(idx);
+  }
+  for (size_t offset = 0; offset < 17; offset++) {
+    for (const size_t length : {size_t(0), size_t(1), size_t(15), size_t(16), size_t(17), size_t(256)}) {
+      std::vector<unsigned char> output(length);
+      dns_tolower_n(input.data() + offset, length, output.data());
+      for (size_t idx = 0; idx < length; idx++) {
+        BOOST_CHECK_EQUAL(output.at(idx), dns_tolower(input.at(offset + idx)));
+      }
+
+      /* in place */
+      std::vector<unsigned char> inPlace(input.begin() + offset, input.begin() + offset + length);
+      dns_tolower_n(inPlace.data(), inPlace.size(), inPlace.data());
+      BOOST_CHECK(inPlace == output);
+    }
+  }
+}
+
+BOOST_AUTO_TEST_CASE(test_imismatch) {
+  std::vector<unsigned char> lower(256);
+  std::vector<unsigned char> upper(256);
+  for (size_t idx = 0; idx < lower.size(); idx++) {
+    lower.at(idx) = dns_tolower(static_cast<unsigned char>(idx));
+    upper.at(idx) = dns_toupper(static_cast<unsigned char>(idx));
+  }
+
+  for (const size_t length : {size_t(0), size_t(1), size_t(15), size_t(16), size_t(17), size_t(255), size_t(256)}) {
+    BOOST_CHECK_EQUAL(dns_imismatch(lower.data(), upper.data(), length), length);
+    BOOST_CHECK(dns_iequals_n(upper.data(), lower.data(), length));
+
+    /* a difference at every possible position, including ones that only differ by the case bit */
+    for (size_t pos = 0; pos < length; pos++) {
+      for (const unsigned char diff : {0x01, 0x20, 0x80}) {
+        auto other = upper;
+        other.at(pos) ^= diff;
+        const bool caseOnly = dns_tolower(other.at(pos)) == lower.at(pos);
+        BOOST_CHECK_EQUAL(dns_imismatch(lower.data(), other.data(), length), caseOnly ? length : pos);
+        BOOST_CHECK_EQUAL(dns_imismatch(other.data(), lower.data(), length), caseOnly ? length : pos);
+      }
+    }
+  }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,19 @@
 
 BOOST_AUTO_TEST_SUITE(mplexer)
 
+/* some multiplexers might not be usable here, for example io_uring on an older kernel or when
+   the system call is filtered, in which case their constructor throws */
+static std::unique_ptr<FDMultiplexer> makeMultiplexer(FDMultiplexer::getMultiplexer_t* maker, unsigned int maxEventsHint)
+{
+  try {
+    return std::unique_ptr<FDMultiplexer>(maker(maxEventsHint));
+  }
+  catch (const FDMultiplexerException& e) {
+    BOOST_TEST_MESSAGE("Skipping a multiplexer that cannot be used here: " << e.what());
+    return nullptr;
+  }
+}
+
 BOOST_AUTO_TEST_CASE(test_getMultiplexerSilent)
 {
   auto mplexer = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
@@ -21,11 +34,30 @@ BOOST_AUTO_TEST_CASE(test_getMultiplexerSilent)
   BOOST_CHECK(now.tv_sec != 0);
 }
 
+BOOST_AUTO_TEST_CASE(test_getMultiplexerSilent_Preferred)
+{
+  FDMultiplexer::s_preferredMultiplexer = "poll";
+  auto mplexer = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
+  BOOST_REQUIRE(mplexer != nullptr);
+  BOOST_CHECK_EQUAL(mplexer->getName(), "poll");
+
+  /* not available, we should get the default one instead */
+  FDMultiplexer::s_preferredMultiplexer = "does-not-exist";
+  mplexer = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
+  BOOST_REQUIRE(mplexer != nullptr);
+  FDMultiplexer::s_preferredMultiplexer.clear();
+  auto defaultMplexer = std::unique_ptr<FDMultiplexer>(FDMultiplexer::getMultiplexerSilent());
+  BOOST_REQUIRE(defaultMplexer != nullptr);
+  BOOST_CHECK_EQUAL(mplexer->getName(), defaultMplexer->getName());
+}
+
 BOOST_AUTO_TEST_CASE(test_MPlexer)
 {
   for (const auto& entry : FDMultiplexer::getMultiplexerMap()) {
-    auto mplexer = std::unique_ptr<FDMultiplexer>(entry.second(FDMultiplexer::s_maxevents));
-    BOOST_REQUIRE(mplexer != nullptr);
+    auto mplexer = makeMultiplexer(entry.second, FDMultiplexer::s_maxevents);
+    if (!mplexer) {
+      continue;
+    }
     //cerr<<"Testing multiplexer "<<mplexer->getName()<<endl;
 
     struct timeval now = {0, 0};
@@ -224,8 +256,10 @@ BOOST_AUTO_TEST_CASE(test_MPlexer)
 BOOST_AUTO_TEST_CASE(test_MPlexer_ReadAndWrite)
 {
   for (const auto& entry : FDMultiplexer::getMultiplexerMap()) {
-    auto mplexer = std::unique_ptr<FDMultiplexer>(entry.second(FDMultiplexer::s_maxevents));
-    BOOST_REQUIRE(mplexer != nullptr);
+    auto mplexer = makeMultiplexer(entry.second, FDMultiplexer::s_maxevents);
+    if (!mplexer) {
+      continue;
+    }
     //cerr<<"Testing multiplexer "<<mplexer->getName()<<" for read AND write"<<endl;
 
     int sockets[2];
@@ -302,6 +336,52 @@ BOOST_AUTO_TEST_CASE(test_MPlexer_ReadAndWrite)
   }
 }
 
+BOOST_AUTO_TEST_CASE(test_MPlexer_IOUringThrowingCallback)
+{
+  /* the io_uring multiplexer has to poll the descriptors again itself once their callbacks have been called */
+  const auto maker = FDMultiplexer::getMultiplexerNames().find("io_uring");
+  if (maker == FDMultiplexer::getMultiplexerNames().end()) {
+    return;
+  }
+  auto mplexer = makeMultiplexer(maker->second, FDMultiplexer::s_maxevents);
+  if (!mplexer) {
+    return;
+  }
+
+  int sockets[2];
+  int res = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
+  BOOST_REQUIRE_EQUAL(res, 0);
+  BOOST_REQUIRE_EQUAL(setNonBlocking(sockets[0]), true);
+  BOOST_REQUIRE_EQUAL(setNonBlocking(sockets[1]), true);
+
+  size_t called = 0;
+  bool shouldThrow = true;
+  auto param = std::make_pair(&called, &shouldThrow);
+  mplexer->addReadFD(sockets[0], [](int fd, FDMultiplexer::funcparam_t& parameter) {
+    auto [calledPtr, shouldThrowPtr] = boost::any_cast<std::pair<size_t*, bool*>>(parameter);
+    ++*calledPtr;
+    if (*shouldThrowPtr) {
+      throw std::runtime_error("callback failure");
+    }
+  },
+                     param);
+  BOOST_REQUIRE_EQUAL(write(sockets[1], "0", 1), 1);
+
+  struct timeval now;
+  BOOST_CHECK_THROW(mplexer->run(&now, 100), std::runtime_error);
+  BOOST_CHECK_EQUAL(called, 1U);
+
+  /* the descriptor is still readable, and should still be reported */
+  shouldThrow = false;
+  auto ready = mplexer->run(&now, 100);
+  BOOST_CHECK_EQUAL(ready, 1);
+  BOOST_CHECK_EQUAL(called, 2U);
+
+  mplexer->removeReadFD(sockets[0]);
+  close(sockets[0]);
+  close(sockets[1]);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(test_MPlexer_Bench)
 {
@@ -331,8 +411,10 @@ BOOST_AUTO_TEST_CASE(test_MPlexer_Bench)
   readyFDs.reserve(count * 2);
 
   for (const auto& entry : FDMultiplexer::getMultiplexerMap()) {
-    auto mplexer = std::unique_ptr<FDMultiplexer>(entry.second());
-    BOOST_REQUIRE(mplexer != nullptr);
+    auto mplexer = makeMultiplexer(entry.second, FDMultiplexer::s_maxevents);
+    if (!mplexer) {
+      continue;
+    }
     cerr<<"Testing multiplexer "<<mplexer->getName()<<" performances"<<endl;
 
     for (auto& pair : pairs) {
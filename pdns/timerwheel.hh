@@ -0,0 +1,270 @@
+/*
+ * This file is part of PowerDNS or dnsdist.
+ * Copyright -- PowerDNS.COM B.V. and its contributors
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of version 2 of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * In addition, for the avoidance of any doubt, permission is granted to
+ * link this program with OpenSSL and to (re)distribute the binaries
+ * produced as the result of such linking.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <sys/time.h>
+#include <utility>
+#include <vector>
+
+namespace pdns
+{
+/* A hierarchical timer wheel with a millisecond resolution, for timeouts that are
+   almost always cancelled before they expire: adding and cancelling a timer are O(1),
+   and expiring them costs O(1) per elapsed millisecond when timers are close, less
+   when they are not.
+   There are four levels of 256 slots, covering 256 ms, 65 s, 4.6 hours and 49 days.
+   A timer is placed on the lowest level whose range covers its expiration time, then
+   moved down one level ('cascaded') when the level below reaches that range. Timers
+   further away than 49 days are placed on the last level and cascaded again later.
+   Not thread-safe. */
+template <typename T>
+class TimerWheel
+{
+public:
+  /* identifies a timer, 0 is never a valid handle */
+  using Handle = uint64_t;
+
+  static uint64_t toMsec(const struct timeval& tv)
+  {
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + static_cast<uint64_t>(tv.tv_usec) / 1000;
+  }
+
+  /* add a timer expiring at 'when' (in milliseconds), 'now' being the current time */
+  Handle add(uint64_t now, uint64_t when, T value)
+  {
+    if (d_count == 0 && now > d_current) {
+      /* nothing is scheduled, we can move forward at no cost */
+      d_current = now;
+    }
+
+    uint32_t index;
+    if (d_freeList != s_none) {
+      index = d_freeList;
+      d_freeList = d_nodes[index].d_next;
+    }
+    else {
+      index = static_cast<uint32_t>(d_nodes.size());
+      d_nodes.emplace_back();
+    }
+
+    auto& node = d_nodes[index];
+    node.d_value = std::move(value);
+    node.d_when = when;
+    node.d_generation++;
+    if (node.d_generation == 0) {
+      node.d_generation = 1;
+    }
+    link(index);
+    d_count++;
+    return (static_cast<Handle>(node.d_generation) << 32) | index;
+  }
+
+  /* 'when' is rounded up to the next millisecond, so that the timer never expires before it */
+  Handle add(const struct timeval& now, const struct timeval& when, T value)
+  {
+    return add(toMsec(now), static_cast<uint64_t>(when.tv_sec) * 1000 + (static_cast<uint64_t>(when.tv_usec) + 999) / 1000, std::move(value));
+  }
+
+  /* returns false if that timer has already expired or been cancelled */
+  bool cancel(Handle handle)
+  {
+    auto index = static_cast<uint32_t>(handle & 0xffffffff);
+    if (handle == 0 || index >= d_nodes.size()) {
+      return false;
+    }
+    auto& node = d_nodes[index];
+    if (node.d_generation != static_cast<uint32_t>(handle >> 32) || node.d_slot == s_none) {
+      return false;
+    }
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  /* move the current time to 'now', appending the timers that expired, with their handle, to 'expired'.
+     Expired timers are removed from the wheel before being returned, so the caller is free to
+     add or cancel timers while processing them */
+  void advance(uint64_t now, std::vector<std::pair<Handle, T>>& expired)
+  {
+    expire(s_dueSlot, expired);
+
+    while (d_current <= now) {
+      if (d_count == 0) {
+        d_current = now + 1;
+        break;
+      }
+
+      /* the higher levels first, as timers cascaded from a level might land on the
+         slot of the level below that needs to be cascaded at the same time */
+      for (unsigned int level = s_levels - 1; level > 0; level--) {
+        if ((d_current & ((uint64_t(1) << (s_bitsPerLevel * level)) - 1)) == 0) {
+          cascade(level, (d_current >> (s_bitsPerLevel * level)) & s_slotMask);
+        }
+      }
+
+      expire(d_current & s_slotMask, expired);
+
+      /* skip the slots we know are empty: if the lowest levels have no timers,
+         nothing happens until the next slot of the first non-empty one */
+      uint64_t next = d_current + 1;
+      for (unsigned int level = 0; level < s_levels - 1 && d_levelCounts[level] == 0; level++) {
+        const unsigned int shift = s_bitsPerLevel * (level + 1);
+        next = ((d_current >> shift) + 1) << shift;
+      }
+      d_current = std::min(next, now + 1);
+    }
+  }
+
+  void advance(const struct timeval& now, std::vector<std::pair<Handle, T>>& expired)
+  {
+    advance(toMsec(now), expired);
+  }
+
+  size_t size() const
+  {
+    return d_count;
+  }
+
+  bool empty() const
+  {
+    return d_count == 0;
+  }
+
+private:
+  static constexpr unsigned int s_levels = 4;
+  static constexpr unsigned int s_bitsPerLevel = 8;
+  static constexpr uint64_t s_slotsPerLevel = 1 << s_bitsPerLevel;
+  static constexpr uint64_t s_slotMask = s_slotsPerLevel - 1;
+  static constexpr uint32_t s_none = std::numeric_limits<uint32_t>::max();
+  /* timers added when they were already due, they expire at the next advance() */
+  static constexpr uint32_t s_dueSlot = s_levels * s_slotsPerLevel;
+
+  struct Node
+  {
+    T d_value{};
+    uint64_t d_when{0};
+    uint32_t d_prev{s_none};
+    uint32_t d_next{s_none};
+    uint32_t d_generation{0};
+    /* level * s_slotsPerLevel + slot, s_none when not scheduled */
+    uint32_t d_slot{s_none};
+  };
+
+  void link(uint32_t index)
+  {
+    auto& node = d_nodes[index];
+    if (node.d_when < d_current) {
+      node.d_slot = s_dueSlot;
+    }
+    else {
+      const uint64_t delta = node.d_when - d_current;
+      unsigned int level = 0;
+      while (level < s_levels - 1 && delta >= (uint64_t(1) << (s_bitsPerLevel * (level + 1)))) {
+        level++;
+      }
+      node.d_slot = static_cast<uint32_t>(level * s_slotsPerLevel + ((node.d_when >> (s_bitsPerLevel * level)) & s_slotMask));
+    }
+
+    auto& head = d_heads[node.d_slot];
+    node.d_prev = s_none;
+    node.d_next = head;
+    if (head != s_none) {
+      d_nodes[head].d_prev = index;
+    }
+    head = index;
+    d_levelCounts[node.d_slot / s_slotsPerLevel]++;
+  }
+
+  void unlink(uint32_t index)
+  {
+    auto& node = d_nodes[index];
+    if (node.d_prev != s_none) {
+      d_nodes[node.d_prev].d_next = node.d_next;
+    }
+    else {
+      d_heads[node.d_slot] = node.d_next;
+    }
+    if (node.d_next != s_none) {
+      d_nodes[node.d_next].d_prev = node.d_prev;
+    }
+    d_levelCounts[node.d_slot / s_slotsPerLevel]--;
+    node.d_slot = s_none;
+  }
+
+  void release(uint32_t index)
+  {
+    auto& node = d_nodes[index];
+    node.d_value = T();
+    node.d_next = d_freeList;
+    d_freeList = index;
+    d_count--;
+  }
+
+  void expire(uint32_t slot, std::vector<std::pair<Handle, T>>& expired)
+  {
+    auto& head = d_heads[slot];
+    while (head != s_none) {
+      const auto index = head;
+      unlink(index);
+      auto& node = d_nodes[index];
+      expired.emplace_back((static_cast<Handle>(node.d_generation) << 32) | index, std::move(node.d_value));
+      release(index);
+    }
+  }
+
+  void cascade(unsigned int level, uint64_t slot)
+  {
+    auto& head = d_heads[level * s_slotsPerLevel + slot];
+    /* detach the whole list first, in case some timers land on that same slot again */
+    uint32_t index = head;
+    head = s_none;
+    while (index != s_none) {
+      const auto next = d_nodes[index].d_next;
+      d_levelCounts[level]--;
+      link(index);
+      index = next;
+    }
+  }
+
+  std::vector<Node> d_nodes;
+  /* the last one is s_dueSlot */
+  std::array<uint32_t, s_levels * s_slotsPerLevel + 1> d_heads{fillHeads()};
+  std::array<size_t, s_levels + 1> d_levelCounts{};
+  /* the next tick to process */
+  uint64_t d_current{0};
+  size_t d_count{0};
+  uint32_t d_freeList{s_none};
+
+  static constexpr std::array<uint32_t, s_levels * s_slotsPerLevel + 1> fillHeads()
+  {
+    std::array<uint32_t, s_levels * s_slotsPerLevel + 1> heads{};
+    for (auto& head : heads) {
+      head = s_none;
+    }
+    return heads;
+  }
+};
+}